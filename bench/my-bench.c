@@ -0,0 +1,807 @@
+/**
+ * Benchmark harness for my-ls, my-find and my-shell.
+ *
+ * my-bench -p /dev/shm/tree -t 1,2,4,8 -c warm,cold -o results.json
+ *
+ * Implementation Notes
+ * ====================
+ *
+ * 1) A synthetic tree is generated (see my-tree.h) at the given path: on
+ *    tmpfs (the default) to measure the tools themselves, or on a real disk
+ *    to measure them against the storage. It is removed at the end, unless -k
+ *    is specified.
+ *
+ * 2) Each tool is run with each cache mode: with a warm cache (after a first
+ *    run), or with a cold one (the page, dentry and inode caches being dropped
+ *    through /proc/sys/vm/drop_caches before each run, which requires root).
+ *    my-find is run with each thread count, my-ls (which lists the root of
+ *    the tree) with and without io_uring.
+ *
+ * 3) A configuration is run several times (-r), its output being discarded:
+ *    entries/sec is derived from the median elapsed time. A preloaded library
+ *    (my-latency.so) records how long each directory stays open, which gives
+ *    the per-directory latency percentiles. The system calls are counted by
+ *    a separate run traced with ptrace (which slows it down), all threads
+ *    included.
+ *
+ * 4) my-shell is run on a script of trivial commands (-m lines running
+ *    /bin/true: an absolute path, since true alone would run the shell's
+ *    builtin without creating a process), once creating processes with
+ *    posix_spawnp and once with fork:
+ *    its entries are the commands, so entriesPerSec is the number of commands
+ *    run per second. The latency library is not preloaded (every command
+ *    would load it).
+ *
+ * 5) The results are written as JSON, tagged with a label (-T), so that runs
+ *    of different releases can be compared.
+ */
+#define _GNU_SOURCE
+#include "my-trace.h"
+#include "my-tree.h"
+#include "my-util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Maximum number of thread counts that can be benchmarked.
+#define MAX_THREAD_COUNTS 32
+
+// Maximum number of arguments of a benchmarked command.
+#define MAX_COMMAND_ARGS 16
+
+/**
+ * Holds the settings of the benchmark, populated from the command line.
+ */
+typedef struct _Settings {
+  TreeSettings tree;
+  const char *treePath;
+  bool isKeepingTree;
+  uint32_t threadCounts[MAX_THREAD_COUNTS];
+  uint32_t threadCountCount;
+  bool withWarmCache;
+  bool withColdCache;
+  uint32_t repetitions;
+  bool withSyscalls;
+  const char *pattern;
+  const char *label;
+  const char *outputPath;
+  uint32_t shellCommandCount;
+  char lsPath[PATH_MAX];
+  char findPath[PATH_MAX];
+  char shellPath[PATH_MAX];
+  char preloadPath[PATH_MAX];
+  // Script run by my-shell (next to the tree).
+  char scriptPath[PATH_MAX];
+} Settings;
+
+/**
+ * A command to benchmark, and the number of entries (or, for my-shell, of
+ * commands) it goes through.
+ */
+typedef struct _Command {
+  const char *tool;
+  // Name of the variant (NULL for the default one).
+  const char *variant;
+  // Number of threads (beyond the main one), -1 if not applicable.
+  int threads;
+  char *argv[MAX_COMMAND_ARGS];
+  uint64_t entries;
+  // File read on the standard input (NULL for none).
+  const char *inputPath;
+  // Whether the latency library is preloaded.
+  bool withLatencies;
+} Command;
+
+/**
+ * Measures of a command, in a given cache mode.
+ */
+typedef struct _Measure {
+  double *seconds;
+  uint32_t runCount;
+  int exitStatus;
+  uint64_t syscalls;
+  bool hasSyscalls;
+  // Per-directory latencies (in nanoseconds) of all runs.
+  uint64_t *latencies;
+  size_t latencyCount;
+  size_t latencyCapacity;
+} Measure;
+
+void help(char *program) {
+  printf("Benchmarks my-ls and my-find on a synthetic tree, and my-shell on "
+         "a script.\n\n");
+  printf("Usage: %s [-h] [-k] [-x] [-p <path>] [-d <depth>] [-n <fan-out>]\n",
+         program);
+  printf("          [-f <files>] [-z <size>] [-l <min:max>] [-D "
+         "<distribution>]\n");
+  printf("          [-s <seed>] [-t <threads>] [-c <caches>] [-r "
+         "<repetitions>]\n");
+  printf("          [-e <pattern>] [-m <commands>] [-T <label>] [-o "
+         "<output>]\n");
+  printf("          [-L <my-ls>] [-F <my-find>] [-S <my-shell>]\n\n");
+  printf("  -h: displays this help\n");
+  printf("  -p: path of the tree to generate (defaults to "
+         "/dev/shm/my-bench-tree;\n");
+  printf("      must not exist)\n");
+  printf("  -k: keeps the tree once done\n");
+  printf("  -d, -n, -f, -z, -l, -D, -s: shape of the tree (see "
+         "my-gentree -h)\n");
+  printf("  -t: comma-separated thread counts to run my-find with (beyond "
+         "the\n");
+  printf("      main thread; defaults to 1,2,4,8)\n");
+  printf("  -c: comma-separated cache modes (defaults to warm,cold). "
+         "Possible\n");
+  printf("      values: warm, cold (requires root, to drop caches)\n");
+  printf("  -r: number of timed runs per configuration (defaults to 3)\n");
+  printf("  -x: does not count system calls (no traced run)\n");
+  printf("  -e: pattern given to my-find (defaults to *.c)\n");
+  printf("  -m: number of commands of the script run by my-shell (defaults "
+         "to 1000)\n");
+  printf("  -T: label of the results (e.g. a release name)\n");
+  printf("  -o: output file (defaults to stdout)\n");
+  printf("  -L, -F, -S: paths of the my-ls, my-find and my-shell programs "
+         "(default\n");
+  printf("      to the module2/out, module4/out and module6/bin/static "
+         "directories of\n");
+  printf("      the repository)\n");
+}
+
+/**
+ * Fills the default paths of the programs, relative to the directory holding
+ * the benchmark's own executable (bench/out).
+ */
+static void newSettings(Settings *settings) {
+  newTreeSettings(&settings->tree);
+  settings->treePath = "/dev/shm/my-bench-tree";
+  settings->isKeepingTree = FALSE;
+  settings->threadCounts[0] = 1;
+  settings->threadCounts[1] = 2;
+  settings->threadCounts[2] = 4;
+  settings->threadCounts[3] = 8;
+  settings->threadCountCount = 4;
+  settings->withWarmCache = TRUE;
+  settings->withColdCache = TRUE;
+  settings->repetitions = 3;
+  settings->withSyscalls = TRUE;
+  settings->pattern = "*.c";
+  settings->label = NULL;
+  settings->outputPath = NULL;
+  settings->shellCommandCount = 1000;
+
+  char exeDir[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", exeDir, sizeof(exeDir) - 1);
+  length = length < 0 ? 0 : length;
+  exeDir[length] = '\0';
+  char *slash = strrchr(exeDir, '/');
+  if (slash != NULL) {
+    *slash = '\0';
+  } else {
+    strcpy(exeDir, ".");
+  }
+  snprintf(settings->lsPath, PATH_MAX, "%s/../../module2/out/my-ls", exeDir);
+  snprintf(settings->findPath, PATH_MAX, "%s/../../module4/out/my-find",
+           exeDir);
+  snprintf(settings->shellPath, PATH_MAX,
+           "%s/../../module6/bin/static/my-shell", exeDir);
+  snprintf(settings->preloadPath, PATH_MAX, "%s/my-latency.so", exeDir);
+}
+
+static int parseThreadCounts(Settings *settings, const char *text) {
+  settings->threadCountCount = 0;
+  const char *cursor = text;
+  while (*cursor != '\0') {
+    char *end;
+    long count = strtol(cursor, &end, 10);
+    if (end == cursor || count < 1 || count > 1024 ||
+        settings->threadCountCount == MAX_THREAD_COUNTS ||
+        (*end != ',' && *end != '\0')) {
+      return -1;
+    }
+    settings->threadCounts[settings->threadCountCount++] = (uint32_t)count;
+    cursor = *end == ',' ? end + 1 : end;
+  }
+  return settings->threadCountCount > 0 ? 0 : -1;
+}
+
+static int parseCacheModes(Settings *settings, const char *text) {
+  settings->withWarmCache = FALSE;
+  settings->withColdCache = FALSE;
+  const char *cursor = text;
+  while (*cursor != '\0') {
+    size_t length = strcspn(cursor, ",");
+    if (length == 4 && strncmp(cursor, "warm", 4) == 0) {
+      settings->withWarmCache = TRUE;
+    } else if (length == 4 && strncmp(cursor, "cold", 4) == 0) {
+      settings->withColdCache = TRUE;
+    } else {
+      return -1;
+    }
+    cursor += length;
+    cursor += *cursor == ',' ? 1 : 0;
+  }
+  return settings->withWarmCache || settings->withColdCache ? 0 : -1;
+}
+
+// ----------------------------------------------------------------------------
+// Running commands
+
+static double elapsedSeconds(const struct timespec *start,
+                             const struct timespec *end) {
+  return (double)(end->tv_sec - start->tv_sec) +
+         (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Drops the page, dentry and inode caches (once dirty data is written back).
+ * Returns 0 on success, -1 if not permitted.
+ */
+static int dropCaches(void) {
+  sync();
+  int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  int status = write(fd, "3\n", 2) == 2 ? 0 : -1;
+  close(fd);
+  return status;
+}
+
+static void addLatencies(Measure *measure, const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    size_t count = (size_t)info.st_size / sizeof(uint64_t);
+    if (measure->latencyCount + count > measure->latencyCapacity) {
+      measure->latencyCapacity = (measure->latencyCount + count) * 2;
+      measure->latencies = (uint64_t *)realloc(
+          measure->latencies, measure->latencyCapacity * sizeof(uint64_t));
+      assertIt(measure->latencies != NULL, "Could not allocate memory\n");
+    }
+    char *data = (char *)(measure->latencies + measure->latencyCount);
+    size_t remaining = count * sizeof(uint64_t);
+    while (remaining > 0) {
+      ssize_t bytes = read(fd, data, remaining);
+      if (bytes <= 0) {
+        break;
+      }
+      data += bytes;
+      remaining -= (size_t)bytes;
+    }
+    measure->latencyCount += count - remaining / sizeof(uint64_t);
+  }
+  close(fd);
+}
+
+/**
+ * Runs the given command once (its output being discarded), with the latency
+ * library preloaded if requested. Returns its exit status (-1 if it could not
+ * be run).
+ */
+static int runTimed(const Settings *settings, const Command *command,
+                    Measure *measure) {
+  char latencyPath[] = "/tmp/my-bench-latency-XXXXXX";
+  int latencyFd = mkstemp(latencyPath);
+  if (latencyFd < 0) {
+    return -1;
+  }
+  close(latencyFd);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pid_t child = fork();
+  if (child < 0) {
+    unlink(latencyPath);
+    return -1;
+  }
+  if (child == 0) {
+    int devNull = open("/dev/null", O_WRONLY);
+    if (devNull >= 0) {
+      dup2(devNull, STDOUT_FILENO);
+      close(devNull);
+    }
+    if (command->inputPath != NULL) {
+      int input = open(command->inputPath, O_RDONLY);
+      if (input < 0) {
+        _exit(127);
+      }
+      dup2(input, STDIN_FILENO);
+      close(input);
+    }
+    if (command->withLatencies) {
+      setenv("LD_PRELOAD", settings->preloadPath, 1);
+      setenv("MY_BENCH_LATENCY_FILE", latencyPath, 1);
+    }
+    execv(command->argv[0], command->argv);
+    _exit(127);
+  }
+  int status;
+  while (waitpid(child, &status, 0) < 0 && errno == EINTR) {
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  measure->seconds[measure->runCount++] = elapsedSeconds(&start, &end);
+  addLatencies(measure, latencyPath);
+  unlink(latencyPath);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static int compareUint64s(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/**
+ * Returns the given percentile (nearest rank) of the given sorted values.
+ */
+static uint64_t percentile(const uint64_t *values, size_t count,
+                           uint32_t percent) {
+  if (count == 0) {
+    return 0;
+  }
+  size_t rank = (count * percent + 99) / 100;
+  return values[rank > 0 ? rank - 1 : 0];
+}
+
+// ----------------------------------------------------------------------------
+// JSON output
+
+static void writeJsonString(FILE *output, const char *text) {
+  fputc('"', output);
+  for (const char *c = text; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(output, "\\%c", *c);
+    } else if ((unsigned char)*c < 0x20) {
+      fprintf(output, "\\u%04x", (unsigned char)*c);
+    } else {
+      fputc(*c, output);
+    }
+  }
+  fputc('"', output);
+}
+
+static void writeHeader(FILE *output, const Settings *settings,
+                        const TreeStats *stats) {
+  char timestamp[32];
+  time_t now = time(NULL);
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+  struct utsname host;
+  uname(&host);
+  struct statfs fs;
+  long fsType = statfs(settings->treePath, &fs) == 0 ? (long)fs.f_type : 0;
+
+  fprintf(output, "{\n  \"version\": 1,\n  \"label\": ");
+  if (settings->label != NULL) {
+    writeJsonString(output, settings->label);
+  } else {
+    fprintf(output, "null");
+  }
+  fprintf(output, ",\n  \"timestamp\": \"%s\",\n", timestamp);
+  fprintf(output, "  \"host\": {\"kernel\": ");
+  writeJsonString(output, host.release);
+  fprintf(output, ", \"cpus\": %ld},\n", sysconf(_SC_NPROCESSORS_ONLN));
+  fprintf(output, "  \"tree\": {\n    \"path\": ");
+  writeJsonString(output, settings->treePath);
+  fprintf(output, ",\n    \"fsType\": \"0x%lx\",\n", fsType);
+  fprintf(output,
+          "    \"depth\": %u, \"fanOut\": %u, \"filesPerDir\": %u, "
+          "\"fileSize\": %u,\n",
+          settings->tree.depth, settings->tree.fanOut,
+          settings->tree.fileCount, settings->tree.fileSize);
+  fprintf(output,
+          "    \"nameLength\": {\"min\": %u, \"max\": %u, "
+          "\"distribution\": \"%s\"},\n",
+          settings->tree.minNameLen, settings->tree.maxNameLen,
+          nameDistributionName(settings->tree.distribution));
+  fprintf(output,
+          "    \"seed\": %" PRIu64 ", \"dirs\": %" PRIu64
+          ", \"files\": %" PRIu64 "\n  },\n",
+          settings->tree.seed, stats->dirCount, stats->fileCount);
+  fprintf(output, "  \"results\": [");
+}
+
+static void writeResult(FILE *output, const Command *command, bool isCold,
+                        Measure *measure, bool isFirst) {
+  qsort(measure->seconds, measure->runCount, sizeof(double), compareDoubles);
+  qsort(measure->latencies, measure->latencyCount, sizeof(uint64_t),
+        compareUint64s);
+  double median = measure->runCount == 0
+                      ? 0
+                      : measure->runCount % 2 == 1
+                            ? measure->seconds[measure->runCount / 2]
+                            : (measure->seconds[measure->runCount / 2 - 1] +
+                               measure->seconds[measure->runCount / 2]) /
+                                  2;
+
+  fprintf(output, "%s\n    {\"tool\": \"%s\", \"variant\": ",
+          isFirst ? "" : ",", command->tool);
+  if (command->variant != NULL) {
+    writeJsonString(output, command->variant);
+  } else {
+    fprintf(output, "null");
+  }
+  if (command->threads >= 0) {
+    fprintf(output, ", \"threads\": %d", command->threads);
+  } else {
+    fprintf(output, ", \"threads\": null");
+  }
+  fprintf(output, ", \"cache\": \"%s\",\n", isCold ? "cold" : "warm");
+  fprintf(output, "     \"exitStatus\": %d, \"runs\": %u, \"entries\": %" PRIu64
+          ",\n", measure->exitStatus, measure->runCount, command->entries);
+  fprintf(output,
+          "     \"seconds\": {\"min\": %.6f, \"median\": %.6f, \"max\": "
+          "%.6f},\n",
+          measure->runCount > 0 ? measure->seconds[0] : 0, median,
+          measure->runCount > 0 ? measure->seconds[measure->runCount - 1] : 0);
+  fprintf(output, "     \"entriesPerSec\": %.1f,\n",
+          median > 0 ? (double)command->entries / median : 0);
+  if (measure->hasSyscalls) {
+    fprintf(output,
+            "     \"syscalls\": %" PRIu64 ", \"syscallsPerEntry\": %.3f,\n",
+            measure->syscalls,
+            command->entries > 0
+                ? (double)measure->syscalls / (double)command->entries
+                : 0);
+  } else {
+    fprintf(output, "     \"syscalls\": null, \"syscallsPerEntry\": null,\n");
+  }
+  fprintf(output,
+          "     \"dirLatencyUs\": {\"samples\": %zu, \"p50\": %.1f, \"p99\": "
+          "%.1f, \"max\": %.1f}}",
+          measure->latencyCount,
+          percentile(measure->latencies, measure->latencyCount, 50) / 1e3,
+          percentile(measure->latencies, measure->latencyCount, 99) / 1e3,
+          measure->latencyCount > 0
+              ? measure->latencies[measure->latencyCount - 1] / 1e3
+              : 0);
+  fflush(output);
+}
+
+// ----------------------------------------------------------------------------
+// Benchmark
+
+/**
+ * Measures the given command in the given cache mode, and writes the result.
+ * Returns FALSE if caches could not be dropped (nothing is measured then).
+ */
+static bool benchmarkCommand(const Settings *settings, const Command *command,
+                             bool isCold, FILE *output, bool isFirst) {
+  Measure measure;
+  measure.seconds =
+      (double *)safemalloc(settings->repetitions * sizeof(double));
+  measure.runCount = 0;
+  measure.exitStatus = 0;
+  measure.syscalls = 0;
+  measure.hasSyscalls = FALSE;
+  measure.latencies = NULL;
+  measure.latencyCount = 0;
+  measure.latencyCapacity = 0;
+
+  fprintf(stderr, "Running %s%s%s (threads: %d, %s cache)\n", command->tool,
+          command->variant != NULL ? " " : "",
+          command->variant != NULL ? command->variant : "", command->threads,
+          isCold ? "cold" : "warm");
+
+  if (isCold && dropCaches() != 0) {
+    safefree(measure.seconds);
+    return FALSE;
+  }
+  // The traced run also warms the cache up for the timed runs. Without it
+  // (-x), an untimed run does (in warm mode: cold runs drop caches anyway).
+  if (settings->withSyscalls) {
+    int status = countSyscalls(command->argv, command->inputPath,
+                               &measure.syscalls);
+    measure.hasSyscalls = status >= 0;
+    if (status < 0) {
+      fprintf(stderr, "Could not trace %s: %s\n", command->tool,
+              strerror(errno));
+    }
+  } else if (!isCold) {
+    runTimed(settings, command, &measure);
+    measure.runCount = 0;
+    measure.latencyCount = 0;
+  }
+
+  for (uint32_t i = 0; i < settings->repetitions; i++) {
+    if (isCold) {
+      dropCaches();
+    }
+    int status = runTimed(settings, command, &measure);
+    if (status != 0) {
+      fprintf(stderr, "%s exited with status %d\n", command->tool, status);
+      measure.exitStatus = status;
+    }
+  }
+
+  writeResult(output, command, isCold, &measure, isFirst);
+  safefree(measure.latencies);
+  safefree(measure.seconds);
+  return TRUE;
+}
+
+/**
+ * Fills the list of commands to benchmark. Returns the number of commands.
+ */
+static uint32_t makeCommands(Settings *settings, const TreeStats *stats,
+                             Command *commands, char threadArgs[][16]) {
+  uint32_t count = 0;
+  uint64_t treeEntries = stats->dirCount + stats->fileCount;
+
+  // my-ls lists the root of the tree, stat'ing each entry.
+  commands[count] =
+      (Command){"my-ls", NULL, -1, {NULL}, stats->rootEntryCount, NULL, TRUE};
+  commands[count].argv[0] = settings->lsPath;
+  commands[count].argv[1] = "-a";
+  commands[count].argv[2] = (char *)settings->treePath;
+  count++;
+  commands[count] = (Command){
+      "my-ls", "io_uring", -1, {NULL}, stats->rootEntryCount, NULL, TRUE};
+  commands[count].argv[0] = settings->lsPath;
+  commands[count].argv[1] = "-a";
+  commands[count].argv[2] = "-q";
+  commands[count].argv[3] = "64";
+  commands[count].argv[4] = (char *)settings->treePath;
+  count++;
+
+  for (uint32_t i = 0; i < settings->threadCountCount; i++) {
+    snprintf(threadArgs[i], 16, "%u", settings->threadCounts[i]);
+    commands[count] = (Command){"my-find",   NULL,
+                                (int)settings->threadCounts[i],
+                                {NULL},      treeEntries,
+                                NULL,        TRUE};
+    char **argv = commands[count].argv;
+    argv[0] = settings->findPath;
+    argv[1] = "-r";
+    argv[2] = "-t";
+    argv[3] = threadArgs[i];
+    argv[4] = "-p";
+    argv[5] = (char *)settings->pattern;
+    argv[6] = (char *)settings->treePath;
+    count++;
+  }
+
+  // my-shell runs the script, with each way of creating processes.
+  const char *variants[] = {"spawn", "fork"};
+  for (uint32_t i = 0; i < 2; i++) {
+    commands[count] = (Command){"my-shell",
+                                variants[i],
+                                -1,
+                                {NULL},
+                                settings->shellCommandCount,
+                                settings->scriptPath,
+                                FALSE};
+    commands[count].argv[0] = settings->shellPath;
+    commands[count].argv[1] = i == 1 ? "-f" : NULL;
+    count++;
+  }
+  return count;
+}
+
+/**
+ * Writes the script run by my-shell: the given number of lines, each running
+ * a trivial command (so that the time measured is that of the shell).
+ * Returns 0 on success, -1 otherwise (errno is set).
+ */
+static int writeScript(const char *path, uint32_t commandCount) {
+  FILE *script = fopen(path, "w");
+  if (script == NULL) {
+    return -1;
+  }
+  for (uint32_t i = 0; i < commandCount; i++) {
+    fputs("/bin/true\n", script);
+  }
+  return fclose(script) == 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+  int exitCode = EXIT_SUCCESS;
+  FILE *output = stdout;
+  bool hasTree = FALSE;
+  Settings settings;
+  newSettings(&settings);
+
+  int opt;
+  while ((opt = getopt(argc, argv,
+                       "hkxp:d:n:f:z:l:D:s:t:c:r:e:m:T:o:L:F:S:")) != -1) {
+    switch (opt) {
+    case 'h':
+      help(argv[0]);
+      goto Finally;
+    case 'k':
+      settings.isKeepingTree = TRUE;
+      break;
+    case 'x':
+      settings.withSyscalls = FALSE;
+      break;
+    case 'p':
+      settings.treePath = optarg;
+      break;
+    case 'd':
+      settings.tree.depth = (uint32_t)atoi(optarg);
+      break;
+    case 'n':
+      settings.tree.fanOut = (uint32_t)atoi(optarg);
+      break;
+    case 'f':
+      settings.tree.fileCount = (uint32_t)atoi(optarg);
+      break;
+    case 'z':
+      settings.tree.fileSize = (uint32_t)atoi(optarg);
+      break;
+    case 'l':
+      if (parseNameLengths(&settings.tree, optarg) != 0) {
+        fprintf(stderr, "Value of -l option (name lengths) must be MIN:MAX, "
+                        "with 1 <= MIN <= MAX <= 255\n");
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      break;
+    case 'D': {
+      int distribution = parseNameDistribution(optarg);
+      if (distribution < 0) {
+        fprintf(stderr, "Value of -D option (distribution) must be one of: "
+                        "uniform, skewed\n");
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      settings.tree.distribution = (NameDistribution)distribution;
+      break;
+    }
+    case 's':
+      settings.tree.seed = strtoull(optarg, NULL, 10);
+      break;
+    case 't':
+      if (parseThreadCounts(&settings, optarg) != 0) {
+        fprintf(stderr, "Value of -t option (thread counts) must be a "
+                        "comma-separated list of (at most %u) numbers\n",
+                MAX_THREAD_COUNTS);
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      break;
+    case 'c':
+      if (parseCacheModes(&settings, optarg) != 0) {
+        fprintf(stderr, "Value of -c option (cache modes) must be a "
+                        "comma-separated list of: warm, cold\n");
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      break;
+    case 'r':
+      settings.repetitions = (uint32_t)atoi(optarg);
+      if (settings.repetitions == 0) {
+        fprintf(stderr, "Value of -r option (repetitions) must be > 0\n");
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      break;
+    case 'e':
+      settings.pattern = optarg;
+      break;
+    case 'm':
+      settings.shellCommandCount = (uint32_t)atoi(optarg);
+      if (settings.shellCommandCount == 0) {
+        fprintf(stderr, "Value of -m option (commands) must be > 0\n");
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      break;
+    case 'T':
+      settings.label = optarg;
+      break;
+    case 'o':
+      settings.outputPath = optarg;
+      break;
+    case 'L':
+      strncpy(settings.lsPath, optarg, PATH_MAX - 1);
+      break;
+    case 'F':
+      strncpy(settings.findPath, optarg, PATH_MAX - 1);
+      break;
+    case 'S':
+      strncpy(settings.shellPath, optarg, PATH_MAX - 1);
+      break;
+    default:
+      help(argv[0]);
+      exitCode = EXIT_FAILURE;
+      goto Finally;
+    }
+  }
+
+  const char *programs[] = {settings.lsPath, settings.findPath,
+                            settings.shellPath, settings.preloadPath};
+  for (size_t i = 0; i < sizeof(programs) / sizeof(programs[0]); i++) {
+    if (access(programs[i], R_OK) != 0) {
+      fprintf(stderr, "Could not find %s (build it, or see -h)\n", programs[i]);
+      exitCode = EXIT_FAILURE;
+      goto Finally;
+    }
+  }
+
+  fprintf(stderr, "Generating tree at %s\n", settings.treePath);
+  TreeStats stats;
+  if (generateTree(&settings.tree, settings.treePath, &stats) != 0) {
+    fprintf(stderr, "Could not generate tree at %s: %s\n", settings.treePath,
+            strerror(errno));
+    exitCode = EXIT_FAILURE;
+    goto Finally;
+  }
+  hasTree = TRUE;
+
+  snprintf(settings.scriptPath, PATH_MAX, "%s.script", settings.treePath);
+  if (writeScript(settings.scriptPath, settings.shellCommandCount) != 0) {
+    fprintf(stderr, "Could not write script %s: %s\n", settings.scriptPath,
+            strerror(errno));
+    exitCode = EXIT_FAILURE;
+    goto Finally;
+  }
+
+  if (settings.outputPath != NULL) {
+    output = fopen(settings.outputPath, "w");
+    if (output == NULL) {
+      fprintf(stderr, "Could not open %s: %s\n", settings.outputPath,
+              strerror(errno));
+      output = stdout;
+      exitCode = EXIT_FAILURE;
+      goto Finally;
+    }
+  }
+
+  Command commands[4 + MAX_THREAD_COUNTS];
+  char threadArgs[MAX_THREAD_COUNTS][16];
+  uint32_t commandCount = makeCommands(&settings, &stats, commands, threadArgs);
+
+  writeHeader(output, &settings, &stats);
+  bool isFirst = TRUE;
+  bool withColdCache = settings.withColdCache;
+  for (uint32_t mode = 0; mode < 2; mode++) {
+    bool isCold = mode == 1;
+    if ((isCold && !withColdCache) || (!isCold && !settings.withWarmCache)) {
+      continue;
+    }
+    for (uint32_t i = 0; i < commandCount; i++) {
+      if (!benchmarkCommand(&settings, &commands[i], isCold, output,
+                            isFirst)) {
+        fprintf(stderr, "Could not drop caches (requires root): skipping "
+                        "cold cache runs\n");
+        withColdCache = FALSE;
+        break;
+      }
+      isFirst = FALSE;
+    }
+  }
+  fprintf(output, "\n  ]\n}\n");
+
+Finally:
+  if (output != stdout) {
+    fclose(output);
+  }
+  if (hasTree && !settings.isKeepingTree) {
+    unlink(settings.scriptPath);
+  }
+  if (hasTree && !settings.isKeepingTree &&
+      removeTree(settings.treePath) != 0) {
+    fprintf(stderr, "Could not remove tree at %s: %s\n", settings.treePath,
+            strerror(errno));
+  }
+  exit(exitCode);
+}
@@ -0,0 +1,111 @@
+/**
+ * Generates a synthetic directory tree for benchmarking my-ls and my-find.
+ *
+ * my-gentree -d 4 -n 8 -f 32 -l 4:24 /dev/shm/tree
+ *
+ * Every directory down to the given depth holds the same number of files and
+ * sub-directories, whose name lengths follow the given distribution. The same
+ * options always produce the same tree (names are picked by a seeded random
+ * generator), so that runs on different machines or releases compare.
+ */
+#define _GNU_SOURCE
+#include "my-tree.h"
+#include "my-util.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void help(char *program) {
+  printf("Generates a synthetic directory tree.\n\n");
+  printf("Usage: %s [-h] [-d <depth>] [-n <fan-out>] [-f <files>]\n", program);
+  printf("          [-z <size>] [-l <min:max>] [-D <distribution>] [-s "
+         "<seed>] <path>\n\n");
+  printf("  -h: displays this help\n");
+  printf("  -d: number of levels of sub-directories below the root "
+         "(defaults to 4)\n");
+  printf("  -n: number of sub-directories per directory (defaults to 8)\n");
+  printf("  -f: number of files per directory (defaults to 32)\n");
+  printf("  -z: size of each file in bytes (defaults to 0)\n");
+  printf("  -l: range of name lengths (defaults to 4:24)\n");
+  printf("  -D: distribution of name lengths (defaults to skewed). Possible\n");
+  printf("      values: uniform, skewed (mostly short names)\n");
+  printf("  -s: seed of the random generator picking names (defaults to "
+         "1)\n");
+  printf("  <path>: path of the root of the tree (must not exist)\n");
+}
+
+int main(int argc, char **argv) {
+  int exitCode = EXIT_SUCCESS;
+  TreeSettings settings;
+  newTreeSettings(&settings);
+
+  int opt;
+  while ((opt = getopt(argc, argv, "hd:n:f:z:l:D:s:")) != -1) {
+    switch (opt) {
+    case 'h':
+      help(argv[0]);
+      goto Finally;
+    case 'd':
+      settings.depth = (uint32_t)atoi(optarg);
+      break;
+    case 'n':
+      settings.fanOut = (uint32_t)atoi(optarg);
+      break;
+    case 'f':
+      settings.fileCount = (uint32_t)atoi(optarg);
+      break;
+    case 'z':
+      settings.fileSize = (uint32_t)atoi(optarg);
+      break;
+    case 'l':
+      if (parseNameLengths(&settings, optarg) != 0) {
+        fprintf(stderr, "Value of -l option (name lengths) must be MIN:MAX, "
+                        "with 1 <= MIN <= MAX <= 255\n");
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      break;
+    case 'D': {
+      int distribution = parseNameDistribution(optarg);
+      if (distribution < 0) {
+        fprintf(stderr, "Value of -D option (distribution) must be one of: "
+                        "uniform, skewed\n");
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      settings.distribution = (NameDistribution)distribution;
+      break;
+    }
+    case 's':
+      settings.seed = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      help(argv[0]);
+      exitCode = EXIT_FAILURE;
+      goto Finally;
+    }
+  }
+
+  if (optind != argc - 1) {
+    fprintf(stderr, "Missing path of the tree to generate\n");
+    help(argv[0]);
+    exitCode = EXIT_FAILURE;
+    goto Finally;
+  }
+
+  TreeStats stats;
+  if (generateTree(&settings, argv[optind], &stats) != 0) {
+    fprintf(stderr, "Could not generate tree at %s: %s\n", argv[optind],
+            strerror(errno));
+    exitCode = EXIT_FAILURE;
+    goto Finally;
+  }
+  printf("{\"dirs\": %" PRIu64 ", \"files\": %" PRIu64 "}\n", stats.dirCount,
+         stats.fileCount);
+
+Finally:
+  exit(exitCode);
+}
@@ -0,0 +1,141 @@
+/**
+ * Preloaded library (LD_PRELOAD) measuring how long the directories opened by
+ * the program stay open: the time between the openat call opening a directory
+ * (O_DIRECTORY) and the close call closing it, which is the time spent
+ * reading and processing the directory. The durations (in nanoseconds, as
+ * native uint64_t values) are written at exit to the file named by the
+ * MY_BENCH_LATENCY_FILE environment variable.
+ *
+ * Only the calls made by the program itself are seen (not those made inside
+ * the C library, e.g. by opendir).
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Descriptors beyond this one are not tracked.
+#define MAX_TRACKED_FDS 65536
+
+// Maximum number of durations recorded (the buffer is only backed by memory
+// as it fills up).
+#define MAX_SAMPLES (16 * 1024 * 1024)
+
+typedef int (*OpenAtFunction)(int, const char *, int, ...);
+typedef int (*CloseFunction)(int);
+
+static OpenAtFunction realOpenAt;
+static CloseFunction realClose;
+static const char *outputPath;
+
+// Time at which each descriptor was opened (0 if it is not a directory).
+static _Atomic uint64_t openTimes[MAX_TRACKED_FDS];
+static uint64_t *samples;
+static _Atomic uint64_t sampleCount;
+
+static uint64_t now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+
+/**
+ * Looks up the functions wrapped (which may be called by other libraries'
+ * constructors, before ours).
+ */
+static void resolveFunctions(void) {
+  if (realOpenAt == NULL) {
+    realOpenAt = (OpenAtFunction)dlsym(RTLD_NEXT, "openat");
+    realClose = (CloseFunction)dlsym(RTLD_NEXT, "close");
+  }
+}
+
+__attribute__((constructor)) static void startRecording(void) {
+  resolveFunctions();
+  outputPath = getenv("MY_BENCH_LATENCY_FILE");
+  if (outputPath != NULL) {
+    void *buffer = mmap(NULL, MAX_SAMPLES * sizeof(uint64_t),
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    samples = buffer != MAP_FAILED ? (uint64_t *)buffer : NULL;
+  }
+}
+
+__attribute__((destructor)) static void stopRecording(void) {
+  if (samples == NULL) {
+    return;
+  }
+  int fd = realOpenAt(AT_FDCWD, outputPath,
+                      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return;
+  }
+  uint64_t count = atomic_load(&sampleCount);
+  if (count > MAX_SAMPLES) {
+    count = MAX_SAMPLES;
+  }
+  const char *data = (const char *)samples;
+  size_t remaining = count * sizeof(uint64_t);
+  while (remaining > 0) {
+    ssize_t written = write(fd, data, remaining);
+    if (written <= 0) {
+      break;
+    }
+    data += written;
+    remaining -= (size_t)written;
+  }
+  realClose(fd);
+}
+
+static int openAt(int dirFd, const char *path, int flags, mode_t mode) {
+  resolveFunctions();
+  uint64_t start = samples != NULL && (flags & O_DIRECTORY) != 0 ? now() : 0;
+  int fd = realOpenAt(dirFd, path, flags, mode);
+  if (start != 0 && fd >= 0 && fd < MAX_TRACKED_FDS) {
+    atomic_store_explicit(&openTimes[fd], start, memory_order_relaxed);
+  }
+  return fd;
+}
+
+int openat(int dirFd, const char *path, int flags, ...) {
+  mode_t mode = 0;
+  if ((flags & (O_CREAT | O_TMPFILE)) != 0) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return openAt(dirFd, path, flags, mode);
+}
+
+int openat64(int dirFd, const char *path, int flags, ...) {
+  mode_t mode = 0;
+  if ((flags & (O_CREAT | O_TMPFILE)) != 0) {
+    va_list args;
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+  return openAt(dirFd, path, flags, mode);
+}
+
+int close(int fd) {
+  resolveFunctions();
+  if (samples != NULL && fd >= 0 && fd < MAX_TRACKED_FDS) {
+    uint64_t start = atomic_exchange_explicit(&openTimes[fd], 0,
+                                              memory_order_relaxed);
+    if (start != 0) {
+      uint64_t index = atomic_fetch_add(&sampleCount, 1);
+      if (index < MAX_SAMPLES) {
+        samples[index] = now() - start;
+      }
+    }
+  }
+  return realClose(fd);
+}
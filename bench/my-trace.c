@@ -0,0 +1,95 @@
+#define _GNU_SOURCE
+#include "my-trace.h"
+#include "my-util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Threads and processes created by the command are traced as well.
+#define TRACE_OPTIONS                                                          \
+  (PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK |          \
+   PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL)
+
+int countSyscalls(char *const argv[], const char *inputPath,
+                  uint64_t *count) {
+  *count = 0;
+  pid_t child = fork();
+  if (child < 0) {
+    return -1;
+  }
+  if (child == 0) {
+    int devNull = open("/dev/null", O_WRONLY);
+    if (devNull >= 0) {
+      dup2(devNull, STDOUT_FILENO);
+      close(devNull);
+    }
+    if (inputPath != NULL) {
+      int input = open(inputPath, O_RDONLY);
+      if (input < 0) {
+        _exit(127);
+      }
+      dup2(input, STDIN_FILENO);
+      close(input);
+    }
+    // Stopping until the tracer has set its options (execve is then traced).
+    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    raise(SIGSTOP);
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+
+  int status;
+  if (waitpid(child, &status, 0) != child || !WIFSTOPPED(status) ||
+      ptrace(PTRACE_SETOPTIONS, child, NULL, (void *)TRACE_OPTIONS) != 0 ||
+      ptrace(PTRACE_SYSCALL, child, NULL, NULL) != 0) {
+    int error = errno;
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+    errno = error;
+    return -1;
+  }
+
+  int exitStatus = -1;
+  while (TRUE) {
+    pid_t pid = waitpid(-1, &status, __WALL);
+    if (pid < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // ECHILD: all threads and processes are gone
+      break;
+    }
+    if (WIFEXITED(status) || WIFSIGNALED(status)) {
+      if (pid == child) {
+        exitStatus = WIFEXITED(status) ? WEXITSTATUS(status)
+                                       : 128 + WTERMSIG(status);
+      }
+      continue;
+    }
+    if (!WIFSTOPPED(status)) {
+      continue;
+    }
+
+    int signal = WSTOPSIG(status);
+    int injected = 0;
+    if (signal == (SIGTRAP | 0x80)) {
+      // Syscall stops happen on entry and on exit: only counting entries
+      // (execve and exit_group never return).
+      struct __ptrace_syscall_info info;
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, (void *)sizeof(info), &info) >
+              0 &&
+          info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+        (*count)++;
+      }
+    } else if (status >> 16 == 0 && signal != SIGSTOP) {
+      // A signal sent to the command (new threads start with a SIGSTOP, and
+      // events such as clone or exec are not signals).
+      injected = signal;
+    }
+    ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)injected);
+  }
+  return exitStatus;
+}
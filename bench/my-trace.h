@@ -0,0 +1,17 @@
+#ifndef MY_TRACE_H
+#define MY_TRACE_H
+
+#include <stdint.h>
+
+/**
+ * Runs the given command (its standard input being read from the given file
+ * if not NULL, its standard output being discarded) under ptrace,
+ * and counts the system calls made by all of its threads, execve included.
+ * Tracing slows the command down a lot: timings must be taken from separate
+ * runs. Returns the command's exit status, or -1 if it could not be traced
+ * (errno is set).
+ */
+int countSyscalls(char *const argv[], const char *inputPath,
+                  uint64_t *count);
+
+#endif
@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+#include "my-tree.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Characters names are made of (no '.', which only starts file extensions).
+static const char NAME_CHARS[] = "abcdefghijklmnopqrstuvwxyz0123456789_-";
+
+// Extensions given to files, in turn picked at random.
+static const char *const FILE_EXTENSIONS[] = {".c", ".h", ".txt", ".dat"};
+#define FILE_EXTENSION_COUNT                                                   \
+  (sizeof(FILE_EXTENSIONS) / sizeof(FILE_EXTENSIONS[0]))
+
+// Longest name generated (whatever the settings).
+#define MAX_GENERATED_NAME_LEN 255
+
+/**
+ * State of the generation of a tree: the random generator (xorshift64*) is
+ * shared by the whole tree, which is created depth-first, so that a seed
+ * always yields the same tree.
+ */
+typedef struct _TreeGenerator {
+  const TreeSettings *settings;
+  uint64_t random;
+  TreeStats *stats;
+  char *fileData;
+} TreeGenerator;
+
+void newTreeSettings(TreeSettings *settings) {
+  settings->depth = 4;
+  settings->fanOut = 8;
+  settings->fileCount = 32;
+  settings->fileSize = 0;
+  settings->minNameLen = 4;
+  settings->maxNameLen = 24;
+  settings->distribution = NAMES_SKEWED;
+  settings->seed = 1;
+}
+
+int parseNameLengths(TreeSettings *settings, const char *text) {
+  char *end;
+  long min = strtol(text, &end, 10);
+  long max = min;
+  if (*end == ':') {
+    max = strtol(end + 1, &end, 10);
+  }
+  if (*end != '\0' || min < 1 || max < min || max > MAX_GENERATED_NAME_LEN) {
+    return -1;
+  }
+  settings->minNameLen = (uint32_t)min;
+  settings->maxNameLen = (uint32_t)max;
+  return 0;
+}
+
+int parseNameDistribution(const char *text) {
+  if (strcmp(text, "uniform") == 0) {
+    return NAMES_UNIFORM;
+  }
+  if (strcmp(text, "skewed") == 0) {
+    return NAMES_SKEWED;
+  }
+  return -1;
+}
+
+const char *nameDistributionName(NameDistribution distribution) {
+  return distribution == NAMES_UNIFORM ? "uniform" : "skewed";
+}
+
+static uint64_t nextRandom(TreeGenerator *generator) {
+  uint64_t x = generator->random;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  generator->random = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t pickNameLen(TreeGenerator *generator) {
+  const TreeSettings *settings = generator->settings;
+  uint32_t range = settings->maxNameLen - settings->minNameLen;
+  if (range == 0) {
+    return settings->minNameLen;
+  }
+  double u = (double)(nextRandom(generator) >> 11) / (double)(1ULL << 53);
+  if (settings->distribution == NAMES_SKEWED) {
+    u = u * u * u;
+  }
+  return settings->minNameLen + (uint32_t)(u * (range + 1));
+}
+
+/**
+ * Writes the name of the index-th entry of a directory to the given buffer
+ * (at least MAX_GENERATED_NAME_LEN + 1 bytes long). The index is written at
+ * the end of the name (before the extension), which makes names unique: names
+ * too short to hold it are made longer.
+ */
+static void makeName(TreeGenerator *generator, uint32_t index,
+                     const char *extension, char *name) {
+  char digits[16];
+  size_t digitCount = 0;
+  do {
+    digits[digitCount++] = NAME_CHARS[index % 36];
+    index /= 36;
+  } while (index > 0);
+
+  size_t extensionLen = strlen(extension);
+  size_t nameLen = pickNameLen(generator);
+  size_t prefixLen = nameLen > digitCount + extensionLen
+                         ? nameLen - digitCount - extensionLen
+                         : 0;
+  char *cursor = name;
+  for (size_t i = 0; i < prefixLen; i++) {
+    *cursor++ = NAME_CHARS[nextRandom(generator) % (sizeof(NAME_CHARS) - 1)];
+  }
+  for (size_t i = digitCount; i > 0; i--) {
+    *cursor++ = digits[i - 1];
+  }
+  memcpy(cursor, extension, extensionLen + 1);
+}
+
+static int createFile(TreeGenerator *generator, int dirFd, const char *name) {
+  int fd = openat(dirFd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  size_t written = 0;
+  while (written < generator->settings->fileSize) {
+    ssize_t count = write(fd, generator->fileData + written,
+                          generator->settings->fileSize - written);
+    if (count < 0) {
+      int error = errno;
+      close(fd);
+      errno = error;
+      return -1;
+    }
+    written += (size_t)count;
+  }
+  close(fd);
+  generator->stats->fileCount++;
+  return 0;
+}
+
+static int fillDir(TreeGenerator *generator, int dirFd, uint32_t depth) {
+  const TreeSettings *settings = generator->settings;
+  char name[MAX_GENERATED_NAME_LEN + 1];
+
+  for (uint32_t i = 0; i < settings->fileCount; i++) {
+    const char *extension =
+        FILE_EXTENSIONS[nextRandom(generator) % FILE_EXTENSION_COUNT];
+    makeName(generator, i, extension, name);
+    if (createFile(generator, dirFd, name) != 0) {
+      return -1;
+    }
+  }
+  if (depth == settings->depth) {
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < settings->fanOut; i++) {
+    // Sub-directories are numbered after the files, so that their names
+    // never collide with those of files.
+    makeName(generator, settings->fileCount + i, "", name);
+    if (mkdirat(dirFd, name, 0755) != 0) {
+      return -1;
+    }
+    generator->stats->dirCount++;
+    int subDirFd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (subDirFd < 0) {
+      return -1;
+    }
+    int status = fillDir(generator, subDirFd, depth + 1);
+    int error = errno;
+    close(subDirFd);
+    if (status != 0) {
+      errno = error;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int generateTree(const TreeSettings *settings, const char *path,
+                 TreeStats *stats) {
+  stats->dirCount = 0;
+  stats->fileCount = 0;
+  stats->rootEntryCount = (uint64_t)settings->fileCount +
+                          (settings->depth > 0 ? settings->fanOut : 0);
+
+  if (mkdir(path, 0755) != 0) {
+    return -1;
+  }
+  int rootFd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (rootFd < 0) {
+    return -1;
+  }
+
+  TreeGenerator generator;
+  generator.settings = settings;
+  // xorshift must not start from 0
+  generator.random = settings->seed != 0 ? settings->seed : 1;
+  generator.stats = stats;
+  generator.fileData = NULL;
+  if (settings->fileSize > 0) {
+    generator.fileData = (char *)safemalloc(settings->fileSize);
+    for (uint32_t i = 0; i < settings->fileSize; i++) {
+      generator.fileData[i] = NAME_CHARS[i % (sizeof(NAME_CHARS) - 1)];
+    }
+  }
+
+  int status = fillDir(&generator, rootFd, 0);
+  int error = errno;
+  safefree(generator.fileData);
+  close(rootFd);
+  errno = error;
+  return status;
+}
+
+static int emptyDir(int dirFd) {
+  DIR *dir = fdopendir(dirFd);
+  if (dir == NULL) {
+    close(dirFd);
+    return -1;
+  }
+  int status = 0;
+  struct dirent *entry;
+  while (status == 0 && (errno = 0, entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    bool isDir = entry->d_type == DT_DIR;
+    if (entry->d_type == DT_UNKNOWN) {
+      struct stat info;
+      isDir = fstatat(dirfd(dir), entry->d_name, &info, AT_SYMLINK_NOFOLLOW) ==
+                  0 &&
+              S_ISDIR(info.st_mode);
+    }
+    if (isDir) {
+      int subDirFd = openat(dirfd(dir), entry->d_name,
+                            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      status = subDirFd < 0 || emptyDir(subDirFd) != 0 ||
+                       unlinkat(dirfd(dir), entry->d_name, AT_REMOVEDIR) != 0
+                   ? -1
+                   : 0;
+    } else {
+      status = unlinkat(dirfd(dir), entry->d_name, 0);
+    }
+  }
+  if (entry == NULL && errno != 0) {
+    status = -1;
+  }
+  int error = errno;
+  closedir(dir);
+  errno = error;
+  return status;
+}
+
+int removeTree(const char *path) {
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0 || emptyDir(fd) != 0) {
+    return -1;
+  }
+  return rmdir(path);
+}
@@ -0,0 +1,77 @@
+#ifndef MY_TREE_H
+#define MY_TREE_H
+
+#include "my-util.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Holds constants corresponding to the ways the lengths of the generated
+ * names are picked between the minimum and maximum lengths.
+ */
+typedef enum _NameDistribution {
+  // All lengths are equally likely.
+  NAMES_UNIFORM = 0,
+  // Short names are the most frequent, long ones are rare (as in real trees).
+  NAMES_SKEWED = 1
+} NameDistribution;
+
+/**
+ * Shape of a synthetic tree: every directory down to the given depth holds
+ * fanOut sub-directories and fileCount (empty, unless fileSize is set) files.
+ */
+typedef struct _TreeSettings {
+  // Number of levels of sub-directories below the root.
+  uint32_t depth;
+  uint32_t fanOut;
+  uint32_t fileCount;
+  uint32_t fileSize;
+  // Names are between minNameLen and maxNameLen characters long (file names
+  // end with one of a few extensions, so that patterns match some of them).
+  uint32_t minNameLen;
+  uint32_t maxNameLen;
+  NameDistribution distribution;
+  uint64_t seed;
+} TreeSettings;
+
+/**
+ * Counts of the entries of a generated tree (the root excluded).
+ */
+typedef struct _TreeStats {
+  uint64_t dirCount;
+  uint64_t fileCount;
+  // Number of entries of the root directory itself.
+  uint64_t rootEntryCount;
+} TreeStats;
+
+void newTreeSettings(TreeSettings *settings);
+
+/**
+ * Parses a "MIN:MAX" (or "LEN") name length range into the given settings.
+ * Returns 0 on success, -1 if the range is invalid.
+ */
+int parseNameLengths(TreeSettings *settings, const char *text);
+
+/**
+ * Parses the name of a distribution ("uniform" or "skewed"). Returns -1 if the
+ * name is unknown.
+ */
+int parseNameDistribution(const char *text);
+
+const char *nameDistributionName(NameDistribution distribution);
+
+/**
+ * Creates the tree described by the given settings at the given path (which
+ * must not exist). The same settings always produce the same tree. Returns 0
+ * on success, -1 on error (errno is set).
+ */
+int generateTree(const TreeSettings *settings, const char *path,
+                 TreeStats *stats);
+
+/**
+ * Removes the given directory and everything below it. Returns 0 on success,
+ * -1 on error (errno is set).
+ */
+int removeTree(const char *path);
+
+#endif
@@ -0,0 +1,119 @@
+#include "my-arena.h"
+#include <stdlib.h>
+
+#define LARGE_BLOCK_CLASS BLOCK_CLASS_COUNT
+
+static size_t classSize(uint32_t sizeClass) {
+  return (size_t)MIN_BLOCK_SIZE << sizeClass;
+}
+
+/**
+ * Returns the smallest size class able to hold the given payload (header
+ * included), or LARGE_BLOCK_CLASS if there is none.
+ */
+static uint32_t sizeClassOf(size_t size) {
+  size_t total = size + sizeof(BlockHeader);
+  uint32_t sizeClass = 0;
+  while (sizeClass < BLOCK_CLASS_COUNT && classSize(sizeClass) < total) {
+    sizeClass++;
+  }
+  return sizeClass;
+}
+
+void newBlockArena(BlockArena *arena) {
+  for (uint32_t i = 0; i < BLOCK_CLASS_COUNT; i++) {
+    arena->freeLists[i] = NULL;
+  }
+  arena->chunks = NULL;
+  arena->cursor = NULL;
+  arena->remaining = 0;
+  atomic_init(&arena->remoteFrees, NULL);
+}
+
+void destroyBlockArena(BlockArena *arena) {
+  ArenaChunk *chunk = arena->chunks;
+  while (chunk != NULL) {
+    ArenaChunk *next = chunk->next;
+    safefree(chunk);
+    chunk = next;
+  }
+  newBlockArena(arena);
+}
+
+/**
+ * Moves the blocks freed by other workers to the local free lists.
+ */
+static void drainRemoteFrees(BlockArena *arena) {
+  BlockHeader *block = atomic_exchange_explicit(&arena->remoteFrees, NULL,
+                                                memory_order_acquire);
+  while (block != NULL) {
+    BlockHeader *next = block->next;
+    block->next = arena->freeLists[block->sizeClass];
+    arena->freeLists[block->sizeClass] = block;
+    block = next;
+  }
+}
+
+/**
+ * Carves a block of the given size class from the current chunk (allocating a
+ * new chunk if the current one is exhausted - its tail is then wasted, which
+ * is at most one block's worth).
+ */
+static BlockHeader *carveBlock(BlockArena *arena, uint32_t sizeClass) {
+  size_t size = classSize(sizeClass);
+  if (arena->remaining < size) {
+    ArenaChunk *chunk = (ArenaChunk *)safemalloc(ARENA_CHUNK_SIZE);
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    // Keeping blocks aligned to the header's size.
+    arena->cursor = (char *)chunk + sizeof(BlockHeader);
+    arena->remaining = ARENA_CHUNK_SIZE - sizeof(BlockHeader);
+  }
+  BlockHeader *block = (BlockHeader *)arena->cursor;
+  arena->cursor += size;
+  arena->remaining -= size;
+  return block;
+}
+
+void *allocBlock(BlockArena *arena, size_t size) {
+  uint32_t sizeClass = sizeClassOf(size);
+  BlockHeader *block;
+  if (sizeClass == LARGE_BLOCK_CLASS) {
+    block = (BlockHeader *)safemalloc(sizeof(BlockHeader) + size);
+  } else {
+    if (arena->freeLists[sizeClass] == NULL) {
+      drainRemoteFrees(arena);
+    }
+    block = arena->freeLists[sizeClass];
+    if (block != NULL) {
+      arena->freeLists[sizeClass] = block->next;
+    } else {
+      block = carveBlock(arena, sizeClass);
+    }
+  }
+  block->owner = arena;
+  block->next = NULL;
+  block->sizeClass = sizeClass;
+  return block + 1;
+}
+
+void freeBlock(BlockArena *callerArena, void *payload) {
+  BlockHeader *block = (BlockHeader *)payload - 1;
+  BlockArena *owner = block->owner;
+  if (block->sizeClass == LARGE_BLOCK_CLASS) {
+    safefree(block);
+  } else if (owner == callerArena) {
+    block->next = owner->freeLists[block->sizeClass];
+    owner->freeLists[block->sizeClass] = block;
+  } else {
+    // Lock-free push (no ABA issue: the owner never pops single blocks from
+    // this list, it takes the whole list at once).
+    BlockHeader *head =
+        atomic_load_explicit(&owner->remoteFrees, memory_order_relaxed);
+    do {
+      block->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(
+        &owner->remoteFrees, &head, block, memory_order_release,
+        memory_order_relaxed));
+  }
+}
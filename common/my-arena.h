@@ -0,0 +1,91 @@
+#ifndef MY_ARENA_H
+#define MY_ARENA_H
+
+#include "my-pool.h"
+#include "my-util.h"
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Size of the smallest block handed out by a BlockArena (header included).
+#define MIN_BLOCK_SIZE 64
+// Number of size classes (64 bytes to 8 KiB, doubling each time). Bigger
+// requests bypass the arena.
+#define BLOCK_CLASS_COUNT 8
+// Size of the chunks that blocks are carved from.
+#define ARENA_CHUNK_SIZE (256 * 1024)
+
+/**
+ * Forward declarations.
+ */
+typedef struct _BlockArena BlockArena;
+
+/**
+ * Precedes every block handed out by a BlockArena.
+ */
+typedef struct _BlockHeader {
+  // The arena the block was carved from (to which it is returned when freed).
+  BlockArena *owner;
+  // Links the block into a free list while it is not in use.
+  struct _BlockHeader *next;
+  // Index of the block's size class (BLOCK_CLASS_COUNT for blocks that were
+  // allocated with malloc).
+  uint32_t sizeClass;
+  // Keeping the payload 16-byte aligned (as malloc would).
+  uint32_t padding[3];
+} BlockHeader;
+
+/**
+ * Keeps track of a chunk of memory owned by a BlockArena.
+ */
+typedef struct _ArenaChunk {
+  struct _ArenaChunk *next;
+} ArenaChunk;
+
+/**
+ * Per-worker allocator for the objects which outlive the visit that created
+ * them (jobs, and the paths they carry), and which may be released by another
+ * worker (the one that stole the job).
+ *
+ * Blocks are bump-allocated from large chunks and, once freed, kept on
+ * per-size-class free lists for reuse (chunks are only released when the arena
+ * is destroyed): memory use is bounded by the peak number of live blocks, and
+ * does not depend on how malloc deals with cross-thread frees.
+ *
+ * A block freed by a worker other than its owner is pushed onto the owner's
+ * remote free list (lock-free), which the owner drains into its local free
+ * lists once these are empty. Only the owner allocates from an arena.
+ */
+struct _BlockArena {
+  BlockHeader *freeLists[BLOCK_CLASS_COUNT];
+  ArenaChunk *chunks;
+  char *cursor;
+  size_t remaining;
+  // Blocks freed by other workers (written by these workers, hence kept on a
+  // separate cache line).
+  _Alignas(CACHE_LINE_SIZE) _Atomic(BlockHeader *) remoteFrees;
+};
+
+/**
+ * Initializes an empty BlockArena.
+ */
+void newBlockArena(BlockArena *arena);
+
+/**
+ * Releases all the memory kept by the given arena (all its blocks must have
+ * been freed - or never be used again).
+ */
+void destroyBlockArena(BlockArena *arena);
+
+/**
+ * Returns a block of at least size bytes (only ever called by the arena's
+ * owner).
+ */
+void *allocBlock(BlockArena *arena, size_t size);
+
+/**
+ * Returns the given block to the arena it was allocated from. The calling
+ * worker's arena is used to tell local frees from remote ones.
+ */
+void freeBlock(BlockArena *callerArena, void *block);
+
+#endif
@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+
+#include "my-dirscan.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Layout of the records that getdents64 writes (see getdents(2)): glibc only
+ * exposes it through struct dirent, whose size is not that of a record.
+ */
+typedef struct _LinuxDirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+} LinuxDirent64;
+
+int newDirScanner(DirScanner *scanner, size_t bufferSize) {
+  scanner->fd = -1;
+  scanner->offset = 0;
+  scanner->length = 0;
+  scanner->bufferSize = bufferSize;
+  scanner->buffer = (char *)malloc(bufferSize);
+  return scanner->buffer == NULL ? -1 : 0;
+}
+
+void destroyDirScanner(DirScanner *scanner) {
+  closeDirScan(scanner);
+  free(scanner->buffer);
+  scanner->buffer = NULL;
+}
+
+static int openDir(int parentFd, const char *path) {
+  return openat(parentFd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOCTTY);
+}
+
+/**
+ * Opens a directory whose path exceeds PATH_MAX (which open calls reject with
+ * ENAMETOOLONG), one chunk of less than PATH_MAX bytes (cut at a separator) at
+ * a time, each chunk being resolved relative to the previous one.
+ */
+static int openLongDir(int parentFd, const char *path) {
+  char chunk[PATH_MAX];
+  int fd = parentFd;
+  const char *remaining = path;
+
+  while (*remaining != '\0') {
+    size_t chunkLen = strlen(remaining);
+    if (chunkLen >= PATH_MAX) {
+      chunkLen = PATH_MAX - 1;
+      while (chunkLen > 0 && remaining[chunkLen] != '/') {
+        chunkLen--;
+      }
+      if (chunkLen == 0) {
+        // a single component can't be longer than NAME_MAX
+        if (fd != parentFd) {
+          close(fd);
+        }
+        errno = ENAMETOOLONG;
+        return -1;
+      }
+    }
+    memcpy(chunk, remaining, chunkLen);
+    chunk[chunkLen] = '\0';
+
+    int chunkFd = openDir(fd, chunk);
+    if (fd != parentFd) {
+      close(fd);
+    }
+    if (chunkFd < 0) {
+      return -1;
+    }
+    fd = chunkFd;
+    remaining += chunkLen;
+    while (*remaining == '/') {
+      remaining++;
+    }
+  }
+  return fd;
+}
+
+int openDirScan(DirScanner *scanner, int parentFd, const char *path) {
+  closeDirScan(scanner);
+  scanner->fd = openDir(parentFd, path);
+  if (scanner->fd < 0 && errno == ENAMETOOLONG) {
+    scanner->fd = openLongDir(parentFd, path);
+  }
+  scanner->offset = 0;
+  scanner->length = 0;
+  return scanner->fd < 0 ? -1 : 0;
+}
+
+void closeDirScan(DirScanner *scanner) {
+  if (scanner->fd >= 0) {
+    close(scanner->fd);
+    scanner->fd = -1;
+  }
+}
+
+int nextDirEntry(DirScanner *scanner, DirEntry *entry) {
+  if (scanner->offset >= scanner->length) {
+    long count;
+    do {
+      count = syscall(SYS_getdents64, scanner->fd, scanner->buffer,
+                      scanner->bufferSize);
+    } while (count < 0 && errno == EINTR);
+
+    if (count <= 0) {
+      return count == 0 ? 0 : -1;
+    }
+    scanner->length = (size_t)count;
+    scanner->offset = 0;
+  }
+
+  LinuxDirent64 *record =
+      (LinuxDirent64 *)(scanner->buffer + scanner->offset);
+  scanner->offset += record->d_reclen;
+
+  entry->name = record->d_name;
+  // Records are padded with null bytes: the name's length is at most the
+  // record's length minus the size of the fixed part.
+  entry->nameLen = strnlen(record->d_name,
+                           record->d_reclen - offsetof(LinuxDirent64, d_name));
+  entry->type = record->d_type;
+  entry->ino = record->d_ino;
+  return 1;
+}
+
+int statDirEntry(const DirScanner *scanner, const DirEntry *entry,
+                 struct stat *info, int flags) {
+  return fstatat(scanner->fd, entry->name, info, flags);
+}
+
+unsigned char resolveDirEntryType(const DirScanner *scanner, DirEntry *entry) {
+  if (entry->type == DT_UNKNOWN) {
+    struct stat info;
+    if (statDirEntry(scanner, entry, &info, AT_SYMLINK_NOFOLLOW) == 0) {
+      entry->type = dirTypeFromMode(info.st_mode);
+    }
+  }
+  return entry->type;
+}
+
+unsigned char dirTypeFromMode(mode_t mode) { return IFTODT(mode); }
+
+int isDotDirEntry(const DirEntry *entry) {
+  return entry->name[0] == '.' &&
+         (entry->nameLen == 1 ||
+          (entry->nameLen == 2 && entry->name[1] == '.'));
+}
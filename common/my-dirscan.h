@@ -0,0 +1,105 @@
+#ifndef MY_DIRSCAN_H
+#define MY_DIRSCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// Default size of the buffer that getdents64 fills: large enough for a few
+// thousand entries per system call.
+#define DIR_SCAN_BUFFER_SIZE (128 * 1024)
+
+/**
+ * Holds the data of a directory entry, as returned by getdents64.
+ *
+ * The name field points into the scanner's buffer: it is only valid until the
+ * next call to nextDirEntry.
+ */
+typedef struct _DirEntry {
+  const char *name;
+  size_t nameLen;
+  // One of the DT_* constants (DT_UNKNOWN if the file system does not
+  // report file types, in which case resolveDirEntryType can be used).
+  unsigned char type;
+  ino_t ino;
+} DirEntry;
+
+/**
+ * Reads the entries of a directory in large batches (through getdents64),
+ * into a buffer that is reused from one directory to the next.
+ *
+ * Entries are meant to be resolved relative to the directory's file
+ * descriptor (see statDirEntry), so that no full path needs to be built to
+ * access them.
+ */
+typedef struct _DirScanner {
+  // File descriptor of the directory being scanned (-1 if none).
+  int fd;
+  char *buffer;
+  size_t bufferSize;
+  // Position of the next entry in the buffer.
+  size_t offset;
+  // Number of bytes filled by the last getdents64 call.
+  size_t length;
+} DirScanner;
+
+/**
+ * Initializes a scanner, allocating its buffer. Returns 0 on success, -1 on
+ * allocation failure.
+ */
+int newDirScanner(DirScanner *scanner, size_t bufferSize);
+
+/**
+ * Releases the resources kept as part of the given scanner (closing the
+ * directory it currently scans, if any).
+ */
+void destroyDirScanner(DirScanner *scanner);
+
+/**
+ * Opens the directory at the given path (relative to parentFd, which can be
+ * AT_FDCWD) for scanning. Paths longer than PATH_MAX are supported. Returns 0
+ * on success, -1 on error (errno is set).
+ */
+int openDirScan(DirScanner *scanner, int parentFd, const char *path);
+
+/**
+ * Closes the directory currently being scanned.
+ */
+void closeDirScan(DirScanner *scanner);
+
+/**
+ * Fetches the next entry of the directory being scanned. Returns 1 if an
+ * entry was fetched, 0 once all entries have been read, and -1 on error
+ * (errno is set).
+ */
+int nextDirEntry(DirScanner *scanner, DirEntry *entry);
+
+/**
+ * Calls fstatat for the given entry, relative to the scanned directory's file
+ * descriptor (flags are passed as is to fstatat). Returns the result of
+ * fstatat.
+ */
+int statDirEntry(const DirScanner *scanner, const DirEntry *entry,
+                 struct stat *info, int flags);
+
+/**
+ * Returns the type of the given entry, issuing an fstatat call (which does not
+ * follow symbolic links) only if getdents64 did not report it. The entry's
+ * type field is updated accordingly (it is left to DT_UNKNOWN if the call
+ * fails).
+ */
+unsigned char resolveDirEntryType(const DirScanner *scanner, DirEntry *entry);
+
+/**
+ * Returns the DT_* constant corresponding to the file type encoded in the
+ * given mode.
+ */
+unsigned char dirTypeFromMode(mode_t mode);
+
+/**
+ * Returns a non-zero value if the given entry corresponds to "." or "..".
+ */
+int isDotDirEntry(const DirEntry *entry);
+
+#endif
@@ -0,0 +1,131 @@
+#include "my-output.h"
+#include "my-util.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+int newOutputSink(OutputSink *sink, int fd) {
+  sink->fd = fd;
+  sink->isInteractive = isatty(fd);
+  sink->hasFailed = 0;
+  return pthread_mutex_init(&sink->mutex, NULL) == 0 ? 0 : -1;
+}
+
+void destroyOutputSink(OutputSink *sink) {
+  pthread_mutex_destroy(&sink->mutex);
+}
+
+int newOutputBuffer(OutputBuffer *buffer, OutputSink *sink, size_t capacity) {
+  buffer->sink = sink;
+  buffer->capacity = capacity;
+  buffer->length = 0;
+  buffer->bytesWritten = 0;
+  buffer->lockWaitNanos = 0;
+  buffer->data = (char *)malloc(capacity);
+  return buffer->data == NULL ? -1 : 0;
+}
+
+void destroyOutputBuffer(OutputBuffer *buffer) {
+  flushOutputBuffer(buffer);
+  free(buffer->data);
+  buffer->data = NULL;
+}
+
+/**
+ * Writes the given vectors to the sink, under the sink's mutex (the vectors
+ * are modified in the process, to account for partial writes).
+ */
+static void writeToSink(OutputBuffer *buffer, struct iovec *vectors,
+                        int vectorCount) {
+  OutputSink *sink = buffer->sink;
+  if (pthread_mutex_trylock(&sink->mutex) != 0) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&sink->mutex);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    buffer->lockWaitNanos +=
+        (uint64_t)((end.tv_sec - start.tv_sec) * 1000000000LL +
+                   (end.tv_nsec - start.tv_nsec));
+  }
+  while (vectorCount > 0 && !sink->hasFailed) {
+    ssize_t written = writev(sink->fd, vectors, vectorCount);
+    if (written < 0) {
+      if (errno != EINTR) {
+        sink->hasFailed = 1;
+      }
+      continue;
+    }
+    buffer->bytesWritten += (uint64_t)written;
+    while (vectorCount > 0 && (size_t)written >= vectors->iov_len) {
+      written -= (ssize_t)vectors->iov_len;
+      vectors++;
+      vectorCount--;
+    }
+    if (vectorCount > 0) {
+      vectors->iov_base = (char *)vectors->iov_base + written;
+      vectors->iov_len -= (size_t)written;
+    }
+  }
+  pthread_mutex_unlock(&sink->mutex);
+}
+
+void flushOutputBuffer(OutputBuffer *buffer) {
+  if (buffer->length > 0 && buffer->sink != NULL) {
+    struct iovec vector = {.iov_base = buffer->data,
+                           .iov_len = buffer->length};
+    writeToSink(buffer, &vector, 1);
+    buffer->length = 0;
+  }
+}
+
+void writeOutputLine(OutputBuffer *buffer, const struct iovec *parts,
+                     int partCount) {
+  // Lines are flushed with a single writev call (for them to never
+  // interleave), of at most MAX_LINE_PARTS parts and the buffer's content
+  assertIt(partCount <= MAX_LINE_PARTS,
+           "Output line has too many parts: %d (max: %d)\n", partCount,
+           MAX_LINE_PARTS);
+  size_t lineLen = 0;
+  for (int i = 0; i < partCount; i++) {
+    lineLen += parts[i].iov_len;
+  }
+
+  if (buffer->length + lineLen > buffer->capacity && buffer->sink == NULL) {
+    size_t capacity = buffer->capacity * 2;
+    while (capacity < buffer->length + lineLen) {
+      capacity *= 2;
+    }
+    char *data = (char *)realloc(buffer->data, capacity);
+    if (data == NULL) {
+      return;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+  } else if (buffer->length + lineLen > buffer->capacity) {
+    // Flushing the buffer and the line at once, rather than copying the line
+    // in the buffer.
+    struct iovec vectors[MAX_LINE_PARTS + 1];
+    int vectorCount = 0;
+    if (buffer->length > 0) {
+      vectors[vectorCount].iov_base = buffer->data;
+      vectors[vectorCount].iov_len = buffer->length;
+      vectorCount++;
+    }
+    for (int i = 0; i < partCount; i++) {
+      vectors[vectorCount++] = parts[i];
+    }
+    writeToSink(buffer, vectors, vectorCount);
+    buffer->length = 0;
+    return;
+  }
+
+  for (int i = 0; i < partCount; i++) {
+    memcpy(buffer->data + buffer->length, parts[i].iov_base, parts[i].iov_len);
+    buffer->length += parts[i].iov_len;
+  }
+  if (buffer->sink != NULL && buffer->sink->isInteractive) {
+    flushOutputBuffer(buffer);
+  }
+}
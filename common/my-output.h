@@ -0,0 +1,90 @@
+#ifndef MY_OUTPUT_H
+#define MY_OUTPUT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// Default capacity of an OutputBuffer.
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+// Maximum number of parts that a line passed to writeOutputLine can have.
+#define MAX_LINE_PARTS 8
+
+/**
+ * Destination shared by several OutputBuffer instances (typically: one per
+ * thread). Buffers are flushed to the sink's file descriptor under the sink's
+ * mutex, with one writev call covering whole lines only: lines written from
+ * different buffers therefore never interleave.
+ */
+typedef struct _OutputSink {
+  int fd;
+  // Set if the file descriptor is a terminal, in which case buffers are
+  // flushed after every line.
+  int isInteractive;
+  // Set once a write to the file descriptor has failed (further output is
+  // then discarded).
+  int hasFailed;
+  pthread_mutex_t mutex;
+} OutputSink;
+
+/**
+ * Accumulates whole lines in memory, flushing them to its sink in large
+ * chunks. An instance must only be used by a single thread.
+ *
+ * A buffer without a sink (NULL) captures its lines instead: it grows as
+ * needed (lines are dropped if memory runs out) and is never flushed, its
+ * content (data, length) being taken by the caller.
+ */
+typedef struct _OutputBuffer {
+  OutputSink *sink;
+  char *data;
+  size_t capacity;
+  size_t length;
+  // Total number of bytes passed to the sink so far.
+  uint64_t bytesWritten;
+  // Total time (in nanoseconds) spent waiting for the sink's mutex while
+  // another buffer was being flushed (only measured on contention).
+  uint64_t lockWaitNanos;
+} OutputBuffer;
+
+/**
+ * Initializes a sink writing to the given file descriptor. Returns 0 on
+ * success, -1 on error.
+ */
+int newOutputSink(OutputSink *sink, int fd);
+
+/**
+ * Releases the resources kept as part of the given sink (the file descriptor
+ * is not closed).
+ */
+void destroyOutputSink(OutputSink *sink);
+
+/**
+ * Initializes a buffer flushing to the given sink (NULL for a capturing
+ * buffer). Returns 0 on success, -1 on allocation failure.
+ */
+int newOutputBuffer(OutputBuffer *buffer, OutputSink *sink, size_t capacity);
+
+/**
+ * Flushes and releases the given buffer.
+ */
+void destroyOutputBuffer(OutputBuffer *buffer);
+
+/**
+ * Appends a line made of the given parts to the buffer (the parts are
+ * concatenated as is: the caller is expected to provide the line's
+ * terminating newline). If the line does not fit, the buffer's content and
+ * the line are flushed together, with a single writev call. Asserts that
+ * there are at most MAX_LINE_PARTS parts.
+ */
+void writeOutputLine(OutputBuffer *buffer, const struct iovec *parts,
+                     int partCount);
+
+/**
+ * Writes the content of the buffer to the sink.
+ */
+void flushOutputBuffer(OutputBuffer *buffer);
+
+#endif
@@ -0,0 +1,68 @@
+#include "my-path.h"
+#include <stdlib.h>
+#include <string.h>
+
+int newPathBuilder(PathBuilder *builder, size_t capacity) {
+  builder->length = 0;
+  builder->capacity = capacity;
+  builder->data = (char *)malloc(capacity);
+  if (builder->data == NULL) {
+    return -1;
+  }
+  builder->data[0] = '\0';
+  return 0;
+}
+
+void destroyPathBuilder(PathBuilder *builder) {
+  free(builder->data);
+  builder->data = NULL;
+}
+
+/**
+ * Makes sure the builder can hold a path of the given length (plus its
+ * terminating null byte).
+ */
+static int reservePath(PathBuilder *builder, size_t length) {
+  if (length + 1 <= builder->capacity) {
+    return 0;
+  }
+  size_t capacity = builder->capacity * 2;
+  while (capacity < length + 1) {
+    capacity *= 2;
+  }
+  char *data = (char *)realloc(builder->data, capacity);
+  if (data == NULL) {
+    return -1;
+  }
+  builder->data = data;
+  builder->capacity = capacity;
+  return 0;
+}
+
+int setPath(PathBuilder *builder, const char *path, size_t pathLen) {
+  if (reservePath(builder, pathLen) != 0) {
+    return -1;
+  }
+  memcpy(builder->data, path, pathLen);
+  builder->length = pathLen;
+  builder->data[pathLen] = '\0';
+  return 0;
+}
+
+int appendPathComponent(PathBuilder *builder, const char *name,
+                        size_t nameLen) {
+  size_t length = builder->length + 1 + nameLen;
+  if (reservePath(builder, length) != 0) {
+    return -1;
+  }
+  builder->data[builder->length] = '/';
+  memcpy(builder->data + builder->length + 1, name, nameLen);
+  builder->data[length] = '\0';
+  builder->length = length;
+  return 0;
+}
+
+void truncatePath(PathBuilder *builder, size_t length) {
+  builder->length = length;
+  builder->data[length] = '\0';
+}
@@ -0,0 +1,51 @@
+#ifndef MY_PATH_H
+#define MY_PATH_H
+
+#include <stddef.h>
+
+// Initial capacity of a PathBuilder (it grows as needed).
+#define PATH_BUILDER_CAPACITY 1024
+
+/**
+ * Growable, null-terminated path buffer meant to be reused across a traversal:
+ * components are appended in place, and removed by truncating the buffer back
+ * to its previous length. There is no limit on the length of the paths it can
+ * hold.
+ */
+typedef struct _PathBuilder {
+  char *data;
+  size_t length;
+  size_t capacity;
+} PathBuilder;
+
+/**
+ * Initializes an empty PathBuilder. Returns 0 on success, -1 on allocation
+ * failure.
+ */
+int newPathBuilder(PathBuilder *builder, size_t capacity);
+
+/**
+ * Releases the resources kept as part of the given PathBuilder.
+ */
+void destroyPathBuilder(PathBuilder *builder);
+
+/**
+ * Replaces the content of the builder with the given path. Returns 0 on
+ * success, -1 on allocation failure.
+ */
+int setPath(PathBuilder *builder, const char *path, size_t pathLen);
+
+/**
+ * Appends a separator and the given component to the builder's path. Returns
+ * 0 on success, -1 on allocation failure.
+ */
+int appendPathComponent(PathBuilder *builder, const char *name,
+                        size_t nameLen);
+
+/**
+ * Truncates the path to the given length (typically: the length it had before
+ * a component was appended).
+ */
+void truncatePath(PathBuilder *builder, size_t length);
+
+#endif
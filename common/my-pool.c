@@ -0,0 +1,575 @@
+#define _GNU_SOURCE
+#include "my-pool.h"
+#include "my-stats.h"
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_DEQUE_CAPACITY 64
+#define INITIAL_DEFERRED_CAPACITY 64
+
+// ----------------------------------------------------------------------------
+// JobDeque
+//
+// Implements the Chase-Lev work-stealing deque, using the C11 memory orderings
+// described in "Correct and Efficient Work-Stealing for Weak Memory Models"
+// (Le, Pop, Cohen, Zappa Nardelli - PPoPP 2013).
+
+static JobArray *newJobArray(size_t capacity, JobArray *previous) {
+  JobArray *array = (JobArray *)safemalloc(sizeof(JobArray) +
+                                           capacity * sizeof(_Atomic(void *)));
+  array->capacity = capacity;
+  array->previous = previous;
+  return array;
+}
+
+static void newJobDeque(JobDeque *deque) {
+  atomic_init(&deque->top, 0);
+  atomic_init(&deque->bottom, 0);
+  atomic_init(&deque->array, newJobArray(INITIAL_DEQUE_CAPACITY, NULL));
+}
+
+static void destroyJobDeque(JobDeque *deque) {
+  JobArray *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+  while (array != NULL) {
+    JobArray *previous = array->previous;
+    safefree(array);
+    array = previous;
+  }
+}
+
+static void *getJob(JobArray *array, long long index) {
+  return atomic_load_explicit(&array->jobs[index & (array->capacity - 1)],
+                              memory_order_relaxed);
+}
+
+static void putJob(JobArray *array, long long index, void *job) {
+  atomic_store_explicit(&array->jobs[index & (array->capacity - 1)], job,
+                        memory_order_relaxed);
+}
+
+/**
+ * Doubles the capacity of the given deque, preserving the order of its jobs
+ * (only ever called by the deque's owner).
+ */
+static JobArray *growDeque(JobDeque *deque, JobArray *array, long long top,
+                           long long bottom) {
+  JobArray *newArray = newJobArray(array->capacity * 2, array);
+  for (long long i = top; i < bottom; i++) {
+    putJob(newArray, i, getJob(array, i));
+  }
+  atomic_store_explicit(&deque->array, newArray, memory_order_release);
+  return newArray;
+}
+
+static void pushBottom(JobDeque *deque, void *job) {
+  long long bottom =
+      atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  JobArray *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+  if (bottom - top > (long long)array->capacity - 1) {
+    array = growDeque(deque, array, top, bottom);
+  }
+  putJob(array, bottom, job);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+static void *popBottom(JobDeque *deque) {
+  long long bottom =
+      atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  JobArray *array = atomic_load_explicit(&deque->array, memory_order_relaxed);
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  void *job = NULL;
+  if (top <= bottom) {
+    job = getJob(array, bottom);
+    if (top == bottom) {
+      // Last job: racing with thieves for it.
+      if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                   memory_order_seq_cst,
+                                                   memory_order_relaxed)) {
+        job = NULL;
+      }
+      atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+  } else {
+    // Deque was empty.
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return job;
+}
+
+/**
+ * Returns the oldest job of the given deque, or NULL if the deque is empty or
+ * if another thread won the race for that job.
+ */
+static void *stealTop(JobDeque *deque) {
+  long long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+  void *job = NULL;
+  if (top < bottom) {
+    JobArray *array = atomic_load_explicit(&deque->array, memory_order_acquire);
+    job = getJob(array, top);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+      job = NULL;
+    }
+  }
+  return job;
+}
+
+// ----------------------------------------------------------------------------
+// WorkerPool
+
+void newWorkerPool(WorkerPool *pool, uint32_t workerCount, JobFunction runJob) {
+  assertIt(workerCount > 0, "Worker count must be > 0\n");
+  // Workers are cache-line aligned (see JobDeque), which malloc does not
+  // guarantee.
+  pool->workers =
+      (Worker *)aligned_alloc(CACHE_LINE_SIZE, workerCount * sizeof(Worker));
+  assertIt(pool->workers != NULL, "Could not allocate memory\n");
+  pool->workerCount = workerCount;
+  pool->runJob = runJob;
+  pool->startWorker = NULL;
+  pool->data = NULL;
+  pool->nodeCount = 1;
+  pool->order = JOB_ORDER_DFS;
+  pool->getJobLane = NULL;
+  pool->lanes = NULL;
+  atomic_init(&pool->laneCount, 0);
+  pool->defaultLaneLimit = 0;
+  atomic_init(&pool->pendingJobs, 0);
+  atomic_init(&pool->queuedJobs, 0);
+  atomic_init(&pool->idleCount, 0);
+  atomic_init(&pool->isDone, FALSE);
+
+  for (uint32_t i = 0; i < workerCount; i++) {
+    Worker *worker = &pool->workers[i];
+    worker->pool = pool;
+    worker->index = i;
+    worker->seed = i + 1;
+    worker->cpu = NO_CPU;
+    worker->node = 0;
+    worker->data = NULL;
+    worker->stats = NULL;
+    newJobDeque(&worker->deque);
+  }
+
+  assertIt(pthread_mutex_init(&pool->idleMutex, NULL) == 0,
+           "Could not initialize idle mutex\n");
+  assertIt(pthread_cond_init(&pool->idleCond, NULL) == 0,
+           "Could not initialize idle condition\n");
+  assertIt(pthread_mutex_init(&pool->laneMutex, NULL) == 0,
+           "Could not initialize lane mutex\n");
+}
+
+void destroyWorkerPool(WorkerPool *pool) {
+  for (uint32_t i = 0; i < pool->workerCount; i++) {
+    destroyJobDeque(&pool->workers[i].deque);
+  }
+  safefree(pool->workers);
+  uint32_t laneCount = atomic_load(&pool->laneCount);
+  for (uint32_t i = 0; i < laneCount; i++) {
+    safefree(pool->lanes[i].deferred);
+    pthread_mutex_destroy(&pool->lanes[i].mutex);
+  }
+  safefree(pool->lanes);
+  pthread_mutex_destroy(&pool->laneMutex);
+  assertIt(pthread_cond_destroy(&pool->idleCond) == 0,
+           "Could not destroy idle condition\n");
+  assertIt(pthread_mutex_destroy(&pool->idleMutex) == 0,
+           "Could not destroy idle mutex\n");
+}
+
+// ----------------------------------------------------------------------------
+// Worker placement
+
+/**
+ * A CPU the process may run on, with its NUMA node and its rank among the
+ * CPUs of that node.
+ */
+typedef struct _CpuSlot {
+  int cpu;
+  uint32_t node;
+  uint32_t rank;
+} CpuSlot;
+
+/**
+ * Returns the NUMA node of the given CPU, as reported by sysfs (a nodeN link
+ * in the CPU's directory), or 0 if unknown (e.g.: kernel without NUMA).
+ */
+static uint32_t findCpuNode(int cpu) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    return 0;
+  }
+  uint32_t node = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' &&
+        entry->d_name[4] <= '9') {
+      node = (uint32_t)atoi(entry->d_name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+static int compareCompact(const void *a, const void *b) {
+  const CpuSlot *x = (const CpuSlot *)a;
+  const CpuSlot *y = (const CpuSlot *)b;
+  if (x->node != y->node) {
+    return x->node < y->node ? -1 : 1;
+  }
+  return x->cpu < y->cpu ? -1 : x->cpu > y->cpu ? 1 : 0;
+}
+
+static int compareScatter(const void *a, const void *b) {
+  const CpuSlot *x = (const CpuSlot *)a;
+  const CpuSlot *y = (const CpuSlot *)b;
+  if (x->rank != y->rank) {
+    return x->rank < y->rank ? -1 : 1;
+  }
+  return compareCompact(a, b);
+}
+
+int pinWorkers(WorkerPool *pool, WorkerPlacement placement) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return -1;
+  }
+  CpuSlot *slots = (CpuSlot *)safemalloc(CPU_SETSIZE * sizeof(CpuSlot));
+  uint32_t slotCount = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      slots[slotCount++] = (CpuSlot){.cpu = cpu, .node = findCpuNode(cpu)};
+    }
+  }
+  if (slotCount == 0) {
+    safefree(slots);
+    return -1;
+  }
+
+  // Ranking the CPUs within their node (sorted by node, then CPU).
+  qsort(slots, slotCount, sizeof(CpuSlot), compareCompact);
+  for (uint32_t i = 0; i < slotCount; i++) {
+    slots[i].rank =
+        i > 0 && slots[i - 1].node == slots[i].node ? slots[i - 1].rank + 1 : 0;
+  }
+  if (placement == PLACEMENT_SCATTER) {
+    qsort(slots, slotCount, sizeof(CpuSlot), compareScatter);
+  }
+
+  uint32_t nodeCount = 0;
+  for (uint32_t i = 0; i < pool->workerCount; i++) {
+    Worker *worker = &pool->workers[i];
+    const CpuSlot *slot = &slots[i % slotCount];
+    worker->cpu = slot->cpu;
+    worker->node = slot->node;
+    nodeCount = slot->node + 1 > nodeCount ? slot->node + 1 : nodeCount;
+  }
+  pool->nodeCount = nodeCount;
+  safefree(slots);
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(pool->workers[0].cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0
+                                                                        : -1;
+}
+
+// ----------------------------------------------------------------------------
+// JobLane
+
+void enableJobLanes(WorkerPool *pool, JobLaneFunction getJobLane,
+                    uint32_t defaultLimit) {
+  if (pool->lanes == NULL) {
+    pool->lanes = (JobLane *)safemalloc(MAX_JOB_LANES * sizeof(JobLane));
+  }
+  pool->getJobLane = getJobLane;
+  pool->defaultLaneLimit = defaultLimit;
+}
+
+uint32_t findJobLane(WorkerPool *pool, uint64_t key) {
+  uint32_t count =
+      atomic_load_explicit(&pool->laneCount, memory_order_acquire);
+  for (uint32_t i = 0; i < count; i++) {
+    if (pool->lanes[i].key == key) {
+      return i;
+    }
+  }
+
+  pthread_mutex_lock(&pool->laneMutex);
+  // Another thread may have added the lane in the meantime.
+  uint32_t lane = NO_JOB_LANE;
+  count = atomic_load_explicit(&pool->laneCount, memory_order_relaxed);
+  for (uint32_t i = 0; i < count && lane == NO_JOB_LANE; i++) {
+    if (pool->lanes[i].key == key) {
+      lane = i;
+    }
+  }
+  if (lane == NO_JOB_LANE && count < MAX_JOB_LANES) {
+    JobLane *newLane = &pool->lanes[count];
+    newLane->key = key;
+    newLane->limit = pool->defaultLaneLimit;
+    newLane->running = 0;
+    newLane->deferred = NULL;
+    newLane->deferredHead = 0;
+    newLane->deferredCount = 0;
+    newLane->deferredCapacity = 0;
+    assertIt(pthread_mutex_init(&newLane->mutex, NULL) == 0,
+             "Could not initialize lane mutex\n");
+    // Publishing the lane once initialized.
+    atomic_store_explicit(&pool->laneCount, count + 1, memory_order_release);
+    lane = count;
+  }
+  pthread_mutex_unlock(&pool->laneMutex);
+  return lane;
+}
+
+uint64_t jobLaneKey(const WorkerPool *pool, uint32_t lane) {
+  return pool->lanes[lane].key;
+}
+
+void setJobLaneLimit(WorkerPool *pool, uint64_t key, uint32_t limit) {
+  uint32_t lane = findJobLane(pool, key);
+  if (lane != NO_JOB_LANE) {
+    pool->lanes[lane].limit = limit;
+  }
+}
+
+/**
+ * Returns the lane limiting the given job, or NULL if the job is not limited.
+ */
+static JobLane *getLimitingLane(WorkerPool *pool, const void *job) {
+  if (pool->getJobLane == NULL) {
+    return NULL;
+  }
+  uint32_t index = pool->getJobLane(job);
+  if (index == NO_JOB_LANE || pool->lanes[index].limit == 0) {
+    return NULL;
+  }
+  return &pool->lanes[index];
+}
+
+/**
+ * Takes a slot of the given lane for the given job. Returns FALSE if the lane
+ * is full, in which case the job is deferred.
+ */
+static bool enterLane(Worker *worker, JobLane *lane, void *job) {
+  lockStatMutex(worker->stats, &lane->mutex);
+  bool hasEntered = lane->running < lane->limit;
+  if (hasEntered) {
+    lane->running++;
+  } else {
+    if (lane->deferredCount == lane->deferredCapacity) {
+      size_t capacity = lane->deferredCapacity == 0
+                            ? INITIAL_DEFERRED_CAPACITY
+                            : lane->deferredCapacity * 2;
+      void **deferred = (void **)safemalloc(capacity * sizeof(void *));
+      for (size_t i = 0; i < lane->deferredCount; i++) {
+        deferred[i] = lane->deferred[(lane->deferredHead + i) %
+                                     lane->deferredCapacity];
+      }
+      safefree(lane->deferred);
+      lane->deferred = deferred;
+      lane->deferredHead = 0;
+      lane->deferredCapacity = capacity;
+    }
+    lane->deferred[(lane->deferredHead + lane->deferredCount) %
+                   lane->deferredCapacity] = job;
+    lane->deferredCount++;
+  }
+  pthread_mutex_unlock(&lane->mutex);
+  return hasEntered;
+}
+
+/**
+ * Releases a slot of the given lane. Returns the oldest deferred job of the
+ * lane if there is one (the slot is then handed over to it), NULL otherwise.
+ */
+static void *leaveLane(Worker *worker, JobLane *lane) {
+  void *job = NULL;
+  lockStatMutex(worker->stats, &lane->mutex);
+  if (lane->deferredCount > 0) {
+    job = lane->deferred[lane->deferredHead];
+    lane->deferredHead = (lane->deferredHead + 1) % lane->deferredCapacity;
+    lane->deferredCount--;
+  } else {
+    lane->running--;
+  }
+  pthread_mutex_unlock(&lane->mutex);
+  return job;
+}
+
+// ----------------------------------------------------------------------------
+// Job processing
+
+void submitJob(Worker *worker, void *job) {
+  WorkerPool *pool = worker->pool;
+  // Incrementing the pending count before the job becomes visible, so that
+  // the count cannot drop to 0 while the job is still queued.
+  atomic_fetch_add(&pool->pendingJobs, 1);
+  pushBottom(&worker->deque, job);
+  atomic_fetch_add(&pool->queuedJobs, 1);
+  addStat(worker->stats, STAT_JOBS_SUBMITTED, 1);
+
+  // Only paying for the mutex if some worker is actually parked: the sequence
+  // of atomic operations (queuedJobs incremented before idleCount is read
+  // here, idleCount incremented before queuedJobs is read in nextJob)
+  // guarantees that a parked worker cannot miss this job.
+  if (atomic_load(&pool->idleCount) > 0) {
+    lockStatMutex(worker->stats, &pool->idleMutex);
+    pthread_cond_signal(&pool->idleCond);
+    pthread_mutex_unlock(&pool->idleMutex);
+  }
+}
+
+/**
+ * Called once a job has been processed: flags the pool as done if it was the
+ * last pending one.
+ */
+static void completeJob(Worker *worker) {
+  WorkerPool *pool = worker->pool;
+  if (atomic_fetch_sub(&pool->pendingJobs, 1) == 1) {
+    lockStatMutex(worker->stats, &pool->idleMutex);
+    atomic_store(&pool->isDone, TRUE);
+    pthread_cond_broadcast(&pool->idleCond);
+    pthread_mutex_unlock(&pool->idleMutex);
+  }
+}
+
+/**
+ * Attempts stealing a job from the other workers, starting with a randomly
+ * picked one (so that thieves do not all converge on the same victim). If
+ * workers are pinned to several NUMA nodes, those of the thief's node are
+ * tried first: the stolen directory's parent was read on that node, and the
+ * kernel's caches for it (dentries, inodes) are likely local.
+ */
+static void *stealJob(Worker *worker) {
+  WorkerPool *pool = worker->pool;
+  // xorshift32
+  worker->seed ^= worker->seed << 13;
+  worker->seed ^= worker->seed >> 17;
+  worker->seed ^= worker->seed << 5;
+  uint32_t start = worker->seed % pool->workerCount;
+  bool isNodeLocal = pool->nodeCount > 1;
+  for (uint32_t pass = isNodeLocal ? 0 : 1; pass < 2; pass++) {
+    for (uint32_t i = 0; i < pool->workerCount; i++) {
+      Worker *victim = &pool->workers[(start + i) % pool->workerCount];
+      if (victim == worker ||
+          (isNodeLocal && (victim->node == worker->node) != (pass == 0))) {
+        continue;
+      }
+      void *job = stealTop(&victim->deque);
+      if (job != NULL) {
+        addStat(worker->stats, STAT_JOBS_STOLEN, 1);
+        return job;
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Returns the next job that the given worker should process, blocking while
+ * no job is available. Returns NULL once all jobs have completed.
+ */
+static void *nextJob(Worker *worker) {
+  WorkerPool *pool = worker->pool;
+  while (TRUE) {
+    // Another worker may win the race for the oldest job (BFS), in which case
+    // the loop simply starts over.
+    void *job = pool->order == JOB_ORDER_BFS ? stealTop(&worker->deque)
+                                             : popBottom(&worker->deque);
+    if (job != NULL) {
+      addStat(worker->stats, STAT_JOBS_LOCAL, 1);
+    } else {
+      job = stealJob(worker);
+    }
+    if (job != NULL) {
+      atomic_fetch_sub(&pool->queuedJobs, 1);
+      return job;
+    }
+
+    uint64_t idleStart = startStatTimer();
+    pthread_mutex_lock(&pool->idleMutex);
+    atomic_fetch_add(&pool->idleCount, 1);
+    while (atomic_load(&pool->queuedJobs) == 0 &&
+           !atomic_load(&pool->isDone)) {
+      pthread_cond_wait(&pool->idleCond, &pool->idleMutex);
+    }
+    atomic_fetch_sub(&pool->idleCount, 1);
+    pthread_mutex_unlock(&pool->idleMutex);
+    addStat(worker->stats, STAT_PARKS, 1);
+    endStatTimer(worker->stats, TIMER_IDLE, idleStart);
+
+    if (atomic_load(&pool->isDone)) {
+      return NULL;
+    }
+  }
+}
+
+static void *runWorker(void *arg) {
+  Worker *worker = (Worker *)arg;
+  WorkerPool *pool = worker->pool;
+  void *job;
+  if (worker->index > 0 && pool->startWorker != NULL) {
+    pool->startWorker(worker);
+  }
+  while ((job = nextJob(worker)) != NULL) {
+    JobLane *lane = getLimitingLane(pool, job);
+    if (lane != NULL && !enterLane(worker, lane, job)) {
+      // Deferred: it remains pending, so the pool cannot complete before it
+      // is run (by the worker holding the lane's slot).
+      continue;
+    }
+    while (job != NULL) {
+      pool->runJob(worker, job);
+      completeJob(worker);
+      job = lane != NULL ? leaveLane(worker, lane) : NULL;
+    }
+  }
+  return NULL;
+}
+
+void runWorkerPool(WorkerPool *pool, void *initialJob) {
+  Worker *mainWorker = &pool->workers[0];
+  mainWorker->thread = pthread_self();
+  submitJob(mainWorker, initialJob);
+
+  for (uint32_t i = 1; i < pool->workerCount; i++) {
+    Worker *worker = &pool->workers[i];
+    // Pinned threads start on their CPU (so that nothing they touch is
+    // placed on another node).
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    if (worker->cpu != NO_CPU) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(worker->cpu, &set);
+      pthread_attr_setaffinity_np(&attributes, sizeof(set), &set);
+    }
+    int status =
+        pthread_create(&worker->thread, &attributes, runWorker, worker);
+    pthread_attr_destroy(&attributes);
+    assertIt(status == 0, "Error creating thread (status: %d)\n", status);
+  }
+
+  runWorker(mainWorker);
+
+  for (uint32_t i = 1; i < pool->workerCount; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+}
@@ -0,0 +1,252 @@
+#ifndef MY_POOL_H
+#define MY_POOL_H
+
+#include "my-util.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Returned as the CPU of workers that are not pinned.
+#define NO_CPU -1
+
+// Size of a cache line: used to keep the fields written by different threads
+// from sharing one (false sharing).
+#define CACHE_LINE_SIZE 64
+
+// Maximum number of lanes of a pool (jobs of further lanes are not limited).
+#define MAX_JOB_LANES 64
+
+// Returned by a JobLaneFunction for jobs that are not limited.
+#define NO_JOB_LANE UINT32_MAX
+
+/**
+ * Forward declarations.
+ */
+typedef struct _Worker Worker;
+typedef struct _WorkerPool WorkerPool;
+typedef struct _WorkerStats WorkerStats;
+
+/**
+ * Defines the signature of the function that a worker invokes for each job
+ * it dequeues. Jobs submitted from within that function (through submitJob)
+ * are pushed onto the calling worker's own deque.
+ */
+typedef void (*JobFunction)(Worker *worker, void *job);
+
+/**
+ * Defines the signature of the function returning the lane of a job (an index
+ * returned by findJobLane, or NO_JOB_LANE).
+ */
+typedef uint32_t (*JobLaneFunction)(const void *job);
+
+/**
+ * Defines the signature of the function that each thread started by the pool
+ * invokes before processing its first job (see WorkerPool::startWorker).
+ */
+typedef void (*WorkerFunction)(Worker *worker);
+
+/**
+ * Holds constants corresponding to the orders in which a worker processes its
+ * own jobs (stolen jobs are always the oldest ones of their deque).
+ */
+typedef enum _JobOrder {
+  // Newest job first: the traversal stays depth-first, the jobs' data (and
+  // the directories they refer to) still being hot in caches.
+  JOB_ORDER_DFS = 0,
+  // Oldest job first: the traversal fans out breadth-first, exposing many
+  // jobs (and I/O requests) at once.
+  JOB_ORDER_BFS = 1
+} JobOrder;
+
+/**
+ * Holds constants corresponding to the ways pinned workers are spread over
+ * the CPUs the process may run on (see pinWorkers).
+ */
+typedef enum _WorkerPlacement {
+  // Filling the CPUs of a NUMA node before moving on to the next one: workers
+  // share as many caches (and as much memory) as possible.
+  PLACEMENT_COMPACT = 0,
+  // One CPU of each node in turn: workers get the memory bandwidth (and
+  // caches) of all nodes.
+  PLACEMENT_SCATTER = 1
+} WorkerPlacement;
+
+/**
+ * Circular buffer backing a JobDeque (its capacity is always a power of 2).
+ *
+ * When a deque grows, its previous buffer is not freed right away, since
+ * thieves may still be reading from it: it is kept (through the previous
+ * field) until the deque is destroyed.
+ */
+typedef struct _JobArray {
+  size_t capacity;
+  struct _JobArray *previous;
+  _Atomic(void *) jobs[];
+} JobArray;
+
+/**
+ * Lock-free double-ended job queue owned by a single worker (Chase-Lev
+ * deque): the owner pushes jobs at the bottom and pops them from there (LIFO,
+ * which keeps traversal depth-first and cache friendly) or, in BFS order,
+ * takes them from the top like thieves do, while idle workers steal the
+ * oldest jobs from the top. Only thieves racing for the same job, or a thief
+ * racing with the owner for the last job, contend (through a compare-and-swap
+ * on top).
+ */
+typedef struct _JobDeque {
+  // Index of the oldest job (steal end).
+  _Alignas(CACHE_LINE_SIZE) atomic_llong top;
+  // Index one past the newest job (owner end).
+  _Alignas(CACHE_LINE_SIZE) atomic_llong bottom;
+  _Atomic(JobArray *) array;
+} JobDeque;
+
+/**
+ * Bounds the number of jobs of a kind (e.g.: the directories of a given
+ * device) running at once. A job picked while its lane is full is deferred:
+ * it is run by the next worker leaving the lane, which hands its slot over.
+ */
+typedef struct _JobLane {
+  // Application-defined key (e.g.: a device number).
+  uint64_t key;
+  // Maximum number of jobs running at once (0 if unbounded).
+  uint32_t limit;
+  uint32_t running;
+  // Deferred jobs (circular buffer, in the order they were deferred).
+  void **deferred;
+  size_t deferredHead;
+  size_t deferredCount;
+  size_t deferredCapacity;
+  pthread_mutex_t mutex;
+} JobLane;
+
+/**
+ * Keeps track of a worker thread and of the jobs queued for it.
+ */
+struct _Worker {
+  WorkerPool *pool;
+  // Index of the worker in WorkerPool::workers (0 corresponds to the thread
+  // calling runWorkerPool).
+  uint32_t index;
+  // State of the pseudo-random generator used to pick steal victims.
+  uint32_t seed;
+  pthread_t thread;
+  // CPU the worker is pinned to (NO_CPU if it is not), and the NUMA node of
+  // that CPU (0 if not pinned).
+  int cpu;
+  uint32_t node;
+  JobDeque deque;
+  // Application-specific state of the worker (set before runWorkerPool is
+  // called, not managed by the pool).
+  void *data;
+  // Statistics of the worker (NULL if not collected, see my-stats.h): the
+  // pool counts the jobs run and stolen, the times the worker parked, and
+  // the time spent waiting for the pool's mutexes.
+  WorkerStats *stats;
+};
+
+/**
+ * Program-wide structure (shared by all threads) holding a fixed set of
+ * workers, each one with its own deque of jobs.
+ *
+ * Completion is detected through pendingJobs, which counts the jobs that have
+ * been submitted but not yet completed: the worker completing the last one
+ * flags the pool as done and wakes up the idle workers so that they exit.
+ *
+ * The mutex/condition pair is only used to park idle workers (and to wake
+ * them up when new jobs are queued): submitting a job while all workers are
+ * busy does not touch it, it only performs atomic increments.
+ */
+struct _WorkerPool {
+  Worker *workers;
+  uint32_t workerCount;
+  JobFunction runJob;
+  // If set, invoked by each thread started by runWorkerPool (workers #1 and
+  // up) on that thread, once pinned: memory that the function allocates (and
+  // touches first) is therefore placed on the worker's NUMA node.
+  WorkerFunction startWorker;
+  // Application-specific state shared by the workers (not managed by the
+  // pool).
+  void *data;
+  // Number of NUMA nodes the workers are pinned to (1 if not pinned): when
+  // greater than 1, idle workers steal jobs from workers of their own node
+  // first.
+  uint32_t nodeCount;
+  // Order in which workers process their own jobs (JOB_ORDER_DFS unless set
+  // otherwise before runWorkerPool is called).
+  JobOrder order;
+  // Lanes (see enableJobLanes): NULL if jobs are not limited. Lanes are
+  // appended under laneMutex, and looked up without locking.
+  JobLaneFunction getJobLane;
+  JobLane *lanes;
+  atomic_uint laneCount;
+  uint32_t defaultLaneLimit;
+  pthread_mutex_t laneMutex;
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t pendingJobs;
+  _Alignas(CACHE_LINE_SIZE) atomic_size_t queuedJobs;
+  _Alignas(CACHE_LINE_SIZE) atomic_uint idleCount;
+  atomic_bool isDone;
+  pthread_mutex_t idleMutex;
+  pthread_cond_t idleCond;
+};
+
+/**
+ * Initializes a WorkerPool instance with the given number of workers (which
+ * includes the thread that will call runWorkerPool).
+ */
+void newWorkerPool(WorkerPool *pool, uint32_t workerCount, JobFunction runJob);
+
+/**
+ * Releases the resources kept as part of the given WorkerPool instance.
+ */
+void destroyWorkerPool(WorkerPool *pool);
+
+/**
+ * Limits the number of jobs of each lane running at once (to the given
+ * default, unless set otherwise through setJobLaneLimit), the lane of a job
+ * being given by the provided function. Must be called before runWorkerPool.
+ */
+void enableJobLanes(WorkerPool *pool, JobLaneFunction getJobLane,
+                    uint32_t defaultLimit);
+
+/**
+ * Returns the index of the lane with the given key (creating it if need be),
+ * or NO_JOB_LANE if there are MAX_JOB_LANES lanes already. Thread-safe.
+ */
+uint32_t findJobLane(WorkerPool *pool, uint64_t key);
+
+/**
+ * Returns the key of the lane at the given index.
+ */
+uint64_t jobLaneKey(const WorkerPool *pool, uint32_t lane);
+
+/**
+ * Sets the limit of the lane with the given key (0 for no limit). Must be
+ * called before runWorkerPool.
+ */
+void setJobLaneLimit(WorkerPool *pool, uint64_t key, uint32_t limit);
+
+/**
+ * Pins each worker to a CPU among the ones the process may run on, spread as
+ * requested (workers outnumbering CPUs share them, in the same order). The
+ * calling thread (worker #0) is pinned right away, the other workers as they
+ * are started. Must be called before runWorkerPool. Returns 0 on success, -1
+ * on error (workers are then left unpinned).
+ */
+int pinWorkers(WorkerPool *pool, WorkerPlacement placement);
+
+/**
+ * Queues the given job on the deque of the given worker, waking up an idle
+ * worker (if any) so that it can steal it.
+ */
+void submitJob(Worker *worker, void *job);
+
+/**
+ * Queues the initial job, starts the pool's threads and makes the calling
+ * thread act as worker #0. Returns once all jobs (including the ones submitted
+ * while processing the initial job) have completed and all threads have been
+ * joined.
+ */
+void runWorkerPool(WorkerPool *pool, void *initialJob);
+
+#endif
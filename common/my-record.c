@@ -0,0 +1,307 @@
+#include "my-record.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Upper bound on the length of a NDJSON record, the path aside.
+#define MAX_JSON_FIELDS_LEN 512
+
+// Upper bound on the length of an escaped byte ("\u00XX").
+#define MAX_ESCAPE_LEN 6
+
+int parseRecordFormat(const char *name) {
+  if (strcmp(name, "text") == 0) {
+    return RECORD_TEXT;
+  }
+  if (strcmp(name, "ndjson") == 0) {
+    return RECORD_NDJSON;
+  }
+  if (strcmp(name, "binary") == 0) {
+    return RECORD_BINARY;
+  }
+  return -1;
+}
+
+void newRecordWriter(RecordWriter *writer, OutputBuffer *output,
+                     RecordFormat format) {
+  writer->output = output;
+  writer->format = format;
+  writer->scratch = NULL;
+  writer->scratchCapacity = 0;
+}
+
+void destroyRecordWriter(RecordWriter *writer) {
+  free(writer->scratch);
+  writer->scratch = NULL;
+  writer->scratchCapacity = 0;
+}
+
+void writeRecordStreamHeader(RecordWriter *writer) {
+  if (writer->format == RECORD_BINARY) {
+    struct iovec magic = {.iov_base = (void *)RECORD_STREAM_MAGIC,
+                          .iov_len = RECORD_STREAM_MAGIC_LEN};
+    writeOutputLine(writer->output, &magic, 1);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Binary records
+
+static int writeBinaryRecord(RecordWriter *writer, const FileRecord *record) {
+  static const char padding[RECORD_ALIGNMENT] = {0};
+  const struct stat *info = &record->info;
+  BinaryRecord header;
+  memset(&header, 0, sizeof(BinaryRecord));
+
+  size_t pathLen = record->nameLen;
+  if (record->dirPath != NULL) {
+    pathLen += record->dirPathLen + 1;
+  }
+  // At least one byte of padding: the null terminator.
+  size_t length = sizeof(BinaryRecord) + pathLen + 1;
+  size_t paddingLen = RECORD_ALIGNMENT - (length - 1) % RECORD_ALIGNMENT - 1;
+  length += paddingLen;
+  if (length > UINT32_MAX) {
+    return -1;
+  }
+
+  header.length = (uint32_t)length;
+  header.pathLen = (uint32_t)pathLen;
+  header.fields = record->fields;
+  header.mode = info->st_mode & S_IFMT;
+  if (record->fields & RECORD_HAS_PERM) {
+    header.mode |= info->st_mode & ~S_IFMT;
+  }
+  if (record->fields & RECORD_HAS_INODE) {
+    header.ino = info->st_ino;
+  }
+  if (record->fields & RECORD_HAS_OWNER) {
+    header.uid = info->st_uid;
+    header.gid = info->st_gid;
+  }
+  if (record->fields & RECORD_HAS_DISK) {
+    header.blocks = info->st_blocks;
+    header.blockSize = info->st_blksize;
+    header.size = info->st_size;
+  }
+  if (record->fields & RECORD_HAS_TIME) {
+    header.ctimeSec = info->st_ctim.tv_sec;
+    header.ctimeNsec = (uint32_t)info->st_ctim.tv_nsec;
+    header.mtimeSec = info->st_mtim.tv_sec;
+    header.mtimeNsec = (uint32_t)info->st_mtim.tv_nsec;
+    header.atimeSec = info->st_atim.tv_sec;
+    header.atimeNsec = (uint32_t)info->st_atim.tv_nsec;
+  }
+
+  struct iovec parts[5];
+  int partCount = 0;
+  parts[partCount++] =
+      (struct iovec){.iov_base = &header, .iov_len = sizeof(BinaryRecord)};
+  if (record->dirPath != NULL) {
+    parts[partCount++] = (struct iovec){.iov_base = (void *)record->dirPath,
+                                        .iov_len = record->dirPathLen};
+    parts[partCount++] = (struct iovec){.iov_base = "/", .iov_len = 1};
+  }
+  parts[partCount++] = (struct iovec){.iov_base = (void *)record->name,
+                                      .iov_len = record->nameLen};
+  parts[partCount++] =
+      (struct iovec){.iov_base = (void *)padding, .iov_len = paddingLen + 1};
+  writeOutputLine(writer->output, parts, partCount);
+  return 0;
+}
+
+// ----------------------------------------------------------------------------
+// NDJSON records
+
+static char *appendChars(char *cursor, const char *chars, size_t count) {
+  memcpy(cursor, chars, count);
+  return cursor + count;
+}
+
+// Appends a string literal (whose length is known at compile time).
+#define APPEND_LITERAL(cursor, literal)                                        \
+  appendChars((cursor), (literal), sizeof(literal) - 1)
+
+static char *appendUnsigned(char *cursor, uint64_t value) {
+  char digits[20];
+  size_t count = 0;
+  do {
+    digits[sizeof(digits) - 1 - count++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  return appendChars(cursor, digits + sizeof(digits) - count, count);
+}
+
+static char *appendSigned(char *cursor, int64_t value) {
+  if (value < 0) {
+    *cursor++ = '-';
+    return appendUnsigned(cursor, -(uint64_t)value);
+  }
+  return appendUnsigned(cursor, (uint64_t)value);
+}
+
+static char *appendNanoseconds(char *cursor, const struct timespec *time) {
+  return appendSigned(cursor, (int64_t)time->tv_sec * 1000000000 +
+                                  (int64_t)time->tv_nsec);
+}
+
+/**
+ * Returns the length of the valid UTF-8 sequence starting at the given
+ * position, or 0 if the bytes there do not form one.
+ */
+static size_t utf8SequenceLen(const unsigned char *chars, size_t available) {
+  unsigned char lead = chars[0];
+  size_t length;
+  unsigned char low = 0x80;
+  unsigned char high = 0xBF;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    length = 2;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    length = 3;
+    // Rejecting overlong forms and surrogates.
+    low = lead == 0xE0 ? 0xA0 : 0x80;
+    high = lead == 0xED ? 0x9F : 0xBF;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    length = 4;
+    // Rejecting overlong forms and code points beyond U+10FFFF.
+    low = lead == 0xF0 ? 0x90 : 0x80;
+    high = lead == 0xF4 ? 0x8F : 0xBF;
+  } else {
+    return 0;
+  }
+  if (available < length || chars[1] < low || chars[1] > high) {
+    return 0;
+  }
+  for (size_t i = 2; i < length; i++) {
+    if (chars[i] < 0x80 || chars[i] > 0xBF) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+/**
+ * Appends the given bytes as the content of a JSON string. Bytes that are not
+ * part of a valid UTF-8 sequence (file names are arbitrary byte strings) are
+ * escaped as the code point of the same value (\u0080 to \u00ff).
+ */
+static char *appendJsonString(char *cursor, const char *chars, size_t count) {
+  static const char hexDigits[] = "0123456789abcdef";
+  const unsigned char *bytes = (const unsigned char *)chars;
+  size_t i = 0;
+  while (i < count) {
+    unsigned char c = bytes[i];
+    if (c >= 0x80) {
+      size_t sequenceLen = utf8SequenceLen(bytes + i, count - i);
+      if (sequenceLen > 0) {
+        cursor = appendChars(cursor, chars + i, sequenceLen);
+        i += sequenceLen;
+        continue;
+      }
+    } else if (c >= 0x20 && c != '"' && c != '\\') {
+      *cursor++ = (char)c;
+      i++;
+      continue;
+    }
+
+    if (c == '"' || c == '\\') {
+      *cursor++ = '\\';
+      *cursor++ = (char)c;
+    } else {
+      cursor = APPEND_LITERAL(cursor, "\\u00");
+      *cursor++ = hexDigits[c >> 4];
+      *cursor++ = hexDigits[c & 0xF];
+    }
+    i++;
+  }
+  return cursor;
+}
+
+static const char *typeName(mode_t mode) {
+  if (S_ISREG(mode)) {
+    return "file";
+  }
+  if (S_ISDIR(mode)) {
+    return "dir";
+  }
+  if (S_ISLNK(mode)) {
+    return "link";
+  }
+  return "other";
+}
+
+static int writeJsonRecord(RecordWriter *writer, const FileRecord *record) {
+  const struct stat *info = &record->info;
+  size_t pathLen = record->nameLen;
+  if (record->dirPath != NULL) {
+    pathLen += record->dirPathLen + 1;
+  }
+  size_t maxLen = pathLen * MAX_ESCAPE_LEN + MAX_JSON_FIELDS_LEN;
+  if (maxLen > writer->scratchCapacity) {
+    char *scratch = (char *)realloc(writer->scratch, maxLen);
+    if (scratch == NULL) {
+      return -1;
+    }
+    writer->scratch = scratch;
+    writer->scratchCapacity = maxLen;
+  }
+
+  char *cursor = writer->scratch;
+  cursor = APPEND_LITERAL(cursor, "{\"path\":\"");
+  if (record->dirPath != NULL) {
+    cursor = appendJsonString(cursor, record->dirPath, record->dirPathLen);
+    *cursor++ = '/';
+  }
+  cursor = appendJsonString(cursor, record->name, record->nameLen);
+  cursor = APPEND_LITERAL(cursor, "\",\"type\":\"");
+  const char *type = typeName(info->st_mode);
+  cursor = appendChars(cursor, type, strlen(type));
+  *cursor++ = '"';
+
+  if (record->fields & RECORD_HAS_INODE) {
+    cursor = APPEND_LITERAL(cursor, ",\"ino\":");
+    cursor = appendUnsigned(cursor, info->st_ino);
+  }
+  if (record->fields & RECORD_HAS_DISK) {
+    cursor = APPEND_LITERAL(cursor, ",\"blocks\":");
+    cursor = appendSigned(cursor, info->st_blocks);
+    cursor = APPEND_LITERAL(cursor, ",\"block_size\":");
+    cursor = appendSigned(cursor, info->st_blksize);
+    cursor = APPEND_LITERAL(cursor, ",\"size\":");
+    cursor = appendSigned(cursor, info->st_size);
+  }
+  if (record->fields & RECORD_HAS_PERM) {
+    cursor = APPEND_LITERAL(cursor, ",\"mode\":");
+    cursor = appendUnsigned(cursor, info->st_mode & ~S_IFMT);
+  }
+  if (record->fields & RECORD_HAS_OWNER) {
+    cursor = APPEND_LITERAL(cursor, ",\"uid\":");
+    cursor = appendUnsigned(cursor, info->st_uid);
+    cursor = APPEND_LITERAL(cursor, ",\"gid\":");
+    cursor = appendUnsigned(cursor, info->st_gid);
+  }
+  if (record->fields & RECORD_HAS_TIME) {
+    cursor = APPEND_LITERAL(cursor, ",\"ctime_ns\":");
+    cursor = appendNanoseconds(cursor, &info->st_ctim);
+    cursor = APPEND_LITERAL(cursor, ",\"mtime_ns\":");
+    cursor = appendNanoseconds(cursor, &info->st_mtim);
+    cursor = APPEND_LITERAL(cursor, ",\"atime_ns\":");
+    cursor = appendNanoseconds(cursor, &info->st_atim);
+  }
+  cursor = APPEND_LITERAL(cursor, "}\n");
+
+  struct iovec line = {.iov_base = writer->scratch,
+                       .iov_len = (size_t)(cursor - writer->scratch)};
+  writeOutputLine(writer->output, &line, 1);
+  return 0;
+}
+
+int writeRecord(RecordWriter *writer, const FileRecord *record) {
+  switch (writer->format) {
+  case RECORD_NDJSON:
+    return writeJsonRecord(writer, record);
+  case RECORD_BINARY:
+    return writeBinaryRecord(writer, record);
+  default:
+    return -1;
+  }
+}
@@ -0,0 +1,133 @@
+#ifndef MY_RECORD_H
+#define MY_RECORD_H
+
+#include "my-output.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/**
+ * Holds constants corresponding to the supported output formats.
+ */
+typedef enum _RecordFormat {
+  // The tool's own greppable format (not handled by writeRecord).
+  RECORD_TEXT = 0,
+  // One JSON object per line.
+  RECORD_NDJSON = 1,
+  // Length-prefixed binary records (see BinaryRecord).
+  RECORD_BINARY = 2
+} RecordFormat;
+
+/**
+ * Flags telling which of a record's fields are set (the path and the file
+ * type always are).
+ */
+#define RECORD_HAS_INODE 0x1
+// blocks, block size and size
+#define RECORD_HAS_DISK 0x2
+// permission bits of the mode
+#define RECORD_HAS_PERM 0x4
+// uid and gid
+#define RECORD_HAS_OWNER 0x8
+// change, modification and access times
+#define RECORD_HAS_TIME 0x10
+
+// Written once, at the beginning of a binary stream.
+#define RECORD_STREAM_MAGIC "MYREC\0\0\1"
+#define RECORD_STREAM_MAGIC_LEN 8
+
+// Records of a binary stream are padded to a multiple of this size (so that
+// every header is suitably aligned when the stream is mapped in memory).
+#define RECORD_ALIGNMENT 8
+
+/**
+ * Fixed-size header of a binary record, in host byte order. It is followed by
+ * the path (pathLen bytes), a null terminator and padding up to the next
+ * multiple of RECORD_ALIGNMENT: the next record starts length bytes after
+ * this one. Fields that are not flagged in the fields member are 0.
+ */
+typedef struct _BinaryRecord {
+  // Total length of the record (header, path and padding).
+  uint32_t length;
+  uint32_t pathLen;
+  // RECORD_HAS_* flags.
+  uint32_t fields;
+  // File type bits (S_IFMT), along with the permission bits if flagged.
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint64_t ino;
+  int64_t blocks;
+  int64_t blockSize;
+  int64_t size;
+  int64_t ctimeSec;
+  int64_t mtimeSec;
+  int64_t atimeSec;
+  uint32_t ctimeNsec;
+  uint32_t mtimeNsec;
+  uint32_t atimeNsec;
+  uint32_t reserved;
+} BinaryRecord;
+
+/**
+ * Describes a file to output. The path is given as an optional directory path
+ * and a name (joined with a slash), so that callers do not have to
+ * concatenate them.
+ */
+typedef struct _FileRecord {
+  // NULL if the name is the whole path.
+  const char *dirPath;
+  size_t dirPathLen;
+  const char *name;
+  size_t nameLen;
+  // RECORD_HAS_* flags.
+  uint32_t fields;
+  // The file type is read from info.st_mode, other members are only read if
+  // flagged in fields.
+  struct stat info;
+} FileRecord;
+
+/**
+ * Formats records to an OutputBuffer, each record being appended as one line
+ * (so that records written by different threads never interleave). An
+ * instance must only be used by a single thread.
+ */
+typedef struct _RecordWriter {
+  OutputBuffer *output;
+  RecordFormat format;
+  // Holds escaped paths (NDJSON).
+  char *scratch;
+  size_t scratchCapacity;
+} RecordWriter;
+
+/**
+ * Returns the format corresponding to the given name ("text", "ndjson" or
+ * "binary"), or -1 if the name is unknown.
+ */
+int parseRecordFormat(const char *name);
+
+/**
+ * Initializes a writer appending records of the given format (NDJSON or
+ * binary) to the given buffer.
+ */
+void newRecordWriter(RecordWriter *writer, OutputBuffer *output,
+                     RecordFormat format);
+
+/**
+ * Releases the resources kept as part of the given writer (the output buffer
+ * is not flushed).
+ */
+void destroyRecordWriter(RecordWriter *writer);
+
+/**
+ * Writes what precedes the first record (the magic number of binary streams),
+ * if anything.
+ */
+void writeRecordStreamHeader(RecordWriter *writer);
+
+/**
+ * Formats the given record. Returns 0 on success, -1 on allocation failure.
+ */
+int writeRecord(RecordWriter *writer, const FileRecord *record);
+
+#endif
@@ -0,0 +1,161 @@
+#include "my-stats.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *const COUNTER_NAMES[STAT_COUNTER_COUNT] = {
+    "directories", "entries",        "stat calls",       "match attempts",
+    "matches",     "jobs submitted", "jobs run locally", "jobs stolen",
+    "idle parks",  "output bytes",   "searched bytes"};
+
+static const char *const TIMER_NAMES[STAT_TIMER_COUNT] = {
+    "open", "read", "stat", "match", "output", "lock wait", "idle", "search"};
+
+static uint64_t nowNanos(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+}
+
+void newStatsReport(StatsReport *report, uint32_t workerCount) {
+  report->workers = (WorkerStats *)aligned_alloc(
+      CACHE_LINE_SIZE, workerCount * sizeof(WorkerStats));
+  assertIt(report->workers != NULL, "Could not allocate memory\n");
+  memset(report->workers, 0, workerCount * sizeof(WorkerStats));
+  report->workerCount = workerCount;
+  report->outputLockWaitNanos = 0;
+  report->progressInterval = 0;
+  report->isDone = FALSE;
+  report->startNanos = nowNanos();
+#ifdef WITH_STATS
+  report->startTicks = readStatClock();
+#else
+  report->startTicks = 0;
+#endif
+}
+
+void destroyStatsReport(StatsReport *report) {
+  safefree(report->workers);
+  report->workers = NULL;
+}
+
+/**
+ * Returns the sum of the given counter over all workers.
+ */
+static uint64_t sumCounter(const StatsReport *report, StatCounter counter) {
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < report->workerCount; i++) {
+    sum += atomic_load_explicit(&report->workers[i].counters[counter],
+                                memory_order_relaxed);
+  }
+  return sum;
+}
+
+/**
+ * Returns the number of clock ticks per nanosecond (the time stamp counter's
+ * frequency is not known up front: it is measured over the traversal).
+ */
+static double ticksPerNano(const StatsReport *report, uint64_t elapsedNanos) {
+#ifdef WITH_STATS
+  uint64_t elapsedTicks = readStatClock() - report->startTicks;
+  return elapsedNanos > 0 && elapsedTicks > 0
+             ? (double)elapsedTicks / (double)elapsedNanos
+             : 1;
+#else
+  return 1;
+#endif
+}
+
+static void *runProgress(void *arg) {
+  StatsReport *report = (StatsReport *)arg;
+  pthread_mutex_lock(&report->progressMutex);
+  while (!report->isDone) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += report->progressInterval;
+    while (!report->isDone &&
+           pthread_cond_timedwait(&report->progressCond,
+                                  &report->progressMutex, &deadline) == 0) {
+    }
+    if (report->isDone) {
+      break;
+    }
+    uint64_t elapsedNanos = nowNanos() - report->startNanos;
+    uint64_t entries = sumCounter(report, STAT_ENTRIES);
+    fprintf(stderr,
+            "[%.1f s] %" PRIu64 " directories, %" PRIu64 " entries, %" PRIu64
+            " matches (%.0f entries/s)\n",
+            elapsedNanos / 1e9, sumCounter(report, STAT_DIRS), entries,
+            sumCounter(report, STAT_MATCHES),
+            elapsedNanos > 0 ? entries / (elapsedNanos / 1e9) : 0);
+  }
+  pthread_mutex_unlock(&report->progressMutex);
+  return NULL;
+}
+
+void startStatsProgress(StatsReport *report, uint32_t interval) {
+  report->progressInterval = interval;
+  assertIt(pthread_mutex_init(&report->progressMutex, NULL) == 0 &&
+               pthread_cond_init(&report->progressCond, NULL) == 0,
+           "Could not initialize progress report\n");
+  int status =
+      pthread_create(&report->progressThread, NULL, runProgress, report);
+  assertIt(status == 0, "Error creating thread (status: %d)\n", status);
+}
+
+void stopStatsProgress(StatsReport *report) {
+  if (report->progressInterval == 0) {
+    return;
+  }
+  pthread_mutex_lock(&report->progressMutex);
+  report->isDone = TRUE;
+  pthread_cond_signal(&report->progressCond);
+  pthread_mutex_unlock(&report->progressMutex);
+  pthread_join(report->progressThread, NULL);
+  pthread_cond_destroy(&report->progressCond);
+  pthread_mutex_destroy(&report->progressMutex);
+  report->progressInterval = 0;
+}
+
+void printStatsReport(const StatsReport *report) {
+  uint64_t elapsedNanos = nowNanos() - report->startNanos;
+  double seconds = elapsedNanos / 1e9;
+  double ticksToMillis = 1 / (ticksPerNano(report, elapsedNanos) * 1e6);
+
+  fprintf(stderr, "Statistics (%u workers, %.3f s):\n", report->workerCount,
+          seconds);
+  for (uint32_t i = 0; i < STAT_COUNTER_COUNT; i++) {
+    uint64_t sum = sumCounter(report, (StatCounter)i);
+    fprintf(stderr, "  %-18s %14" PRIu64 "  (%.0f/s)\n", COUNTER_NAMES[i], sum,
+            seconds > 0 ? sum / seconds : 0);
+  }
+  fprintf(stderr, "Time spent, summed over workers (ms):\n");
+  for (uint32_t i = 0; i < STAT_TIMER_COUNT; i++) {
+    uint64_t ticks = 0;
+    for (uint32_t j = 0; j < report->workerCount; j++) {
+      ticks += atomic_load_explicit(&report->workers[j].ticks[i],
+                                    memory_order_relaxed);
+    }
+    double millis = ticks * ticksToMillis;
+    if (i == TIMER_LOCK_WAIT) {
+      millis += report->outputLockWaitNanos / 1e6;
+    }
+    fprintf(stderr, "  %-18s %14.1f\n", TIMER_NAMES[i], millis);
+  }
+  fprintf(stderr, "Per worker (directories, entries, jobs stolen, idle ms):\n");
+  for (uint32_t i = 0; i < report->workerCount; i++) {
+    const WorkerStats *stats = &report->workers[i];
+    fprintf(
+        stderr, "  #%-4u %14" PRIu64 " %14" PRIu64 " %10" PRIu64 " %10.1f\n",
+        i,
+        atomic_load_explicit(&stats->counters[STAT_DIRS], memory_order_relaxed),
+        atomic_load_explicit(&stats->counters[STAT_ENTRIES],
+                             memory_order_relaxed),
+        atomic_load_explicit(&stats->counters[STAT_JOBS_STOLEN],
+                             memory_order_relaxed),
+        atomic_load_explicit(&stats->ticks[TIMER_IDLE], memory_order_relaxed) *
+            ticksToMillis);
+  }
+}
@@ -0,0 +1,185 @@
+#ifndef MY_STATS_H
+#define MY_STATS_H
+
+#include "my-pool.h"
+#include "my-util.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * Instrumentation of the traversal, compiled in only if WITH_STATS is defined
+ * (see the Makefile's STATS variable): otherwise, the functions below are
+ * macros expanding to nothing, and instrumented code costs nothing.
+ */
+
+/**
+ * Holds constants corresponding to the events counted by each worker.
+ */
+typedef enum _StatCounter {
+  STAT_DIRS = 0,
+  STAT_ENTRIES = 1,
+  // stat/statx calls (directories, entries of unknown type, expressions and
+  // du mode)
+  STAT_STAT_CALLS = 2,
+  STAT_MATCH_ATTEMPTS = 3,
+  STAT_MATCHES = 4,
+  STAT_JOBS_SUBMITTED = 5,
+  // Jobs run by the worker which submitted them, and jobs stolen from other
+  // workers.
+  STAT_JOBS_LOCAL = 6,
+  STAT_JOBS_STOLEN = 7,
+  // Times the worker parked because no job could be found.
+  STAT_PARKS = 8,
+  STAT_OUTPUT_BYTES = 9,
+  // File contents read or mapped (content search mode).
+  STAT_SEARCHED_BYTES = 10,
+  STAT_COUNTER_COUNT = 11
+} StatCounter;
+
+/**
+ * Holds constants corresponding to the phases timed by each worker.
+ */
+typedef enum _StatTimer {
+  TIMER_OPEN = 0,
+  TIMER_READ = 1,
+  TIMER_STAT = 2,
+  // Matching against the patterns and the expression (statx calls issued by
+  // the latter included).
+  TIMER_MATCH = 3,
+  TIMER_OUTPUT = 4,
+  // Waiting for a mutex held by another thread (pool and output sink).
+  TIMER_LOCK_WAIT = 5,
+  // Parked, waiting for jobs.
+  TIMER_IDLE = 6,
+  // Opening, reading and searching files (content search mode).
+  TIMER_SEARCH = 7,
+  STAT_TIMER_COUNT = 8
+} StatTimer;
+
+/**
+ * Counters and timers of a worker. They are only written by their worker
+ * (with plain relaxed loads and stores, no atomic read-modify-write), and
+ * may be read by any thread (to report progress).
+ */
+typedef struct _WorkerStats {
+  _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t counters[STAT_COUNTER_COUNT];
+  // In clock ticks (see readStatClock).
+  _Atomic uint64_t ticks[STAT_TIMER_COUNT];
+} WorkerStats;
+
+/**
+ * Statistics of a traversal: those of its workers, and what is needed to
+ * report them (every interval seconds, if a progress line was requested).
+ */
+typedef struct _StatsReport {
+  WorkerStats *workers;
+  uint32_t workerCount;
+  // Start of the traversal (monotonic clock, and ticks).
+  uint64_t startNanos;
+  uint64_t startTicks;
+  // Time spent waiting for the output sink's mutex (not measured in ticks,
+  // see OutputBuffer::lockWaitNanos).
+  uint64_t outputLockWaitNanos;
+  uint32_t progressInterval;
+  pthread_t progressThread;
+  pthread_mutex_t progressMutex;
+  pthread_cond_t progressCond;
+  bool isDone;
+} StatsReport;
+
+#ifdef WITH_STATS
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/**
+ * Returns the current value of the clock timers are measured with: the time
+ * stamp counter where available (a few cycles to read), the monotonic clock
+ * (in nanoseconds) otherwise.
+ */
+static inline uint64_t readStatClock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000ULL + (uint64_t)time.tv_nsec;
+#endif
+}
+
+static inline void addStat(WorkerStats *stats, StatCounter counter,
+                           uint64_t value) {
+  if (stats != NULL) {
+    atomic_store_explicit(
+        &stats->counters[counter],
+        atomic_load_explicit(&stats->counters[counter], memory_order_relaxed) +
+            value,
+        memory_order_relaxed);
+  }
+}
+
+static inline uint64_t startStatTimer(void) { return readStatClock(); }
+
+/**
+ * Adds the time elapsed since the given start (see startStatTimer) to the
+ * given timer.
+ */
+static inline void endStatTimer(WorkerStats *stats, StatTimer timer,
+                                uint64_t start) {
+  if (stats != NULL) {
+    uint64_t ticks = readStatClock() - start;
+    atomic_store_explicit(
+        &stats->ticks[timer],
+        atomic_load_explicit(&stats->ticks[timer], memory_order_relaxed) +
+            ticks,
+        memory_order_relaxed);
+  }
+}
+
+/**
+ * Locks the given mutex, timing the wait if it is held by another thread (an
+ * uncontended lock costs the same as pthread_mutex_lock).
+ */
+static inline void lockStatMutex(WorkerStats *stats, pthread_mutex_t *mutex) {
+  if (pthread_mutex_trylock(mutex) != 0) {
+    uint64_t start = readStatClock();
+    pthread_mutex_lock(mutex);
+    endStatTimer(stats, TIMER_LOCK_WAIT, start);
+  }
+}
+
+#else
+
+#define addStat(stats, counter, value) ((void)0)
+#define startStatTimer() ((uint64_t)0)
+#define endStatTimer(stats, timer, start) ((void)(start))
+#define lockStatMutex(stats, mutex) pthread_mutex_lock(mutex)
+
+#endif
+
+/**
+ * Initializes a report for the given number of workers, starting its clock.
+ */
+void newStatsReport(StatsReport *report, uint32_t workerCount);
+
+void destroyStatsReport(StatsReport *report);
+
+/**
+ * Starts a thread writing a progress line to stderr every given number of
+ * seconds, until stopStatsProgress is called.
+ */
+void startStatsProgress(StatsReport *report, uint32_t interval);
+
+void stopStatsProgress(StatsReport *report);
+
+/**
+ * Writes the summary of the statistics (all workers merged, then a line per
+ * worker) to stderr.
+ */
+void printStatsReport(const StatsReport *report);
+
+#endif
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+
+#include "my-uring.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+static int ioUringSetup(unsigned entries, struct io_uring_params *params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                        unsigned flags) {
+  return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags,
+                      NULL, 0);
+}
+
+static int ioUringRegister(int fd, unsigned opcode, void *arg,
+                           unsigned argCount) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, argCount);
+}
+
+// The head/tail indexes of the rings are shared with the kernel: they must be
+// accessed with acquire/release semantics.
+static unsigned loadAcquire(unsigned *ptr) {
+  return atomic_load_explicit((_Atomic unsigned *)ptr, memory_order_acquire);
+}
+
+static void storeRelease(unsigned *ptr, unsigned value) {
+  atomic_store_explicit((_Atomic unsigned *)ptr, value, memory_order_release);
+}
+
+/**
+ * Checks, through the probe interface, that the kernel supports the statx
+ * operation (io_uring itself predates it).
+ */
+static int supportsStatx(int fd) {
+  size_t probeSize =
+      sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probeSize);
+  if (probe == NULL) {
+    return 0;
+  }
+  int supported = 0;
+  if (ioUringRegister(fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+      probe->last_op >= IORING_OP_STATX) {
+    supported =
+        (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED) != 0;
+  }
+  free(probe);
+  return supported;
+}
+
+int newStatxRing(StatxRing *ring, unsigned queueDepth) {
+  memset(ring, 0, sizeof(StatxRing));
+  ring->fd = -1;
+  if (queueDepth == 0 || queueDepth > MAX_STATX_QUEUE_DEPTH) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring->fd = ioUringSetup(queueDepth, &params);
+  if (ring->fd < 0) {
+    return -1;
+  }
+  if (!supportsStatx(ring->fd)) {
+    goto Failure;
+  }
+  // The kernel rounds the number of entries up to a power of 2: sticking to
+  // the requested depth nonetheless.
+  ring->queueDepth = queueDepth;
+
+  ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cqRingSize =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cqRingSize > ring->sqRingSize) {
+      ring->sqRingSize = ring->cqRingSize;
+    }
+    ring->cqRingSize = 0;
+  }
+
+  ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqRing == MAP_FAILED) {
+    ring->sqRing = NULL;
+    goto Failure;
+  }
+  if (ring->cqRingSize == 0) {
+    ring->cqRing = ring->sqRing;
+  } else {
+    ring->cqRing =
+        mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqRing == MAP_FAILED) {
+      ring->cqRing = NULL;
+      goto Failure;
+    }
+  }
+
+  ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = (struct io_uring_sqe *)mmap(
+      NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    goto Failure;
+  }
+
+  char *sq = (char *)ring->sqRing;
+  ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+  ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+
+  char *cq = (char *)ring->cqRing;
+  ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+  ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+  return 0;
+
+Failure:
+  destroyStatxRing(ring);
+  return -1;
+}
+
+void destroyStatxRing(StatxRing *ring) {
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqesSize);
+  }
+  if (ring->cqRing != NULL && ring->cqRing != ring->sqRing) {
+    munmap(ring->cqRing, ring->cqRingSize);
+  }
+  if (ring->sqRing != NULL) {
+    munmap(ring->sqRing, ring->sqRingSize);
+  }
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+  memset(ring, 0, sizeof(StatxRing));
+  ring->fd = -1;
+}
+
+int queueStatx(StatxRing *ring, int dirFd, const char *name, int flags,
+               unsigned mask, struct statx *buffer, uint64_t userData) {
+  if (ring->toSubmit + ring->inFlight >= ring->queueDepth) {
+    return -1;
+  }
+  unsigned tail = *ring->sqTail;
+  unsigned index = tail & *ring->sqMask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = IORING_OP_STATX;
+  sqe->fd = dirFd;
+  sqe->addr = (uint64_t)(uintptr_t)name;
+  sqe->len = mask;
+  sqe->off = (uint64_t)(uintptr_t)buffer;
+  sqe->statx_flags = (uint32_t)flags;
+  sqe->user_data = userData;
+  ring->sqArray[index] = index;
+  storeRelease(ring->sqTail, tail + 1);
+  ring->toSubmit++;
+  return 0;
+}
+
+int submitStatx(StatxRing *ring, unsigned minComplete) {
+  if (minComplete > ring->toSubmit + ring->inFlight) {
+    minComplete = ring->toSubmit + ring->inFlight;
+  }
+  while (ring->toSubmit > 0 || minComplete > 0) {
+    int submitted = ioUringEnter(ring->fd, ring->toSubmit, minComplete,
+                                 minComplete > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if (submitted < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    ring->toSubmit -= (unsigned)submitted;
+    ring->inFlight += (unsigned)submitted;
+    if (ring->toSubmit == 0) {
+      break;
+    }
+  }
+  return 0;
+}
+
+int reapStatx(StatxRing *ring, uint64_t *userData, int *result) {
+  unsigned head = *ring->cqHead;
+  if (head == loadAcquire(ring->cqTail)) {
+    return 0;
+  }
+  struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+  *userData = cqe->user_data;
+  *result = cqe->res;
+  storeRelease(ring->cqHead, head + 1);
+  ring->inFlight--;
+  return 1;
+}
+
+void statxToStat(const struct statx *source, struct stat *target) {
+  memset(target, 0, sizeof(struct stat));
+  target->st_dev = makedev(source->stx_dev_major, source->stx_dev_minor);
+  target->st_ino = source->stx_ino;
+  target->st_mode = source->stx_mode;
+  target->st_nlink = source->stx_nlink;
+  target->st_uid = source->stx_uid;
+  target->st_gid = source->stx_gid;
+  target->st_rdev = makedev(source->stx_rdev_major, source->stx_rdev_minor);
+  target->st_size = (off_t)source->stx_size;
+  target->st_blksize = source->stx_blksize;
+  target->st_blocks = (blkcnt_t)source->stx_blocks;
+  target->st_atim.tv_sec = source->stx_atime.tv_sec;
+  target->st_atim.tv_nsec = source->stx_atime.tv_nsec;
+  target->st_mtim.tv_sec = source->stx_mtime.tv_sec;
+  target->st_mtim.tv_nsec = source->stx_mtime.tv_nsec;
+  target->st_ctim.tv_sec = source->stx_ctime.tv_sec;
+  target->st_ctim.tv_nsec = source->stx_ctime.tv_nsec;
+}
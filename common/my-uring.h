@@ -0,0 +1,93 @@
+#ifndef MY_URING_H
+#define MY_URING_H
+
+// Note: struct statx is only declared by glibc if _GNU_SOURCE is defined
+// before any system header is included.
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+// Upper bound on the queue depth of a StatxRing.
+#define MAX_STATX_QUEUE_DEPTH 4096
+
+/**
+ * Minimal io_uring instance dedicated to asynchronous statx calls. It talks to
+ * the kernel directly through the io_uring_setup/io_uring_enter system calls
+ * (liburing is not required).
+ *
+ * Typical usage: queue up to <queue depth> requests with queueStatx, call
+ * submitStatx (which waits for at least the given number of completions),
+ * then consume the completions with reapStatx.
+ */
+typedef struct _StatxRing {
+  int fd;
+  unsigned queueDepth;
+  // Number of requests queued but not yet passed to the kernel.
+  unsigned toSubmit;
+  // Number of requests passed to the kernel whose completion has not been
+  // reaped yet.
+  unsigned inFlight;
+
+  // Submission queue (shared with the kernel).
+  void *sqRing;
+  size_t sqRingSize;
+  unsigned *sqHead;
+  unsigned *sqTail;
+  unsigned *sqMask;
+  unsigned *sqArray;
+  struct io_uring_sqe *sqes;
+  size_t sqesSize;
+
+  // Completion queue (shared with the kernel - possibly mapped along with the
+  // submission queue).
+  void *cqRing;
+  size_t cqRingSize;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned *cqMask;
+  struct io_uring_cqe *cqes;
+} StatxRing;
+
+/**
+ * Initializes a ring that can hold up to queueDepth requests. Returns 0 on
+ * success, and -1 if io_uring (or its statx operation) is not available on
+ * the running kernel, in which case callers are expected to fall back to
+ * synchronous calls.
+ */
+int newStatxRing(StatxRing *ring, unsigned queueDepth);
+
+/**
+ * Releases the resources kept as part of the given ring.
+ */
+void destroyStatxRing(StatxRing *ring);
+
+/**
+ * Queues a statx call for the given name, relative to dirFd (flags and mask
+ * are those of statx(2)). The name and the buffer must remain valid until the
+ * request's completion is reaped. Returns 0 on success, -1 if the ring is
+ * full.
+ */
+int queueStatx(StatxRing *ring, int dirFd, const char *name, int flags,
+               unsigned mask, struct statx *buffer, uint64_t userData);
+
+/**
+ * Passes the queued requests to the kernel, waiting until at least
+ * minComplete completions are available. Returns 0 on success, -1 on error
+ * (errno is set).
+ */
+int submitStatx(StatxRing *ring, unsigned minComplete);
+
+/**
+ * Fetches the next available completion, if any: sets the user data given to
+ * queueStatx and the result of the call (0 on success, -errno on failure).
+ * Returns 1 if a completion was fetched, 0 otherwise.
+ */
+int reapStatx(StatxRing *ring, uint64_t *userData, int *result);
+
+/**
+ * Converts the result of a statx call to a struct stat.
+ */
+void statxToStat(const struct statx *source, struct stat *target);
+
+#endif
@@ -0,0 +1,41 @@
+#include "my-util.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void logIt(LogLevel systemLevel, LogLevel currentLevel, char *format, ...) {
+  if (currentLevel >= systemLevel) {
+    va_list args;
+    va_start(args, format);
+    if (currentLevel == NORMAL) {
+      vfprintf(stdout, format, args);
+    } else {
+      // Errors and diagnostics (trace/verbose) are sent to stderr, so that
+      // they are not mixed with (and do not slow down) the program's output.
+      vfprintf(stderr, format, args);
+    }
+    va_end(args);
+  }
+}
+
+void assertIt(bool condition, char *format, ...) {
+  if (!condition) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    exit(EXIT_FAILURE);
+  }
+}
+
+void *safemalloc(size_t size) {
+  void *ptr = malloc(size);
+  assertIt(ptr != NULL, "Could not allocate memory\n");
+  return ptr;
+}
+
+void safefree(void *ptr) {
+  if (ptr != NULL) {
+    free(ptr);
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef MY_UTIL_H
+#define MY_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Boolean values
+#define TRUE 1
+#define FALSE 0
+typedef uint8_t bool;
+
+/**
+ *  Holds constants corresponding to the different log levels.
+ */
+typedef enum _LogLevel {
+  TRACE = 0,
+  VERBOSE = 1,
+  NORMAL = 2,
+  ERROR = 3,
+  OFF = 4
+
+} LogLevel;
+
+/**
+ * Logging function: outputs  only if the current level is >= than the system's
+ * configured level. Only the NORMAL level goes to stdout, other levels go to
+ * stderr.
+ */
+void logIt(LogLevel systemLevel, LogLevel currentLevel, char *format, ...);
+
+/**
+ * Assertion utility.
+ */
+void assertIt(bool condition, char *format, ...);
+
+/**
+ * Wraps malloc() to check for allocation failure (asserts if that's the case).
+ */
+void *safemalloc(size_t size);
+
+/**
+ *  Wrap free() to check that the pointer to free isn't null.
+ */
+void safefree(void *ptr);
+
+#endif
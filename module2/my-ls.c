@@ -5,14 +5,30 @@
  *
  * my-ls -a | sort | grep "type: file"
  *
+ * With -R, sub-directories are listed recursively by a pool of threads (see
+ * my-pool.h, also used by module4/my-find), each one buffering its own output
+ * (the lines of different directories may therefore be interleaved). With -S, the output of each directory
+ * is kept in memory instead, in sorted order, and the whole tree is written
+ * once listed (a directory, then each of its sub-directories in turn).
+ *
  */
 
 // Macro required to be able to use the constants corresponding to the
-// different values that dirent.d_type can take: DT_REG, DT_DIR, etc.
-#define _DEFAULT_SOURCE
+// different values that dirent.d_type can take: DT_REG, DT_DIR, etc. (and
+// struct statx, used in asynchronous metadata mode).
+#define _GNU_SOURCE
 
 #include "dirent.h"
 #include "errno.h"
+#include "fcntl.h"
+#include "my-arena.h"
+#include "my-dirscan.h"
+#include "my-output.h"
+#include "my-path.h"
+#include "my-pool.h"
+#include "my-record.h"
+#include "my-uring.h"
+#include "stdatomic.h"
 #include "stdint.h"
 #include "stdio.h"
 #include "stdlib.h"
@@ -40,12 +56,189 @@ typedef uint8_t bool;
 #define TIME_STR_LEN 50
 typedef char TIME_STR[TIME_STR_LEN];
 
-// Formats time
-void formatTime(time_t timestamp, TIME_STR buffer)
+#define SECONDS_PER_DAY 86400
+
+// Number of days whose date is kept by a TimeCache (a single entry
+// typically involves up to 3 distinct days)
+#define TIME_CACHE_SIZE 4
+
+// Holds the formatted date of a day (local time), which the timestamps
+// falling within that day share
+typedef struct _CachedDay
+{
+    // bounds of the day, in seconds since the epoch (end excluded)
+    time_t start;
+    time_t end;
+    // the formatted date ("%Y-%m-%dT")
+    char date[TIME_STR_LEN];
+    size_t date_len;
+} CachedDay;
+
+// Caches the dates of the last days seen, so that localtime_r and
+// strftime are only called once per distinct day rather than once per
+// timestamp
+typedef struct _TimeCache
+{
+    CachedDay days[TIME_CACHE_SIZE];
+    // index of the next entry to replace
+    uint32_t next;
+} TimeCache;
+
+// initializes an empty time cache
+void newTimeCache(TimeCache *cache)
+{
+    for (uint32_t i = 0; i < TIME_CACHE_SIZE; i++)
+    {
+        cache->days[i].start = 0;
+        cache->days[i].end = 0;
+    }
+    cache->next = 0;
+}
+
+// Caches the date of the day the given timestamp falls within. The day is
+// only cached if the UTC offset is the same throughout it (i.e. it is not
+// a daylight saving time transition day): the time of day of any timestamp
+// within it can then be derived from the number of seconds since its start.
+// Returns the cached day, or NULL if the day cannot be cached.
+const CachedDay *cacheDay(TimeCache *cache, time_t timestamp, const struct tm *tm_info)
 {
-    struct tm tm_info;
-    localtime_r(&timestamp, &tm_info);
-    strftime(buffer, TIME_STR_LEN, "%Y-%m-%dT%H.%M.%S", &tm_info);
+    time_t start = timestamp - (tm_info->tm_hour * 3600 + tm_info->tm_min * 60 + tm_info->tm_sec);
+    time_t last = start + SECONDS_PER_DAY - 1;
+    struct tm start_info;
+    struct tm last_info;
+    localtime_r(&start, &start_info);
+    localtime_r(&last, &last_info);
+    if (start_info.tm_gmtoff != tm_info->tm_gmtoff || last_info.tm_gmtoff != tm_info->tm_gmtoff)
+    {
+        return NULL;
+    }
+
+    CachedDay *day = &cache->days[cache->next];
+    cache->next = (cache->next + 1) % TIME_CACHE_SIZE;
+    day->start = start;
+    day->end = start + SECONDS_PER_DAY;
+    day->date_len = strftime(day->date, TIME_STR_LEN, "%Y-%m-%dT", tm_info);
+    return day;
+}
+
+// appends the given value (0 to 99) as 2 digits
+char *formatTwoDigits(char *buffer, unsigned value)
+{
+    buffer[0] = (char)('0' + value / 10);
+    buffer[1] = (char)('0' + value % 10);
+    return buffer + 2;
+}
+
+// Formats time ("%Y-%m-%dT%H.%M.%S", local time) and returns the length of
+// the formatted string (which is not null-terminated)
+size_t formatTime(TimeCache *cache, time_t timestamp, TIME_STR buffer)
+{
+    const CachedDay *day = NULL;
+    for (uint32_t i = 0; i < TIME_CACHE_SIZE; i++)
+    {
+        if (timestamp >= cache->days[i].start && timestamp < cache->days[i].end)
+        {
+            day = &cache->days[i];
+            break;
+        }
+    }
+
+    if (day == NULL)
+    {
+        struct tm tm_info;
+        localtime_r(&timestamp, &tm_info);
+        day = cacheDay(cache, timestamp, &tm_info);
+        if (day == NULL)
+        {
+            return strftime(buffer, TIME_STR_LEN, "%Y-%m-%dT%H.%M.%S", &tm_info);
+        }
+    }
+
+    unsigned seconds = (unsigned)(timestamp - day->start);
+    memcpy(buffer, day->date, day->date_len);
+    char *cursor = buffer + day->date_len;
+    cursor = formatTwoDigits(cursor, seconds / 3600);
+    *cursor++ = '.';
+    cursor = formatTwoDigits(cursor, seconds / 60 % 60);
+    *cursor++ = '.';
+    cursor = formatTwoDigits(cursor, seconds % 60);
+    return (size_t)(cursor - buffer);
+}
+
+// Maximum length of the metadata part of an output line (the path aside)
+#define LINE_META_LEN 512
+
+// Holds the metadata part of an output line, as it is being built
+typedef struct _LineBuffer
+{
+    char data[LINE_META_LEN];
+    size_t length;
+} LineBuffer;
+
+void appendChars(LineBuffer *line, const char *chars, size_t count)
+{
+    memcpy(line->data + line->length, chars, count);
+    line->length += count;
+}
+
+// appends a string literal (whose length is known at compile time)
+#define APPEND_LITERAL(line, literal) appendChars((line), (literal), sizeof(literal) - 1)
+
+void appendUnsigned(LineBuffer *line, uint64_t value)
+{
+    char digits[20];
+    size_t count = 0;
+    do
+    {
+        digits[sizeof(digits) - 1 - count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    appendChars(line, digits + sizeof(digits) - count, count);
+}
+
+// appends the rwx flags corresponding to the given permission bits
+void appendPermissions(LineBuffer *line, mode_t mode, mode_t readBit, mode_t writeBit, mode_t execBit)
+{
+    line->data[line->length++] = (mode & readBit) ? 'r' : '-';
+    line->data[line->length++] = (mode & writeBit) ? 'w' : '-';
+    line->data[line->length++] = (mode & execBit) ? 'x' : '-';
+}
+
+void appendTime(LineBuffer *line, TimeCache *cache, time_t timestamp)
+{
+    line->length += formatTime(cache, timestamp, line->data + line->length);
+}
+
+// Holds the state of the output: lines (or records) are built in memory
+// and written to stdout in large chunks
+typedef struct _Formatter
+{
+    OutputBuffer output;
+    TimeCache time_cache;
+    // formats entries in the machine-readable formats (NDJSON, binary)
+    RecordWriter records;
+} Formatter;
+
+// initializes a formatter writing to the given sink in the given format
+// (returns 0 on success). If the sink is NULL, the output is kept in
+// memory instead (see newOutputBuffer).
+int newFormatter(Formatter *formatter, OutputSink *sink, RecordFormat format)
+{
+    if (newOutputBuffer(&formatter->output, sink, OUTPUT_BUFFER_SIZE) != 0)
+    {
+        return -1;
+    }
+    newTimeCache(&formatter->time_cache);
+    newRecordWriter(&formatter->records, &formatter->output, format);
+    return 0;
+}
+
+// flushes the pending output and releases the formatter's resources (the
+// sink is left open)
+void destroyFormatter(Formatter *formatter)
+{
+    destroyRecordWriter(&formatter->records);
+    destroyOutputBuffer(&formatter->output);
 }
 
 // Identifies supported file types
@@ -77,6 +270,10 @@ FileType getFileType(mode_t mode)
     return fileType;
 }
 
+// Number of threads listing sub-directories in addition to the main thread,
+// if not specified (-w)
+#define DEFAULT_THREAD_COUNT 3
+
 // Holds user-defined settings
 // (populated from command-line options)
 typedef struct _Settings
@@ -85,9 +282,34 @@ typedef struct _Settings
     bool with_owner_info;
     bool with_perm_info;
     bool with_time_info;
+    // Queue depth of the io_uring instance used to fetch metadata
+    // asynchronously (0 if metadata is fetched synchronously)
+    uint32_t queue_depth;
+    // In asynchronous mode, indicates whether entries should be output
+    // in readdir order (rather than in completion order)
+    bool with_readdir_order;
+    // Format in which entries are output
+    RecordFormat output_format;
+    // Indicates whether sub-directories are listed (recursively)
+    bool is_recursive;
+    // Number of threads listing sub-directories in addition to the main
+    // thread (recursive mode)
+    uint32_t thread_count;
+    // In recursive mode, indicates whether the entries of each directory
+    // and the directories themselves should be output in sorted order
+    // (rather than as they are listed)
+    bool with_sorted_order;
 
 } Settings;
 
+// Indicates whether the given settings require file metadata beyond
+// the file type (in which case a stat call is needed for each entry)
+bool needsFileMeta(const Settings *settings)
+{
+    return settings->with_disk_info || settings->with_owner_info || settings->with_perm_info ||
+           settings->with_time_info;
+}
+
 // initializes settings with defaults
 void newSettings(Settings *settings)
 {
@@ -95,136 +317,907 @@ void newSettings(Settings *settings)
     settings->with_owner_info = FALSE;
     settings->with_perm_info = FALSE;
     settings->with_time_info = FALSE;
+    settings->queue_depth = 0;
+    settings->with_readdir_order = FALSE;
+    settings->output_format = RECORD_TEXT;
+    settings->is_recursive = FALSE;
+    settings->thread_count = DEFAULT_THREAD_COUNT;
+    settings->with_sorted_order = FALSE;
 }
 
 void help(const char *programName)
 {
-    printf("%s [-adopt] [<path>]\n", programName);
+    printf("%s [-adopt] [-q <queue depth> [-s]] [-f <format>] [-R [-S] [-w <threads>]] [<path>]\n", programName);
     printf("  -a: all info (equivalent to -dopt)\n");
     printf("  -d: disk info\n");
     printf("  -o: owner info\n");
     printf("  -p: permission info\n");
     printf("  -t: time info\n");
+    printf("  -q: fetches metadata asynchronously (io_uring), with the given\n");
+    printf("      number of statx calls in flight (falls back to synchronous\n");
+    printf("      calls if io_uring is not supported); entries are output in\n");
+    printf("      completion order\n");
+    printf("  -s: with -q, outputs entries in readdir order\n");
+    printf("  -f: output format: text (default), ndjson (one JSON object per\n");
+    printf("      entry) or binary (length-prefixed records, see my-record.h)\n");
+    printf("  -R: lists sub-directories recursively, through a pool of threads\n");
+    printf("      (entries are output as they are listed, the lines of\n");
+    printf("      different directories being interleaved)\n");
+    printf("  -S: with -R, outputs the entries of each directory sorted by\n");
+    printf("      name, followed by its sub-directories (in the same order);\n");
+    printf("      the output is written once the whole tree is listed, and\n");
+    printf("      -q is ignored\n");
+    printf("  -w: with -R, number of threads in addition to the main one\n");
+    printf("      (defaults to %u)\n", DEFAULT_THREAD_COUNT);
 }
 
 // ============================================================================
 // Core functionality
 
-uint8_t processFile(FileType fileType, const Settings *settings, const char *path, const struct stat *fileInfo)
+// Outputs the given file's info as a record (NDJSON or binary format):
+// the fields within the record are those the settings require
+uint8_t processFileRecord(FileType fileType, const Settings *settings, Formatter *formatter, const char *dirPath,
+                          const char *path, const struct stat *fileInfo)
 {
-    char typeName[NAME_MAX];
+    FileRecord record;
+    record.dirPath = dirPath;
+    record.dirPathLen = dirPath != NULL ? strlen(dirPath) : 0;
+    record.name = path;
+    record.nameLen = strlen(path);
+    record.fields = 0;
+    if (needsFileMeta(settings))
+    {
+        record.info = *fileInfo;
+    }
+    else
+    {
+        memset(&record.info, 0, sizeof(struct stat));
+    }
+
     switch (fileType)
     {
     case TYPE_FILE:
-        strcpy(typeName, "file");
+        record.info.st_mode = (record.info.st_mode & ~S_IFMT) | S_IFREG;
         break;
     case TYPE_LINK:
-        strcpy(typeName, "link");
+        record.info.st_mode = (record.info.st_mode & ~S_IFMT) | S_IFLNK;
         break;
     case TYPE_DIR:
-        strcpy(typeName, "dir");
+        record.info.st_mode = (record.info.st_mode & ~S_IFMT) | S_IFDIR;
         break;
     default:
         fprintf(stderr, "Invalid file type: %s", path);
         return EC_INVALID_FILE_TYPE;
     }
 
-    printf("name: %s, type: %s", path, typeName);
+    if (settings->with_owner_info)
+    {
+        record.fields |= RECORD_HAS_OWNER;
+    }
+    if (settings->with_disk_info)
+    {
+        record.fields |= RECORD_HAS_INODE | RECORD_HAS_DISK;
+    }
+    if (settings->with_perm_info)
+    {
+        record.fields |= RECORD_HAS_PERM;
+    }
+    if (settings->with_time_info)
+    {
+        record.fields |= RECORD_HAS_TIME;
+    }
+
+    if (writeRecord(&formatter->records, &record) != 0)
+    {
+        fprintf(stderr, "Could not allocate memory\n");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Outputs the given file's info. The file's path is given as a directory
+// path (which can be NULL) and a name, so that entries of a directory can
+// be processed without concatenating their full path. The fileInfo argument
+// is only accessed if the settings require metadata (see needsFileMeta).
+// The line is built in memory and appended to the formatter's output.
+uint8_t processFile(FileType fileType, const Settings *settings, Formatter *formatter, const char *dirPath,
+                    const char *path, const struct stat *fileInfo)
+{
+    if (settings->output_format != RECORD_TEXT)
+    {
+        return processFileRecord(fileType, settings, formatter, dirPath, path, fileInfo);
+    }
+
+    LineBuffer meta;
+    meta.length = 0;
+    switch (fileType)
+    {
+    case TYPE_FILE:
+        APPEND_LITERAL(&meta, ", type: file");
+        break;
+    case TYPE_LINK:
+        APPEND_LITERAL(&meta, ", type: link");
+        break;
+    case TYPE_DIR:
+        APPEND_LITERAL(&meta, ", type: dir");
+        break;
+    default:
+        fprintf(stderr, "Invalid file type: %s", path);
+        return EC_INVALID_FILE_TYPE;
+    }
 
     if (settings->with_owner_info)
     {
-        printf(", uid: %u, gid: %u", fileInfo->st_uid, fileInfo->st_gid);
+        APPEND_LITERAL(&meta, ", uid: ");
+        appendUnsigned(&meta, fileInfo->st_uid);
+        APPEND_LITERAL(&meta, ", gid: ");
+        appendUnsigned(&meta, fileInfo->st_gid);
     }
 
     if (settings->with_disk_info)
     {
-        printf(", inode: %lu, blocks: %zu, block_size: %zu, size: %zu", fileInfo->st_ino, fileInfo->st_blocks,
-               fileInfo->st_blksize, fileInfo->st_size);
+        APPEND_LITERAL(&meta, ", inode: ");
+        appendUnsigned(&meta, fileInfo->st_ino);
+        APPEND_LITERAL(&meta, ", blocks: ");
+        appendUnsigned(&meta, (uint64_t)fileInfo->st_blocks);
+        APPEND_LITERAL(&meta, ", block_size: ");
+        appendUnsigned(&meta, (uint64_t)fileInfo->st_blksize);
+        APPEND_LITERAL(&meta, ", size: ");
+        appendUnsigned(&meta, (uint64_t)fileInfo->st_size);
     }
 
     if (settings->with_perm_info)
     {
-        printf(", u: ");
-        printf((fileInfo->st_mode & S_IRUSR) ? "r" : "-");
-        printf((fileInfo->st_mode & S_IWUSR) ? "w" : "-");
-        printf((fileInfo->st_mode & S_IXUSR) ? "x" : "-");
+        APPEND_LITERAL(&meta, ", u: ");
+        appendPermissions(&meta, fileInfo->st_mode, S_IRUSR, S_IWUSR, S_IXUSR);
+        APPEND_LITERAL(&meta, ", g: ");
+        appendPermissions(&meta, fileInfo->st_mode, S_IRGRP, S_IWGRP, S_IXGRP);
+        APPEND_LITERAL(&meta, ", o: ");
+        appendPermissions(&meta, fileInfo->st_mode, S_IROTH, S_IWOTH, S_IXOTH);
+    }
 
-        printf(", g: ");
-        printf((fileInfo->st_mode & S_IRGRP) ? "r" : "-");
-        printf((fileInfo->st_mode & S_IWGRP) ? "w" : "-");
-        printf((fileInfo->st_mode & S_IXGRP) ? "x" : "-");
+    if (settings->with_time_info)
+    {
+        APPEND_LITERAL(&meta, ", created: ");
+        appendTime(&meta, &formatter->time_cache, fileInfo->st_ctim.tv_sec);
+        APPEND_LITERAL(&meta, ", modified: ");
+        appendTime(&meta, &formatter->time_cache, fileInfo->st_mtim.tv_sec);
+        APPEND_LITERAL(&meta, ", accessed: ");
+        appendTime(&meta, &formatter->time_cache, fileInfo->st_atim.tv_sec);
+    }
+
+    APPEND_LITERAL(&meta, "\n");
 
-        printf(", o: ");
-        printf((fileInfo->st_mode & S_IROTH) ? "r" : "-");
-        printf((fileInfo->st_mode & S_IWOTH) ? "w" : "-");
-        printf((fileInfo->st_mode & S_IXOTH) ? "x" : "-");
+    // the path is written as is (rather than copied to the line buffer),
+    // since its length is not bounded
+    struct iovec parts[5];
+    int partCount = 0;
+    parts[partCount++] = (struct iovec){.iov_base = "name: ", .iov_len = 6};
+    if (dirPath != NULL)
+    {
+        parts[partCount++] = (struct iovec){.iov_base = (void *)dirPath, .iov_len = strlen(dirPath)};
+        parts[partCount++] = (struct iovec){.iov_base = "/", .iov_len = 1};
     }
+    parts[partCount++] = (struct iovec){.iov_base = (void *)path, .iov_len = strlen(path)};
+    parts[partCount++] = (struct iovec){.iov_base = meta.data, .iov_len = meta.length};
+    writeOutputLine(&formatter->output, parts, partCount);
+    return EXIT_SUCCESS;
+}
 
-    if (settings->with_time_info)
+// Returns the type of the given directory entry, relying on the
+// type reported by getdents64 whenever possible. The fileInfo and
+// hasFileInfo arguments are set if a stat call had to be issued.
+FileType getEntryType(const DirScanner *scanner, const DirEntry *entry, struct stat *fileInfo, bool *hasFileInfo)
+{
+    switch (entry->type)
+    {
+    case DT_REG:
+        return TYPE_FILE;
+    case DT_DIR:
+        return TYPE_DIR;
+    case DT_LNK:
+    case DT_UNKNOWN:
+        // Links are reported with the type of their target (or as
+        // links if the target does not exist)
+        if (statDirEntry(scanner, entry, fileInfo, 0) == 0 ||
+            statDirEntry(scanner, entry, fileInfo, AT_SYMLINK_NOFOLLOW) == 0)
+        {
+            *hasFileInfo = TRUE;
+            return getFileType(fileInfo->st_mode);
+        }
+        return UNDEFINED_FILE_TYPE;
+    default:
+        return UNDEFINED_FILE_TYPE;
+    }
+}
+
+// Outputs the info of the given entry of the directory at the given path
+uint8_t processEntry(FileType fileType, const Settings *settings, Formatter *formatter, const char *path,
+                     const char *name, const struct stat *fileInfo)
+{
+    switch (fileType)
+    {
+    case TYPE_FILE:
+    case TYPE_LINK:
+    case TYPE_DIR:
+        return processFile(fileType, settings, formatter, path, name, fileInfo);
+    default:
+        // ignoring other types
+        return EXIT_SUCCESS;
+    }
+}
+
+// Indicates whether the given entry is a sub-directory to list in recursive
+// mode. Links to directories are not followed (so that the listing cannot
+// loop), which takes a (non-following) stat call if getdents64 did not
+// report the entry's type.
+bool isSubDir(const DirScanner *scanner, DirEntry *entry)
+{
+    return resolveDirEntryType(scanner, entry) == DT_DIR && !isDotDirEntry(entry);
+}
+
+// Holds the output of a directory listed in sorted order mode, and the
+// listings of its sub-directories (in sorted order): the whole tree is
+// written once all directories have been listed
+typedef struct _DirListing
+{
+    char *output;
+    size_t output_len;
+    struct _DirListing *children;
+    uint32_t child_count;
+} DirListing;
+
+// Holds an entry of a directory listed in sorted order mode, until all the
+// directory's entries have been read
+typedef struct _SortedEntry
+{
+    // offset of the entry's (null-terminated) name in ListState.names
+    size_t name_offset;
+    size_t name_len;
+    unsigned char type;
+    ino_t ino;
+    bool is_sub_dir;
+} SortedEntry;
+
+// Holds the resources used to list directories, reused from one directory
+// to the next (in recursive mode, each thread of the pool has its own)
+typedef struct _ListState
+{
+    // Allocates the jobs submitted by the thread (kept on its own cache
+    // lines, see my-arena.h)
+    BlockArena arena;
+    Formatter formatter;
+    DirScanner scanner;
+    // Used to fetch metadata asynchronously (if is_async is set)
+    StatxRing ring;
+    bool is_async;
+    // Pool worker the state belongs to (NULL if not listing recursively)
+    Worker *worker;
+    // Path of the directory being listed, to which the names of its
+    // sub-directories are appended as they are dispatched
+    PathBuilder path;
+    // In sorted order mode: the entries of the directory being listed,
+    // and their names
+    SortedEntry *entries;
+    uint32_t entry_count;
+    uint32_t entry_capacity;
+    char *names;
+    size_t names_len;
+    size_t names_capacity;
+} ListState;
+
+// Holds the state shared by the threads of a recursive listing (the data
+// of their pool)
+typedef struct _ListContext
+{
+    const Settings *settings;
+    // Sink the threads write to (NULL in sorted order mode, in which the
+    // output of each directory is kept in memory)
+    OutputSink *sink;
+    // set once a directory could not be listed
+    atomic_bool has_failed;
+} ListContext;
+
+// Holds a directory to list in recursive mode (a job of the pool)
+typedef struct _ListJob
+{
+    // listing to fill (sorted order mode only, NULL otherwise)
+    DirListing *listing;
+    size_t path_len;
+    char path[];
+} ListJob;
+
+// initializes the given state, writing to the given sink (or keeping the
+// output in memory if it is NULL). Returns 0 on success.
+int newListState(ListState *state, const Settings *settings, OutputSink *sink)
+{
+    newBlockArena(&state->arena);
+    state->worker = NULL;
+    state->is_async = FALSE;
+    state->entries = NULL;
+    state->entry_count = 0;
+    state->entry_capacity = 0;
+    state->names = NULL;
+    state->names_len = 0;
+    state->names_capacity = 0;
+    if (newFormatter(&state->formatter, sink, settings->output_format) != 0)
+    {
+        destroyBlockArena(&state->arena);
+        return -1;
+    }
+    if (newDirScanner(&state->scanner, DIR_SCAN_BUFFER_SIZE) != 0)
+    {
+        destroyFormatter(&state->formatter);
+        destroyBlockArena(&state->arena);
+        return -1;
+    }
+    if (newPathBuilder(&state->path, PATH_BUILDER_CAPACITY) != 0)
     {
-        TIME_STR created;
-        TIME_STR modified;
-        TIME_STR accessed;
+        destroyDirScanner(&state->scanner);
+        destroyFormatter(&state->formatter);
+        destroyBlockArena(&state->arena);
+        return -1;
+    }
 
-        formatTime(fileInfo->st_ctim.tv_sec, created);
-        formatTime(fileInfo->st_mtim.tv_sec, modified);
-        formatTime(fileInfo->st_atim.tv_sec, accessed);
+    // asynchronous mode only pays off if metadata is needed; if io_uring
+    // isn't supported by the running kernel, the synchronous mode is used
+    if (settings->queue_depth > 0 && needsFileMeta(settings) && !settings->with_sorted_order)
+    {
+        state->is_async = newStatxRing(&state->ring, settings->queue_depth) == 0;
+    }
+    return 0;
+}
 
-        printf(", created: %s, modified: %s, accessed: %s", created, modified, accessed);
+// flushes the pending output and releases the state's resources
+void destroyListState(ListState *state)
+{
+    if (state->is_async)
+    {
+        destroyStatxRing(&state->ring);
     }
+    free(state->entries);
+    free(state->names);
+    destroyPathBuilder(&state->path);
+    destroyDirScanner(&state->scanner);
+    destroyFormatter(&state->formatter);
+    destroyBlockArena(&state->arena);
+}
 
-    printf("\n");
+// Allocates a job listing the directory at the given path from the given
+// state's arena (returns NULL if memory is exhausted)
+static ListJob *newListJob(ListState *state, const char *path, size_t pathLen, DirListing *listing)
+{
+    ListJob *job = (ListJob *)allocBlock(&state->arena, sizeof(ListJob) + pathLen + 1);
+    if (job != NULL)
+    {
+        job->listing = listing;
+        job->path_len = pathLen;
+        memcpy(job->path, path, pathLen);
+        job->path[pathLen] = '\0';
+    }
+    return job;
+}
+
+// Queues the listing of the given sub-directory of the directory being
+// listed (on the deque of the state's worker, from which idle threads steal)
+uint8_t dispatchSubDir(ListState *state, const char *name, size_t nameLen, DirListing *listing)
+{
+    size_t dirPathLen = state->path.length;
+    if (appendPathComponent(&state->path, name, nameLen) != 0)
+    {
+        fprintf(stderr, "Could not allocate memory\n");
+        return EXIT_FAILURE;
+    }
+    ListJob *job = newListJob(state, state->path.data, state->path.length, listing);
+    truncatePath(&state->path, dirPathLen);
+    if (job == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory\n");
+        return EXIT_FAILURE;
+    }
+    submitJob(state->worker, job);
     return EXIT_SUCCESS;
 }
 
-uint8_t processDir(const Settings *settings, const char *path, const struct stat *dirInfo)
+// Outputs the info of the given entry of the directory at the given path,
+// fetching its metadata if the settings require it. In recursive mode,
+// isSubDirectory is set if the entry is a sub-directory to list.
+uint8_t listEntry(const Settings *settings, ListState *state, const char *path, DirEntry *entry,
+                  bool *isSubDirectory)
+{
+    struct stat fileInfo;
+    bool hasFileInfo = FALSE;
+    FileType fileType = getEntryType(&state->scanner, entry, &fileInfo, &hasFileInfo);
+
+    *isSubDirectory = FALSE;
+    if (fileType == UNDEFINED_FILE_TYPE)
+    {
+        // ignoring other types
+        return EXIT_SUCCESS;
+    }
+
+    if (needsFileMeta(settings) && !hasFileInfo && statDirEntry(&state->scanner, entry, &fileInfo, 0) != 0)
+    {
+        fprintf(stderr, "Error accessing file: %s/%s (errno: %u)\n", path, entry->name, errno);
+        return EXIT_SUCCESS;
+    }
+
+    *isSubDirectory = state->worker != NULL && fileType == TYPE_DIR && isSubDir(&state->scanner, entry);
+    return processEntry(fileType, settings, &state->formatter, path, entry->name, &fileInfo);
+}
+
+uint8_t processDirSync(const Settings *settings, ListState *state, const char *path)
 {
     uint8_t exitCode = EXIT_SUCCESS;
-    DIR *dir;
-    struct dirent *entry;
-    if ((dir = opendir(path)) != NULL)
+    DirEntry entry;
+    int scanStatus;
+
+    while ((scanStatus = nextDirEntry(&state->scanner, &entry)) > 0)
     {
-        while ((entry = readdir(dir)) != NULL)
+        bool isSubDirectory;
+        exitCode = listEntry(settings, state, path, &entry, &isSubDirectory);
+        if (exitCode == EXIT_SUCCESS && isSubDirectory)
+        {
+            exitCode = dispatchSubDir(state, entry.name, entry.nameLen, NULL);
+        }
+        if (exitCode != EXIT_SUCCESS)
         {
-            char fname[NAME_MAX] = "";
+            return exitCode;
+        }
+    }
 
-            strcat(fname, path);
-            strcat(fname, "/");
-            strcat(fname, entry->d_name);
+    if (scanStatus < 0)
+    {
+        fprintf(stderr, "Error reading directory: %s (errno: %u)\n", path, errno);
+        exitCode = EXIT_FAILURE;
+    }
+    return exitCode;
+}
 
-            struct stat fileInfo;
-            stat(fname, &fileInfo);
+// Copies the given entry (whose name is overwritten as further entries are
+// read) to the entries of the directory being listed in sorted order mode
+// (returns 0 on success)
+int addSortedEntry(ListState *state, const DirEntry *entry)
+{
+    if (state->entry_count == state->entry_capacity)
+    {
+        uint32_t capacity = state->entry_capacity == 0 ? 256 : state->entry_capacity * 2;
+        SortedEntry *entries = (SortedEntry *)realloc(state->entries, capacity * sizeof(SortedEntry));
+        if (entries == NULL)
+        {
+            return -1;
+        }
+        state->entries = entries;
+        state->entry_capacity = capacity;
+    }
+    if (state->names_len + entry->nameLen + 1 > state->names_capacity)
+    {
+        size_t capacity = state->names_capacity == 0 ? 4096 : state->names_capacity;
+        while (state->names_len + entry->nameLen + 1 > capacity)
+        {
+            capacity *= 2;
+        }
+        char *names = (char *)realloc(state->names, capacity);
+        if (names == NULL)
+        {
+            return -1;
+        }
+        state->names = names;
+        state->names_capacity = capacity;
+    }
+
+    SortedEntry *sortedEntry = &state->entries[state->entry_count++];
+    sortedEntry->name_offset = state->names_len;
+    sortedEntry->name_len = entry->nameLen;
+    sortedEntry->type = entry->type;
+    sortedEntry->ino = entry->ino;
+    sortedEntry->is_sub_dir = FALSE;
+    memcpy(state->names + state->names_len, entry->name, entry->nameLen + 1);
+    state->names_len += entry->nameLen + 1;
+    return 0;
+}
+
+// Orders sorted entries by name (byte order, as with LC_COLLATE=C); the
+// names are passed as the context argument of qsort_r
+int compareSortedEntries(const void *a, const void *b, void *names)
+{
+    return strcmp((const char *)names + ((const SortedEntry *)a)->name_offset,
+                  (const char *)names + ((const SortedEntry *)b)->name_offset);
+}
+
+// Lists the directory being scanned in sorted order mode: its entries are
+// read, sorted by name and output to the given listing, then its
+// sub-directories are dispatched (their listings being allocated in the
+// same order)
+uint8_t processDirSorted(const Settings *settings, ListState *state, const char *path, DirListing *listing)
+{
+    uint8_t exitCode = EXIT_SUCCESS;
+    DirEntry entry;
+    int scanStatus;
+
+    state->entry_count = 0;
+    state->names_len = 0;
+    while ((scanStatus = nextDirEntry(&state->scanner, &entry)) > 0)
+    {
+        if (addSortedEntry(state, &entry) != 0)
+        {
+            fprintf(stderr, "Could not allocate memory\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (scanStatus < 0)
+    {
+        // still outputting the entries read so far
+        fprintf(stderr, "Error reading directory: %s (errno: %u)\n", path, errno);
+        exitCode = EXIT_FAILURE;
+    }
+    qsort_r(state->entries, state->entry_count, sizeof(SortedEntry), compareSortedEntries, state->names);
+
+    uint32_t subDirCount = 0;
+    for (uint32_t i = 0; i < state->entry_count; i++)
+    {
+        SortedEntry *sortedEntry = &state->entries[i];
+        DirEntry dirEntry = {.name = state->names + sortedEntry->name_offset,
+                             .nameLen = sortedEntry->name_len,
+                             .type = sortedEntry->type,
+                             .ino = sortedEntry->ino};
+        bool isSubDirectory;
+        if (listEntry(settings, state, path, &dirEntry, &isSubDirectory) != EXIT_SUCCESS)
+        {
+            return EXIT_FAILURE;
+        }
+        sortedEntry->is_sub_dir = isSubDirectory;
+        subDirCount += isSubDirectory;
+    }
+
+    // the output is moved to the listing, the formatter's buffer being
+    // reused for the next directory
+    OutputBuffer *output = &state->formatter.output;
+    listing->output = (char *)malloc(output->length);
+    listing->children = subDirCount > 0 ? (DirListing *)calloc(subDirCount, sizeof(DirListing)) : NULL;
+    if ((output->length > 0 && listing->output == NULL) || (subDirCount > 0 && listing->children == NULL))
+    {
+        fprintf(stderr, "Could not allocate memory\n");
+        return EXIT_FAILURE;
+    }
+    memcpy(listing->output, output->data, output->length);
+    listing->output_len = output->length;
+    output->length = 0;
 
-            switch (entry->d_type)
+    for (uint32_t i = 0; i < state->entry_count; i++)
+    {
+        SortedEntry *sortedEntry = &state->entries[i];
+        if (sortedEntry->is_sub_dir)
+        {
+            DirListing *child = &listing->children[listing->child_count++];
+            if (dispatchSubDir(state, state->names + sortedEntry->name_offset, sortedEntry->name_len, child) !=
+                EXIT_SUCCESS)
             {
-            case DT_REG:
-            case DT_LNK:
-                exitCode = processFile(getFileType(fileInfo.st_mode), settings, fname, &fileInfo);
-                break;
-            case DT_DIR:
-                exitCode = processFile(TYPE_DIR, settings, entry->d_name, &fileInfo);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    return exitCode;
+}
+
+// Holds an entry whose metadata is being fetched asynchronously
+typedef struct _AsyncEntry
+{
+    // copy of the entry's name (the scanner's buffer is overwritten as
+    // further entries are read)
+    char name[NAME_MAX + 1];
+    unsigned char type;
+    bool isDone;
+    int result;
+    struct statx info;
+} AsyncEntry;
+
+// Outputs the given entry once its statx call has completed (and in
+// recursive mode, dispatches it if it is a sub-directory)
+uint8_t processAsyncEntry(const Settings *settings, ListState *state, const char *path,
+                          const AsyncEntry *asyncEntry)
+{
+    struct stat fileInfo;
+    FileType fileType;
+
+    if (asyncEntry->result == 0)
+    {
+        statxToStat(&asyncEntry->info, &fileInfo);
+    }
+    else
+    {
+        // Most likely a link whose target does not exist:
+        // falling back to the link itself
+        DirEntry entry = {.name = asyncEntry->name, .type = asyncEntry->type};
+        if (statDirEntry(&state->scanner, &entry, &fileInfo, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            fprintf(stderr, "Error accessing file: %s/%s (errno: %u)\n", path, asyncEntry->name, -asyncEntry->result);
+            return EXIT_SUCCESS;
+        }
+    }
+
+    fileType = asyncEntry->type == DT_DIR ? TYPE_DIR : getFileType(fileInfo.st_mode);
+    uint8_t exitCode = processEntry(fileType, settings, &state->formatter, path, asyncEntry->name, &fileInfo);
+    if (exitCode == EXIT_SUCCESS && state->worker != NULL && fileType == TYPE_DIR)
+    {
+        // the statx call followed links: checking the entry itself
+        DirEntry entry = {.name = asyncEntry->name, .nameLen = strlen(asyncEntry->name), .type = asyncEntry->type};
+        if (isSubDir(&state->scanner, &entry))
+        {
+            exitCode = dispatchSubDir(state, entry.name, entry.nameLen, NULL);
+        }
+    }
+    return exitCode;
+}
+
+// Fetches the metadata of the entries of a directory through io_uring: up
+// to <queue depth> statx calls are kept in flight, and entries are output
+// as their calls complete (or in readdir order, if so specified, in which
+// case an entry is only output once all preceding ones have been).
+uint8_t processDirAsync(const Settings *settings, ListState *state, const char *path)
+{
+    DirScanner *scanner = &state->scanner;
+    StatxRing *ring = &state->ring;
+    uint8_t exitCode = EXIT_SUCCESS;
+    uint32_t depth = settings->queue_depth;
+    AsyncEntry *slots = (AsyncEntry *)malloc(depth * sizeof(AsyncEntry));
+    // free slots (only used in completion order mode)
+    uint32_t *freeSlots = (uint32_t *)malloc(depth * sizeof(uint32_t));
+    uint32_t freeCount = depth;
+    // sequence numbers of the next entry to queue and of the next
+    // entry to output
+    uint64_t queuedSeq = 0;
+    uint64_t outputSeq = 0;
+    bool isEndOfDir = FALSE;
+    DirEntry entry;
+    int scanStatus = 0;
+    uint64_t slot;
+    int result;
+
+    if (slots == NULL || freeSlots == NULL)
+    {
+        fprintf(stderr, "Could not allocate memory\n");
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+    }
+    for (uint32_t i = 0; i < depth; i++)
+    {
+        freeSlots[i] = depth - 1 - i;
+    }
+
+    while (TRUE)
+    {
+        // queuing statx calls until the ring is full
+        while (!isEndOfDir && queuedSeq - outputSeq < depth)
+        {
+            if ((scanStatus = nextDirEntry(scanner, &entry)) <= 0)
+            {
+                isEndOfDir = TRUE;
                 break;
-            default:
+            }
+            if (entry.type != DT_REG && entry.type != DT_DIR && entry.type != DT_LNK && entry.type != DT_UNKNOWN)
+            {
                 // ignoring other types
+                continue;
+            }
+
+            uint32_t newSlot = settings->with_readdir_order ? queuedSeq % depth : freeSlots[--freeCount];
+            AsyncEntry *asyncEntry = &slots[newSlot];
+            memcpy(asyncEntry->name, entry.name, entry.nameLen + 1);
+            asyncEntry->type = entry.type;
+            asyncEntry->isDone = FALSE;
+            queueStatx(ring, scanner->fd, asyncEntry->name, 0, STATX_BASIC_STATS, &asyncEntry->info, newSlot);
+            queuedSeq++;
+        }
+
+        if (queuedSeq == outputSeq)
+        {
+            break;
+        }
+
+        if (submitStatx(ring, 1) != 0)
+        {
+            fprintf(stderr, "Error submitting statx calls (errno: %u)\n", errno);
+            exitCode = EXIT_FAILURE;
+            goto Finally;
+        }
+
+        while (reapStatx(ring, &slot, &result))
+        {
+            AsyncEntry *asyncEntry = &slots[slot];
+            asyncEntry->result = result;
+            asyncEntry->isDone = TRUE;
+            if (!settings->with_readdir_order)
+            {
+                exitCode = processAsyncEntry(settings, state, path, asyncEntry);
+                freeSlots[freeCount++] = (uint32_t)slot;
+                outputSeq++;
+                if (exitCode != EXIT_SUCCESS)
+                {
+                    goto Finally;
+                }
             }
+        }
 
+        // in readdir order mode: outputting the entries whose
+        // preceding entries have all been output
+        while (settings->with_readdir_order && outputSeq < queuedSeq && slots[outputSeq % depth].isDone)
+        {
+            exitCode = processAsyncEntry(settings, state, path, &slots[outputSeq % depth]);
+            outputSeq++;
             if (exitCode != EXIT_SUCCESS)
             {
                 goto Finally;
             }
         }
     }
-    else
+
+    if (scanStatus < 0)
     {
-        fprintf(stderr, "No such directory: %s\n", path);
+        fprintf(stderr, "Error reading directory: %s (errno: %u)\n", path, errno);
         exitCode = EXIT_FAILURE;
     }
 
 Finally:
-    closedir(dir);
+    // the kernel may still be writing to the slots if we bailed out
+    // early: waiting for the outstanding calls before freeing them
+    while (ring->inFlight + ring->toSubmit > 0 && submitStatx(ring, ring->inFlight + ring->toSubmit) == 0)
+    {
+        while (reapStatx(ring, &slot, &result))
+        {
+        }
+    }
+    free(slots);
+    free(freeSlots);
+    return exitCode;
+}
+
+// Lists the directory at the given path. In recursive mode, its
+// sub-directories are dispatched to the pool; in sorted order mode, its
+// output goes to the given listing (which is NULL otherwise).
+uint8_t listDir(const Settings *settings, ListState *state, const char *path, size_t pathLen, DirListing *listing)
+{
+    uint8_t exitCode = EXIT_SUCCESS;
+
+    if (openDirScan(&state->scanner, AT_FDCWD, path) != 0)
+    {
+        if (errno == ERRNO_NOT_FOUND)
+        {
+            fprintf(stderr, "No such directory: %s\n", path);
+        }
+        else
+        {
+            fprintf(stderr, "Error accessing directory: %s (errno: %u)\n", path, errno);
+        }
+        return EXIT_FAILURE;
+    }
+
+    if (state->worker != NULL && setPath(&state->path, path, pathLen) != 0)
+    {
+        fprintf(stderr, "Could not allocate memory\n");
+        exitCode = EXIT_FAILURE;
+    }
+    else if (listing != NULL)
+    {
+        exitCode = processDirSorted(settings, state, path, listing);
+    }
+    else
+    {
+        exitCode = state->is_async ? processDirAsync(settings, state, path) : processDirSync(settings, state, path);
+    }
+    closeDirScan(&state->scanner);
     return exitCode;
 }
 
+// Lists the directory at the given path (without its sub-directories)
+uint8_t processDir(const Settings *settings, Formatter *formatter, OutputSink *sink, const char *path)
+{
+    uint8_t exitCode = EXIT_SUCCESS;
+    ListState state;
+
+    if (newListState(&state, settings, sink) != 0)
+    {
+        fprintf(stderr, "Could not allocate directory scanner\n");
+        return EXIT_FAILURE;
+    }
+    // the header of the record stream must come first
+    flushOutputBuffer(&formatter->output);
+    exitCode = listDir(settings, &state, path, strlen(path), NULL);
+    destroyListState(&state);
+    return exitCode;
+}
+
+// Implements the JobFunction typedef (see my-pool.h): lists the directory
+// of the given job (a ListJob instance), then releases the job
+static void runListJob(Worker *worker, void *job)
+{
+    ListState *state = (ListState *)worker->data;
+    ListContext *context = (ListContext *)worker->pool->data;
+    ListJob *listJob = (ListJob *)job;
+    if (listDir(context->settings, state, listJob->path, listJob->path_len, listJob->listing) != EXIT_SUCCESS)
+    {
+        atomic_store(&context->has_failed, TRUE);
+    }
+    freeBlock(&state->arena, job);
+}
+
+// Implements the WorkerFunction typedef (see my-pool.h): initializes the
+// state of the worker on its own thread
+static void startListWorker(Worker *worker)
+{
+    ListContext *context = (ListContext *)worker->pool->data;
+    ListState *state = (ListState *)worker->data;
+    assertIt(newListState(state, context->settings, context->sink) == 0, "Could not allocate memory\n");
+    state->worker = worker;
+}
+
+// Writes the given listing, then those of its sub-directories (depth
+// first), releasing them
+void writeListing(OutputBuffer *output, DirListing *listing)
+{
+    if (listing->output_len > 0)
+    {
+        struct iovec part = {.iov_base = listing->output, .iov_len = listing->output_len};
+        writeOutputLine(output, &part, 1);
+    }
+    free(listing->output);
+    for (uint32_t i = 0; i < listing->child_count; i++)
+    {
+        writeListing(output, &listing->children[i]);
+    }
+    free(listing->children);
+}
+
+// Lists the directory at the given path and its sub-directories through a
+// pool of threads: the main thread acts as worker #0, in addition to the
+// <thread count> threads started by the pool. Each thread writes its own
+// output to the given sink, except in sorted order mode, in which the tree
+// is written through the given formatter once it has been listed.
+uint8_t processTree(const Settings *settings, Formatter *formatter, OutputSink *sink, const char *path)
+{
+    ListContext context = {.settings = settings, .sink = settings->with_sorted_order ? NULL : sink};
+    atomic_init(&context.has_failed, FALSE);
+    DirListing root = {0};
+    WorkerPool pool;
+    newWorkerPool(&pool, settings->thread_count + 1, runListJob);
+    pool.startWorker = startListWorker;
+    pool.data = &context;
+
+    // states are cache-line aligned (see BlockArena); the other workers
+    // initialize theirs on their own thread
+    ListState *states = (ListState *)aligned_alloc(CACHE_LINE_SIZE, pool.workerCount * sizeof(ListState));
+    if (states == NULL || newListState(&states[0], settings, context.sink) != 0)
+    {
+        fprintf(stderr, "Could not allocate memory\n");
+        free(states);
+        destroyWorkerPool(&pool);
+        return EXIT_FAILURE;
+    }
+    for (uint32_t i = 0; i < pool.workerCount; i++)
+    {
+        pool.workers[i].data = &states[i];
+    }
+    states[0].worker = &pool.workers[0];
+    ListJob *job = newListJob(&states[0], path, strlen(path), settings->with_sorted_order ? &root : NULL);
+    assertIt(job != NULL, "Could not allocate memory\n");
+
+    // the header of the record stream must come first
+    flushOutputBuffer(&formatter->output);
+    runWorkerPool(&pool, job);
+    for (uint32_t i = 0; i < pool.workerCount; i++)
+    {
+        destroyListState(&states[i]);
+    }
+    free(states);
+    destroyWorkerPool(&pool);
+
+    if (settings->with_sorted_order)
+    {
+        writeListing(&formatter->output, &root);
+    }
+    return atomic_load(&context.has_failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv)
 {
     // exit code
@@ -240,7 +1233,7 @@ int main(int argc, char **argv)
 
     // option processing
     int opt;
-    while ((opt = getopt(argc, argv, ":hadopt :")) != -1)
+    while ((opt = getopt(argc, argv, ":hadoptsq:f:RSw: :")) != -1)
     {
         switch (opt)
         {
@@ -266,6 +1259,44 @@ int main(int argc, char **argv)
         case 't':
             settings.with_time_info = TRUE;
             break;
+        case 'q':
+            settings.queue_depth = (uint32_t)atoi(optarg);
+            if (settings.queue_depth == 0 || settings.queue_depth > MAX_STATX_QUEUE_DEPTH)
+            {
+                fprintf(stderr, "Value of -q option (queue depth) must be between 1 and %u\n", MAX_STATX_QUEUE_DEPTH);
+                exitCode = EXIT_FAILURE;
+                goto Finally;
+            }
+            break;
+        case 's':
+            settings.with_readdir_order = TRUE;
+            break;
+        case 'f': {
+            int format = parseRecordFormat(optarg);
+            if (format < 0)
+            {
+                fprintf(stderr, "Value of -f option (format) must be one of: text, ndjson, binary\n");
+                exitCode = EXIT_FAILURE;
+                goto Finally;
+            }
+            settings.output_format = (RecordFormat)format;
+            break;
+        }
+        case 'R':
+            settings.is_recursive = TRUE;
+            break;
+        case 'S':
+            settings.with_sorted_order = TRUE;
+            break;
+        case 'w':
+            if (atoi(optarg) < 0)
+            {
+                fprintf(stderr, "Value of -w option (threads) must be >= 0\n");
+                exitCode = EXIT_FAILURE;
+                goto Finally;
+            }
+            settings.thread_count = (uint32_t)atoi(optarg);
+            break;
         }
     }
 
@@ -294,15 +1325,33 @@ int main(int argc, char **argv)
 
     FileType fileType = getFileType(pathInfo.st_mode);
 
+    OutputSink sink;
+    Formatter formatter;
+    if (newOutputSink(&sink, STDOUT_FILENO) != 0)
+    {
+        fprintf(stderr, "Could not initialize output\n");
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+    }
+    if (newFormatter(&formatter, &sink, settings.output_format) != 0)
+    {
+        fprintf(stderr, "Could not initialize output\n");
+        destroyOutputSink(&sink);
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+    }
+    writeRecordStreamHeader(&formatter.records);
+
     switch (fileType)
     {
     case TYPE_FILE:
     case TYPE_LINK:
-        exitCode = processFile(fileType, &settings, path, &pathInfo);
+        exitCode = processFile(fileType, &settings, &formatter, NULL, path, &pathInfo);
         break;
 
     case TYPE_DIR:
-        exitCode = processDir(&settings, path, &pathInfo);
+        exitCode = settings.is_recursive ? processTree(&settings, &formatter, &sink, path)
+                                         : processDir(&settings, &formatter, &sink, path);
         break;
 
     default:
@@ -310,6 +1359,9 @@ int main(int argc, char **argv)
         exitCode = EXIT_FAILURE;
     }
 
+    destroyFormatter(&formatter);
+    destroyOutputSink(&sink);
+
 // Catch-all: terminates the process
 Finally:
     exit(exitCode);
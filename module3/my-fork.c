@@ -1,64 +1,192 @@
+#include "my-prefork.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-#define MAX_LOOPS 10
-#define SLEEP_INTERVAL 5
+#define DEFAULT_WORKER_COUNT 4
+#define DEFAULT_TASK_COUNT 10000
+#define DEFAULT_ITERATIONS 10000
 
 /**
- * A simple program illustrating fork/wait functionality for basic
- * multi-processing and process coordination:
+ * A program illustrating process-based parallelism for batch CPU jobs, and
+ * what fork costs:
  *
- * - Parent forks a child process and waits on child completion.
- * - Child does some work and exits.
- * - Parent recuperates child's exit code, returns its own exit
- *   code accordingly.
+ * - By default, a prefork supervisor (see my-prefork.h) forks the workers
+ *   once, then hands them the tasks through a ring in shared memory. The
+ *   workers it reaps when they die are replaced, their tasks run again.
+ * - With -f, the parent forks a child per task (at most <workers> at once)
+ *   and waits for it, paying the fork cost for every task.
  *
+ * Each task runs a pseudo-random generator for the given number of
+ * iterations; the pool sums the tasks' final values, as a checksum.
  */
 
-int main() {
+/**
+ * Payload of a task.
+ */
+typedef struct _Job {
+  uint64_t seed;
+  uint32_t iterations;
+  // Whether the worker running it must crash (on its first attempt only).
+  uint32_t isCrashing;
+} Job;
 
-  printf("Forking child process (parent pid = %u)\n", getpid());
+void help(char *program) {
+  printf("Usage: %s [-h] [-f] [-w <workers>] [-t <tasks>] [-n <iterations>] "
+         "[-c <n>]\n\n",
+         program);
+  printf("  -h: displays this help\n");
+  printf("  -f: forks a process per task (defaults to a prefork pool)\n");
+  printf("  -w: number of worker processes (defaults to %u)\n",
+         DEFAULT_WORKER_COUNT);
+  printf("  -t: number of tasks (defaults to %u)\n", DEFAULT_TASK_COUNT);
+  printf("  -n: iterations of each task (defaults to %u)\n",
+         DEFAULT_ITERATIONS);
+  printf("  -c: makes the worker running every n-th task crash (prefork "
+         "pool only),\n");
+  printf("      to exercise the restarts\n");
+}
 
-  int childPid = fork();
+static uint64_t runJob(const Job *job) {
+  // xorshift64
+  uint64_t value = job->seed | 1;
+  for (uint32_t i = 0; i < job->iterations; i++) {
+    value ^= value << 13;
+    value ^= value >> 7;
+    value ^= value << 17;
+  }
+  return value;
+}
 
-  if (childPid < 0) {
-    return EXIT_SUCCESS;
+static int runTask(const Task *task, uint64_t *result) {
+  Job job;
+  memcpy(&job, task->payload, sizeof(job));
+  if (job.isCrashing && task->crashCount == 0) {
+    abort();
   }
+  *result = runJob(&job);
+  return EXIT_SUCCESS;
+}
 
-  uint8_t loopCount = 0;
+static double elapsedSecs(const struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (double)(end.tv_sec - start->tv_sec) +
+         (double)(end.tv_nsec - start->tv_nsec) / 1e9;
+}
 
-  switch (childPid) {
-  // If childPid is 0: it means execution is currently
-  // occurring in the child process.
-  case 0:
-    while (loopCount < MAX_LOOPS) {
-      printf("Child PID=%d. Running iteration #%u\n", getpid(), loopCount);
-      sleep(SLEEP_INTERVAL);
-      loopCount++;
+static void runPrefork(uint32_t workerCount, uint32_t taskCount,
+                       uint32_t iterations, uint32_t crashInterval) {
+  PreforkPool pool;
+  printf("Forking %u workers (supervisor PID=%d)\n", workerCount, getpid());
+  newPreforkPool(&pool, workerCount, runTask);
+  for (uint32_t i = 0; i < taskCount; i++) {
+    Job job = {i, iterations,
+               crashInterval > 0 && i % crashInterval == crashInterval - 1};
+    submitTask(&pool, &job, sizeof(job));
+  }
+  PreforkStats stats = closePreforkPool(&pool);
+  printf("Tasks completed: %llu, failed: %llu, lost: %llu (workers "
+         "restarted: %llu)\n",
+         (unsigned long long)stats.completedCount,
+         (unsigned long long)stats.failedCount,
+         (unsigned long long)stats.lostCount,
+         (unsigned long long)stats.restartCount);
+  printf("Checksum: %016llx\n", (unsigned long long)stats.resultSum);
+}
+
+static void runForks(uint32_t workerCount, uint32_t taskCount,
+                     uint32_t iterations) {
+  uint32_t runningCount = 0;
+  uint32_t failedCount = 0;
+  printf("Forking a child per task, %u at once (parent PID=%d)\n",
+         workerCount, getpid());
+  fflush(stdout);
+  for (uint32_t i = 0; i < taskCount || runningCount > 0;) {
+    if (i < taskCount && runningCount < workerCount) {
+      pid_t childPid = fork();
+      if (childPid < 0) {
+        perror("Could not fork child process");
+        exit(EXIT_FAILURE);
+      }
+      // If childPid is 0: it means execution is currently occurring in the
+      // child process.
+      if (childPid == 0) {
+        Job job = {i, iterations, 0};
+        runJob(&job);
+        _exit(EXIT_SUCCESS);
+      }
+      runningCount++;
+      i++;
+      continue;
     }
-    printf("Exiting child PID=%d. Iteration #%u)\n", getpid(), loopCount);
-    return EXIT_SUCCESS;
-  // Otherwise, execution is in the context of the parent:
-  // that process waits until the child completes and collects
-  // the child's status.
-  default:
+    // Otherwise, the parent waits for a child to complete and collects its
+    // status.
     int childStatus;
-    printf("Parent PID=%d. Waiting (child PID=%d)\n", getpid(), childPid);
-    waitpid(childPid, &childStatus, 0);
+    if (wait(&childStatus) < 0) {
+      perror("Could not wait for child process");
+      exit(EXIT_FAILURE);
+    }
+    runningCount--;
+    failedCount += WIFEXITED(childStatus) && WEXITSTATUS(childStatus) == 0
+                       ? 0
+                       : 1;
+  }
+  printf("Tasks completed: %u, failed: %u\n", taskCount - failedCount,
+         failedCount);
+}
 
-    printf("Child process exited, parent process is resuming execution (parent "
-           "PID=%d, "
-           "child PID=%d)\n",
-           getpid(), childPid);
-    if (WIFSIGNALED(childStatus)) {
-      printf("Child process exit code (%u) indicates failure\n", childStatus);
+int main(int argc, char **argv) {
+  uint32_t workerCount = DEFAULT_WORKER_COUNT;
+  uint32_t taskCount = DEFAULT_TASK_COUNT;
+  uint32_t iterations = DEFAULT_ITERATIONS;
+  uint32_t crashInterval = 0;
+  int isForkingPerTask = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "hfw:t:n:c:")) != -1) {
+    switch (opt) {
+    case 'h':
+      help(argv[0]);
+      return EXIT_SUCCESS;
+    case 'f':
+      isForkingPerTask = 1;
+      break;
+    case 'w':
+      workerCount = (uint32_t)atoi(optarg);
+      break;
+    case 't':
+      taskCount = (uint32_t)atoi(optarg);
+      break;
+    case 'n':
+      iterations = (uint32_t)atoi(optarg);
+      break;
+    case 'c':
+      crashInterval = (uint32_t)atoi(optarg);
+      break;
+    default:
+      help(argv[0]);
       return EXIT_FAILURE;
     }
-    printf("Child process exit code (%u) indicates successful completion\n",
-           childStatus);
-    return EXIT_SUCCESS;
   }
+  if (workerCount == 0) {
+    fprintf(stderr, "Value of -w option (workers) must be > 0\n");
+    return EXIT_FAILURE;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (isForkingPerTask) {
+    runForks(workerCount, taskCount, iterations);
+  } else {
+    runPrefork(workerCount, taskCount, iterations, crashInterval);
+  }
+  double secs = elapsedSecs(&start);
+  printf("Ran %u tasks in %.3fs (%.0f tasks/s)\n", taskCount, secs,
+         secs > 0 ? taskCount / secs : 0.0);
+  return EXIT_SUCCESS;
 }
@@ -0,0 +1,392 @@
+#define _GNU_SOURCE
+#include "my-prefork.h"
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Data of the eventfd's epoll events (those of the pidfds being the index of
+// their worker).
+#define EVENT_FD_DATA UINT64_MAX
+
+// Events handled per epoll_wait call.
+#define MAX_EVENTS 64
+
+/**
+ * Defines the signature of the conditions the supervisor waits for.
+ */
+typedef int (*PoolCondition)(PreforkPool *pool);
+
+static void checkIt(int condition, const char *action) {
+  if (!condition) {
+    fprintf(stderr, "Could not %s (errno: %d)\n", action, errno);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void waitFutex(atomic_uint *futex, unsigned value) {
+  // Shared (not FUTEX_PRIVATE_FLAG): the waiters are different processes
+  syscall(SYS_futex, futex, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+static void wakeFutex(atomic_uint *futex, int count) {
+  syscall(SYS_futex, futex, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+/**
+ * Appends the given task to the ring, waking an idle worker (if any). Returns
+ * 0 if the ring is full.
+ */
+static int pushTask(PreforkPool *pool, const Task *task) {
+  PreforkShared *shared = pool->shared;
+  TaskSlot *slot = &shared->slots[pool->tail & (TASK_RING_CAPACITY - 1)];
+  // The slot is still waiting for a worker to take the task of the previous
+  // lap
+  if (atomic_load_explicit(&slot->sequence, memory_order_acquire) !=
+      pool->tail) {
+    return 0;
+  }
+  slot->task = *task;
+  atomic_store_explicit(&slot->sequence, pool->tail + 1, memory_order_release);
+  pool->tail++;
+
+  // Ordered (seq_cst) with the idle workers' increment of idleCount: either
+  // the worker sees the new pushCount in waitFutex, or the supervisor sees it
+  // idle
+  atomic_fetch_add(&shared->pushCount, 1);
+  if (atomic_load(&shared->idleCount) > 0) {
+    wakeFutex(&shared->pushCount, 1);
+  }
+  return 1;
+}
+
+/**
+ * Takes the task at the head of the ring (racing with the other workers),
+ * recording it in the given worker slot. Returns 0 if the ring is empty.
+ */
+static int takeTask(PreforkShared *shared, WorkerSlot *self) {
+  uint_fast64_t head =
+      atomic_load_explicit(&shared->head, memory_order_relaxed);
+  while (1) {
+    TaskSlot *slot = &shared->slots[head & (TASK_RING_CAPACITY - 1)];
+    uint_fast64_t sequence =
+        atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    int64_t difference = (int64_t)(sequence - (head + 1));
+    if (difference < 0) {
+      return 0;
+    }
+    if (difference > 0) {
+      // Another worker took it
+      head = atomic_load_explicit(&shared->head, memory_order_relaxed);
+    } else if (atomic_compare_exchange_weak_explicit(
+                   &shared->head, &head, head + 1, memory_order_relaxed,
+                   memory_order_relaxed)) {
+      // The supervisor does not write the slot again until it is released.
+      // The task is published (for the supervisor to submit it again if the
+      // worker dies) before that: released first, it would be lost if the
+      // worker died in between
+      self->task = slot->task;
+      atomic_store_explicit(&self->taskId, self->task.id,
+                            memory_order_release);
+      atomic_store_explicit(&slot->sequence, head + TASK_RING_CAPACITY,
+                            memory_order_release);
+      return 1;
+    }
+  }
+}
+
+/**
+ * Wakes the supervisor up if it is waiting (for room in the ring or for the
+ * tasks to complete), the calling worker having just made progress.
+ */
+static void notifySupervisor(PreforkPool *pool) {
+  // Orders the progress made (a release store) before reading the flag, as
+  // the supervisor sets it before checking for progress
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&pool->shared->isSupervisorWaiting,
+                           memory_order_relaxed) &&
+      atomic_exchange(&pool->shared->isSupervisorWaiting, 0)) {
+    uint64_t one = 1;
+    checkIt(write(pool->eventFd, &one, sizeof(one)) == sizeof(one),
+            "notify supervisor");
+  }
+}
+
+/**
+ * Runs the tasks of the ring, sleeping on the pushCount futex while it is
+ * empty, until the pool is closed.
+ */
+static void runWorker(PreforkPool *pool, uint32_t index) {
+  PreforkShared *shared = pool->shared;
+  WorkerSlot *self = &shared->workers[index];
+  // Only the supervisor watches the workers
+  close(pool->epollFd);
+  for (uint32_t i = 0; i < pool->workerCount; i++) {
+    if (i != index && pool->pidFds[i] >= 0) {
+      close(pool->pidFds[i]);
+    }
+  }
+
+  Task task;
+  while (1) {
+    unsigned pushCount = atomic_load(&shared->pushCount);
+    if (!takeTask(shared, self)) {
+      if (atomic_load(&shared->isClosed)) {
+        break;
+      }
+      atomic_fetch_add(&shared->idleCount, 1);
+      // Returns at once if a task was pushed since pushCount was read
+      waitFutex(&shared->pushCount, pushCount);
+      atomic_fetch_sub(&shared->idleCount, 1);
+      continue;
+    }
+    task = self->task;
+    notifySupervisor(pool);
+
+    uint64_t result = 0;
+    int status = pool->runTask(&task, &result);
+    atomic_fetch_add_explicit(&shared->resultSum, result,
+                              memory_order_relaxed);
+    // Counted before being cleared: dying in between, the worker gets the
+    // task run again (rather than never counted)
+    atomic_fetch_add_explicit(status == 0 ? &shared->completedCount
+                                          : &shared->failedCount,
+                              1, memory_order_release);
+    atomic_store_explicit(&self->taskId, 0, memory_order_release);
+    notifySupervisor(pool);
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+static void startWorker(PreforkPool *pool, uint32_t index) {
+  // Output buffered by the supervisor would otherwise be written by the
+  // worker too
+  fflush(NULL);
+  pid_t pid = fork();
+  checkIt(pid >= 0, "fork worker");
+  if (pid == 0) {
+    runWorker(pool, index);
+  }
+  pool->pids[index] = pid;
+  pool->pidFds[index] = (int)syscall(SYS_pidfd_open, pid, 0);
+  checkIt(pool->pidFds[index] >= 0, "open worker pidfd");
+  struct epoll_event event = {0};
+  event.events = EPOLLIN;
+  event.data.u64 = index;
+  checkIt(epoll_ctl(pool->epollFd, EPOLL_CTL_ADD, pool->pidFds[index],
+                    &event) == 0,
+          "watch worker pidfd");
+}
+
+/**
+ * Waits for the given worker to exit, and releases its pidfd.
+ */
+static int reapWorker(PreforkPool *pool, uint32_t index) {
+  int status;
+  while (waitpid(pool->pids[index], &status, 0) < 0) {
+    checkIt(errno == EINTR, "wait for worker");
+  }
+  // Closing it would not be enough if a worker being forked still holds a
+  // copy: the pidfd would stay in the epoll instance
+  epoll_ctl(pool->epollFd, EPOLL_CTL_DEL, pool->pidFds[index], NULL);
+  close(pool->pidFds[index]);
+  pool->pidFds[index] = -1;
+  return status;
+}
+
+/**
+ * Replaces the given worker, which died, submitting its task again (unless
+ * it was given up on).
+ */
+static void restartWorker(PreforkPool *pool, uint32_t index) {
+  int status = reapWorker(pool, index);
+  WorkerSlot *slot = &pool->shared->workers[index];
+  if (atomic_load_explicit(&slot->taskId, memory_order_acquire) != 0) {
+    Task task = slot->task;
+    atomic_store_explicit(&slot->taskId, 0, memory_order_relaxed);
+    if (++task.crashCount < MAX_TASK_CRASHES) {
+      if (pool->retryCount == pool->retryCapacity) {
+        pool->retryCapacity *= 2;
+        pool->retries = (Task *)realloc(pool->retries,
+                                        pool->retryCapacity * sizeof(Task));
+        checkIt(pool->retries != NULL, "grow task retries");
+      }
+      pool->retries[pool->retryCount++] = task;
+    } else {
+      fprintf(stderr, "Task #%llu given up on after %u crashes\n",
+              (unsigned long long)task.id, task.crashCount);
+      pool->lostCount++;
+    }
+  }
+  fprintf(stderr, "Worker #%u (PID=%d) died (status %d), restarting it\n",
+          index, pool->pids[index], status);
+  startWorker(pool, index);
+  pool->restartCount++;
+}
+
+/**
+ * Pushes the tasks of dead workers, as far as there is room in the ring.
+ */
+static void flushRetries(PreforkPool *pool) {
+  while (pool->retryCount > 0 &&
+         pushTask(pool, &pool->retries[pool->retryCount - 1])) {
+    pool->retryCount--;
+  }
+}
+
+static int hasRoom(PreforkPool *pool) {
+  TaskSlot *slot =
+      &pool->shared->slots[pool->tail & (TASK_RING_CAPACITY - 1)];
+  return pool->retryCount == 0 &&
+         atomic_load_explicit(&slot->sequence, memory_order_acquire) ==
+             pool->tail;
+}
+
+static int isDrained(PreforkPool *pool) {
+  PreforkShared *shared = pool->shared;
+  uint64_t doneCount =
+      atomic_load_explicit(&shared->completedCount, memory_order_acquire) +
+      atomic_load_explicit(&shared->failedCount, memory_order_acquire) +
+      pool->lostCount;
+  return doneCount >= pool->submittedCount;
+}
+
+/**
+ * Supervises the workers (restarting those which die) until the given
+ * condition holds, sleeping in epoll_wait meanwhile: workers write to the
+ * eventfd when they make progress while the supervisor waits.
+ */
+static void superviseUntil(PreforkPool *pool, PoolCondition condition) {
+  PreforkShared *shared = pool->shared;
+  while (1) {
+    flushRetries(pool);
+    if (condition(pool)) {
+      break;
+    }
+    atomic_store(&shared->isSupervisorWaiting, 1);
+    // A worker may have made progress before seeing the flag
+    atomic_thread_fence(memory_order_seq_cst);
+    if (condition(pool)) {
+      break;
+    }
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(pool->epollFd, events, MAX_EVENTS, -1);
+    if (count < 0) {
+      checkIt(errno == EINTR, "wait for workers");
+      continue;
+    }
+    for (int i = 0; i < count; i++) {
+      if (events[i].data.u64 == EVENT_FD_DATA) {
+        uint64_t value;
+        checkIt(read(pool->eventFd, &value, sizeof(value)) == sizeof(value),
+                "read supervisor eventfd");
+      } else {
+        restartWorker(pool, (uint32_t)events[i].data.u64);
+      }
+    }
+  }
+  atomic_store(&shared->isSupervisorWaiting, 0);
+}
+
+void newPreforkPool(PreforkPool *pool, uint32_t workerCount,
+                    TaskFunction runTask) {
+  if (workerCount == 0) {
+    fprintf(stderr, "Worker count must be > 0\n");
+    exit(EXIT_FAILURE);
+  }
+  pool->workerCount = workerCount;
+  pool->runTask = runTask;
+  pool->sharedSize =
+      sizeof(PreforkShared) + workerCount * sizeof(WorkerSlot);
+  pool->shared = (PreforkShared *)mmap(NULL, pool->sharedSize,
+                                       PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  checkIt(pool->shared != MAP_FAILED, "map pool memory");
+  // Anonymous mappings are zeroed: only the sequences need setting
+  for (uint64_t i = 0; i < TASK_RING_CAPACITY; i++) {
+    atomic_init(&pool->shared->slots[i].sequence, i);
+  }
+
+  pool->pids = (pid_t *)malloc(workerCount * sizeof(pid_t));
+  pool->pidFds = (int *)malloc(workerCount * sizeof(int));
+  pool->retries = (Task *)malloc(workerCount * sizeof(Task));
+  checkIt(pool->pids != NULL && pool->pidFds != NULL && pool->retries != NULL,
+          "allocate pool");
+  pool->tail = 0;
+  pool->submittedCount = 0;
+  pool->retryCount = 0;
+  pool->retryCapacity = workerCount;
+  pool->lostCount = 0;
+  pool->restartCount = 0;
+
+  pool->epollFd = epoll_create1(EPOLL_CLOEXEC);
+  checkIt(pool->epollFd >= 0, "create epoll instance");
+  pool->eventFd = eventfd(0, EFD_CLOEXEC);
+  checkIt(pool->eventFd >= 0, "create eventfd");
+  struct epoll_event event = {0};
+  event.events = EPOLLIN;
+  event.data.u64 = EVENT_FD_DATA;
+  checkIt(epoll_ctl(pool->epollFd, EPOLL_CTL_ADD, pool->eventFd, &event) == 0,
+          "watch eventfd");
+
+  for (uint32_t i = 0; i < workerCount; i++) {
+    pool->pidFds[i] = -1;
+  }
+  for (uint32_t i = 0; i < workerCount; i++) {
+    startWorker(pool, i);
+  }
+}
+
+uint64_t submitTask(PreforkPool *pool, const void *payload, uint32_t size) {
+  if (size > TASK_PAYLOAD_SIZE) {
+    fprintf(stderr, "Task payload too large (max: %u bytes)\n",
+            TASK_PAYLOAD_SIZE);
+    exit(EXIT_FAILURE);
+  }
+  Task task;
+  task.id = ++pool->submittedCount;
+  task.crashCount = 0;
+  task.size = size;
+  memcpy(task.payload, payload, size);
+
+  superviseUntil(pool, hasRoom);
+  pushTask(pool, &task);
+  return task.id;
+}
+
+void drainPreforkPool(PreforkPool *pool) { superviseUntil(pool, isDrained); }
+
+PreforkStats closePreforkPool(PreforkPool *pool) {
+  PreforkShared *shared = pool->shared;
+  drainPreforkPool(pool);
+  atomic_store(&shared->isClosed, 1);
+  atomic_fetch_add(&shared->pushCount, 1);
+  wakeFutex(&shared->pushCount, INT_MAX);
+  for (uint32_t i = 0; i < pool->workerCount; i++) {
+    reapWorker(pool, i);
+  }
+
+  PreforkStats stats;
+  stats.completedCount = atomic_load(&shared->completedCount);
+  stats.failedCount = atomic_load(&shared->failedCount);
+  stats.lostCount = pool->lostCount;
+  stats.restartCount = pool->restartCount;
+  stats.resultSum = atomic_load(&shared->resultSum);
+
+  close(pool->eventFd);
+  close(pool->epollFd);
+  munmap(pool->shared, pool->sharedSize);
+  free(pool->pids);
+  free(pool->pidFds);
+  free(pool->retries);
+  pool->shared = NULL;
+  return stats;
+}
@@ -0,0 +1,161 @@
+#ifndef MY_PREFORK_H
+#define MY_PREFORK_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Size of a cache line: used to keep the fields written by different
+// processes from sharing one (false sharing).
+#define CACHE_LINE_SIZE 64
+
+// Number of slots of the task ring (a power of 2).
+#define TASK_RING_CAPACITY 1024
+
+// Bytes of application data carried by a task.
+#define TASK_PAYLOAD_SIZE 48
+
+// Number of workers dying while running a task after which it is given up on
+// (counted as lost) instead of being submitted again.
+#define MAX_TASK_CRASHES 3
+
+/**
+ * A unit of work handed to a worker: copied into the ring (and out of it), so
+ * it must not point to memory of the supervisor that the worker would not
+ * see (all the memory a worker inherited with fork is a copy of the
+ * supervisor's at the time).
+ */
+typedef struct _Task {
+  // Assigned by submitTask, starting at 1 (0 denoting no task).
+  uint64_t id;
+  // Number of workers which died while running it.
+  uint32_t crashCount;
+  uint32_t size;
+  uint8_t payload[TASK_PAYLOAD_SIZE];
+} Task;
+
+/**
+ * Defines the signature of the function a worker runs for each task. It
+ * returns 0 on success (other values are counted as failures), and may set
+ * the given result, which the pool sums over all tasks (e.g. a checksum).
+ */
+typedef int (*TaskFunction)(const Task *task, uint64_t *result);
+
+/**
+ * Slot of the task ring. Its sequence tells whose turn it is: equal to the
+ * position of the next task it holds when the producer may write it, one
+ * more once written (until a worker takes it, and makes it one lap further).
+ */
+typedef struct _TaskSlot {
+  atomic_uint_fast64_t sequence;
+  Task task;
+} TaskSlot;
+
+/**
+ * State of a worker shared with the supervisor: the task it runs (if any),
+ * which the supervisor submits again if the worker dies meanwhile.
+ */
+typedef struct _WorkerSlot {
+  _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t taskId;
+  Task task;
+} WorkerSlot;
+
+/**
+ * Memory shared by the supervisor and its workers (MAP_SHARED, inherited
+ * with fork): the task ring, the counters, and the workers' slots.
+ *
+ * The ring is a bounded single-producer, multiple-consumer queue (in the
+ * manner of Vyukov's): the supervisor appends at tail without any atomic
+ * read-modify-write, workers race to take the task at head through a
+ * compare-and-swap. Idle workers sleep on a futex (pushCount), which the
+ * supervisor only wakes when some are idle; the supervisor, whether waiting
+ * for room in the ring, for the tasks to complete or for workers to die,
+ * sleeps in epoll_wait (see PreforkPool).
+ */
+typedef struct _PreforkShared {
+  // Position of the next task to take.
+  _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t head;
+  // Incremented for each task pushed: the futex idle workers wait on.
+  _Alignas(CACHE_LINE_SIZE) atomic_uint pushCount;
+  atomic_uint idleCount;
+  atomic_bool isClosed;
+  // Whether the supervisor is waiting for a task to be taken or completed
+  // (the worker doing so then writes to its eventfd).
+  _Alignas(CACHE_LINE_SIZE) atomic_bool isSupervisorWaiting;
+  _Alignas(CACHE_LINE_SIZE) atomic_uint_fast64_t completedCount;
+  atomic_uint_fast64_t failedCount;
+  atomic_uint_fast64_t resultSum;
+  TaskSlot slots[TASK_RING_CAPACITY];
+  WorkerSlot workers[];
+} PreforkShared;
+
+/**
+ * Statistics of a pool, returned by closePreforkPool.
+ */
+typedef struct _PreforkStats {
+  // Tasks whose function returned 0, or not.
+  uint64_t completedCount;
+  uint64_t failedCount;
+  // Tasks given up on (see MAX_TASK_CRASHES).
+  uint64_t lostCount;
+  // Workers restarted after dying.
+  uint64_t restartCount;
+  uint64_t resultSum;
+} PreforkStats;
+
+/**
+ * Supervisor of a fixed set of worker processes, forked once up front (the
+ * fork cost is not paid per task), running tasks submitted through a ring in
+ * shared memory.
+ *
+ * Each worker's pidfd is watched by an epoll instance, along with an eventfd
+ * workers write to when the supervisor waits for them: a dead worker is
+ * reaped and replaced as soon as its death is reported, its task (if it was
+ * running one) being submitted again.
+ */
+typedef struct _PreforkPool {
+  PreforkShared *shared;
+  size_t sharedSize;
+  uint32_t workerCount;
+  TaskFunction runTask;
+  pid_t *pids;
+  int *pidFds;
+  int epollFd;
+  int eventFd;
+  // Position of the next task to push (only the supervisor pushes).
+  uint64_t tail;
+  uint64_t submittedCount;
+  // Tasks of dead workers waiting for room in the ring.
+  Task *retries;
+  uint32_t retryCount;
+  uint32_t retryCapacity;
+  uint64_t lostCount;
+  uint64_t restartCount;
+} PreforkPool;
+
+/**
+ * Maps the shared memory and forks the given number of workers, each running
+ * the given function for the tasks it takes.
+ */
+void newPreforkPool(PreforkPool *pool, uint32_t workerCount,
+                    TaskFunction runTask);
+
+/**
+ * Submits a task carrying the given payload (at most TASK_PAYLOAD_SIZE
+ * bytes), waiting for room in the ring if it is full. Returns its id.
+ */
+uint64_t submitTask(PreforkPool *pool, const void *payload, uint32_t size);
+
+/**
+ * Waits until all the tasks submitted so far are done (completed, failed or
+ * lost).
+ */
+void drainPreforkPool(PreforkPool *pool);
+
+/**
+ * Drains the pool, then stops the workers, waits for them to exit and
+ * releases the pool. Returns its statistics.
+ */
+PreforkStats closePreforkPool(PreforkPool *pool);
+
+#endif
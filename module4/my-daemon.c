@@ -0,0 +1,1132 @@
+#define _GNU_SOURCE
+
+#include "my-daemon.h"
+#include "my-dirscan.h"
+#include "my-output.h"
+#include "my-path.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// A watch key identifies the directory an event refers to: an inotify watch
+// descriptor, or a file system id followed by a file handle (fanotify).
+#define MAX_WATCH_KEY_LEN (sizeof(fsid_t) + sizeof(int) + MAX_HANDLE_SZ)
+
+#define EVENT_BUFFER_SIZE (64 * 1024)
+#define INITIAL_TABLE_CAPACITY 1024
+#define CLIENT_TIMEOUT_SEC 5
+// Clients whose query is being read at once (no more connections are
+// accepted meanwhile).
+#define MAX_PENDING_CLIENTS 64
+
+#define INOTIFY_MASK                                                           \
+  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR |          \
+   IN_DONT_FOLLOW)
+#define FANOTIFY_MASK                                                          \
+  (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR)
+
+// Set from the SIGINT/SIGTERM handler.
+static volatile sig_atomic_t isInterrupted = 0;
+
+static void onInterrupt(int signal) {
+  (void)signal;
+  isInterrupted = 1;
+}
+
+static uint64_t hashBytes(const void *data, size_t length) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// ----------------------------------------------------------------------------
+// DirNode & NodeTable
+
+/**
+ * A directory of the tree (every directory of the tree is watched, and has a
+ * node).
+ */
+typedef struct _DirNode {
+  char *path;
+  size_t pathLen;
+  // Entries read since the snapshot was taken (NULL if the snapshot's are
+  // still current).
+  IndexDir *entries;
+  unsigned char watchKey[MAX_WATCH_KEY_LEN];
+  // 0 if the directory is not watched.
+  size_t watchKeyLen;
+  // Set while the directory is queued for being read again.
+  bool isDirty;
+} DirNode;
+
+typedef enum _TableKind { TABLE_BY_PATH = 0, TABLE_BY_WATCH_KEY = 1 } TableKind;
+
+/**
+ * Open-addressing hash table of nodes, keyed either by path or by watch key.
+ */
+typedef struct _NodeTable {
+  TableKind kind;
+  DirNode **nodes;
+  size_t count;
+  size_t capacity;
+} NodeTable;
+
+static void newNodeTable(NodeTable *table, TableKind kind) {
+  table->kind = kind;
+  table->count = 0;
+  table->capacity = INITIAL_TABLE_CAPACITY;
+  table->nodes = (DirNode **)calloc(table->capacity, sizeof(DirNode *));
+  assertIt(table->nodes != NULL, "Could not allocate memory\n");
+}
+
+static void destroyNodeTable(NodeTable *table) {
+  safefree(table->nodes);
+  table->nodes = NULL;
+}
+
+static const void *nodeKey(const NodeTable *table, const DirNode *node,
+                           size_t *keyLen) {
+  if (table->kind == TABLE_BY_PATH) {
+    *keyLen = node->pathLen;
+    return node->path;
+  }
+  *keyLen = node->watchKeyLen;
+  return node->watchKey;
+}
+
+static size_t nodeSlot(const NodeTable *table, const DirNode *node) {
+  size_t keyLen;
+  const void *key = nodeKey(table, node, &keyLen);
+  return hashBytes(key, keyLen) & (table->capacity - 1);
+}
+
+static DirNode *findNode(const NodeTable *table, const void *key,
+                         size_t keyLen) {
+  size_t mask = table->capacity - 1;
+  for (size_t i = hashBytes(key, keyLen) & mask; table->nodes[i] != NULL;
+       i = (i + 1) & mask) {
+    size_t nodeKeyLen;
+    const void *candidate = nodeKey(table, table->nodes[i], &nodeKeyLen);
+    if (nodeKeyLen == keyLen && memcmp(candidate, key, keyLen) == 0) {
+      return table->nodes[i];
+    }
+  }
+  return NULL;
+}
+
+static void insertNode(NodeTable *table, DirNode *node);
+
+static void growNodeTable(NodeTable *table) {
+  DirNode **nodes = table->nodes;
+  size_t capacity = table->capacity;
+  table->capacity *= 2;
+  table->count = 0;
+  table->nodes = (DirNode **)calloc(table->capacity, sizeof(DirNode *));
+  assertIt(table->nodes != NULL, "Could not allocate memory\n");
+  for (size_t i = 0; i < capacity; i++) {
+    if (nodes[i] != NULL) {
+      insertNode(table, nodes[i]);
+    }
+  }
+  safefree(nodes);
+}
+
+static void insertNode(NodeTable *table, DirNode *node) {
+  if ((table->count + 1) * 2 > table->capacity) {
+    growNodeTable(table);
+  }
+  size_t mask = table->capacity - 1;
+  size_t i = nodeSlot(table, node);
+  while (table->nodes[i] != NULL) {
+    i = (i + 1) & mask;
+  }
+  table->nodes[i] = node;
+  table->count++;
+}
+
+/**
+ * Removes the given node from the table (backward-shift deletion, which keeps
+ * probe sequences free of holes).
+ */
+static void removeNode(NodeTable *table, const DirNode *node) {
+  size_t mask = table->capacity - 1;
+  size_t i = nodeSlot(table, node);
+  while (table->nodes[i] != node) {
+    if (table->nodes[i] == NULL) {
+      return;
+    }
+    i = (i + 1) & mask;
+  }
+  table->nodes[i] = NULL;
+  table->count--;
+  for (size_t j = (i + 1) & mask; table->nodes[j] != NULL; j = (j + 1) & mask) {
+    size_t home = nodeSlot(table, table->nodes[j]);
+    // Moving the node back if its home slot is not in (i, j].
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      table->nodes[i] = table->nodes[j];
+      table->nodes[j] = NULL;
+      i = j;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Daemon state
+
+typedef enum _WatchBackend {
+  WATCH_FANOTIFY = 0,
+  WATCH_INOTIFY = 1
+} WatchBackend;
+
+typedef struct _Daemon {
+  const DaemonSettings *settings;
+  const IndexReader *snapshot;
+  WatchBackend backend;
+  int watchFd;
+  // Devices of the file systems marked so far (fanotify).
+  dev_t *markedDevs;
+  size_t markedDevCount;
+  NodeTable byPath;
+  NodeTable byWatchKey;
+  // Directories to read again (paths are copies: nodes may be removed while
+  // queued).
+  char **dirtyPaths;
+  size_t dirtyCount;
+  size_t dirtyCapacity;
+  DirScanner scanner;
+  // Encodes the directories that are read again.
+  IndexBuilder encoder;
+  PathBuilder path;
+} Daemon;
+
+static DirNode *findDirNode(Daemon *daemon, const char *path, size_t pathLen) {
+  return findNode(&daemon->byPath, path, pathLen);
+}
+
+static DirNode *ensureDirNode(Daemon *daemon, const char *path,
+                              size_t pathLen) {
+  DirNode *node = findDirNode(daemon, path, pathLen);
+  if (node == NULL) {
+    node = (DirNode *)safemalloc(sizeof(DirNode));
+    node->path = (char *)safemalloc(pathLen + 1);
+    memcpy(node->path, path, pathLen);
+    node->path[pathLen] = '\0';
+    node->pathLen = pathLen;
+    node->entries = NULL;
+    node->watchKeyLen = 0;
+    node->isDirty = FALSE;
+    insertNode(&daemon->byPath, node);
+  }
+  return node;
+}
+
+/**
+ * Returns the current entries of the directory at the given path (NULL if the
+ * directory is unknown).
+ */
+static const IndexDir *findEntries(Daemon *daemon, const char *path,
+                                   size_t pathLen) {
+  DirNode *node = findDirNode(daemon, path, pathLen);
+  if (node != NULL && node->entries != NULL) {
+    return node->entries;
+  }
+  return findIndexDir(daemon->snapshot, path, pathLen);
+}
+
+static void markDirty(Daemon *daemon, DirNode *node) {
+  if (node->isDirty) {
+    return;
+  }
+  if (daemon->dirtyCount == daemon->dirtyCapacity) {
+    daemon->dirtyCapacity =
+        daemon->dirtyCapacity == 0 ? 64 : daemon->dirtyCapacity * 2;
+    daemon->dirtyPaths = (char **)realloc(
+        daemon->dirtyPaths, daemon->dirtyCapacity * sizeof(char *));
+    assertIt(daemon->dirtyPaths != NULL, "Could not allocate memory\n");
+  }
+  daemon->dirtyPaths[daemon->dirtyCount] = strdup(node->path);
+  assertIt(daemon->dirtyPaths[daemon->dirtyCount] != NULL,
+           "Could not allocate memory\n");
+  daemon->dirtyCount++;
+  node->isDirty = TRUE;
+}
+
+// ----------------------------------------------------------------------------
+// Watches
+
+/**
+ * Initializes the event source: fanotify if a file system mark can be placed
+ * on the root's file system, inotify otherwise.
+ */
+static int newWatchBackend(Daemon *daemon) {
+  daemon->markedDevs = NULL;
+  daemon->markedDevCount = 0;
+  daemon->watchFd =
+      fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK |
+                        FAN_REPORT_DFID_NAME,
+                    O_RDONLY | O_CLOEXEC);
+  if (daemon->watchFd >= 0) {
+    if (fanotify_mark(daemon->watchFd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                      FANOTIFY_MASK, AT_FDCWD,
+                      daemon->settings->rootPath) == 0) {
+      daemon->backend = WATCH_FANOTIFY;
+      logIt(daemon->settings->systemLogLevel, VERBOSE,
+            "Watching file system events through fanotify\n");
+      return 0;
+    }
+    close(daemon->watchFd);
+  }
+
+  daemon->backend = WATCH_INOTIFY;
+  daemon->watchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  logIt(daemon->settings->systemLogLevel, VERBOSE,
+        "Watching file system events through inotify\n");
+  return daemon->watchFd >= 0 ? 0 : -1;
+}
+
+/**
+ * Marks the file system of the given directory (fanotify), unless it already
+ * is.
+ */
+static int markFileSystem(Daemon *daemon, const DirNode *node,
+                          const struct stat *info) {
+  for (size_t i = 0; i < daemon->markedDevCount; i++) {
+    if (daemon->markedDevs[i] == info->st_dev) {
+      return 0;
+    }
+  }
+  // The root's file system was marked by newWatchBackend.
+  if (daemon->markedDevCount > 0 &&
+      fanotify_mark(daemon->watchFd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                    FANOTIFY_MASK, AT_FDCWD, node->path) != 0) {
+    return -1;
+  }
+  daemon->markedDevs = (dev_t *)realloc(
+      daemon->markedDevs, (daemon->markedDevCount + 1) * sizeof(dev_t));
+  assertIt(daemon->markedDevs != NULL, "Could not allocate memory\n");
+  daemon->markedDevs[daemon->markedDevCount++] = info->st_dev;
+  return 0;
+}
+
+/**
+ * Computes the key under which fanotify reports the events of the given
+ * directory (its file system id and file handle).
+ */
+static int fanotifyKey(const DirNode *node, unsigned char *key,
+                       size_t *keyLen) {
+  struct statfs fsInfo;
+  if (statfs(node->path, &fsInfo) != 0) {
+    return -1;
+  }
+  char handleBuffer[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+  struct file_handle *handle = (struct file_handle *)handleBuffer;
+  handle->handle_bytes = MAX_HANDLE_SZ;
+  int mountId;
+  if (name_to_handle_at(AT_FDCWD, node->path, handle, &mountId, 0) != 0) {
+    return -1;
+  }
+  memcpy(key, &fsInfo.f_fsid, sizeof(fsid_t));
+  memcpy(key + sizeof(fsid_t), &handle->handle_type, sizeof(int));
+  memcpy(key + sizeof(fsid_t) + sizeof(int), handle->f_handle,
+         handle->handle_bytes);
+  *keyLen = sizeof(fsid_t) + sizeof(int) + handle->handle_bytes;
+  return 0;
+}
+
+static void unwatchDir(Daemon *daemon, DirNode *node) {
+  if (node->watchKeyLen == 0) {
+    return;
+  }
+  removeNode(&daemon->byWatchKey, node);
+  if (daemon->backend == WATCH_INOTIFY) {
+    int wd;
+    memcpy(&wd, node->watchKey, sizeof(int));
+    inotify_rm_watch(daemon->watchFd, wd);
+  }
+  node->watchKeyLen = 0;
+}
+
+/**
+ * Starts watching the given directory (if it is not already). Returns 0 on
+ * success, -1 on error.
+ */
+static int watchDir(Daemon *daemon, DirNode *node) {
+  if (node->watchKeyLen > 0) {
+    return 0;
+  }
+  unsigned char key[MAX_WATCH_KEY_LEN];
+  size_t keyLen;
+  if (daemon->backend == WATCH_INOTIFY) {
+    int wd = inotify_add_watch(daemon->watchFd, node->path, INOTIFY_MASK);
+    if (wd < 0) {
+      return -1;
+    }
+    memcpy(key, &wd, sizeof(int));
+    keyLen = sizeof(int);
+  } else {
+    struct stat info;
+    if (stat(node->path, &info) != 0 || markFileSystem(daemon, node, &info) ||
+        fanotifyKey(node, key, &keyLen) != 0) {
+      return -1;
+    }
+  }
+
+  // The same key may still be assigned to a directory that was moved (and
+  // whose former parent has not been read again yet).
+  DirNode *previous = findNode(&daemon->byWatchKey, key, keyLen);
+  if (previous != NULL) {
+    removeNode(&daemon->byWatchKey, previous);
+    previous->watchKeyLen = 0;
+  }
+  memcpy(node->watchKey, key, keyLen);
+  node->watchKeyLen = keyLen;
+  insertNode(&daemon->byWatchKey, node);
+  return 0;
+}
+
+static void watchDirOrLog(Daemon *daemon, DirNode *node) {
+  if (watchDir(daemon, node) != 0) {
+    // A directory removed in the meantime is expected (its parent's event
+    // follows)
+    logIt(daemon->settings->systemLogLevel, errno == ENOENT ? VERBOSE : ERROR,
+          "Could not watch directory: %s (errno: %u)\n", node->path, errno);
+  }
+}
+
+/**
+ * Queues every known directory for being read again (events were lost).
+ */
+static void markAllDirty(Daemon *daemon) {
+  logIt(daemon->settings->systemLogLevel, VERBOSE,
+        "Event queue overflow: reading all directories again\n");
+  for (size_t i = 0; i < daemon->byPath.capacity; i++) {
+    if (daemon->byPath.nodes[i] != NULL) {
+      markDirty(daemon, daemon->byPath.nodes[i]);
+    }
+  }
+}
+
+static void handleInotifyEvents(Daemon *daemon, const char *buffer,
+                                ssize_t length) {
+  const char *cursor = buffer;
+  while (cursor < buffer + length) {
+    const struct inotify_event *event = (const struct inotify_event *)cursor;
+    cursor += sizeof(struct inotify_event) + event->len;
+    if (event->mask & IN_Q_OVERFLOW) {
+      markAllDirty(daemon);
+      continue;
+    }
+    DirNode *node = findNode(&daemon->byWatchKey, &event->wd, sizeof(int));
+    if (node == NULL) {
+      continue;
+    }
+    if (event->mask & IN_IGNORED) {
+      // The directory went away (or was replaced): reading it again tells
+      // which.
+      removeNode(&daemon->byWatchKey, node);
+      node->watchKeyLen = 0;
+    }
+    markDirty(daemon, node);
+  }
+}
+
+static void handleFanotifyEvents(Daemon *daemon, const char *buffer,
+                                 ssize_t length) {
+  const struct fanotify_event_metadata *event =
+      (const struct fanotify_event_metadata *)buffer;
+  size_t remaining = (size_t)length;
+  for (; FAN_EVENT_OK(event, remaining);
+       event = FAN_EVENT_NEXT(event, remaining)) {
+    if (event->mask & FAN_Q_OVERFLOW) {
+      markAllDirty(daemon);
+      continue;
+    }
+    const char *info = (const char *)event + event->metadata_len;
+    const char *end = (const char *)event + event->event_len;
+    while (info + sizeof(struct fanotify_event_info_header) <= end) {
+      const struct fanotify_event_info_fid *fid =
+          (const struct fanotify_event_info_fid *)info;
+      if (fid->hdr.len == 0) {
+        break;
+      }
+      info += fid->hdr.len;
+      if (fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME &&
+          fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID) {
+        continue;
+      }
+      const struct file_handle *handle =
+          (const struct file_handle *)fid->handle;
+      if (handle->handle_bytes > MAX_HANDLE_SZ) {
+        continue;
+      }
+      unsigned char key[MAX_WATCH_KEY_LEN];
+      memcpy(key, &fid->fsid, sizeof(fsid_t));
+      memcpy(key + sizeof(fsid_t), &handle->handle_type, sizeof(int));
+      memcpy(key + sizeof(fsid_t) + sizeof(int), handle->f_handle,
+             handle->handle_bytes);
+      DirNode *node =
+          findNode(&daemon->byWatchKey, key,
+                   sizeof(fsid_t) + sizeof(int) + handle->handle_bytes);
+      if (node != NULL) {
+        markDirty(daemon, node);
+      }
+    }
+  }
+}
+
+/**
+ * Reads all pending events, queuing the directories they refer to.
+ */
+static void readEvents(Daemon *daemon) {
+  // Aligned for the event structures.
+  static _Alignas(8) char buffer[EVENT_BUFFER_SIZE];
+  ssize_t length;
+  while ((length = read(daemon->watchFd, buffer, EVENT_BUFFER_SIZE)) > 0) {
+    if (daemon->backend == WATCH_INOTIFY) {
+      handleInotifyEvents(daemon, buffer, length);
+    } else {
+      handleFanotifyEvents(daemon, buffer, length);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Tree maintenance
+
+/**
+ * Forgets about the directory held by the daemon's PathBuilder, and about all
+ * directories below it.
+ */
+static void removeSubtree(Daemon *daemon) {
+  PathBuilder *path = &daemon->path;
+  const IndexDir *dir = findEntries(daemon, path->data, path->length);
+  if (dir != NULL) {
+    size_t pathLen = path->length;
+    const IndexEntry *entry = firstIndexEntry(dir);
+    for (uint32_t i = 0; i < dir->entryCount; i++) {
+      if (entry->type == DT_DIR) {
+        assertIt(appendPathComponent(path, indexEntryName(entry),
+                                     entry->nameLen) == 0,
+                 "Could not allocate memory\n");
+        removeSubtree(daemon);
+        truncatePath(path, pathLen);
+      }
+      entry = nextIndexEntry(entry);
+    }
+  }
+
+  DirNode *node = findDirNode(daemon, path->data, path->length);
+  if (node != NULL) {
+    logIt(daemon->settings->systemLogLevel, TRACE, "Directory removed: %s\n",
+          node->path);
+    unwatchDir(daemon, node);
+    removeNode(&daemon->byPath, node);
+    safefree(node->entries);
+    safefree(node->path);
+    safefree(node);
+  }
+}
+
+/**
+ * Returns TRUE if the given directory has the given sub-directory (same name
+ * and inode: a directory replaced by another one is a different directory).
+ */
+static bool hasSubdir(const IndexDir *dir, const IndexEntry *subdir) {
+  if (dir == NULL) {
+    return FALSE;
+  }
+  const IndexEntry *entry = firstIndexEntry(dir);
+  for (uint32_t i = 0; i < dir->entryCount; i++) {
+    if (entry->type == DT_DIR && entry->ino == subdir->ino &&
+        entry->nameLen == subdir->nameLen &&
+        memcmp(indexEntryName(entry), indexEntryName(subdir),
+               subdir->nameLen) == 0) {
+      return TRUE;
+    }
+    entry = nextIndexEntry(entry);
+  }
+  return FALSE;
+}
+
+static IndexDir *noEntries(Daemon *daemon, const DirNode *node) {
+  struct stat info;
+  memset(&info, 0, sizeof(struct stat));
+  beginIndexDir(&daemon->encoder, node->path, node->pathLen, &info);
+  endIndexDir(&daemon->encoder);
+  return takeIndexDir(&daemon->encoder);
+}
+
+/**
+ * Reads the entries of the given directory.
+ */
+static IndexDir *readEntries(Daemon *daemon, const DirNode *node) {
+  DirScanner *scanner = &daemon->scanner;
+  if (openDirScan(scanner, AT_FDCWD, node->path) != 0) {
+    // The directory is gone (its parent will be read again as well).
+    return noEntries(daemon, node);
+  }
+
+  struct stat info;
+
+  fstat(scanner->fd, &info);
+  beginIndexDir(&daemon->encoder, node->path, node->pathLen, &info);
+  DirEntry entry;
+  while (nextDirEntry(scanner, &entry) > 0) {
+    unsigned char type = resolveDirEntryType(scanner, &entry);
+    if ((type == DT_REG || type == DT_LNK || type == DT_DIR) &&
+        !isDotDirEntry(&entry)) {
+      addIndexEntry(&daemon->encoder, entry.name, entry.nameLen, type,
+                    entry.ino);
+    }
+  }
+  closeDirScan(scanner);
+  endIndexDir(&daemon->encoder);
+  return takeIndexDir(&daemon->encoder);
+}
+
+/**
+ * Reads the given directory again: sub-directories that disappeared are
+ * forgotten, new ones are watched and queued for being read.
+ */
+static void refreshDir(Daemon *daemon, DirNode *node) {
+  logIt(daemon->settings->systemLogLevel, TRACE, "Reading directory: %s\n",
+        node->path);
+  // Watching before reading, so that no modification goes unnoticed.
+  watchDirOrLog(daemon, node);
+  IndexDir *entries = readEntries(daemon, node);
+  const IndexDir *previous = findEntries(daemon, node->path, node->pathLen);
+
+  PathBuilder *path = &daemon->path;
+  if (daemon->settings->isRecursive) {
+    assertIt(setPath(path, node->path, node->pathLen) == 0,
+             "Could not allocate memory\n");
+    if (previous != NULL) {
+      const IndexEntry *entry = firstIndexEntry(previous);
+      for (uint32_t i = 0; i < previous->entryCount; i++) {
+        if (entry->type == DT_DIR && !hasSubdir(entries, entry)) {
+          assertIt(appendPathComponent(path, indexEntryName(entry),
+                                       entry->nameLen) == 0,
+                   "Could not allocate memory\n");
+          removeSubtree(daemon);
+          truncatePath(path, node->pathLen);
+        }
+        entry = nextIndexEntry(entry);
+      }
+    }
+
+    const IndexEntry *entry = firstIndexEntry(entries);
+    for (uint32_t i = 0; i < entries->entryCount; i++) {
+      if (entry->type == DT_DIR && !hasSubdir(previous, entry)) {
+        assertIt(appendPathComponent(path, indexEntryName(entry),
+                                     entry->nameLen) == 0,
+                 "Could not allocate memory\n");
+        DirNode *subdir = ensureDirNode(daemon, path->data, path->length);
+        // Hiding what the snapshot may hold about a former directory of that
+        // name until the directory is read.
+        safefree(subdir->entries);
+        subdir->entries = noEntries(daemon, subdir);
+        markDirty(daemon, subdir);
+        truncatePath(path, node->pathLen);
+      }
+      entry = nextIndexEntry(entry);
+    }
+  }
+
+  safefree(node->entries);
+  node->entries = entries;
+}
+
+/**
+ * Reads the queued directories again (until no more are queued).
+ */
+static void refreshDirtyDirs(Daemon *daemon) {
+  while (daemon->dirtyCount > 0) {
+    char *path = daemon->dirtyPaths[--daemon->dirtyCount];
+    DirNode *node = findDirNode(daemon, path, strlen(path));
+    if (node != NULL) {
+      node->isDirty = FALSE;
+      refreshDir(daemon, node);
+    }
+    safefree(path);
+  }
+}
+
+/**
+ * Creates the nodes of the directory held by the daemon's PathBuilder and of
+ * the directories below it (as recorded in the snapshot), watching them.
+ * Directories that changed since the snapshot was taken are queued for being
+ * read again.
+ */
+static void watchSnapshot(Daemon *daemon) {
+  PathBuilder *path = &daemon->path;
+  DirNode *node = ensureDirNode(daemon, path->data, path->length);
+  watchDirOrLog(daemon, node);
+  const IndexDir *dir =
+      findIndexDir(daemon->snapshot, path->data, path->length);
+  struct stat info;
+  if (dir == NULL || stat(path->data, &info) != 0 ||
+      !isIndexDirCurrent(dir, &info)) {
+    markDirty(daemon, node);
+  }
+  if (dir == NULL || !daemon->settings->isRecursive) {
+    return;
+  }
+
+  size_t pathLen = path->length;
+  const IndexEntry *entry = firstIndexEntry(dir);
+  for (uint32_t i = 0; i < dir->entryCount; i++) {
+    if (entry->type == DT_DIR) {
+      assertIt(appendPathComponent(path, indexEntryName(entry),
+                                   entry->nameLen) == 0,
+               "Could not allocate memory\n");
+      watchSnapshot(daemon);
+      truncatePath(path, pathLen);
+    }
+    entry = nextIndexEntry(entry);
+  }
+}
+
+// ----------------------------------------------------------------------------
+// Queries
+
+/**
+ * Holds the state of the query being answered.
+ */
+typedef struct _Query {
+  MatcherSet patterns;
+  OutputSink sink;
+  OutputBuffer output;
+  RecordWriter records;
+} Query;
+
+static void outputQueryMatch(Daemon *daemon, Query *query,
+                             const IndexEntry *entry) {
+  PathBuilder *path = &daemon->path;
+  if (daemon->settings->outputFormat == RECORD_TEXT) {
+    struct iovec line[] = {
+        {.iov_base = path->data, .iov_len = path->length},
+        {.iov_base = "\n", .iov_len = 1}};
+    writeOutputLine(&query->output, line, 2);
+    return;
+  }
+  FileRecord record;
+  memset(&record, 0, sizeof(FileRecord));
+  record.name = path->data;
+  record.nameLen = path->length;
+  record.fields = RECORD_HAS_INODE;
+  record.info.st_mode = DTTOIF(entry->type);
+  record.info.st_ino = (ino_t)entry->ino;
+  assertIt(writeRecord(&query->records, &record) == 0,
+           "Could not allocate memory\n");
+}
+
+/**
+ * Matches the entries of the directory held by the daemon's PathBuilder (and
+ * of the directories below it) against the query's patterns.
+ */
+static void answerQuery(Daemon *daemon, Query *query) {
+  PathBuilder *path = &daemon->path;
+  const IndexDir *dir = findEntries(daemon, path->data, path->length);
+  if (dir == NULL) {
+    return;
+  }
+  size_t pathLen = path->length;
+  const IndexEntry *entry = firstIndexEntry(dir);
+  for (uint32_t i = 0; i < dir->entryCount; i++) {
+    bool isDir = entry->type == DT_DIR;
+    if (isDir ? daemon->settings->isRecursive
+              : matchAnyPattern(&query->patterns, indexEntryName(entry),
+                                entry->nameLen) >= 0) {
+      assertIt(appendPathComponent(path, indexEntryName(entry),
+                                   entry->nameLen) == 0,
+               "Could not allocate memory\n");
+      if (isDir) {
+        answerQuery(daemon, query);
+      } else {
+        outputQueryMatch(daemon, query, entry);
+      }
+      truncatePath(path, pathLen);
+    }
+    entry = nextIndexEntry(entry);
+  }
+}
+
+/**
+ * A client whose query is being read: its socket is non-blocking, and polled
+ * along with the watch descriptor, so that a slow client does not hold the
+ * other clients and the events up.
+ */
+typedef struct _Client {
+  int fd;
+  // The query received so far (MAX_QUERY_SIZE + 1 bytes, null-terminated).
+  char *request;
+  size_t length;
+  // Time (CLOCK_MONOTONIC, in milliseconds) past which the client is dropped.
+  int64_t deadline;
+} Client;
+
+static int64_t nowMs(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (int64_t)time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+static void newClient(Client *client, int fd) {
+  client->fd = fd;
+  client->request = (char *)safemalloc(MAX_QUERY_SIZE + 1);
+  client->request[0] = '\0';
+  client->length = 0;
+  client->deadline = nowMs() + CLIENT_TIMEOUT_SEC * 1000;
+}
+
+static void closeClient(Client *client) {
+  close(client->fd);
+  safefree(client->request);
+  client->request = NULL;
+}
+
+/**
+ * Reads what the given client sent so far, without blocking. Returns 1 once
+ * the query is complete (up to an empty line or to the end of the stream), 0
+ * if more is expected and -1 on error or if the query is too large.
+ */
+static int readQuery(Client *client) {
+  while (client->length < MAX_QUERY_SIZE) {
+    ssize_t count = read(client->fd, client->request + client->length,
+                         MAX_QUERY_SIZE - client->length);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    if (count == 0) {
+      return 1;
+    }
+    client->length += (size_t)count;
+    client->request[client->length] = '\0';
+    if (client->request[0] == '\n' ||
+        strstr(client->request, "\n\n") != NULL) {
+      return 1;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Compiles the patterns of the given (complete) query: one per line, up to an
+ * empty line or to its end. Returns 0 on success.
+ */
+static int parseQuery(char *request, MatcherSet *patterns) {
+  int status = 0;
+  char *line = request;
+  while (status == 0 && *line != '\0' && *line != '\n') {
+    char *end = strchr(line, '\n');
+    if (end != NULL) {
+      *end = '\0';
+    }
+    status = addPattern(patterns, line);
+    line = end != NULL ? end + 1 : line + strlen(line);
+  }
+  return status;
+}
+
+static void serveClient(Daemon *daemon, Client *client) {
+  // The reply is written in blocking mode, each write being bounded by the
+  // timeout
+  int flags = fcntl(client->fd, F_GETFL);
+  fcntl(client->fd, F_SETFL, flags & ~O_NONBLOCK);
+  struct timeval timeout = {.tv_sec = CLIENT_TIMEOUT_SEC, .tv_usec = 0};
+  setsockopt(client->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  Query query;
+  newMatcherSet(&query.patterns);
+  if (parseQuery(client->request, &query.patterns) != 0) {
+    logIt(daemon->settings->systemLogLevel, ERROR, "Invalid query\n");
+    destroyMatcherSet(&query.patterns);
+    return;
+  }
+
+  // Applying the pending events first, so that the reply reflects every
+  // modification reported so far.
+  readEvents(daemon);
+  refreshDirtyDirs(daemon);
+
+  assertIt(newOutputSink(&query.sink, client->fd) == 0,
+           "Could not initialize output\n");
+  assertIt(newOutputBuffer(&query.output, &query.sink, OUTPUT_BUFFER_SIZE) ==
+               0,
+           "Could not allocate output buffer\n");
+  newRecordWriter(&query.records, &query.output,
+                  daemon->settings->outputFormat);
+  writeRecordStreamHeader(&query.records);
+  if (query.patterns.count > 0) {
+    const char *rootPath = daemon->settings->rootPath;
+    assertIt(setPath(&daemon->path, rootPath, strlen(rootPath)) == 0,
+             "Could not allocate memory\n");
+    answerQuery(daemon, &query);
+  }
+  destroyRecordWriter(&query.records);
+  destroyOutputBuffer(&query.output);
+  destroyOutputSink(&query.sink);
+  destroyMatcherSet(&query.patterns);
+}
+
+/**
+ * Reads from the pending clients which sent data (as reported by poll, in
+ * the given descriptors), serving those whose query is complete and dropping
+ * those past their deadline. Returns the number of clients still pending.
+ */
+static size_t serveClients(Daemon *daemon, Client *clients, size_t count,
+                           const struct pollfd *fds) {
+  int64_t now = nowMs();
+  // Backwards, as clients are removed by moving the last one in their place
+  for (size_t i = count; i-- > 0;) {
+    Client *client = &clients[i];
+    int status = fds[i].revents != 0 ? readQuery(client) : 0;
+    if (status == 0 && now < client->deadline) {
+      continue;
+    }
+    if (status > 0) {
+      serveClient(daemon, client);
+    } else {
+      logIt(daemon->settings->systemLogLevel, ERROR,
+            status < 0 ? "Invalid query\n" : "Query timed out\n");
+    }
+    closeClient(client);
+    clients[i] = clients[--count];
+  }
+  return count;
+}
+
+// ----------------------------------------------------------------------------
+// Entry points
+
+static int listenOn(const char *socketPath) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(socketPath) >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(address.sun_path, socketPath);
+
+  // Non-blocking, in case a connection is reset before being accepted
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  unlink(socketPath);
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+uint8_t runDaemon(const DaemonSettings *settings, const IndexReader *snapshot) {
+  Daemon daemon;
+  memset(&daemon, 0, sizeof(Daemon));
+  daemon.settings = settings;
+  daemon.snapshot = snapshot;
+  if (newWatchBackend(&daemon) != 0) {
+    logIt(settings->systemLogLevel, ERROR,
+          "Could not initialize file system events (errno: %u)\n", errno);
+    return EXIT_FAILURE;
+  }
+  int listenFd = listenOn(settings->socketPath);
+  if (listenFd < 0) {
+    logIt(settings->systemLogLevel, ERROR,
+          "Could not listen on socket: %s (errno: %u)\n", settings->socketPath,
+          errno);
+    close(daemon.watchFd);
+    return EXIT_FAILURE;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onInterrupt;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  // Clients closing their connection early must not terminate the daemon.
+  signal(SIGPIPE, SIG_IGN);
+
+  newNodeTable(&daemon.byPath, TABLE_BY_PATH);
+  newNodeTable(&daemon.byWatchKey, TABLE_BY_WATCH_KEY);
+  assertIt(newDirScanner(&daemon.scanner, DIR_SCAN_BUFFER_SIZE) == 0,
+           "Could not allocate directory scanner\n");
+  assertIt(newPathBuilder(&daemon.path, PATH_BUILDER_CAPACITY) == 0,
+           "Could not allocate path builder\n");
+  newIndexBuilder(&daemon.encoder, NULL);
+
+  assertIt(setPath(&daemon.path, settings->rootPath,
+                   strlen(settings->rootPath)) == 0,
+           "Could not allocate memory\n");
+  watchSnapshot(&daemon);
+  refreshDirtyDirs(&daemon);
+  logIt(settings->systemLogLevel, VERBOSE,
+        "Watching %zu directories, serving queries on %s\n",
+        daemon.byPath.count, settings->socketPath);
+
+  Client clients[MAX_PENDING_CLIENTS];
+  size_t clientCount = 0;
+  struct pollfd fds[2 + MAX_PENDING_CLIENTS];
+  while (!isInterrupted) {
+    fds[0] = (struct pollfd){.fd = daemon.watchFd, .events = POLLIN};
+    // A negative descriptor is ignored by poll
+    fds[1] = (struct pollfd){
+        .fd = clientCount < MAX_PENDING_CLIENTS ? listenFd : -1,
+        .events = POLLIN};
+    // Waking up at the earliest deadline of the pending clients
+    int timeout = -1;
+    int64_t now = nowMs();
+    for (size_t i = 0; i < clientCount; i++) {
+      fds[2 + i] = (struct pollfd){.fd = clients[i].fd, .events = POLLIN};
+      int64_t remaining = clients[i].deadline - now;
+      remaining = remaining < 0 ? 0 : remaining;
+      timeout = timeout < 0 || remaining < timeout ? (int)remaining : timeout;
+    }
+    if (poll(fds, 2 + clientCount, timeout) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      logIt(settings->systemLogLevel, ERROR, "poll failed (errno: %u)\n",
+            errno);
+      break;
+    }
+    if (fds[0].revents & POLLIN) {
+      readEvents(&daemon);
+      refreshDirtyDirs(&daemon);
+    }
+    clientCount = serveClients(&daemon, clients, clientCount, fds + 2);
+    if (fds[1].revents & POLLIN) {
+      int clientFd =
+          accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (clientFd >= 0) {
+        newClient(&clients[clientCount++], clientFd);
+      }
+    }
+  }
+
+  logIt(settings->systemLogLevel, VERBOSE, "Shutting down\n");
+  for (size_t i = 0; i < clientCount; i++) {
+    closeClient(&clients[i]);
+  }
+  close(listenFd);
+  unlink(settings->socketPath);
+  close(daemon.watchFd);
+  for (size_t i = 0; i < daemon.byPath.capacity; i++) {
+    DirNode *node = daemon.byPath.nodes[i];
+    if (node != NULL) {
+      safefree(node->entries);
+      safefree(node->path);
+      safefree(node);
+    }
+  }
+  for (size_t i = 0; i < daemon.dirtyCount; i++) {
+    safefree(daemon.dirtyPaths[i]);
+  }
+  safefree(daemon.dirtyPaths);
+  safefree(daemon.markedDevs);
+  destroyNodeTable(&daemon.byPath);
+  destroyNodeTable(&daemon.byWatchKey);
+  destroyDirScanner(&daemon.scanner);
+  destroyPathBuilder(&daemon.path);
+  destroyIndexBuilder(&daemon.encoder);
+  return EXIT_SUCCESS;
+}
+
+/**
+ * Writes the given bytes to the given file descriptor, retrying on partial
+ * writes.
+ */
+static int writeAll(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += written;
+    length -= (size_t)written;
+  }
+  return 0;
+}
+
+uint8_t queryDaemon(const char *socketPath, const MatcherSet *patterns,
+                    LogLevel systemLogLevel) {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(socketPath) >= sizeof(address.sun_path)) {
+    logIt(systemLogLevel, ERROR, "Socket path too long: %s\n", socketPath);
+    return EXIT_FAILURE;
+  }
+  strcpy(address.sun_path, socketPath);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0 ||
+      connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    logIt(systemLogLevel, ERROR, "Could not connect to: %s (errno: %u)\n",
+          socketPath, errno);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return EXIT_FAILURE;
+  }
+
+  uint8_t exitCode = EXIT_SUCCESS;
+  for (uint32_t i = 0; i < patterns->count && exitCode == EXIT_SUCCESS; i++) {
+    const char *pattern = patterns->matchers[i].pattern;
+    if (strchr(pattern, '\n') != NULL ||
+        writeAll(fd, pattern, strlen(pattern)) != 0 ||
+        writeAll(fd, "\n", 1) != 0) {
+      exitCode = EXIT_FAILURE;
+    }
+  }
+  if (exitCode == EXIT_SUCCESS && writeAll(fd, "\n", 1) != 0) {
+    exitCode = EXIT_FAILURE;
+  }
+  shutdown(fd, SHUT_WR);
+
+  char buffer[OUTPUT_BUFFER_SIZE];
+  ssize_t count;
+  while (exitCode == EXIT_SUCCESS &&
+         (count = read(fd, buffer, sizeof(buffer))) != 0) {
+    if (count < 0) {
+      if (errno != EINTR) {
+        exitCode = EXIT_FAILURE;
+      }
+      continue;
+    }
+    if (writeAll(STDOUT_FILENO, buffer, (size_t)count) != 0) {
+      exitCode = EXIT_FAILURE;
+    }
+  }
+  if (exitCode != EXIT_SUCCESS) {
+    logIt(systemLogLevel, ERROR, "Query failed (errno: %u)\n", errno);
+  }
+  close(fd);
+  return exitCode;
+}
@@ -0,0 +1,56 @@
+#ifndef MY_DAEMON_H
+#define MY_DAEMON_H
+
+#include "my-index.h"
+#include "my-match.h"
+#include "my-record.h"
+#include "my-util.h"
+
+// Upper bound on the size of a query (patterns and separators).
+#define MAX_QUERY_SIZE (64 * 1024)
+
+/**
+ * Holds the parameters of watch mode.
+ */
+typedef struct _DaemonSettings {
+  // The directory to keep track of (as passed on the command line).
+  const char *rootPath;
+  bool isRecursive;
+  // Format of the query results.
+  RecordFormat outputFormat;
+  LogLevel systemLogLevel;
+  // Path of the Unix socket on which queries are served.
+  const char *socketPath;
+} DaemonSettings;
+
+/**
+ * Serves pattern queries over a Unix socket until interrupted (SIGINT or
+ * SIGTERM), keeping track of the tree rooted at the given path through file
+ * system events.
+ *
+ * The tree starts out as the given snapshot (the index built by an initial
+ * traversal), on top of which the directories that changed since then are
+ * kept in memory: whenever an event is reported for a directory, the
+ * directory is read again. Events are obtained through fanotify (one mark per
+ * file system, which requires CAP_SYS_ADMIN) if possible, and through one
+ * inotify watch per directory otherwise.
+ *
+ * Protocol: a client sends one pattern per line, followed by an empty line (or
+ * by shutting down its side of the connection); the daemon replies with the
+ * matching files (in the configured format) and closes the connection.
+ * Queries are read without blocking, from several clients at once: a client
+ * which does not complete its query within a few seconds is dropped.
+ *
+ * Returns EXIT_SUCCESS once interrupted, EXIT_FAILURE if the daemon could not
+ * be started.
+ */
+uint8_t runDaemon(const DaemonSettings *settings, const IndexReader *snapshot);
+
+/**
+ * Sends the given patterns to the daemon listening on the given socket,
+ * copying its reply to stdout. Returns EXIT_SUCCESS on success.
+ */
+uint8_t queryDaemon(const char *socketPath, const MatcherSet *patterns,
+                    LogLevel systemLogLevel);
+
+#endif
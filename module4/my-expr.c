@@ -0,0 +1,549 @@
+#define _GNU_SOURCE
+
+#include "my-expr.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+// Cost of a predicate that needs the file's metadata (predicates on the name
+// cost 1 to 1 + MATCH_FNMATCH, those on the type and depth 0).
+#define STAT_PREDICATE_COST 100
+
+#define SECONDS_PER_DAY 86400
+
+/**
+ * Holds the state of the expression being parsed (recursive descent, one
+ * function per precedence level).
+ */
+typedef struct _Parser {
+  const char *cursor;
+  time_t now;
+  uint32_t depth;
+  char *error;
+  size_t errorLen;
+  bool hasFailed;
+} Parser;
+
+static void setError(Parser *parser, const char *format, ...) {
+  if (parser->hasFailed) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  vsnprintf(parser->error, parser->errorLen, format, args);
+  va_end(args);
+  parser->hasFailed = TRUE;
+}
+
+static Expr *newExpr(ExprKind kind) {
+  Expr *expr = (Expr *)safemalloc(sizeof(Expr));
+  memset(expr, 0, sizeof(Expr));
+  expr->kind = kind;
+  return expr;
+}
+
+void destroyExpr(Expr *expr) {
+  if (expr == NULL) {
+    return;
+  }
+  switch (expr->kind) {
+  case EXPR_AND:
+  case EXPR_OR:
+  case EXPR_NOT:
+    for (uint32_t i = 0; i < expr->operator.count; i++) {
+      destroyExpr(expr->operator.operands[i]);
+    }
+    safefree(expr->operator.operands);
+    break;
+  case EXPR_NAME:
+    destroyMatcher(&expr->matcher);
+    break;
+  default:
+    break;
+  }
+  safefree(expr);
+}
+
+// ----------------------------------------------------------------------------
+// Tokens
+
+static void skipSpaces(Parser *parser) {
+  while (isspace((unsigned char)*parser->cursor)) {
+    parser->cursor++;
+  }
+}
+
+/**
+ * Returns the length of the next keyword (predicate name, operator or
+ * parenthesis), 0 at the end of the expression. The keyword is not consumed.
+ */
+static size_t peekKeyword(Parser *parser) {
+  skipSpaces(parser);
+  const char *end = parser->cursor;
+  if (*end == '(' || *end == ')') {
+    return 1;
+  }
+  while (*end != '\0' && !isspace((unsigned char)*end) && *end != '(' &&
+         *end != ')') {
+    end++;
+  }
+  return (size_t)(end - parser->cursor);
+}
+
+static bool isKeyword(const Parser *parser, size_t length,
+                      const char *keyword) {
+  return length == strlen(keyword) &&
+         strncmp(parser->cursor, keyword, length) == 0;
+}
+
+/**
+ * Consumes the next argument, which extends to the next whitespace or closing
+ * parenthesis (backslashes escape both, as in globs). Returns a copy of it, or
+ * NULL if there is none.
+ */
+static char *readArgument(Parser *parser) {
+  skipSpaces(parser);
+  const char *end = parser->cursor;
+  while (*end != '\0' && !isspace((unsigned char)*end) && *end != ')') {
+    if (*end == '\\' && end[1] != '\0') {
+      end++;
+    }
+    end++;
+  }
+  size_t length = (size_t)(end - parser->cursor);
+  if (length == 0) {
+    return NULL;
+  }
+  char *argument = (char *)safemalloc(length + 1);
+  memcpy(argument, parser->cursor, length);
+  argument[length] = '\0';
+  parser->cursor = end;
+  return argument;
+}
+
+// ----------------------------------------------------------------------------
+// Predicates
+
+/**
+ * Parses "[+|-]N" followed by an optional unit suffix (only allowed if units
+ * is not NULL: one character per unit, from the smallest).
+ */
+static int parseNumber(Expr *expr, const char *argument, const char *units) {
+  const char *cursor = argument;
+  expr->number.comparison = COMPARE_EQUAL;
+  if (*cursor == '+') {
+    expr->number.comparison = COMPARE_GREATER;
+    cursor++;
+  } else if (*cursor == '-') {
+    expr->number.comparison = COMPARE_LESS;
+    cursor++;
+  }
+  if (!isdigit((unsigned char)*cursor)) {
+    return -1;
+  }
+  char *end;
+  expr->number.value = strtoull(cursor, &end, 10);
+  expr->number.unit = 1;
+  if (*end != '\0' && units != NULL && end[1] == '\0') {
+    const char *unit = strchr(units, *end);
+    if (unit == NULL) {
+      return -1;
+    }
+    expr->number.unit = (uint64_t)1 << (10 * (unit - units));
+    end++;
+  }
+  return *end == '\0' ? 0 : -1;
+}
+
+static int parsePerm(Expr *expr, const char *argument) {
+  const char *cursor = argument;
+  expr->perm.match = PERM_EXACT;
+  if (*cursor == '-') {
+    expr->perm.match = PERM_ALL;
+    cursor++;
+  } else if (*cursor == '/') {
+    expr->perm.match = PERM_ANY;
+    cursor++;
+  }
+  if (*cursor < '0' || *cursor > '7') {
+    return -1;
+  }
+  char *end;
+  unsigned long mode = strtoul(cursor, &end, 8);
+  if (*end != '\0' || mode > 07777) {
+    return -1;
+  }
+  expr->perm.mode = (uint32_t)mode;
+  return 0;
+}
+
+static int parseArgument(Parser *parser, Expr *expr, const char *argument) {
+  switch (expr->kind) {
+  case EXPR_NAME:
+    assertIt(compileMatcher(&expr->matcher, argument) == 0,
+             "Could not compile pattern: %s\n", argument);
+    expr->cost = 1 + expr->matcher.kind;
+    return 0;
+  case EXPR_TYPE:
+    if (strcmp(argument, "f") == 0) {
+      expr->type = DT_REG;
+    } else if (strcmp(argument, "l") == 0) {
+      expr->type = DT_LNK;
+    } else {
+      return -1;
+    }
+    return 0;
+  case EXPR_DEPTH:
+    return parseNumber(expr, argument, NULL);
+  case EXPR_SIZE:
+    expr->statxMask = STATX_SIZE;
+    return parseNumber(expr, argument, "ckMG");
+  case EXPR_MTIME:
+    expr->statxMask = STATX_MTIME;
+    expr->number.now = parser->now;
+    return parseNumber(expr, argument, NULL);
+  case EXPR_UID:
+    expr->statxMask = STATX_UID;
+    return parseNumber(expr, argument, NULL);
+  case EXPR_PERM:
+    expr->statxMask = STATX_MODE;
+    return parsePerm(expr, argument);
+  default:
+    return -1;
+  }
+}
+
+static Expr *parsePredicate(Parser *parser, size_t length) {
+  static const struct {
+    const char *keyword;
+    ExprKind kind;
+  } predicates[] = {{"name", EXPR_NAME},   {"type", EXPR_TYPE},
+                    {"depth", EXPR_DEPTH}, {"size", EXPR_SIZE},
+                    {"mtime", EXPR_MTIME}, {"uid", EXPR_UID},
+                    {"perm", EXPR_PERM}};
+  for (size_t i = 0; i < sizeof(predicates) / sizeof(predicates[0]); i++) {
+    if (!isKeyword(parser, length, predicates[i].keyword)) {
+      continue;
+    }
+    parser->cursor += length;
+    char *argument = readArgument(parser);
+    if (argument == NULL) {
+      setError(parser, "Missing argument for: %s", predicates[i].keyword);
+      return NULL;
+    }
+    Expr *expr = newExpr(predicates[i].kind);
+    if (parseArgument(parser, expr, argument) != 0) {
+      setError(parser, "Invalid argument for %s: %s", predicates[i].keyword,
+               argument);
+      destroyExpr(expr);
+      expr = NULL;
+    } else if (expr->statxMask != 0) {
+      expr->cost = STAT_PREDICATE_COST;
+    }
+    safefree(argument);
+    return expr;
+  }
+  if (length == 0) {
+    setError(parser, "Unexpected end of expression");
+  } else {
+    setError(parser, "Unknown predicate: %.*s", (int)length, parser->cursor);
+  }
+  return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// Operators
+
+/**
+ * Appends the given operand to the given operator node (flattening nested
+ * AND/OR nodes of the same kind).
+ */
+static void addOperand(Expr *expr, Expr *operand) {
+  if (operand->kind == expr->kind && expr->kind != EXPR_NOT) {
+    for (uint32_t i = 0; i < operand->operator.count; i++) {
+      addOperand(expr, operand->operator.operands[i]);
+    }
+    operand->operator.count = 0;
+    destroyExpr(operand);
+    return;
+  }
+  expr->operator.operands = (Expr **)realloc(
+      expr->operator.operands, (expr->operator.count + 1) * sizeof(Expr *));
+  assertIt(expr->operator.operands != NULL, "Could not allocate memory\n");
+  expr->operator.operands[expr->operator.count++] = operand;
+}
+
+/**
+ * Sorts the operands of the given AND/OR node from cheapest to most expensive
+ * (a stable insertion sort: operands are few), and computes the node's cost
+ * and statx mask.
+ */
+static void sortOperands(Expr *expr) {
+  Expr **operands = expr->operator.operands;
+  for (uint32_t i = 1; i < expr->operator.count; i++) {
+    Expr *operand = operands[i];
+    uint32_t j = i;
+    for (; j > 0 && operands[j - 1]->cost > operand->cost; j--) {
+      operands[j] = operands[j - 1];
+    }
+    operands[j] = operand;
+  }
+  for (uint32_t i = 0; i < expr->operator.count; i++) {
+    expr->cost += operands[i]->cost;
+    expr->statxMask |= operands[i]->statxMask;
+  }
+}
+
+static Expr *parseOr(Parser *parser);
+
+static Expr *parseUnary(Parser *parser) {
+  if (++parser->depth > MAX_EXPR_DEPTH) {
+    setError(parser, "Expression nested too deeply");
+    return NULL;
+  }
+  Expr *expr = NULL;
+  size_t length = peekKeyword(parser);
+  if (isKeyword(parser, length, "not")) {
+    parser->cursor += length;
+    Expr *operand = parseUnary(parser);
+    if (operand != NULL) {
+      expr = newExpr(EXPR_NOT);
+      addOperand(expr, operand);
+      sortOperands(expr);
+    }
+  } else if (isKeyword(parser, length, "(")) {
+    parser->cursor += length;
+    expr = parseOr(parser);
+    length = peekKeyword(parser);
+    if (expr != NULL && !isKeyword(parser, length, ")")) {
+      setError(parser, "Missing closing parenthesis");
+      destroyExpr(expr);
+      expr = NULL;
+    }
+    parser->cursor += length;
+  } else {
+    expr = parsePredicate(parser, length);
+  }
+  parser->depth--;
+  return expr;
+}
+
+static Expr *parseAnd(Parser *parser) {
+  Expr *expr = parseUnary(parser);
+  Expr *node = NULL;
+  while (expr != NULL) {
+    size_t length = peekKeyword(parser);
+    if (length == 0 || isKeyword(parser, length, ")") ||
+        isKeyword(parser, length, "or")) {
+      break;
+    }
+    if (isKeyword(parser, length, "and")) {
+      parser->cursor += length;
+    }
+    Expr *operand = parseUnary(parser);
+    if (operand == NULL) {
+      destroyExpr(node != NULL ? node : expr);
+      return NULL;
+    }
+    if (node == NULL) {
+      node = newExpr(EXPR_AND);
+      addOperand(node, expr);
+      expr = node;
+    }
+    addOperand(node, operand);
+  }
+  if (node != NULL) {
+    sortOperands(node);
+  }
+  return expr;
+}
+
+static Expr *parseOr(Parser *parser) {
+  Expr *expr = parseAnd(parser);
+  Expr *node = NULL;
+  while (expr != NULL) {
+    size_t length = peekKeyword(parser);
+    if (!isKeyword(parser, length, "or")) {
+      break;
+    }
+    parser->cursor += length;
+    Expr *operand = parseAnd(parser);
+    if (operand == NULL) {
+      destroyExpr(node != NULL ? node : expr);
+      return NULL;
+    }
+    if (node == NULL) {
+      node = newExpr(EXPR_OR);
+      addOperand(node, expr);
+      expr = node;
+    }
+    addOperand(node, operand);
+  }
+  if (node != NULL) {
+    sortOperands(node);
+  }
+  return expr;
+}
+
+Expr *compileExpr(const char *text, time_t now, char *error, size_t errorLen) {
+  Parser parser = {.cursor = text,
+                   .now = now,
+                   .depth = 0,
+                   .error = error,
+                   .errorLen = errorLen,
+                   .hasFailed = FALSE};
+  Expr *expr = parseOr(&parser);
+  if (expr != NULL && peekKeyword(&parser) != 0) {
+    setError(&parser, "Unexpected token: %s", parser.cursor);
+    destroyExpr(expr);
+    return NULL;
+  }
+  return expr;
+}
+
+// ----------------------------------------------------------------------------
+// Evaluation
+
+void newExprFile(ExprFile *file, unsigned int statxMask, int dirFd,
+                 const char *name, size_t nameLen, unsigned char type,
+                 uint32_t depth) {
+  file->dirFd = dirFd;
+  file->name = name;
+  file->nameLen = nameLen;
+  file->type = type;
+  file->depth = depth;
+  file->statxMask = statxMask;
+  file->hasStat = FALSE;
+  file->statMask = 0;
+}
+
+bool hasStatFields(ExprFile *file, unsigned int fields) {
+  if (!file->hasStat) {
+    struct statx info;
+    file->hasStat = TRUE;
+    if (statx(file->dirFd, file->name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+              file->statxMask, &info) == 0) {
+      file->statMask = info.stx_mask;
+      file->size = info.stx_size;
+      file->mtimeSec = info.stx_mtime.tv_sec;
+      file->uid = info.stx_uid;
+      file->mode = info.stx_mode;
+      file->blocks = info.stx_blocks;
+      file->nlink = info.stx_nlink;
+      file->ino = info.stx_ino;
+      file->dev = makedev(info.stx_dev_major, info.stx_dev_minor);
+    }
+  }
+  return (file->statMask & fields) == fields;
+}
+
+static bool compareNumber(const Expr *expr, int64_t value) {
+  int64_t reference = (int64_t)expr->number.value;
+  switch (expr->number.comparison) {
+  case COMPARE_GREATER:
+    return value > reference;
+  case COMPARE_LESS:
+    return value < reference;
+  default:
+    return value == reference;
+  }
+}
+
+/**
+ * Holds constants corresponding to the outcomes of evaluating a node: a
+ * predicate on metadata that could not be obtained is unknown, which its
+ * operators propagate (three-valued logic: "not unknown" is unknown, "false
+ * and unknown" is false, "true or unknown" is true).
+ */
+typedef enum _ExprResult {
+  RESULT_FALSE = 0,
+  RESULT_TRUE = 1,
+  RESULT_UNKNOWN = 2
+} ExprResult;
+
+static ExprResult toResult(bool value) {
+  return value ? RESULT_TRUE : RESULT_FALSE;
+}
+
+static ExprResult evaluateNode(const Expr *expr, ExprFile *file) {
+  ExprResult result;
+  switch (expr->kind) {
+  case EXPR_AND:
+    result = RESULT_TRUE;
+    for (uint32_t i = 0; i < expr->operator.count; i++) {
+      ExprResult operand = evaluateNode(expr->operator.operands[i], file);
+      if (operand == RESULT_FALSE) {
+        return RESULT_FALSE;
+      }
+      result = operand == RESULT_UNKNOWN ? RESULT_UNKNOWN : result;
+    }
+    return result;
+  case EXPR_OR:
+    result = RESULT_FALSE;
+    for (uint32_t i = 0; i < expr->operator.count; i++) {
+      ExprResult operand = evaluateNode(expr->operator.operands[i], file);
+      if (operand == RESULT_TRUE) {
+        return RESULT_TRUE;
+      }
+      result = operand == RESULT_UNKNOWN ? RESULT_UNKNOWN : result;
+    }
+    return result;
+  case EXPR_NOT:
+    result = evaluateNode(expr->operator.operands[0], file);
+    return result == RESULT_UNKNOWN ? RESULT_UNKNOWN
+                                    : toResult(result == RESULT_FALSE);
+  case EXPR_TYPE:
+    return toResult(file->type == expr->type);
+  case EXPR_DEPTH:
+    return toResult(compareNumber(expr, file->depth));
+  case EXPR_NAME:
+    return toResult(matchName(&expr->matcher, file->name, file->nameLen));
+  case EXPR_SIZE: {
+    if (!hasStatFields(file, STATX_SIZE)) {
+      return RESULT_UNKNOWN;
+    }
+    uint64_t unit = expr->number.unit;
+    return toResult(
+        compareNumber(expr, (int64_t)((file->size + unit - 1) / unit)));
+  }
+  case EXPR_MTIME: {
+    if (!hasStatFields(file, STATX_MTIME)) {
+      return RESULT_UNKNOWN;
+    }
+    int64_t age = (int64_t)expr->number.now - file->mtimeSec;
+    // Rounding down (files modified in the future are 0 days old).
+    return toResult(compareNumber(expr, age < 0 ? 0 : age / SECONDS_PER_DAY));
+  }
+  case EXPR_UID:
+    if (!hasStatFields(file, STATX_UID)) {
+      return RESULT_UNKNOWN;
+    }
+    return toResult(compareNumber(expr, file->uid));
+  case EXPR_PERM: {
+    if (!hasStatFields(file, STATX_MODE)) {
+      return RESULT_UNKNOWN;
+    }
+    uint32_t mode = file->mode & 07777;
+    switch (expr->perm.match) {
+    case PERM_ALL:
+      return toResult((mode & expr->perm.mode) == expr->perm.mode);
+    case PERM_ANY:
+      return toResult(expr->perm.mode == 0 || (mode & expr->perm.mode) != 0);
+    default:
+      return toResult(mode == expr->perm.mode);
+    }
+  }
+  default:
+    return RESULT_FALSE;
+  }
+}
+
+bool evaluateExpr(const Expr *expr, ExprFile *file) {
+  return evaluateNode(expr, file) == RESULT_TRUE;
+}
@@ -0,0 +1,163 @@
+#ifndef MY_EXPR_H
+#define MY_EXPR_H
+
+#include "my-match.h"
+#include "my-util.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Maximum nesting depth of an expression (parentheses and operators).
+#define MAX_EXPR_DEPTH 64
+
+/**
+ * Holds constants corresponding to the node types of an expression. Operators
+ * come first, then predicates from cheapest to most expensive: the ones past
+ * EXPR_DEPTH need the file's metadata (a statx call).
+ */
+typedef enum _ExprKind {
+  EXPR_AND = 0,
+  EXPR_OR = 1,
+  EXPR_NOT = 2,
+  // type f|l
+  EXPR_TYPE = 3,
+  // depth [+|-]N (the entries of the starting directory are at depth 1)
+  EXPR_DEPTH = 4,
+  // name <glob>
+  EXPR_NAME = 5,
+  // size [+|-]N[c|k|M|G] (bytes by default, rounded up to the unit)
+  EXPR_SIZE = 6,
+  // mtime [+|-]N (days since the last modification, rounded down)
+  EXPR_MTIME = 7,
+  // uid N
+  EXPR_UID = 8,
+  // perm [-|/]MODE (octal: exact mode, all bits of MODE or any of them)
+  EXPR_PERM = 9
+} ExprKind;
+
+/**
+ * Holds constants corresponding to the ways a number is compared ("+N", "-N"
+ * and "N").
+ */
+typedef enum _Comparison {
+  COMPARE_GREATER = 0,
+  COMPARE_LESS = 1,
+  COMPARE_EQUAL = 2
+} Comparison;
+
+/**
+ * Holds constants corresponding to the ways permissions are compared ("MODE",
+ * "-MODE" and "/MODE").
+ */
+typedef enum _PermMatch {
+  PERM_EXACT = 0,
+  PERM_ALL = 1,
+  PERM_ANY = 2
+} PermMatch;
+
+/**
+ * A node of a compiled expression. The operands of AND and OR nodes are
+ * sorted from cheapest to most expensive, so that metadata is only fetched
+ * once the predicates on the name, type and depth did not settle the result.
+ */
+typedef struct _Expr {
+  ExprKind kind;
+  // Relative evaluation cost (the sum of the operands' costs for operators).
+  uint32_t cost;
+  // STATX_* fields needed to evaluate the node (and its operands).
+  unsigned int statxMask;
+  union {
+    // EXPR_AND, EXPR_OR (n-ary) and EXPR_NOT (one operand).
+    struct {
+      struct _Expr **operands;
+      uint32_t count;
+    } operator;
+    // EXPR_NAME
+    Matcher matcher;
+    // EXPR_TYPE (DT_* constant)
+    unsigned char type;
+    // EXPR_DEPTH, EXPR_SIZE, EXPR_MTIME and EXPR_UID (the value is expressed
+    // in the predicate's unit).
+    struct {
+      Comparison comparison;
+      uint64_t value;
+      uint64_t unit;
+      // EXPR_MTIME: the time ages are computed from.
+      time_t now;
+    } number;
+    // EXPR_PERM
+    struct {
+      PermMatch match;
+      uint32_t mode;
+    } perm;
+  };
+} Expr;
+
+/**
+ * A file being evaluated: what the directory entry tells (name, type) is
+ * provided by the caller, the metadata is fetched on demand.
+ */
+typedef struct _ExprFile {
+  // The file's name is relative to dirFd (which may be AT_FDCWD).
+  int dirFd;
+  const char *name;
+  size_t nameLen;
+  // DT_* constant
+  unsigned char type;
+  uint32_t depth;
+  // Fields to request when the metadata is needed (those of the whole
+  // expression and those the caller needs afterwards, so that a single statx
+  // call is ever issued per file).
+  unsigned int statxMask;
+  // Set once statx was called, and the fields it returned (0 on error).
+  bool hasStat;
+  unsigned int statMask;
+  uint64_t size;
+  int64_t mtimeSec;
+  uint32_t uid;
+  uint32_t mode;
+  uint64_t blocks;
+  uint32_t nlink;
+  uint64_t ino;
+  uint64_t dev;
+} ExprFile;
+
+/**
+ * Compiles the given expression (whitespace-separated tokens, operators being
+ * "and" (or juxtaposition), "or", "not" and parentheses, from tightest to
+ * loosest). Times are compared against the given reference time. Returns
+ * NULL on error, in which case a description of the error is written to the
+ * given buffer.
+ */
+Expr *compileExpr(const char *text, time_t now, char *error, size_t errorLen);
+
+/**
+ * Releases the given expression (and its operands).
+ */
+void destroyExpr(Expr *expr);
+
+/**
+ * Initializes the file to evaluate an expression against: statxMask holds the
+ * STATX_* fields requested if the metadata is fetched (those of the
+ * expression, or'ed with those the caller reads from the file afterwards).
+ */
+void newExprFile(ExprFile *file, unsigned int statxMask, int dirFd,
+                 const char *name, size_t nameLen, unsigned char type,
+                 uint32_t depth);
+
+/**
+ * Returns TRUE if the given STATX_* fields of the file are known, fetching
+ * its metadata unless it already was (while evaluating an expression).
+ */
+bool hasStatFields(ExprFile *file, unsigned int fields);
+
+/**
+ * Returns TRUE if the given file matches the given expression. Predicates on
+ * metadata that cannot be obtained are unknown, as are the operators they
+ * settle (negations included): a file only matches if the expression is
+ * known to hold, so "not size +1M" does not match a file that could not be
+ * stat'ed.
+ */
+bool evaluateExpr(const Expr *expr, ExprFile *file);
+
+#endif
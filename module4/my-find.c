@@ -7,44 +7,123 @@
  * ====================
  *
  * This program leverages the pthread API to perform directory traversal using
- * multiple threads:
+ * a pool of worker threads:
  *
  * 1) The program allows specifying a number of threads (i.e.: dubbed thread
- *    capacity) to use (beyond the main thread) to perform the traversal. At
- *    the outset, the program has <capacity> available threads to work with,
- *    beyond the main thread.
+ *    capacity) to use (beyond the main thread) to perform the traversal. These
+ *    threads are started once, at the outset, and live until the traversal is
+ *    complete. The main thread acts as an additional worker.
  *
- * 2) Execution starts with the main thread: it lists the files/directories
- *    under the provided path. If the -r option (standing for "recursive")
- *    has been specified by the user, the main thread attempts dispatching
- *    the traversal of the next directory it encounters to a new thread. If
- *    all threads are busy, then the main thread traverses the next directory.
+ * 2) Each worker owns a lock-free deque of jobs, a job corresponding to a
+ *    directory to visit. Execution starts with the main thread, which visits
+ *    the provided path. If the -r option (standing for "recursive") has been
+ *    specified by the user, every sub-directory that a worker encounters is
+ *    pushed onto the worker's own deque (no lock is involved in doing so).
+ *    The job holds an O_PATH descriptor of the sub-directory, opened relative
+ *    to its parent's, so that its visit does not resolve its whole path
+ *    again (up to half of the descriptor limit: past that, the sub-directory
+ *    is opened by path).
  *
- * 3) The process described in #2 continues recursively, and is identical for
- *    the threads started by the main thread, and started by "descendant"
- *    threads of the main thread: when a directory is encountered, the current
- *    thread attempts dispatching its traversal in a new thread. If all are
- *    busy at that moment, then it proceeds to the traversal itself.
+ * 3) A worker pops the jobs on its deque in LIFO order (which keeps the
+ *    traversal depth-first), or in FIFO order if a breadth-first traversal
+ *    was requested (-o bfs, which exposes more directories at once). A worker
+ *    whose deque is empty steals the oldest job of another worker (that is:
+ *    the one closest to the root, and therefore likely to be the biggest
+ *    subtree). Workers for which no job can be found are parked until new
+ *    jobs are submitted.
+ *
+ *    If a per-device limit is set (-d), jobs are grouped by the device of
+ *    their parent directory (obtained by fstat'ing each directory visited),
+ *    and no more jobs of a device than its limit run at once: a job picked
+ *    while its device is saturated is deferred, and run by the next worker
+ *    completing a job of that device. Workers are thus free to serve other
+ *    devices, each device getting the queue depth that suits it.
  *
  * 4) The processing of files (matching their names against the provided
- *    pattern) is done in the current thread (i.e.: only upon encountering
- *    a directory is spawning a new thread attempted).
+ *    pattern) is done by the worker visiting the directory containing them.
+ *    An expression (-e) can further filter files on their type, depth, size,
+ *    modification time, owner and permissions: its predicates are evaluated
+ *    from cheapest to most expensive, and the file is only stat'ed (with
+ *    statx, relative to the directory's descriptor, and only for the fields
+ *    the expression needs) if the predicates on the name, type and depth did
+ *    not settle the result. Name-only queries never stat files.
+ *
+ * 5) If an index file is specified (-i), each worker records the directories
+ *    it visits (their inode and modification/change times, and their
+ *    entries). On the next run, directories whose metadata did not change
+ *    are not read again: their entries are taken from the previous index,
+ *    which is memory-mapped. Sub-directories are still visited (and stat'ed)
+ *    one by one, since a modification deep in the tree does not change the
+ *    metadata of its ancestors. Workers append the directories they record
+ *    to the new index file in large chunks (at offsets reserved through an
+ *    atomic counter), the hash table mapping directory paths to their
+ *    offsets being written by the main thread once the traversal is done.
+ *
+ * 6) In watch mode (-w), the index produced by the traversal is kept mapped
+ *    once the traversal is done, and the program turns into a daemon serving
+ *    pattern queries (sent with -c) over a Unix socket. File system events
+ *    (fanotify if possible, inotify otherwise) tell which directories are
+ *    modified: those are read again, and their new entries kept in memory on
+ *    top of the index (see my-daemon.h). Queries are thus answered without
+ *    reading the tree.
+ *
+ * 7) In du mode (-u), the disk usage of each directory's files is summed up
+ *    by the worker visiting it, in a per-worker accumulator (no counter is
+ *    shared between workers during the traversal). Files with several hard
+ *    links are only counted once, which a set of (device, inode) pairs
+ *    sharded across 64 mutexes tells. Once the traversal is done, the main
+ *    thread adds each directory's usage to its parent's (deepest directories
+ *    first) and outputs the largest subtrees.
+ *
+ * 8) With -s, each worker counts its directories, entries, stat calls, match
+ *    attempts, matches, jobs (run locally or stolen) and output bytes, and
+ *    times each phase (open, read, stat, match, output, lock waits, idle)
+ *    with the time stamp counter, in per-worker counters that only it writes
+ *    (see my-stats.h). They are merged once the traversal is done (and read
+ *    by the progress thread with -n). Built with STATS=0, none of this is
+ *    compiled in.
  *
- * The above process requires the use of a recursive mutex to keep track of
- * the running threads.
+ * 9) With -a, each worker is pinned to a CPU (filling NUMA nodes one after
+ *    the other, or spreading workers over them), and allocates its buffers
+ *    on its own thread, so that they are placed on its node. Idle workers
+ *    then steal from the workers of their own node first: the kernel's
+ *    caches for a stolen directory's parent were filled on that node.
+ *
+ * 10) In content search mode (-g), the files matching the patterns and the
+ *    expression are searched for the given literals by the worker which found
+ *    them, in the same pass (see my-search.h): files are read in chunks into
+ *    a per-worker buffer, the search stopping at the first occurrence. Only
+ *    the files containing any of the literals are output.
+ *
+ * Completion is detected through a pending job counter: the worker which
+ * completes the last pending job wakes up all other workers so that they exit,
+ * after which the main thread joins them.
  *
  */
-#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 
 #include "dirent.h"
 #include "errno.h"
-#include "fnmatch.h"
-#include "pthread.h"
-#include "stdarg.h"
+#include "fcntl.h"
+#include "my-arena.h"
+#include "my-daemon.h"
+#include "my-dirscan.h"
+#include "my-expr.h"
+#include "my-index.h"
+#include "my-match.h"
+#include "my-output.h"
+#include "my-path.h"
+#include "my-pool.h"
+#include "my-record.h"
+#include "my-search.h"
+#include "my-stats.h"
+#include "my-usage.h"
+#include "my-util.h"
 #include "stdint.h"
 #include "stdio.h"
 #include "stdlib.h"
 #include "string.h"
+#include "sys/resource.h"
 #include "sys/stat.h"
 #include "time.h"
 #include "unistd.h"
@@ -56,228 +135,472 @@
 // on the file system)
 #define ERRNO_NOT_FOUND 2
 
-// Boolean values
-#define TRUE 1
-#define FALSE 0
-typedef uint8_t bool;
-
 #define LOG_LEVEL_NAME_LEN 50
-#define MAX_THREADS 255
-#define SLOT_MAIN_THREAD 255
+
+// STATX_* fields read by accumulateUsage (du mode); the device is always
+// returned.
+#define USAGE_STATX_MASK (STATX_BLOCKS | STATX_SIZE | STATX_NLINK | STATX_INO)
 
 // ----------------------------------------------------------------------------
-// Utilities
+// User input
 
 /**
- *  Holds constants corresponding to the different log levels.
+ * Limit on the number of directories of a device visited at once (specified
+ * with -d <path>=<limit>).
  */
-typedef enum _LogLevel {
-  TRACE = 0,
-  VERBOSE = 1,
-  NORMAL = 2,
-  ERROR = 3,
-  OFF = 4
-
-} LogLevel;
+typedef struct _DeviceLimit {
+  dev_t dev;
+  uint32_t limit;
+} DeviceLimit;
 
 /**
- * Logging function: outputs  only if the current level is >= than the system's
- * configured level.
+ * Holds user-defined settings (populated from command-line options).
  */
-void logIt(LogLevel systemLevel, LogLevel currentLevel, char *format, ...) {
-  if (currentLevel >= systemLevel) {
-    va_list args;
-    va_start(args, format);
-    if (currentLevel == ERROR) {
-      // making sure any error output is sent to
-      // the terminal right away
-      vfprintf(stderr, format, args);
-    } else {
-      vfprintf(stdout, format, args);
-    }
-  }
-}
+typedef struct _Settings {
+  // Patterns specified with -p (a file matches if its name matches any of
+  // them), compiled once at startup.
+  MatcherSet patterns;
+  // Expression specified with -e (NULL if none), which matching files must
+  // satisfy as well.
+  Expr *expr;
+  // Literals specified with -g (content search mode if any), one of which
+  // matching files must contain as well.
+  LiteralSet literals;
+  bool isRecursive;
+  // Order in which workers visit the directories they find (specified with
+  // -o).
+  JobOrder traversalOrder;
+  // Default limit on the number of directories of a device visited at once
+  // (0 if unbounded), and limits specific to some devices (specified with
+  // -d).
+  uint32_t deviceLimit;
+  DeviceLimit deviceLimits[MAX_JOB_LANES];
+  uint32_t deviceLimitCount;
+  LogLevel systemLogLevel;
+  // du mode: number of largest directories to output (specified with -u, 0
+  // if not in du mode).
+  uint32_t usageCount;
+  // STATX_* fields requested when a file is stat'ed: those of the expression
+  // and, in du mode, those accumulateUsage reads.
+  unsigned int statxMask;
+  // Format in which matches are output (specified with -f).
+  RecordFormat outputFormat;
+  // Path of the index file (specified with -i, NULL if none).
+  const char *indexPath;
+  // Socket on which to serve queries once the traversal is done (specified
+  // with -w, NULL if none).
+  const char *watchSocketPath;
+  // Socket of the daemon to query instead of traversing (specified with -c,
+  // NULL if none).
+  const char *querySocketPath;
+  // Set if statistics are reported once the traversal is done (specified
+  // with -s), and interval in seconds between progress lines (specified with
+  // -n, 0 if none).
+  bool withStats;
+  uint32_t progressInterval;
+  // Set if workers are pinned to CPUs (specified with -a), spread as given
+  // by placement.
+  bool isPinned;
+  WorkerPlacement placement;
+} Settings;
 
 /**
- * Assertion utility.
+ * Initializes settings with defaults.
  */
-void assertIt(bool condition, char *format, ...) {
-  if (!condition) {
-    va_list args;
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    exit(EXIT_FAILURE);
-  }
+void newSettings(Settings *settings) {
+  newMatcherSet(&settings->patterns);
+  settings->expr = NULL;
+  newLiteralSet(&settings->literals);
+  settings->isRecursive = FALSE;
+  settings->traversalOrder = JOB_ORDER_DFS;
+  settings->deviceLimit = 0;
+  settings->deviceLimitCount = 0;
+  settings->systemLogLevel = NORMAL;
+  settings->usageCount = 0;
+  settings->statxMask = 0;
+  settings->outputFormat = RECORD_TEXT;
+  settings->indexPath = NULL;
+  settings->watchSocketPath = NULL;
+  settings->querySocketPath = NULL;
+  settings->withStats = FALSE;
+  settings->progressInterval = 0;
+  settings->isPinned = FALSE;
+  settings->placement = PLACEMENT_COMPACT;
 }
 
-/**
- * Wraps malloc() to check for allocation failure (asserts if that's the case).
- */
-void *safemalloc(size_t size) {
-  void *ptr = malloc(size);
-  assertIt(ptr != NULL, "Could not allocate memory\n");
-  return ptr;
-}
+// ----------------------------------------------------------------------------
+// File metadata
 
 /**
- *  Wrap free() to check that the pointer to free isn't null.
+ * Holds directory/file metadata.
+ *
+ * The path and name fields are views over buffers owned by the worker
+ * visiting the file's parent directory: they are only valid for the duration
+ * of the FileMatchCallback call the instance is passed to.
  */
-void safefree(void *ptr) {
-  if (ptr != NULL) {
-    free(ptr);
-  }
-}
+typedef struct _FileInfo {
+  // The full path to the file/directory to which this instance corresponds
+  // (null-terminated).
+  const char *path;
+  size_t pathLen;
+  // The relative file name of the file/directory to which this instance
+  // corrresponds (null-terminated, points into path).
+  const char *name;
+  size_t nameLen;
+  // The type (DT_* constant) and inode number reported by the file system
+  // for the directory entry (no stat call is involved).
+  unsigned char type;
+  ino_t ino;
+  // Descriptor of the directory containing the file (which name is relative
+  // to), and depth of the file below the starting directory (1 for its
+  // entries).
+  int dirFd;
+  uint32_t depth;
+} FileInfo;
 
 // ----------------------------------------------------------------------------
-// Threading
+// WorkerState
 
 /**
- * Keeps track of a thread.
+ * Bounds the number of directory descriptors held by queued visits (shared
+ * by all workers): past the limit, sub-directories are opened by path when
+ * visited, rather than relative to their parent's descriptor.
  */
-typedef struct _ThreadRef {
-  /**
-   * ID of the thread to which this field corresonds - should be deemded
-   * invalid is the isAvailable flag is true.
-   */
-  pthread_t thread;
-
-  /**
-   * Indicates whether or not the slot corresponding to the thread is available
-   * or not. If it isn't available, it means that the thread corresponding to
-   * this instance is currently active, and that the slot isn't available.
-   * Otherwise, it means that the thread has been exited (and the thread ID
-   * kept by the thread field is invalid).
-   */
-  bool isAvailable;
-} ThreadRef;
+typedef struct _DirFdBudget {
+  atomic_uint count;
+  uint32_t limit;
+} DirFdBudget;
 
 /**
- * Program-wide structure (shared by all threads) holding the ThreadRef array
- * used to keep track of running threads and available thread slots (a slot
- * is simply a cell in the threadRefs array specified as a field of this
- * struct).
- *
- * Access to the threadRefs and availableThreadCount fields should be done in
- * a thread-safe manner, using the mutex that an instance of this struct
- * provides.
+ * Holds the resources that a worker reuses from one visit to the next (an
+ * instance is kept by each Worker, through its data field).
  */
-typedef struct _ThreadState {
-  // Used to synchronize access to the members of this struct.
-  pthread_mutex_t mutex;
-  pthread_mutexattr_t mutex_attr;
-  ThreadRef threadRefs[MAX_THREADS];
-  uint8_t threadCapacity;
-  uint8_t availableThreadCount;
-} ThreadState;
+typedef struct _WorkerState {
+  // Allocates the jobs that the worker submits.
+  BlockArena arena;
+  DirScanner scanner;
+  // Holds the path of the entry being processed (the path of the directory
+  // being visited, followed by the entry's name).
+  PathBuilder path;
+  // Accumulates the worker's matches (flushed to stdout in large chunks).
+  OutputBuffer output;
+  // Formats matches in the machine-readable formats (NDJSON, binary).
+  RecordWriter records;
+  // Index of the previous run (NULL if none), and builder of the index of
+  // the current run (only used if isIndexing is set).
+  const IndexReader *previousIndex;
+  IndexBuilder index;
+  bool isIndexing;
+  // Lane of the device of the directory being visited (NO_JOB_LANE if
+  // devices are not limited).
+  uint32_t lane;
+  // du mode: the worker's accumulator, the id of the directory being visited
+  // in it, and the set of hard-linked files (shared by all workers).
+  UsageAccumulator *usage;
+  uint64_t usageId;
+  InodeSet *inodes;
+  // Descriptors held by the queued visits (shared by all workers).
+  DirFdBudget *dirFds;
+  // Content search mode: reads (or maps) the files to search.
+  ContentSearcher searcher;
+  // Statistics of the worker (NULL if not collected).
+  WorkerStats *stats;
+} WorkerState;
 
 /**
- * Initializes a ThreadState instance.
+ * Initializes a WorkerState instance, whose output is formatted in the given
+ * format. Its buffers are only allocated by startWorkerState.
  */
-void newThreadState(ThreadState *ts, uint8_t threadCapacity) {
-
-  assertIt(threadCapacity <= MAX_THREADS,
-           "Specified thread capacity (%u) must be <= MAX_THREADS (%u)\n",
-           threadCapacity, MAX_THREADS);
-  ts->threadCapacity = threadCapacity;
-  // Set to threadCapacity at the outset.
-  ts->availableThreadCount = threadCapacity;
-
-  for (int slot = 0; slot < ts->threadCapacity; slot++) {
-    ThreadRef *ref = &ts->threadRefs[slot];
-    ref->isAvailable = TRUE;
-  }
+void newWorkerState(WorkerState *state, RecordFormat format) {
+  newBlockArena(&state->arena);
+  newRecordWriter(&state->records, &state->output, format);
+  state->previousIndex = NULL;
+  state->isIndexing = FALSE;
+  state->lane = NO_JOB_LANE;
+  state->usage = NULL;
+  state->usageId = NO_DIR_USAGE;
+  state->inodes = NULL;
+  state->dirFds = NULL;
+  newContentSearcher(&state->searcher);
+  state->stats = NULL;
+}
 
-  assertIt(pthread_mutexattr_init(&ts->mutex_attr) == 0,
-           "Could not initialize mutex attributes\n");
-  pthread_mutexattr_settype(&ts->mutex_attr, PTHREAD_MUTEX_RECURSIVE);
-  assertIt(pthread_mutex_init(&ts->mutex, &ts->mutex_attr) == 0,
-           "Could not initialize mutex\n");
+/**
+ * Allocates the buffers of the given WorkerState instance, whose output is
+ * flushed to the given sink. Called by the worker itself, on its thread: if
+ * workers are pinned, the buffers are thus first touched (and placed) on the
+ * worker's NUMA node.
+ */
+void startWorkerState(WorkerState *state, OutputSink *sink) {
+  assertIt(newDirScanner(&state->scanner, DIR_SCAN_BUFFER_SIZE) == 0,
+           "Could not allocate directory scanner\n");
+  assertIt(newPathBuilder(&state->path, PATH_BUILDER_CAPACITY) == 0,
+           "Could not allocate path builder\n");
+  assertIt(newOutputBuffer(&state->output, sink, OUTPUT_BUFFER_SIZE) == 0,
+           "Could not allocate output buffer\n");
 }
 
 /**
- * Releases the resources kept as part of the given ThreadState instance.
+ * Releases the resources kept as part of the given WorkerState instance
+ * (flushing its pending output).
  */
-void destroyThreadState(ThreadState *ts) {
-  assertIt(pthread_mutexattr_destroy(&ts->mutex_attr) == 0,
-           "Could not destroy mutex attributes\n");
-  assertIt(pthread_mutex_destroy(&ts->mutex) == 0, "Could not destroy mutex\n");
+void destroyWorkerState(WorkerState *state) {
+  destroyDirScanner(&state->scanner);
+  destroyPathBuilder(&state->path);
+  destroyRecordWriter(&state->records);
+  destroyOutputBuffer(&state->output);
+  destroyContentSearcher(&state->searcher);
+  if (state->isIndexing) {
+    destroyIndexBuilder(&state->index);
+  }
+  destroyBlockArena(&state->arena);
 }
 
 // ----------------------------------------------------------------------------
-// User input
+// File match callback
 
 /**
- * Holds user-defined settings (populated from command-line options).
+ * Defines the signature of the callback that is invoked when
+ * a matching file is found.
  */
-typedef struct _Settings {
-  char pattern[NAME_MAX];
-  bool isRecursive;
-  LogLevel systemLogLevel;
-} Settings;
+typedef void (*FileMatchCallback)(const Settings *settings,
+                                  WorkerState *state,
+                                  const FileInfo *fileInfo);
 
 /**
- * Initializes settings with defaults.
+ * Writes the given file as a record (NDJSON or binary format), carrying the
+ * metadata known without a stat call: the file's type and inode number.
  */
-void newSettings(Settings *settings) {
-  strcpy(settings->pattern, "");
-  settings->isRecursive = FALSE;
-  settings->systemLogLevel = NORMAL;
+static void outputRecord(const Settings *settings, WorkerState *state,
+                         const FileInfo *fileInfo) {
+  FileRecord record;
+  memset(&record, 0, sizeof(FileRecord));
+  record.name = fileInfo->path;
+  record.nameLen = fileInfo->pathLen;
+  record.fields = RECORD_HAS_INODE;
+  record.info.st_mode = DTTOIF(fileInfo->type);
+  record.info.st_ino = fileInfo->ino;
+  assertIt(writeRecord(&state->records, &record) == 0,
+           "Could not allocate memory\n");
 }
 
-// ----------------------------------------------------------------------------
-// File metadata
-
 /**
- * Holds directory/file metadata.
+ * Returns TRUE if the given file matches the patterns and the expression (if
+ * any). The given ExprFile is initialized for the file, holding its metadata
+ * if the expression needed it.
  */
-typedef struct _FileInfo {
-  // The full path to the file/directory to which this instance corresponds.
-  char path[NAME_MAX];
-  // The relative file name of the file/directory to which this instance
-  // corrresponds.
-  char name[NAME_MAX];
-} FileInfo;
+static bool isMatchingFile(const Settings *settings, WorkerState *state,
+                           const FileInfo *fileInfo, ExprFile *file) {
+  uint64_t start = startStatTimer();
+  newExprFile(file, settings->statxMask, fileInfo->dirFd, fileInfo->name,
+              fileInfo->nameLen, fileInfo->type, fileInfo->depth);
+  bool isMatch = settings->patterns.count == 0 ||
+                 matchAnyPattern(&settings->patterns, fileInfo->name,
+                                 fileInfo->nameLen) >= 0;
+  if (isMatch && settings->expr != NULL) {
+    isMatch = evaluateExpr(settings->expr, file);
+    addStat(state->stats, STAT_STAT_CALLS, file->hasStat ? 1 : 0);
+  }
+  endStatTimer(state->stats, TIMER_MATCH, start);
+  addStat(state->stats, STAT_MATCH_ATTEMPTS, 1);
+  addStat(state->stats, STAT_MATCHES, isMatch ? 1 : 0);
+  return isMatch;
+}
 
-// ----------------------------------------------------------------------------
-// File match callback
+/**
+ * Appends the given matching file to the calling worker's output buffer, in
+ * the format given by the settings.
+ */
+static void writeMatch(const Settings *settings, WorkerState *state,
+                       const FileInfo *fileInfo) {
+  uint64_t start = startStatTimer();
+  if (settings->systemLogLevel > NORMAL) {
+    // output disabled
+  } else if (settings->outputFormat != RECORD_TEXT) {
+    outputRecord(settings, state, fileInfo);
+  } else {
+    struct iovec line[] = {
+        {.iov_base = (void *)fileInfo->path, .iov_len = fileInfo->pathLen},
+        {.iov_base = "\n", .iov_len = 1}};
+    writeOutputLine(&state->output, line, 2);
+  }
+  endStatTimer(state->stats, TIMER_OUTPUT, start);
+}
 
 /**
- * Defines the signature of the callback that is invoked when
- * a matching file is found.
+ * Implements the FileMatchCallback typedef: matches are appended to the
+ * calling worker's output buffer, in the format given by the settings
+ * (diagnostics go to stderr, see logIt).
  */
-typedef void (*FileMatchCallback)(const Settings *settings,
-                                  const FileInfo *fileInfo);
+void outputMatch(const Settings *settings, WorkerState *state,
+                 const FileInfo *fileInfo) {
+  ExprFile file;
+  if (isMatchingFile(settings, state, fileInfo, &file)) {
+    writeMatch(settings, state, fileInfo);
+  } else {
+    logIt(settings->systemLogLevel, TRACE, "No match against file path %s\n",
+          fileInfo->path);
+  }
+}
 
 /**
- * Implements the FileMatchCallback typedef.
+ * Implements the FileMatchCallback typedef (watch mode): the initial
+ * traversal only fills the index, matches being output in reply to queries.
  */
-void outputMatch(const Settings *settings, const FileInfo *fileInfo) {
+void ignoreMatch(const Settings *settings, WorkerState *state,
+                 const FileInfo *fileInfo) {}
 
-  int result = fnmatch(settings->pattern, fileInfo->name, FNM_PATHNAME);
-  if (result == 0) {
-    logIt(settings->systemLogLevel, NORMAL, "%s\n", fileInfo->path);
+/**
+ * Implements the FileMatchCallback typedef (content search mode): matching
+ * files are searched for the literals on the calling worker's thread, and
+ * output as with outputMatch if they contain any of them.
+ */
+void outputContentMatch(const Settings *settings, WorkerState *state,
+                        const FileInfo *fileInfo) {
+  ExprFile file;
+  if (!isMatchingFile(settings, state, fileInfo, &file)) {
+    logIt(settings->systemLogLevel, TRACE, "No match against file path %s\n",
+          fileInfo->path);
+    return;
+  }
+  uint64_t start = startStatTimer();
+  int status = searchFile(&state->searcher, &settings->literals,
+                          fileInfo->dirFd, fileInfo->name);
+  endStatTimer(state->stats, TIMER_SEARCH, start);
+  addStat(state->stats, STAT_SEARCHED_BYTES, state->searcher.searchedBytes);
+  if (status < 0) {
+    logIt(settings->systemLogLevel, ERROR,
+          "Could not search file: %s (errno: %u)\n", fileInfo->path, errno);
+  } else if (status > 0) {
+    writeMatch(settings, state, fileInfo);
   } else {
-    logIt(settings->systemLogLevel, TRACE,
-          "No match for pattern %s against file path %s\n", settings->pattern,
+    logIt(settings->systemLogLevel, TRACE, "No match in file %s\n",
           fileInfo->path);
   }
 }
 
+/**
+ * Implements the FileMatchCallback typedef (du mode): the disk usage of
+ * matching files is added to that of the directory being visited, files with
+ * several hard links being only counted the first time they are seen. The
+ * metadata fetched while evaluating the expression is reused (its statx mask
+ * includes USAGE_STATX_MASK in du mode): a file is stat'ed once at most.
+ */
+void accumulateUsage(const Settings *settings, WorkerState *state,
+                     const FileInfo *fileInfo) {
+  ExprFile file;
+  if (!isMatchingFile(settings, state, fileInfo, &file)) {
+    return;
+  }
+  uint64_t start = startStatTimer();
+  addStat(state->stats, STAT_STAT_CALLS, file.hasStat ? 0 : 1);
+  bool isKnown = hasStatFields(&file, USAGE_STATX_MASK);
+  endStatTimer(state->stats, TIMER_STAT, start);
+  if (!isKnown) {
+    logIt(settings->systemLogLevel, ERROR,
+          "Could not stat file: %s (errno: %u)\n", fileInfo->path, errno);
+    return;
+  }
+  if (file.nlink > 1 && !insertInode(state->inodes, file.dev, file.ino)) {
+    return;
+  }
+  addDirUsage(state->usage, file.blocks, file.size);
+}
+
+/**
+ * Outputs the largest subtrees (du mode, once the traversal is done), through
+ * the given worker state: in text format, one line per directory holding its
+ * disk usage in KiB (rounded up, as du does) and its path; as records
+ * otherwise (the number of blocks and apparent size of the whole subtree).
+ */
+static void outputLargestDirs(const Settings *settings, WorkerState *state,
+                              UsageAccumulator *usages, uint32_t usageCount) {
+  sumDirUsages(usages, usageCount);
+  uint64_t *largest =
+      (uint64_t *)safemalloc(settings->usageCount * sizeof(uint64_t));
+  size_t count = findLargestDirUsages(usages, usageCount,
+                                      settings->usageCount, largest);
+  for (size_t i = 0; i < count && settings->systemLogLevel <= NORMAL; i++) {
+    const DirUsage *dir = findDirUsage(usages, largest[i]);
+    const char *dirPath =
+        dirUsagePath(&usages[largest[i] >> DIR_USAGE_INDEX_BITS], dir);
+    if (settings->outputFormat != RECORD_TEXT) {
+      FileRecord record;
+      memset(&record, 0, sizeof(FileRecord));
+      record.name = dirPath;
+      record.nameLen = dir->pathLen;
+      record.fields = RECORD_HAS_DISK;
+      record.info.st_mode = S_IFDIR;
+      record.info.st_blocks = (blkcnt_t)dir->blocks;
+      record.info.st_blksize = 512;
+      record.info.st_size = (off_t)dir->size;
+      assertIt(writeRecord(&state->records, &record) == 0,
+               "Could not allocate memory\n");
+      continue;
+    }
+    char kibibytes[24];
+    int kibibytesLen = snprintf(kibibytes, sizeof(kibibytes), "%llu\t",
+                                (unsigned long long)(dir->blocks + 1) / 2);
+    struct iovec line[] = {
+        {.iov_base = kibibytes, .iov_len = (size_t)kibibytesLen},
+        {.iov_base = (void *)dirPath, .iov_len = dir->pathLen},
+        {.iov_base = "\n", .iov_len = 1}};
+    writeOutputLine(&state->output, line, 3);
+  }
+  safefree(largest);
+}
+
 // ----------------------------------------------------------------------------
 // VisitContext
 
 /**
- * Encapsulates all parameters necessary for a visitDir function call in the
- * context of a specific thread.
+ * Encapsulates all parameters necessary for a visitDir function call (an
+ * instance corresponds to a job queued in the WorkerPool). The path of the
+ * directory to visit is stored inline, so that a job takes a single block of
+ * the submitting worker's arena.
  */
 typedef struct _VisitContext {
   Settings *settings;
-  FileInfo dirInfo;
   FileMatchCallback callback;
-  ThreadState *threadState;
-  int threadSlot;
+  // Lane of the parent directory's device (see enableJobLanes), by which the
+  // visit is limited.
+  uint32_t lane;
+  // Depth of the directory below the starting directory (0 for the latter).
+  uint32_t depth;
+  // du mode: id of the parent directory's usage (NO_DIR_USAGE for the
+  // starting directory).
+  uint64_t parentUsage;
+  // Descriptor (O_PATH) of the directory, opened relative to its parent's
+  // when the visit was queued, or -1 if it is to be opened by path (the
+  // starting directory, or once the DirFdBudget is exhausted).
+  int dirFd;
+  size_t pathLen;
+  // The full path to the directory to visit (null-terminated).
+  char path[];
 } VisitContext;
 
+/**
+ * Allocates a VisitContext instance for the directory at the given path (and
+ * depth), from the given worker state's arena.
+ */
+VisitContext *newVisitContext(WorkerState *state, Settings *settings,
+                              FileMatchCallback callback, uint32_t lane,
+                              uint32_t depth, const char *path,
+                              size_t pathLen) {
+  VisitContext *context = (VisitContext *)allocBlock(
+      &state->arena, sizeof(VisitContext) + pathLen + 1);
+  context->settings = settings;
+  context->callback = callback;
+  context->lane = lane;
+  context->depth = depth;
+  context->parentUsage = NO_DIR_USAGE;
+  context->dirFd = -1;
+  context->pathLen = pathLen;
+  memcpy(context->path, path, pathLen);
+  context->path[pathLen] = '\0';
+  return context;
+}
+
 // ============================================================================
 // Core logic
 
@@ -287,217 +610,338 @@ typedef struct _VisitContext {
 /**
  * Forward declaration of function prototype.
  */
-void startVisitThread(VisitContext *context);
+void dispatchVisit(Worker *worker, const VisitContext *parentContext,
+                   const PathBuilder *path, const char *name);
+
+/**
+ * Processes an entry of the directory being visited (whose path is held by
+ * the worker's PathBuilder, and is dirPathLen bytes long): files are passed to
+ * the context's callback, sub-directories to dispatchVisit.
+ */
+static void visitEntry(Worker *worker, VisitContext *context, size_t dirPathLen,
+                       const char *name, size_t nameLen, unsigned char type,
+                       ino_t ino) {
+  WorkerState *state = (WorkerState *)worker->data;
+  PathBuilder *path = &state->path;
+  addStat(state->stats, STAT_ENTRIES, 1);
+  switch (type) {
+  case DT_REG:
+  case DT_LNK:
+    assertIt(appendPathComponent(path, name, nameLen) == 0,
+             "Could not allocate memory\n");
+    logIt(context->settings->systemLogLevel, TRACE, "Got file entry %s\n",
+          path->data);
+
+    FileInfo file = {.path = path->data,
+                     .pathLen = path->length,
+                     .name = path->data + dirPathLen + 1,
+                     .nameLen = nameLen,
+                     .type = type,
+                     .ino = ino,
+                     .dirFd = state->scanner.fd,
+                     .depth = context->depth + 1};
+    context->callback(context->settings, state, &file);
+    truncatePath(path, dirPathLen);
+    break;
+  case DT_DIR:
+    if (context->settings->isRecursive) {
+      assertIt(appendPathComponent(path, name, nameLen) == 0,
+               "Could not allocate memory\n");
+      logIt(context->settings->systemLogLevel, TRACE,
+            "Calling dispatchVisit for directory entry %s\n", path->data);
+      dispatchVisit(worker, context, path, name);
+      truncatePath(path, dirPathLen);
+    }
+    break;
+  default:
+    // ignoring other types
+  }
+}
+
+/**
+ * Visits the entries recorded for the current directory in the previous
+ * index.
+ */
+static void visitIndexedDir(Worker *worker, VisitContext *context,
+                            size_t dirPathLen, const IndexDir *dir) {
+  const IndexEntry *entry = firstIndexEntry(dir);
+  for (uint32_t i = 0; i < dir->entryCount; i++) {
+    visitEntry(worker, context, dirPathLen, indexEntryName(entry),
+               entry->nameLen, entry->type, (ino_t)entry->ino);
+    entry = nextIndexEntry(entry);
+  }
+}
 
 /**
  * Visits the directory whose representation is encapsulated by the given
- * context. Calls startVisitThread whenever it encounters a sub-directory.
+ * context. Calls dispatchVisit whenever it encounters a sub-directory.
+ *
+ * Entries are read in batches through the worker's DirScanner: no stat call
+ * is issued, unless the file system does not report the entries' type. The
+ * path of each entry is built in place in the worker's PathBuilder (the
+ * entry's name is appended to the directory's path, then truncated away).
+ *
+ * If an index is being maintained, devices are limited or disk usage is being
+ * computed, the directory is stat'ed (through the descriptor opened for
+ * scanning). Its entries are taken from the previous index if it did not
+ * change since, and recorded in the new one. Its device gives the lane of its
+ * sub-directories' visits, and its blocks count towards its disk usage.
  */
-uint8_t visitDir(VisitContext *context) {
+uint8_t visitDir(Worker *worker, VisitContext *context) {
   uint8_t exitCode = EXIT_SUCCESS;
-  DIR *dir;
-  struct dirent *entry;
+  WorkerState *state = (WorkerState *)worker->data;
+  DirScanner *scanner = &state->scanner;
+  PathBuilder *path = &state->path;
+  DirEntry entry;
+  int scanStatus;
   logIt(context->settings->systemLogLevel, VERBOSE,
-        "visitDir -> directory: %s\n", context->dirInfo.path);
-  if ((dir = opendir(context->dirInfo.path)) != NULL) {
-    while ((entry = readdir(dir)) != NULL) {
-      char fname[NAME_MAX] = "";
-
-      strcat(fname, context->dirInfo.path);
-      strcat(fname, "/");
-      strcat(fname, entry->d_name);
-
-      switch (entry->d_type) {
-      case DT_REG:
-      case DT_LNK:
-        // TODO: check file match
-        logIt(context->settings->systemLogLevel, TRACE, "Got file entry %s\n",
-              fname);
-
-        struct stat fileMeta;
-        stat(fname, &fileMeta);
-        FileInfo file;
-        strncpy(file.path, fname, NAME_MAX);
-        strncpy(file.name, entry->d_name, NAME_MAX);
-        context->callback(context->settings, &file);
-        break;
-      case DT_DIR:
-        if (context->settings->isRecursive &&
-            strncmp(entry->d_name, ".", NAME_MAX) != 0 &&
-            strncmp(entry->d_name, "..", NAME_MAX) != 0) {
-          logIt(context->settings->systemLogLevel, TRACE,
-                "Got directory entry %s\n", fname);
-
-          VisitContext childContext;
-          childContext.settings = context->settings;
-          strncpy(childContext.dirInfo.path, fname, NAME_MAX);
-          strncpy(childContext.dirInfo.name, entry->d_name, NAME_MAX);
-          childContext.callback = context->callback;
-          childContext.threadState = context->threadState;
-          logIt(context->settings->systemLogLevel, TRACE,
-                "Calling startVisitThread for directory entry %s\n", fname);
-          startVisitThread(&childContext);
-        }
-        break;
-      default:
-        // ignoring other types
-      }
+        "visitDir -> directory: %s (worker #%u)\n", context->path,
+        worker->index);
+  uint64_t start = startStatTimer();
+  int openStatus = context->dirFd >= 0
+                       ? openDirScan(scanner, context->dirFd, ".")
+                       : openDirScan(scanner, AT_FDCWD, context->path);
+  endStatTimer(state->stats, TIMER_OPEN, start);
+  if (context->dirFd >= 0) {
+    close(context->dirFd);
+    atomic_fetch_sub_explicit(&state->dirFds->count, 1, memory_order_relaxed);
+  }
+  if (openStatus != 0) {
+    logIt(context->settings->systemLogLevel, ERROR,
+          "Could not access file or directory: %s\n", context->path);
+    return exitCode;
+  }
+  addStat(state->stats, STAT_DIRS, 1);
+
+  assertIt(setPath(path, context->path, context->pathLen) == 0,
+           "Could not allocate memory\n");
+  size_t dirPathLen = path->length;
+
+  bool isIndexing = state->isIndexing;
+  bool isLimited = context->lane != NO_JOB_LANE;
+  struct stat dirInfo;
+  bool hasDirInfo = FALSE;
+  if (isIndexing || isLimited || state->usage != NULL) {
+    start = startStatTimer();
+    hasDirInfo = fstat(scanner->fd, &dirInfo) == 0;
+    endStatTimer(state->stats, TIMER_STAT, start);
+    addStat(state->stats, STAT_STAT_CALLS, 1);
+  }
+  if (state->usage != NULL) {
+    state->usageId =
+        beginDirUsage(state->usage, context->parentUsage, context->depth,
+                      context->path, context->pathLen);
+    // The directories themselves only count if all files do.
+    if (hasDirInfo && context->settings->patterns.count == 0 &&
+        context->settings->expr == NULL) {
+      addDirUsage(state->usage, (uint64_t)dirInfo.st_blocks,
+                  (uint64_t)dirInfo.st_size);
+    }
+  }
+  state->lane = context->lane;
+  if (isLimited && hasDirInfo &&
+      jobLaneKey(worker->pool, context->lane) != (uint64_t)dirInfo.st_dev) {
+    // A mount point: its sub-directories are charged to its own device.
+    state->lane = findJobLane(worker->pool, (uint64_t)dirInfo.st_dev);
+  }
 
-      if (exitCode != EXIT_SUCCESS) {
-        goto Finally;
+  const IndexDir *indexedDir = NULL;
+  if (isIndexing) {
+    if (!hasDirInfo) {
+      isIndexing = FALSE;
+    } else if (state->previousIndex != NULL) {
+      indexedDir = findIndexDir(state->previousIndex, context->path,
+                                context->pathLen);
+      if (indexedDir != NULL && !isIndexDirCurrent(indexedDir, &dirInfo)) {
+        indexedDir = NULL;
       }
     }
-  } else {
+    if (isIndexing && indexedDir == NULL) {
+      beginIndexDir(&state->index, context->path, context->pathLen, &dirInfo);
+    }
+  }
+
+  if (indexedDir != NULL) {
+    logIt(context->settings->systemLogLevel, TRACE,
+          "Directory unchanged since last indexed: %s\n", context->path);
+    // The scan's descriptor is kept open for the expression's stat calls.
+    visitIndexedDir(worker, context, dirPathLen, indexedDir);
+    closeDirScan(scanner);
+    copyIndexDir(&state->index, indexedDir);
+    return exitCode;
+  }
+
+  start = startStatTimer();
+  while ((scanStatus = nextDirEntry(scanner, &entry)) > 0) {
+    endStatTimer(state->stats, TIMER_READ, start);
+    unsigned char type = entry.type;
+    if (type == DT_UNKNOWN) {
+      uint64_t statStart = startStatTimer();
+      type = resolveDirEntryType(scanner, &entry);
+      endStatTimer(state->stats, TIMER_STAT, statStart);
+      addStat(state->stats, STAT_STAT_CALLS, 1);
+    }
+    if (type == DT_DIR && isDotDirEntry(&entry)) {
+      start = startStatTimer();
+      continue;
+    }
+    if (isIndexing && (type == DT_REG || type == DT_LNK || type == DT_DIR)) {
+      addIndexEntry(&state->index, entry.name, entry.nameLen, type, entry.ino);
+    }
+    visitEntry(worker, context, dirPathLen, entry.name, entry.nameLen, type,
+               entry.ino);
+    start = startStatTimer();
+  }
+  endStatTimer(state->stats, TIMER_READ, start);
+
+  if (scanStatus < 0) {
     logIt(context->settings->systemLogLevel, ERROR,
-          "Could not access file or directory: %s\n", context->dirInfo.path);
+          "Error reading directory: %s (errno: %u)\n", context->path, errno);
+  }
+  if (isIndexing) {
+    if (scanStatus < 0) {
+      abortIndexDir(&state->index);
+    } else {
+      endIndexDir(&state->index);
+    }
   }
 
-Finally:
-  closedir(dir);
+  closeDirScan(scanner);
   return exitCode;
 }
 
 /**
- * Corresponds to the function pointer passed to the pthread_create call.
- * This function ensures that the proper book keeping is done when it has
- * completed its part of directory traversal.
- *
- * Namely, before call pthread_exit, this function releases the appropriate
- * thread slot (entry in the ThreadState::threadRefs table) and increments
- * ThreadState::availableThreadCount.
- *
+ * Implements the JobFunction typedef: visits the directory corresponding to
+ * the given job (a VisitContext instance), and frees that job afterwards
+ * (returning it to the arena of the worker that submitted it).
  */
-static void *runVisitThread(void *arg) {
-  VisitContext *context = (VisitContext *)arg;
-  logIt(context->settings->systemLogLevel, VERBOSE,
-        "Calling visitDir in thread (slot #%d)\n", context->threadSlot);
-  uint8_t status = visitDir(context);
-  logIt(context->settings->systemLogLevel, VERBOSE,
-        "visitDir completed by thread (slot #%d) - status: %u\n",
-        context->threadSlot, status);
-
-  int lockStatus = pthread_mutex_lock(&(context->threadState->mutex));
-  assertIt(lockStatus == 0,
-           "Error trying to lock thread state mutex (status: %d)\n",
-           lockStatus);
-  context->threadState->availableThreadCount += 1;
-  logIt(context->settings->systemLogLevel, VERBOSE,
-        "Available thread count now at %u\n",
-        context->threadState->availableThreadCount);
-
-  ThreadRef *ref = &(context->threadState->threadRefs[context->threadSlot]);
-  ref->isAvailable = TRUE;
-  int unlockStatus = pthread_mutex_unlock(&(context->threadState->mutex));
-  assertIt(unlockStatus == 0,
-           "Error trying to unlock thread state mutex (status: %d)\n",
-           unlockStatus);
+static void runVisitJob(Worker *worker, void *job) {
+  VisitContext *context = (VisitContext *)job;
+  uint8_t status = visitDir(worker, context);
   logIt(context->settings->systemLogLevel, TRACE,
-        "Freeing up VisitContext for thread (slot #%u)\n", context->threadSlot);
-  if (context->threadSlot != SLOT_MAIN_THREAD) {
-    safefree(context);
-    pthread_exit(NULL);
-  } else {
-    safefree(context);
-  }
+        "visitDir completed by worker #%u - status: %u\n", worker->index,
+        status);
+  freeBlock(&((WorkerState *)worker->data)->arena, context);
+}
 
-  return NULL;
+/**
+ * Implements the WorkerFunction typedef: allocates the buffers of the worker's
+ * state, the pool's data being the output sink.
+ */
+static void startVisitWorker(Worker *worker) {
+  startWorkerState((WorkerState *)worker->data,
+                   (OutputSink *)worker->pool->data);
 }
 
 /**
- * This function attempts to perform the next visit in a new thread: if
- * all the thread slots are busy (i.e.: the number of active threads is
- * currently at capacity), then the next visit is performed by the
- * calling thread.
- *
- * Otherwise, the function starts a new thread, making sure the proper
- * bookkeeping is done (marking the corresponding slot has unavailable,
- * decrementing the available thread count).
+ * Implements the JobLaneFunction typedef: a visit is limited by the lane of
+ * its parent directory's device.
  */
-void startVisitThread(VisitContext *context) {
-  assertIt(context != NULL, "startVisitThread:: VisitContext is NULL\n");
-  logIt(context->settings->systemLogLevel, TRACE,
-        "Acquiring thread state mutex lock\n");
-  int lockStatus = pthread_mutex_lock(&(context->threadState->mutex));
-  assertIt(lockStatus == 0,
-           "Error trying to lock thread state mutex (status: %d)\n",
-           lockStatus);
-  logIt(context->settings->systemLogLevel, TRACE,
-        "Acquired thread state mutex lock\n");
-  if (context->threadState->availableThreadCount > 0) {
-    logIt(context->settings->systemLogLevel, VERBOSE,
-          "Will handle directory %s in another thread\n",
-          context->dirInfo.path);
-
-    int slot = 0;
-    // finding an available slot
-    while (slot < context->threadState->threadCapacity) {
-      ThreadRef *ref = &(context->threadState->threadRefs[slot]);
-      if (ref->isAvailable) {
-        logIt(context->settings->systemLogLevel, TRACE,
-              "Found available slot #%d\n", slot);
-        break;
-      }
-      slot++;
-    }
-
-    // The following condition should never be true since
-    // since if availableThreadCount > 0, then we should 
-    // haveslots available. Nevertheless, we're taking it 
-    // into account, for robustness' sake.
-    if (slot == context->threadState->threadCapacity) {
-      logIt(context->settings->systemLogLevel, VERBOSE,
-            "Could not find available slot for thread expected to handle %s "
-            "(thread capacity: %u, "
-            "available: %u)\n",
-            context->dirInfo.path, context->threadState->threadCapacity,
-            context->threadState->availableThreadCount);
-      goto VisitInCurrentThread;
-    }
-
-    // Making copy of parent context (the parent context exists
-    // on the stack of the calling function, so we need to copy it).
-    VisitContext *threadContext =
-        (VisitContext *)safemalloc(sizeof(VisitContext));
-    threadContext->callback = context->callback;
-    strncpy(threadContext->dirInfo.path, context->dirInfo.path,
-            sizeof(context->dirInfo.path));
-    strncpy(threadContext->dirInfo.name, context->dirInfo.name,
-            sizeof(context->dirInfo.name));
-    threadContext->settings = context->settings;
-    threadContext->threadState = context->threadState;
-    ThreadRef *threadRef = &(threadContext->threadState->threadRefs[slot]);
-    threadRef->isAvailable = FALSE;
-
-    threadContext->threadSlot = slot;
-    threadContext->threadState->availableThreadCount -= 1;
-    int status = pthread_create(&threadRef->thread, NULL, runVisitThread,
-                                (void *)threadContext);
-    assertIt(status == 0, "Error creating thread (status: %d)\n", status);
-    logIt(
-        context->settings->systemLogLevel, VERBOSE,
-        "Started new thread for slot #%d (available thread count now at: %u)\n",
-        slot, threadContext->threadState->availableThreadCount);
-    int unlockStatus = pthread_mutex_unlock(&(context->threadState->mutex));
-    assertIt(unlockStatus == 0,
-             "Error trying to unlock thread state mutex (status: %d)\n",
-             lockStatus);
-    return;
+static uint32_t getVisitLane(const void *job) {
+  return ((const VisitContext *)job)->lane;
+}
+
+/**
+ * Opens the given sub-directory of the directory being visited (O_PATH,
+ * relative to the scan's descriptor), so that its visit does not resolve its
+ * whole path again. Returns -1 if the budget is exhausted or on error, the
+ * visit then opening the directory by path.
+ */
+static int openSubdir(WorkerState *state, const char *name) {
+  DirFdBudget *budget = state->dirFds;
+  if (atomic_fetch_add_explicit(&budget->count, 1, memory_order_relaxed) >=
+      budget->limit) {
+    atomic_fetch_sub_explicit(&budget->count, 1, memory_order_relaxed);
+    return -1;
+  }
+  int fd = openat(state->scanner.fd, name,
+                  O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0) {
+    atomic_fetch_sub_explicit(&budget->count, 1, memory_order_relaxed);
   }
-VisitInCurrentThread:
-  int unlockStatus = pthread_mutex_unlock(&(context->threadState->mutex));
-  assertIt(unlockStatus == 0,
-           "Error trying to unlock thread state mutex (status: %d)\n",
-           lockStatus);
-  visitDir(context);
+  return fd;
+}
+
+/**
+ * Queues the visit of the directory at the given path (the given entry of
+ * the directory being visited) on the deque of the calling worker (idle
+ * workers will steal it if they have nothing else to do).
+ */
+void dispatchVisit(Worker *worker, const VisitContext *parentContext,
+                   const PathBuilder *path, const char *name) {
+  assertIt(parentContext != NULL, "dispatchVisit:: VisitContext is NULL\n");
+
+  // Making a copy of the path (the builder's content changes as soon as the
+  // calling worker moves on to the next entry).
+  VisitContext *jobContext =
+      newVisitContext((WorkerState *)worker->data, parentContext->settings,
+                      parentContext->callback,
+                      ((WorkerState *)worker->data)->lane,
+                      parentContext->depth + 1, path->data, path->length);
+  jobContext->parentUsage = ((WorkerState *)worker->data)->usageId;
+  jobContext->dirFd = openSubdir((WorkerState *)worker->data, name);
+  submitJob(worker, jobContext);
 }
 
 // ----------------------------------------------------------------------------
 // help & main
 
 void help(const char *programName) {
-  printf("%s [-p <pattern>] [-r] [-l <log level>] [<path>]\n", programName);
-  printf("  -p: glob pattern to use for matching files (defaults to *)\n");
+  printf("%s -p <pattern> [-p <pattern>...] [-e <expression>] "
+         "[-g <literal>...] [-r] "
+         "[-t <thread capacity>] [-a <placement>] [-o <order>] "
+         "[-d [<path>=]<limit>...] [-l <log level>] [-f <format>] "
+         "[-i <index file>] [-s] [-n <seconds>] [<path>]\n",
+         programName);
+  printf("%s -u <count> [-p <pattern>...] [-e <expression>] [-r] "
+         "[-t <thread capacity>] [-a <placement>] [-o <order>] "
+         "[-d [<path>=]<limit>...] [-l <log level>] [-f <format>] "
+         "[-i <index file>] [-s] [-n <seconds>] [<path>]\n",
+         programName);
+  printf("%s -w <socket> [-r] [-t <thread capacity>] [-a <placement>] "
+         "[-l <log level>] "
+         "[-f <format>] [-i <index file>] [<path>]\n",
+         programName);
+  printf("%s -c <socket> -p <pattern> [-p <pattern>...] [-l <log level>]\n",
+         programName);
+  printf("  -p: glob pattern to use for matching files (can be repeated, in\n");
+  printf("      which case files matching any of the patterns are output)\n");
+  printf("  -e: expression that matching files must also satisfy (-p may\n");
+  printf("      then be omitted), made of the following predicates:\n");
+  printf("      - name <glob>\n");
+  printf("      - type f|l (regular file or symbolic link)\n");
+  printf("      - depth [+|-]N (1 for the entries of <path>)\n");
+  printf("      - size [+|-]N[c|k|M|G] (in bytes by default, rounded up)\n");
+  printf("      - mtime [+|-]N (days since last modified, rounded down)\n");
+  printf("      - uid N\n");
+  printf("      - perm [-|/]MODE (octal: exact mode, all or any bits)\n");
+  printf("      combined with not, and (or juxtaposition), or and\n");
+  printf("      parentheses. +N stands for \"more than N\", -N for \"less\n");
+  printf("      than N\". Arguments end at the next space or ')' (which\n");
+  printf("      can be escaped with a backslash). Example:\n");
+  printf("      -e 'size +1M and (mtime -7 or not uid 0)'\n");
+  printf("  -g: content search mode: outputs the matching files which\n");
+  printf("      contain the given string (can be repeated, in which case\n");
+  printf("      files containing any of them are output). Files are\n");
+  printf("      searched by the traversal threads (-p and -e may then be\n");
+  printf("      omitted)\n");
   printf("  -r: indicates that the traversal should be recursive\n");
+  printf("  -u: du mode: outputs the given number of directories whose\n");
+  printf("      subtree uses the most disk space, largest first (-p and\n");
+  printf("      -e are optional, and restrict the files counted)\n");
+  printf("  -t: number of threads to use beyond the main thread (defaults\n");
+  printf("      to 0)\n");
+  printf("  -a: pins each thread to a CPU (and allocates its buffers on\n");
+  printf("      the CPU's NUMA node). Possible values:\n");
+  printf("      - compact: fills the CPUs of a node before the next one\n");
+  printf("      - scatter: spreads threads over all nodes\n");
+  printf("  -o: traversal order (defaults to dfs). Possible values:\n");
+  printf("      - dfs: depth-first (better cache locality)\n");
+  printf("      - bfs: breadth-first (faster fan-out)\n");
+  printf("  -d: maximum number of directories of a device visited at once\n");
+  printf("      (defaults to unbounded). <path>=<limit> sets the limit of\n");
+  printf("      the device holding <path> (can be repeated), <limit> alone\n");
+  printf("      that of the other devices\n");
   printf("  -l: indicates the log level (defaults to normal).\n");
   printf("      Possible values, from most verbose to least verbose:\n");
   printf("      - trace\n");
@@ -505,6 +949,24 @@ void help(const char *programName) {
   printf("      - normal\n");
   printf("      - error\n");
   printf("      - off\n");
+  printf("  -f: output format (defaults to text). Possible values:\n");
+  printf("      - text: one path per line\n");
+  printf("      - ndjson: one JSON object per line\n");
+  printf("      - binary: length-prefixed records (see my-record.h)\n");
+  printf("  -i: index file, updated at the end of the traversal: the\n");
+  printf("      directories that did not change since the index was last\n");
+  printf("      updated are not read again (their entries are taken from\n");
+  printf("      the index)\n");
+  printf("  -w: watch mode: once the traversal is done, keeps track of the\n");
+  printf("      tree's modifications and serves queries on the given Unix\n");
+  printf("      socket (until interrupted), in the format given by -f\n");
+  printf("  -c: sends the patterns to the daemon listening on the given\n");
+  printf("      socket, and outputs its reply\n");
+  printf("  -s: writes statistics to stderr once the traversal is done\n");
+  printf("      (counts of directories, entries, stat calls, matches, jobs\n");
+  printf("      and output bytes, and time spent in each phase)\n");
+  printf("  -n: writes a progress line to stderr every given number of\n");
+  printf("      seconds during the traversal\n");
 }
 
 int main(int argc, char **argv) {
@@ -512,31 +974,53 @@ int main(int argc, char **argv) {
   uint8_t exitCode = EXIT_SUCCESS;
 
   // path set to current dir by default
-  char path[NAME_MAX];
-  strcpy(path, ".");
+  const char *path = ".";
 
   // populated from command-line options
   Settings settings;
   newSettings(&settings);
-  ThreadState threadState;
   // Defaulting to 0 additional threads (all
   // will be executed in the main thread).
-  newThreadState(&threadState, 0);
+  int threadCapacity = 0;
 
   // option processing
   int opt;
-  while ((opt = getopt(argc, argv, "hrp:l:t:")) != -1) {
+  while ((opt = getopt(argc, argv, "hrsp:e:g:u:l:t:o:d:f:i:w:c:n:a:")) != -1) {
     switch (opt) {
     case 'h':
       help(argv[0]);
       exitCode = EXIT_SUCCESS;
       goto Finally;
     case 'p':
-      strncpy(settings.pattern, optarg, sizeof(settings.pattern));
+      assertIt(addPattern(&settings.patterns, optarg) == 0,
+               "Could not compile pattern: %s\n", optarg);
+      break;
+    case 'e': {
+      char error[256];
+      destroyExpr(settings.expr);
+      settings.expr = compileExpr(optarg, time(NULL), error, sizeof(error));
+      if (settings.expr == NULL) {
+        fprintf(stderr, "Invalid expression: %s\n", error);
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      break;
+    }
+    case 'g':
+      assertIt(addLiteral(&settings.literals, optarg) == 0,
+               "Value of -g option (literal) must not be empty\n");
       break;
     case 'r':
       settings.isRecursive = TRUE;
       break;
+    case 'u': {
+      int usageCount = atoi(optarg);
+      assertIt(usageCount > 0,
+               "Value of -u option (directory count) must be > 0. Got: %d\n",
+               usageCount);
+      settings.usageCount = (uint32_t)usageCount;
+      break;
+    }
     case 'l':
       if (strncmp(optarg, "off", LOG_LEVEL_NAME_LEN) == 0) {
         settings.systemLogLevel = OFF;
@@ -556,26 +1040,147 @@ int main(int argc, char **argv) {
 
       break;
     case 't':
-      int threadCapacity = atoi(optarg);
+      threadCapacity = atoi(optarg);
       assertIt(threadCapacity > 0,
                "Value of -t option (thread capacity) must be > 0. Got: %d\n",
                threadCapacity);
       logIt(settings.systemLogLevel, VERBOSE,
             "Setting thread capacity to: %d\n", threadCapacity);
-      newThreadState(&threadState, (uint8_t)threadCapacity);
+      break;
+    case 'o':
+      if (strcmp(optarg, "dfs") == 0) {
+        settings.traversalOrder = JOB_ORDER_DFS;
+      } else if (strcmp(optarg, "bfs") == 0) {
+        settings.traversalOrder = JOB_ORDER_BFS;
+      } else {
+        fprintf(stderr, "Unknown traversal order: %s\n", optarg);
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      break;
+    case 'd': {
+      char *separator = strrchr(optarg, '=');
+      int limit = atoi(separator != NULL ? separator + 1 : optarg);
+      assertIt(limit >= 0, "Value of -d option (limit) must be >= 0. Got: %d\n",
+               limit);
+      if (separator == NULL) {
+        settings.deviceLimit = (uint32_t)limit;
+        break;
+      }
+      *separator = '\0';
+      struct stat deviceInfo;
+      if (stat(optarg, &deviceInfo) != 0 ||
+          settings.deviceLimitCount == MAX_JOB_LANES) {
+        fprintf(stderr, "Cannot limit the device of: %s\n", optarg);
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      settings.deviceLimits[settings.deviceLimitCount++] =
+          (DeviceLimit){.dev = deviceInfo.st_dev, .limit = (uint32_t)limit};
+      break;
+    }
+    case 'f': {
+      int format = parseRecordFormat(optarg);
+      if (format < 0) {
+        fprintf(stderr, "Unknown output format: %s\n", optarg);
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      settings.outputFormat = (RecordFormat)format;
+      break;
+    }
+    case 'i':
+      settings.indexPath = optarg;
+      break;
+    case 'w':
+      settings.watchSocketPath = optarg;
+      break;
+    case 'c':
+      settings.querySocketPath = optarg;
+      break;
+    case 's':
+      settings.withStats = TRUE;
+      break;
+    case 'a':
+      settings.isPinned = TRUE;
+      if (strcmp(optarg, "compact") == 0) {
+        settings.placement = PLACEMENT_COMPACT;
+      } else if (strcmp(optarg, "scatter") == 0) {
+        settings.placement = PLACEMENT_SCATTER;
+      } else {
+        fprintf(stderr, "Unknown placement: %s\n", optarg);
+        exitCode = EXIT_FAILURE;
+        goto Finally;
+      }
+      break;
+    case 'n': {
+      int interval = atoi(optarg);
+      assertIt(interval > 0,
+               "Value of -n option (progress interval) must be > 0. Got: %d\n",
+               interval);
+      settings.progressInterval = (uint32_t)interval;
+      break;
+    }
     }
   }
 
   // if there's a remaining arg, use as path
   if (optind < argc) {
-    strncpy(path, argv[optind], NAME_MAX);
+    path = argv[optind];
   }
 
-  if (strnlen(settings.pattern, sizeof(settings.pattern)) == 0) {
-    logIt(settings.systemLogLevel, ERROR, "Pattern (-p) must be provided\n");
+  // Patterns are sent along with each query in watch mode.
+  if (settings.patterns.count == 0 && settings.expr == NULL &&
+      settings.literals.count == 0 && settings.watchSocketPath == NULL &&
+      settings.usageCount == 0) {
+    logIt(settings.systemLogLevel, ERROR,
+          "Pattern (-p), expression (-e) or literal (-g) must be provided\n");
+    exitCode = EXIT_FAILURE;
+    goto Finally;
+  }
+  if ((settings.expr != NULL || settings.usageCount > 0) &&
+      (settings.watchSocketPath != NULL || settings.querySocketPath != NULL)) {
+    logIt(settings.systemLogLevel, ERROR,
+          "Expressions (-e) and du mode (-u) are not supported in watch "
+          "mode\n");
     exitCode = EXIT_FAILURE;
     goto Finally;
   }
+  if (settings.literals.count > 0 &&
+      (settings.usageCount > 0 || settings.watchSocketPath != NULL ||
+       settings.querySocketPath != NULL)) {
+    logIt(settings.systemLogLevel, ERROR,
+          "Content search (-g) is not supported in du mode and watch mode\n");
+    exitCode = EXIT_FAILURE;
+    goto Finally;
+  }
+
+  settings.statxMask = (settings.expr != NULL ? settings.expr->statxMask : 0) |
+                       (settings.usageCount > 0 ? USAGE_STATX_MASK : 0);
+
+#ifndef WITH_STATS
+  if (settings.withStats || settings.progressInterval > 0) {
+    logIt(settings.systemLogLevel, ERROR,
+          "Statistics (-s, -n) are not available: rebuild with STATS=1\n");
+    exitCode = EXIT_FAILURE;
+    goto Finally;
+  }
+#endif
+
+  if (settings.querySocketPath != NULL) {
+    exitCode = queryDaemon(settings.querySocketPath, &settings.patterns,
+                           settings.systemLogLevel);
+    goto Finally;
+  }
+
+  // Watch mode requires an index (a temporary one if -i is not specified).
+  char tempIndexPath[PATH_BUILDER_CAPACITY];
+  if (settings.watchSocketPath != NULL && settings.indexPath == NULL) {
+    const char *tempDir = getenv("TMPDIR");
+    snprintf(tempIndexPath, sizeof(tempIndexPath), "%s/my-find.%ld.idx",
+             tempDir != NULL ? tempDir : "/tmp", (long)getpid());
+    settings.indexPath = tempIndexPath;
+  }
 
   // Obtaining metadata for path (used to determine whether
   // it is a file or a directory)
@@ -596,66 +1201,199 @@ int main(int argc, char **argv) {
 
   logIt(settings.systemLogLevel, VERBOSE,
         "Starting traversal at directory: %s\n", path);
-  logIt(settings.systemLogLevel, VERBOSE, "Pattern: %s\n", settings.pattern);
+  for (uint32_t i = 0; i < settings.patterns.count; i++) {
+    logIt(settings.systemLogLevel, VERBOSE, "Pattern: %s (strategy: %u)\n",
+          settings.patterns.matchers[i].pattern,
+          settings.patterns.matchers[i].kind);
+  }
   if (settings.isRecursive) {
     logIt(settings.systemLogLevel, VERBOSE,
           "Will perform recursive traversal\n");
   }
 
   if (S_ISDIR(pathInfo.st_mode)) {
-    VisitContext initialContext;
-    initialContext.settings = &settings;
-    strncpy(initialContext.dirInfo.path, path, NAME_MAX);
-    initialContext.callback = outputMatch;
-    initialContext.threadState = &threadState;
-    initialContext.threadSlot = SLOT_MAIN_THREAD;
-    visitDir(&initialContext);
+    // The main thread acts as worker #0, in addition to the
+    // <capacity> threads started by the pool.
+    WorkerPool pool;
+    newWorkerPool(&pool, (uint32_t)threadCapacity + 1, runVisitJob);
+    pool.order = settings.traversalOrder;
+    pool.startWorker = startVisitWorker;
+    if (settings.isPinned && pinWorkers(&pool, settings.placement) != 0) {
+      logIt(settings.systemLogLevel, ERROR,
+            "Could not pin workers (errno: %u): leaving them unpinned\n",
+            errno);
+    }
+    uint32_t initialLane = NO_JOB_LANE;
+    if (settings.deviceLimit > 0 || settings.deviceLimitCount > 0) {
+      enableJobLanes(&pool, getVisitLane, settings.deviceLimit);
+      for (uint32_t i = 0; i < settings.deviceLimitCount; i++) {
+        setJobLaneLimit(&pool, (uint64_t)settings.deviceLimits[i].dev,
+                        settings.deviceLimits[i].limit);
+      }
+      initialLane = findJobLane(&pool, (uint64_t)pathInfo.st_dev);
+    }
+    OutputSink sink;
+    assertIt(newOutputSink(&sink, STDOUT_FILENO) == 0,
+             "Could not initialize output\n");
+    // Worker states are cache-line aligned (see BlockArena).
+    WorkerState *workerStates = (WorkerState *)aligned_alloc(
+        CACHE_LINE_SIZE, pool.workerCount * sizeof(WorkerState));
+    assertIt(workerStates != NULL, "Could not allocate memory\n");
+    // Half of the descriptors are left to the scans and searches.
+    DirFdBudget dirFds;
+    struct rlimit fileLimit;
+    atomic_init(&dirFds.count, 0);
+    dirFds.limit = getrlimit(RLIMIT_NOFILE, &fileLimit) != 0 ? 0
+                   : fileLimit.rlim_cur / 2 > UINT32_MAX
+                       ? UINT32_MAX
+                       : (uint32_t)(fileLimit.rlim_cur / 2);
+    for (uint32_t i = 0; i < pool.workerCount; i++) {
+      newWorkerState(&workerStates[i], settings.outputFormat);
+      workerStates[i].dirFds = &dirFds;
+      pool.workers[i].data = &workerStates[i];
+    }
+    // The other workers start their state on their own thread.
+    pool.data = &sink;
+    startWorkerState(&workerStates[0], &sink);
+    StatsReport stats;
+    bool withStats = settings.withStats || settings.progressInterval > 0;
+    if (withStats) {
+      newStatsReport(&stats, pool.workerCount);
+      for (uint32_t i = 0; i < pool.workerCount; i++) {
+        pool.workers[i].stats = &stats.workers[i];
+        workerStates[i].stats = &stats.workers[i];
+      }
+      if (settings.progressInterval > 0) {
+        startStatsProgress(&stats, settings.progressInterval);
+      }
+    }
 
-    logIt(settings.systemLogLevel, VERBOSE,
-          "Waiting on active threads to complete...\n");
-
-    // Checking that all threads have completed, avoiding
-    // exiting until that condition is verified. The following
-    // while loop is implemented to avoid the condition where
-    // the main thread omits joining a thread that has been created
-    // at around the same time as it hit that thread's corresponding 
-    // slot: given we're not using a mutex in the context of the
-    // following iteration, this could in theory possible.
-    //
-    // The strategy, therefore, is to keep on checking the state
-    // of each thread (in fact, each ThreadRef) until we could 
-    // count all threads as having completed.
-    uint8_t completedCount = 0;
-    while (TRUE)
-    {
-      for (int slot = 0; slot < initialContext.threadState->threadCapacity;
-          slot++) {
-        logIt(settings.systemLogLevel, TRACE,
-              "Checking if thread for slot #%d is active and should be joined\n",
-              slot);
-        ThreadRef *threadRef = &(initialContext.threadState->threadRefs[slot]);
-        if (!threadRef->isAvailable) {
-          pthread_t thread = threadRef->thread;
-          logIt(settings.systemLogLevel, TRACE, "Joining thread for slot #%d\n",
-                slot);
-          pthread_join(thread, NULL);
-        }
-        else
-        {
-          completedCount++;
-        }
+    IndexReader previousIndex;
+    IndexWriter index;
+    bool isIndexing = FALSE;
+    if (settings.indexPath != NULL) {
+      if (openIndexReader(&previousIndex, settings.indexPath) != 0) {
+        logIt(settings.systemLogLevel, VERBOSE,
+              "No usable index at %s (errno: %u): performing a full scan\n",
+              settings.indexPath, errno);
       }
-      if (completedCount == initialContext.threadState->threadCapacity)
-      {
-        break;
+      isIndexing = newIndexWriter(&index, settings.indexPath) == 0;
+      if (!isIndexing) {
+        logIt(settings.systemLogLevel, ERROR,
+              "Could not create index file: %s (errno: %u)\n",
+              index.tempPath, errno);
+        destroyIndexWriter(&index);
+      }
+    }
+    UsageAccumulator *usages = NULL;
+    InodeSet inodes;
+    FileMatchCallback callback =
+        settings.literals.count > 0 ? outputContentMatch : outputMatch;
+    if (settings.usageCount > 0) {
+      usages = (UsageAccumulator *)safemalloc(pool.workerCount *
+                                              sizeof(UsageAccumulator));
+      newInodeSet(&inodes);
+      for (uint32_t i = 0; i < pool.workerCount; i++) {
+        newUsageAccumulator(&usages[i], i);
+        workerStates[i].usage = &usages[i];
+        workerStates[i].inodes = &inodes;
+      }
+      callback = accumulateUsage;
+    }
+    if (settings.watchSocketPath != NULL) {
+      callback = ignoreMatch;
+    }
+    for (uint32_t i = 0; isIndexing && i < pool.workerCount; i++) {
+      newIndexBuilder(&workerStates[i].index, &index);
+      workerStates[i].isIndexing = TRUE;
+      if (previousIndex.data != NULL) {
+        workerStates[i].previousIndex = &previousIndex;
+      }
+    }
+
+    // The header must reach the sink before any worker flushes its records.
+    if (settings.watchSocketPath == NULL) {
+      writeRecordStreamHeader(&workerStates[0].records);
+      flushOutputBuffer(&workerStates[0].output);
+    }
+    VisitContext *initialContext = newVisitContext(
+        &workerStates[0], &settings, callback, initialLane, 0, path,
+        strlen(path));
+
+    runWorkerPool(&pool, initialContext);
+    logIt(settings.systemLogLevel, VERBOSE, "All workers done\n");
+    if (withStats) {
+      stopStatsProgress(&stats);
+    }
+
+    if (usages != NULL) {
+      outputLargestDirs(&settings, &workerStates[0], usages, pool.workerCount);
+      for (uint32_t i = 0; i < pool.workerCount; i++) {
+        destroyUsageAccumulator(&usages[i]);
+      }
+      safefree(usages);
+      destroyInodeSet(&inodes);
+    }
+    if (withStats) {
+      // Output bytes are only known once every buffer is flushed.
+      for (uint32_t i = 0; i < pool.workerCount; i++) {
+        flushOutputBuffer(&workerStates[i].output);
+        addStat(&stats.workers[i], STAT_OUTPUT_BYTES,
+                workerStates[i].output.bytesWritten);
+        stats.outputLockWaitNanos += workerStates[i].output.lockWaitNanos;
+      }
+      if (settings.withStats) {
+        printStatsReport(&stats);
+      }
+      destroyStatsReport(&stats);
+    }
+
+    bool isIndexCommitted = FALSE;
+    if (isIndexing) {
+      for (uint32_t i = 0; i < pool.workerCount; i++) {
+        flushIndexBuilder(&workerStates[i].index);
+      }
+      isIndexCommitted = commitIndexWriter(&index) == 0;
+      if (!isIndexCommitted) {
+        logIt(settings.systemLogLevel, ERROR,
+              "Could not write index file: %s (errno: %u)\n",
+              settings.indexPath, errno);
+      }
+      destroyIndexWriter(&index);
+    }
+    for (uint32_t i = 0; i < pool.workerCount; i++) {
+      destroyWorkerState(&workerStates[i]);
+    }
+    if (settings.indexPath != NULL) {
+      closeIndexReader(&previousIndex);
+    }
+    safefree(workerStates);
+    destroyOutputSink(&sink);
+    destroyWorkerPool(&pool);
+
+    if (settings.watchSocketPath != NULL) {
+      IndexReader snapshot;
+      if (!isIndexCommitted ||
+          openIndexReader(&snapshot, settings.indexPath) != 0) {
+        logIt(settings.systemLogLevel, ERROR,
+              "Watch mode requires an index: %s (errno: %u)\n",
+              settings.indexPath, errno);
+        exitCode = EXIT_FAILURE;
+        goto Finally;
       }
-      else
-      {
-        completedCount = 0;
+      // The mapping outlives the (temporary) file.
+      if (settings.indexPath == tempIndexPath) {
+        unlink(tempIndexPath);
       }
+      DaemonSettings daemonSettings = {
+          .rootPath = path,
+          .isRecursive = settings.isRecursive,
+          .outputFormat = settings.outputFormat,
+          .systemLogLevel = settings.systemLogLevel,
+          .socketPath = settings.watchSocketPath};
+      exitCode = runDaemon(&daemonSettings, &snapshot);
+      closeIndexReader(&snapshot);
     }
-    logIt(settings.systemLogLevel, VERBOSE, "All active threads done\n");
-    destroyThreadState(&threadState);
   } else {
     logIt(settings.systemLogLevel, ERROR,
           "Invalid file type for: %s (expected path to directory)\n", path);
@@ -664,5 +1402,8 @@ int main(int argc, char **argv) {
 
 // Catch-all: terminates the process
 Finally:
+  destroyMatcherSet(&settings.patterns);
+  destroyExpr(settings.expr);
+  destroyLiteralSet(&settings.literals);
   exit(exitCode);
 }
\ No newline at end of file
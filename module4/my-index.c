@@ -0,0 +1,435 @@
+#define _DEFAULT_SOURCE
+
+#include "my-index.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define INDEX_ALIGNMENT 8
+#define MIN_INDEX_SLOT_COUNT 16
+
+static size_t alignLength(size_t length) {
+  return (length + INDEX_ALIGNMENT - 1) & ~(size_t)(INDEX_ALIGNMENT - 1);
+}
+
+/**
+ * FNV-1a hash of the given path.
+ */
+static uint64_t hashPath(const char *path, size_t pathLen) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < pathLen; i++) {
+    hash ^= (unsigned char)path[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// ----------------------------------------------------------------------------
+// IndexReader
+
+int openIndexReader(IndexReader *reader, const char *path) {
+  memset(reader, 0, sizeof(IndexReader));
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    return -1;
+  }
+  if ((size_t)info.st_size < sizeof(IndexHeader)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return -1;
+  }
+  // Lookups hit random directories.
+  madvise(data, (size_t)info.st_size, MADV_RANDOM);
+
+  reader->data = (const char *)data;
+  reader->size = (size_t)info.st_size;
+  reader->header = (const IndexHeader *)data;
+  const IndexHeader *header = reader->header;
+  if (memcmp(header->magic, INDEX_MAGIC, INDEX_MAGIC_LEN) != 0 ||
+      header->fileSize != reader->size || header->slotCount == 0 ||
+      (header->slotCount & (header->slotCount - 1)) != 0 ||
+      header->tableOffset < sizeof(IndexHeader) ||
+      header->tableOffset % INDEX_ALIGNMENT != 0 ||
+      header->tableOffset > reader->size ||
+      (reader->size - header->tableOffset) / sizeof(IndexSlot) <
+          header->slotCount) {
+    closeIndexReader(reader);
+    errno = EINVAL;
+    return -1;
+  }
+  reader->slots = (const IndexSlot *)(reader->data + header->tableOffset);
+  return 0;
+}
+
+void closeIndexReader(IndexReader *reader) {
+  if (reader->data != NULL) {
+    munmap((void *)reader->data, reader->size);
+  }
+  memset(reader, 0, sizeof(IndexReader));
+}
+
+/**
+ * Checks that the directory at the given offset lies within the directory
+ * section of the file, and so do its entries (so that a corrupted index
+ * cannot lead to reads out of the mapping).
+ */
+static bool isValidIndexDir(const IndexReader *reader, uint64_t offset) {
+  uint64_t sectionEnd = reader->header->tableOffset;
+  if (offset < sizeof(IndexHeader) || offset % INDEX_ALIGNMENT != 0 ||
+      offset + sizeof(IndexDir) > sectionEnd) {
+    return FALSE;
+  }
+  const IndexDir *dir = (const IndexDir *)(reader->data + offset);
+  size_t headerLen = sizeof(IndexDir) + alignLength(dir->pathLen + 1);
+  if (dir->length < headerLen || offset + dir->length > sectionEnd ||
+      ((const char *)(dir + 1))[dir->pathLen] != '\0') {
+    return FALSE;
+  }
+
+  size_t entryOffset = headerLen;
+  for (uint32_t i = 0; i < dir->entryCount; i++) {
+    if (entryOffset + sizeof(IndexEntry) > dir->length) {
+      return FALSE;
+    }
+    const IndexEntry *entry =
+        (const IndexEntry *)((const char *)dir + entryOffset);
+    if (entry->length < sizeof(IndexEntry) + entry->nameLen + 1 ||
+        entry->length % INDEX_ALIGNMENT != 0 ||
+        entryOffset + entry->length > dir->length ||
+        indexEntryName(entry)[entry->nameLen] != '\0') {
+      return FALSE;
+    }
+    entryOffset += entry->length;
+  }
+  return TRUE;
+}
+
+const IndexDir *findIndexDir(const IndexReader *reader, const char *path,
+                             size_t pathLen) {
+  uint64_t hash = hashPath(path, pathLen);
+  uint64_t mask = reader->header->slotCount - 1;
+  for (uint64_t i = 0; i <= mask; i++) {
+    const IndexSlot *slot = &reader->slots[(hash + i) & mask];
+    if (slot->offset == 0) {
+      return NULL;
+    }
+    if (slot->hash != hash || !isValidIndexDir(reader, slot->offset)) {
+      continue;
+    }
+    const IndexDir *dir = (const IndexDir *)(reader->data + slot->offset);
+    if (dir->pathLen == pathLen &&
+        memcmp((const char *)(dir + 1), path, pathLen) == 0) {
+      return dir;
+    }
+  }
+  return NULL;
+}
+
+bool isIndexDirCurrent(const IndexDir *dir, const struct stat *info) {
+  return (dir->flags & INDEX_DIR_RACY) == 0 &&
+         dir->dev == (uint64_t)info->st_dev &&
+         dir->ino == (uint64_t)info->st_ino &&
+         dir->mtimeSec == info->st_mtim.tv_sec &&
+         dir->mtimeNsec == (uint32_t)info->st_mtim.tv_nsec &&
+         dir->ctimeSec == info->st_ctim.tv_sec &&
+         dir->ctimeNsec == (uint32_t)info->st_ctim.tv_nsec;
+}
+
+const IndexEntry *firstIndexEntry(const IndexDir *dir) {
+  return (const IndexEntry *)((const char *)(dir + 1) +
+                              alignLength(dir->pathLen + 1));
+}
+
+const IndexEntry *nextIndexEntry(const IndexEntry *entry) {
+  return (const IndexEntry *)((const char *)entry + entry->length);
+}
+
+const char *indexEntryName(const IndexEntry *entry) {
+  return (const char *)(entry + 1);
+}
+
+// ----------------------------------------------------------------------------
+// IndexWriter
+
+int newIndexWriter(IndexWriter *writer, const char *path) {
+  memset(writer, 0, sizeof(IndexWriter));
+  size_t tempPathLen = strlen(path) + 32;
+  writer->path = strdup(path);
+  writer->tempPath = (char *)safemalloc(tempPathLen);
+  assertIt(writer->path != NULL, "Could not allocate memory\n");
+  snprintf(writer->tempPath, tempPathLen, "%s.tmp.%ld", path, (long)getpid());
+
+  atomic_init(&writer->end, sizeof(IndexHeader));
+  atomic_init(&writer->hasFailed, FALSE);
+  // Modifications within the same timestamp tick as the scan (or the tick
+  // before, on file systems with a coarse granularity) cannot be told apart.
+  writer->racyThreshold = time(NULL) - 2;
+  assertIt(pthread_mutex_init(&writer->mutex, NULL) == 0,
+           "Could not initialize index mutex\n");
+
+  writer->fd = open(writer->tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+  return writer->fd < 0 ? -1 : 0;
+}
+
+/**
+ * Writes the given bytes at the given offset, retrying on partial writes.
+ */
+static int writeAt(int fd, const void *data, size_t length, uint64_t offset) {
+  const char *bytes = (const char *)data;
+  while (length > 0) {
+    ssize_t written = pwrite(fd, bytes, length, (off_t)offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    bytes += written;
+    length -= (size_t)written;
+    offset += (uint64_t)written;
+  }
+  return 0;
+}
+
+int commitIndexWriter(IndexWriter *writer) {
+  if (atomic_load(&writer->hasFailed)) {
+    return -1;
+  }
+
+  uint64_t slotCount = MIN_INDEX_SLOT_COUNT;
+  while (slotCount < writer->slotCount * 2) {
+    slotCount *= 2;
+  }
+  IndexSlot *table = (IndexSlot *)calloc(slotCount, sizeof(IndexSlot));
+  assertIt(table != NULL, "Could not allocate memory\n");
+  for (size_t i = 0; i < writer->slotCount; i++) {
+    const IndexSlot *slot = &writer->slots[i];
+    uint64_t position = slot->hash & (slotCount - 1);
+    while (table[position].offset != 0) {
+      position = (position + 1) & (slotCount - 1);
+    }
+    table[position] = *slot;
+  }
+
+  IndexHeader header;
+  memset(&header, 0, sizeof(IndexHeader));
+  memcpy(header.magic, INDEX_MAGIC, INDEX_MAGIC_LEN);
+  header.tableOffset = atomic_load(&writer->end);
+  header.slotCount = slotCount;
+  header.dirCount = writer->slotCount;
+  header.fileSize = header.tableOffset + slotCount * sizeof(IndexSlot);
+
+  int status = writeAt(writer->fd, table, slotCount * sizeof(IndexSlot),
+                       header.tableOffset);
+  safefree(table);
+  // The header goes last: an interrupted write leaves an invalid file.
+  if (status == 0) {
+    status = writeAt(writer->fd, &header, sizeof(IndexHeader), 0);
+  }
+  if (close(writer->fd) != 0) {
+    status = -1;
+  }
+  writer->fd = -1;
+  if (status == 0) {
+    status = rename(writer->tempPath, writer->path);
+  }
+  if (status != 0) {
+    unlink(writer->tempPath);
+  }
+  return status;
+}
+
+void destroyIndexWriter(IndexWriter *writer) {
+  if (writer->fd >= 0) {
+    close(writer->fd);
+    unlink(writer->tempPath);
+  }
+  pthread_mutex_destroy(&writer->mutex);
+  safefree(writer->slots);
+  safefree(writer->path);
+  safefree(writer->tempPath);
+  memset(writer, 0, sizeof(IndexWriter));
+  writer->fd = -1;
+}
+
+/**
+ * Collects the slots of a chunk written at the given offset.
+ */
+static void addWriterSlots(IndexWriter *writer, const IndexSlot *slots,
+                           size_t slotCount, uint64_t chunkOffset) {
+  pthread_mutex_lock(&writer->mutex);
+  if (writer->slotCount + slotCount > writer->slotCapacity) {
+    size_t capacity = writer->slotCapacity == 0 ? 1024 : writer->slotCapacity;
+    while (capacity < writer->slotCount + slotCount) {
+      capacity *= 2;
+    }
+    writer->slots =
+        (IndexSlot *)realloc(writer->slots, capacity * sizeof(IndexSlot));
+    assertIt(writer->slots != NULL, "Could not allocate memory\n");
+    writer->slotCapacity = capacity;
+  }
+  for (size_t i = 0; i < slotCount; i++) {
+    writer->slots[writer->slotCount].hash = slots[i].hash;
+    writer->slots[writer->slotCount].offset = chunkOffset + slots[i].offset;
+    writer->slotCount++;
+  }
+  pthread_mutex_unlock(&writer->mutex);
+}
+
+// ----------------------------------------------------------------------------
+// IndexBuilder
+
+void newIndexBuilder(IndexBuilder *builder, IndexWriter *writer) {
+  memset(builder, 0, sizeof(IndexBuilder));
+  builder->writer = writer;
+}
+
+void destroyIndexBuilder(IndexBuilder *builder) {
+  safefree(builder->chunk);
+  safefree(builder->slots);
+  memset(builder, 0, sizeof(IndexBuilder));
+}
+
+/**
+ * Reserves the given number of bytes at the end of the chunk (zeroed, so that
+ * padding is deterministic) and returns their offset.
+ */
+static size_t reserve(IndexBuilder *builder, size_t length) {
+  if (builder->length + length > builder->capacity) {
+    size_t capacity =
+        builder->capacity == 0 ? INDEX_CHUNK_SIZE : builder->capacity;
+    while (capacity < builder->length + length) {
+      capacity *= 2;
+    }
+    builder->chunk = (char *)realloc(builder->chunk, capacity);
+    assertIt(builder->chunk != NULL, "Could not allocate memory\n");
+    builder->capacity = capacity;
+  }
+  size_t offset = builder->length;
+  memset(builder->chunk + offset, 0, length);
+  builder->length += length;
+  return offset;
+}
+
+static IndexDir *currentDir(IndexBuilder *builder) {
+  return (IndexDir *)(builder->chunk + builder->dirOffset);
+}
+
+void beginIndexDir(IndexBuilder *builder, const char *path, size_t pathLen,
+                   const struct stat *info) {
+  builder->dirOffset =
+      reserve(builder, sizeof(IndexDir) + alignLength(pathLen + 1));
+  IndexDir *dir = currentDir(builder);
+  dir->pathLen = (uint32_t)pathLen;
+  dir->dev = (uint64_t)info->st_dev;
+  dir->ino = (uint64_t)info->st_ino;
+  dir->mtimeSec = info->st_mtim.tv_sec;
+  dir->mtimeNsec = (uint32_t)info->st_mtim.tv_nsec;
+  dir->ctimeSec = info->st_ctim.tv_sec;
+  dir->ctimeNsec = (uint32_t)info->st_ctim.tv_nsec;
+  if (builder->writer != NULL &&
+      (dir->mtimeSec >= builder->writer->racyThreshold ||
+       dir->ctimeSec >= builder->writer->racyThreshold)) {
+    dir->flags |= INDEX_DIR_RACY;
+  }
+  memcpy((char *)(dir + 1), path, pathLen);
+}
+
+void addIndexEntry(IndexBuilder *builder, const char *name, size_t nameLen,
+                   unsigned char type, uint64_t ino) {
+  size_t length = alignLength(sizeof(IndexEntry) + nameLen + 1);
+  size_t offset = reserve(builder, length);
+  IndexEntry *entry = (IndexEntry *)(builder->chunk + offset);
+  entry->ino = ino;
+  entry->type = type;
+  entry->nameLen = (uint16_t)nameLen;
+  entry->length = (uint32_t)length;
+  memcpy((char *)(entry + 1), name, nameLen);
+  currentDir(builder)->entryCount++;
+}
+
+/**
+ * Adds a slot for the directory at the given offset of the chunk.
+ */
+static void addSlot(IndexBuilder *builder, size_t dirOffset) {
+  if (builder->slotCount == builder->slotCapacity) {
+    size_t capacity =
+        builder->slotCapacity == 0 ? 1024 : builder->slotCapacity * 2;
+    builder->slots =
+        (IndexSlot *)realloc(builder->slots, capacity * sizeof(IndexSlot));
+    assertIt(builder->slots != NULL, "Could not allocate memory\n");
+    builder->slotCapacity = capacity;
+  }
+  const IndexDir *dir = (const IndexDir *)(builder->chunk + dirOffset);
+  IndexSlot *slot = &builder->slots[builder->slotCount++];
+  slot->hash = hashPath((const char *)(dir + 1), dir->pathLen);
+  slot->offset = dirOffset;
+}
+
+void endIndexDir(IndexBuilder *builder) {
+  size_t length = builder->length - builder->dirOffset;
+  if (length > UINT32_MAX) {
+    // Not indexing huge directories (they are read again on the next scan).
+    abortIndexDir(builder);
+    return;
+  }
+  currentDir(builder)->length = (uint32_t)length;
+  if (builder->writer == NULL) {
+    return;
+  }
+  addSlot(builder, builder->dirOffset);
+  if (builder->length >= INDEX_CHUNK_SIZE) {
+    flushIndexBuilder(builder);
+  }
+}
+
+void abortIndexDir(IndexBuilder *builder) {
+  builder->length = builder->dirOffset;
+}
+
+void copyIndexDir(IndexBuilder *builder, const IndexDir *dir) {
+  size_t offset = reserve(builder, dir->length);
+  memcpy(builder->chunk + offset, dir, dir->length);
+  addSlot(builder, offset);
+  if (builder->length >= INDEX_CHUNK_SIZE) {
+    flushIndexBuilder(builder);
+  }
+}
+
+IndexDir *takeIndexDir(IndexBuilder *builder) {
+  IndexDir *dir = (IndexDir *)safemalloc(builder->length - builder->dirOffset);
+  memcpy(dir, currentDir(builder), builder->length - builder->dirOffset);
+  builder->length = 0;
+  builder->dirOffset = 0;
+  return dir;
+}
+
+void flushIndexBuilder(IndexBuilder *builder) {
+  if (builder->length == 0) {
+    return;
+  }
+  IndexWriter *writer = builder->writer;
+  uint64_t offset = atomic_fetch_add(&writer->end, builder->length);
+  if (writeAt(writer->fd, builder->chunk, builder->length, offset) != 0) {
+    atomic_store(&writer->hasFailed, TRUE);
+  }
+  addWriterSlots(writer, builder->slots, builder->slotCount, offset);
+  builder->length = 0;
+  builder->dirOffset = 0;
+  builder->slotCount = 0;
+}
@@ -0,0 +1,230 @@
+#ifndef MY_INDEX_H
+#define MY_INDEX_H
+
+#include "my-util.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+// Identifies index files (the last byte is the format's version).
+#define INDEX_MAGIC "MYIDX\0\0\1"
+#define INDEX_MAGIC_LEN 8
+
+// Size of the chunks in which workers append directories to the index file.
+#define INDEX_CHUNK_SIZE (1024 * 1024)
+
+// Flags of an IndexDir.
+// Set if the directory was modified too close to the scan for its mtime to
+// tell later modifications apart (its entries are then read again on the next
+// scan).
+#define INDEX_DIR_RACY 0x1
+
+/**
+ * Header of an index file. It is followed by the directories (IndexDir), then
+ * by the hash table (IndexSlot) that maps their paths to their offsets. All
+ * integers are in host byte order, and all structures are 8-byte aligned.
+ */
+typedef struct _IndexHeader {
+  char magic[INDEX_MAGIC_LEN];
+  // Size of the file (used to detect truncated files).
+  uint64_t fileSize;
+  uint64_t dirCount;
+  uint64_t tableOffset;
+  // Number of slots of the hash table (a power of 2).
+  uint64_t slotCount;
+} IndexHeader;
+
+/**
+ * Maps the hash of a directory's path to the directory's offset in the file
+ * (an offset of 0 denotes an empty slot).
+ */
+typedef struct _IndexSlot {
+  uint64_t hash;
+  uint64_t offset;
+} IndexSlot;
+
+/**
+ * A directory, as it was when last scanned. It is followed by its path
+ * (pathLen bytes and a null terminator), padded to a multiple of 8 bytes, and
+ * by its entries (IndexEntry).
+ */
+typedef struct _IndexDir {
+  // Total length (header, path and entries).
+  uint32_t length;
+  uint32_t pathLen;
+  uint32_t entryCount;
+  // INDEX_DIR_* flags.
+  uint32_t flags;
+  uint64_t dev;
+  uint64_t ino;
+  int64_t mtimeSec;
+  int64_t ctimeSec;
+  uint32_t mtimeNsec;
+  uint32_t ctimeNsec;
+} IndexDir;
+
+/**
+ * A directory entry. It is followed by its name (nameLen bytes and a null
+ * terminator), padded to a multiple of 8 bytes.
+ */
+typedef struct _IndexEntry {
+  uint64_t ino;
+  // DT_* constant (never DT_UNKNOWN).
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t nameLen;
+  uint32_t length;
+} IndexEntry;
+
+/**
+ * Read-only view over an existing index file (memory-mapped: only the pages
+ * of the directories actually looked up are read from disk).
+ */
+typedef struct _IndexReader {
+  const char *data;
+  size_t size;
+  const IndexHeader *header;
+  const IndexSlot *slots;
+} IndexReader;
+
+/**
+ * Maps the index file at the given path. Returns 0 on success, -1 if the file
+ * does not exist, cannot be read or is not a valid index (errno is set).
+ */
+int openIndexReader(IndexReader *reader, const char *path);
+
+/**
+ * Unmaps the given index.
+ */
+void closeIndexReader(IndexReader *reader);
+
+/**
+ * Returns the directory stored for the given path, or NULL if there is none.
+ */
+const IndexDir *findIndexDir(const IndexReader *reader, const char *path,
+                             size_t pathLen);
+
+/**
+ * Returns TRUE if the stored directory is known to be up to date with
+ * respect to the given metadata (same inode, and same modification/change
+ * times).
+ */
+bool isIndexDirCurrent(const IndexDir *dir, const struct stat *info);
+
+/**
+ * Returns the first entry of the given directory (entries are iterated with
+ * nextIndexEntry, entryCount of them being available).
+ */
+const IndexEntry *firstIndexEntry(const IndexDir *dir);
+
+const IndexEntry *nextIndexEntry(const IndexEntry *entry);
+
+/**
+ * Returns the (null-terminated) name of the given entry.
+ */
+const char *indexEntryName(const IndexEntry *entry);
+
+/**
+ * Shared state of the index being written: workers reserve space in the file
+ * through an atomic offset, and write their chunks without locking (the mutex
+ * only guards the slots, which are collected once per chunk).
+ */
+typedef struct _IndexWriter {
+  int fd;
+  // The index is written to a temporary file, renamed over the target path
+  // once complete.
+  char *path;
+  char *tempPath;
+  // Offset at which the next chunk is written.
+  atomic_uint_fast64_t end;
+  // Directories modified at or after this time are flagged INDEX_DIR_RACY.
+  time_t racyThreshold;
+  atomic_bool hasFailed;
+  pthread_mutex_t mutex;
+  // One slot per directory written so far (offsets are absolute).
+  IndexSlot *slots;
+  size_t slotCount;
+  size_t slotCapacity;
+} IndexWriter;
+
+/**
+ * Accumulates the directories visited by a worker, appending them to the file
+ * in chunks of INDEX_CHUNK_SIZE bytes. An instance must only be used by a
+ * single thread.
+ *
+ * A builder without writer only encodes directories: each directory is then
+ * retrieved with takeIndexDir once recorded.
+ */
+typedef struct _IndexBuilder {
+  IndexWriter *writer;
+  char *chunk;
+  size_t capacity;
+  size_t length;
+  // Offset (in the chunk) of the directory being built.
+  size_t dirOffset;
+  // One slot per directory of the chunk (offsets are relative to the chunk).
+  IndexSlot *slots;
+  size_t slotCount;
+  size_t slotCapacity;
+} IndexBuilder;
+
+/**
+ * Creates a temporary index file next to the given path. Returns 0 on success,
+ * -1 on error (errno is set).
+ */
+int newIndexWriter(IndexWriter *writer, const char *path);
+
+/**
+ * Writes the hash table and the header of the index (all builders must have
+ * been flushed), then renames it over the target path. Returns 0 on success,
+ * -1 on error.
+ */
+int commitIndexWriter(IndexWriter *writer);
+
+/**
+ * Releases the resources kept as part of the given writer (removing the
+ * temporary file if the index was not committed).
+ */
+void destroyIndexWriter(IndexWriter *writer);
+
+void newIndexBuilder(IndexBuilder *builder, IndexWriter *writer);
+
+void destroyIndexBuilder(IndexBuilder *builder);
+
+/**
+ * Starts recording a directory, whose entries are then added with
+ * addIndexEntry, until endIndexDir is called.
+ */
+void beginIndexDir(IndexBuilder *builder, const char *path, size_t pathLen,
+                   const struct stat *info);
+
+void addIndexEntry(IndexBuilder *builder, const char *name, size_t nameLen,
+                   unsigned char type, uint64_t ino);
+
+void endIndexDir(IndexBuilder *builder);
+
+/**
+ * Drops the directory being recorded (e.g. if it could not be read in full).
+ */
+void abortIndexDir(IndexBuilder *builder);
+
+/**
+ * Records the given directory (read from a previous index) as is.
+ */
+void copyIndexDir(IndexBuilder *builder, const IndexDir *dir);
+
+/**
+ * Returns a copy of the directory last recorded by the given builder (which
+ * must not have a writer), to be released with free. The builder is reset.
+ */
+IndexDir *takeIndexDir(IndexBuilder *builder);
+
+/**
+ * Writes the builder's pending chunk to the file.
+ */
+void flushIndexBuilder(IndexBuilder *builder);
+
+#endif
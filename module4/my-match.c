@@ -0,0 +1,364 @@
+#define _GNU_SOURCE
+
+#include "my-match.h"
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Holds constants corresponding to the token types a glob is made of.
+ */
+typedef enum _TokenType {
+  TOKEN_CHAR = 0,
+  TOKEN_ANY_CHAR = 1,
+  TOKEN_CLASS = 2,
+  TOKEN_STAR = 3
+} TokenType;
+
+/**
+ * A glob token: characters are kept as a 256-bit set, so that all token types
+ * but the star can be compiled the same way.
+ */
+typedef struct _Token {
+  TokenType type;
+  unsigned char c;
+  uint64_t charSet[4];
+} Token;
+
+static void addToSet(uint64_t *charSet, unsigned char c) {
+  charSet[c >> 6] |= (uint64_t)1 << (c & 63);
+}
+
+static bool isInSet(const uint64_t *charSet, unsigned char c) {
+  return (charSet[c >> 6] >> (c & 63)) & 1;
+}
+
+/**
+ * Parses a bracket expression starting at pattern[*pos] (which is '['),
+ * following fnmatch's rules. Returns 1 if parsed (*pos then points past the
+ * closing ']'), 0 if there is no closing bracket (the '[' is then a literal
+ * character) and -1 if the expression uses a construct that only fnmatch
+ * supports (character classes, equivalence classes, collating symbols).
+ */
+static int parseBracket(const char *pattern, size_t *pos, Token *token) {
+  size_t i = *pos + 1;
+  bool isNegated = FALSE;
+  uint64_t charSet[4] = {0, 0, 0, 0};
+
+  if (pattern[i] == '!' || pattern[i] == '^') {
+    isNegated = TRUE;
+    i++;
+  }
+
+  bool isFirst = TRUE;
+  while (pattern[i] != '\0' && (isFirst || pattern[i] != ']')) {
+    isFirst = FALSE;
+    if (pattern[i] == '[' &&
+        (pattern[i + 1] == ':' || pattern[i + 1] == '=' ||
+         pattern[i + 1] == '.')) {
+      return -1;
+    }
+    unsigned char low = (unsigned char)pattern[i];
+    if (low == '\\' && pattern[i + 1] != '\0') {
+      low = (unsigned char)pattern[++i];
+    }
+    i++;
+    unsigned char high = low;
+    if (pattern[i] == '-' && pattern[i + 1] != ']' && pattern[i + 1] != '\0') {
+      i++;
+      high = (unsigned char)pattern[i];
+      if (high == '\\' && pattern[i + 1] != '\0') {
+        high = (unsigned char)pattern[++i];
+      }
+      i++;
+    }
+    for (unsigned c = low; c <= high; c++) {
+      addToSet(charSet, (unsigned char)c);
+    }
+  }
+
+  if (pattern[i] != ']') {
+    return 0;
+  }
+
+  token->type = TOKEN_CLASS;
+  for (int w = 0; w < 4; w++) {
+    token->charSet[w] = isNegated ? ~charSet[w] : charSet[w];
+  }
+  // With FNM_PATHNAME, a bracket expression never matches a slash.
+  token->charSet['/' >> 6] &= ~((uint64_t)1 << ('/' & 63));
+  token->charSet[0] &= ~(uint64_t)1;
+  *pos = i + 1;
+  return 1;
+}
+
+/**
+ * Splits the given pattern into tokens (consecutive stars are collapsed into
+ * one). Returns the number of tokens, or -1 if the pattern can only be
+ * evaluated by fnmatch: that includes patterns ending with an unescaped
+ * backslash, which fnmatch never matches.
+ */
+static int tokenize(const char *pattern, Token *tokens, int maxTokens) {
+  int count = 0;
+  size_t pos = 0;
+  while (pattern[pos] != '\0') {
+    if (count == maxTokens) {
+      return -1;
+    }
+    Token *token = &tokens[count];
+    memset(token, 0, sizeof(Token));
+    char c = pattern[pos];
+    if (c == '*') {
+      pos++;
+      if (count > 0 && tokens[count - 1].type == TOKEN_STAR) {
+        continue;
+      }
+      token->type = TOKEN_STAR;
+    } else if (c == '?') {
+      pos++;
+      token->type = TOKEN_ANY_CHAR;
+    } else if (c == '[') {
+      int status = parseBracket(pattern, &pos, token);
+      if (status < 0) {
+        return -1;
+      }
+      if (status == 0) {
+        pos++;
+        token->type = TOKEN_CHAR;
+        token->c = '[';
+      }
+    } else {
+      if (c == '\\' && pattern[pos + 1] == '\0') {
+        return -1;
+      }
+      if (c == '\\') {
+        pos++;
+      }
+      token->type = TOKEN_CHAR;
+      token->c = (unsigned char)pattern[pos];
+      pos++;
+    }
+    count++;
+  }
+  return count;
+}
+
+/**
+ * Stores the characters of the given (TOKEN_CHAR) tokens as the matcher's
+ * literal.
+ */
+static int setLiteral(Matcher *matcher, const Token *tokens, int from, int to) {
+  matcher->literalLen = (size_t)(to - from);
+  matcher->literal = (char *)malloc(matcher->literalLen + 1);
+  if (matcher->literal == NULL) {
+    return -1;
+  }
+  for (int i = from; i < to; i++) {
+    matcher->literal[i - from] = (char)tokens[i].c;
+  }
+  matcher->literal[matcher->literalLen] = '\0';
+  return 0;
+}
+
+static void compileNfa(Matcher *matcher, const Token *tokens, int count) {
+  memset(matcher->advanceMasks, 0, sizeof(matcher->advanceMasks));
+  matcher->starMask = 0;
+  for (int i = 0; i < count; i++) {
+    uint64_t bit = (uint64_t)1 << i;
+    switch (tokens[i].type) {
+    case TOKEN_STAR:
+      matcher->starMask |= bit;
+      break;
+    case TOKEN_CHAR:
+      matcher->advanceMasks[tokens[i].c] |= bit;
+      break;
+    case TOKEN_ANY_CHAR:
+      // With FNM_PATHNAME, ? does not match a slash.
+      for (int c = 1; c < 256; c++) {
+        if (c != '/') {
+          matcher->advanceMasks[c] |= bit;
+        }
+      }
+      break;
+    case TOKEN_CLASS:
+      for (int c = 1; c < 256; c++) {
+        if (isInSet(tokens[i].charSet, (unsigned char)c)) {
+          matcher->advanceMasks[c] |= bit;
+        }
+      }
+      break;
+    }
+  }
+  matcher->acceptMask = (uint64_t)1 << count;
+}
+
+int compileMatcher(Matcher *matcher, const char *pattern) {
+  Token tokens[MAX_NFA_TOKENS];
+  memset(matcher, 0, sizeof(Matcher));
+  matcher->pattern = strdup(pattern);
+  if (matcher->pattern == NULL) {
+    return -1;
+  }
+
+  int count = tokenize(pattern, tokens, MAX_NFA_TOKENS);
+  if (count < 0) {
+    matcher->kind = MATCH_FNMATCH;
+    return 0;
+  }
+
+  // Looking for the "<literal>", "<literal>*", "*<literal>", "*<literal>*"
+  // and "*" shapes, which do not need an NFA.
+  int from = 0;
+  int to = count;
+  bool hasLeadingStar = count > 0 && tokens[0].type == TOKEN_STAR;
+  bool hasTrailingStar = to > from + (hasLeadingStar ? 1 : 0) &&
+                         tokens[count - 1].type == TOKEN_STAR;
+  from += hasLeadingStar ? 1 : 0;
+  to -= hasTrailingStar ? 1 : 0;
+  bool isLiteral = TRUE;
+  for (int i = from; i < to; i++) {
+    if (tokens[i].type != TOKEN_CHAR) {
+      isLiteral = FALSE;
+      break;
+    }
+  }
+
+  if (isLiteral) {
+    if (setLiteral(matcher, tokens, from, to) != 0) {
+      return -1;
+    }
+    if (hasLeadingStar && (hasTrailingStar || to == from)) {
+      matcher->kind = to == from ? MATCH_ANY : MATCH_INFIX;
+    } else if (hasLeadingStar) {
+      matcher->kind = MATCH_SUFFIX;
+    } else if (hasTrailingStar) {
+      matcher->kind = MATCH_PREFIX;
+    } else {
+      matcher->kind = MATCH_LITERAL;
+    }
+    return 0;
+  }
+
+  matcher->kind = MATCH_NFA;
+  compileNfa(matcher, tokens, count);
+  return 0;
+}
+
+void destroyMatcher(Matcher *matcher) {
+  safefree(matcher->pattern);
+  safefree(matcher->literal);
+  matcher->pattern = NULL;
+  matcher->literal = NULL;
+}
+
+/**
+ * Simulates the NFA compiled from a glob: bit i of the state set is on if the
+ * first i tokens match the characters consumed so far. Stars are epsilon
+ * transitions to the next state (consecutive stars having been collapsed, a
+ * single closure step suffices).
+ */
+static bool matchNfa(const Matcher *matcher, const char *name,
+                     size_t nameLen) {
+  uint64_t starMask = matcher->starMask;
+  uint64_t states = 1;
+  states |= (states & starMask) << 1;
+  for (size_t i = 0; i < nameLen && states != 0; i++) {
+    unsigned char c = (unsigned char)name[i];
+    states = ((states & matcher->advanceMasks[c]) << 1) |
+             (c != '/' ? states & starMask : 0);
+    states |= (states & starMask) << 1;
+  }
+  return (states & matcher->acceptMask) != 0;
+}
+
+bool matchName(const Matcher *matcher, const char *name, size_t nameLen) {
+  // With FNM_PATHNAME, wildcards never match a slash: names containing one
+  // (not expected from directory entries) are handled by fnmatch.
+  switch (matcher->kind) {
+  case MATCH_ANY:
+    return memchr(name, '/', nameLen) == NULL;
+  case MATCH_LITERAL:
+    return nameLen == matcher->literalLen &&
+           memcmp(name, matcher->literal, nameLen) == 0;
+  case MATCH_PREFIX:
+    if (nameLen < matcher->literalLen ||
+        memcmp(name, matcher->literal, matcher->literalLen) != 0) {
+      return FALSE;
+    }
+    break;
+  case MATCH_SUFFIX:
+    if (nameLen < matcher->literalLen ||
+        memcmp(name + nameLen - matcher->literalLen, matcher->literal,
+               matcher->literalLen) != 0) {
+      return FALSE;
+    }
+    break;
+  case MATCH_INFIX:
+    if (memmem(name, nameLen, matcher->literal, matcher->literalLen) == NULL) {
+      return FALSE;
+    }
+    break;
+  case MATCH_NFA:
+    return matchNfa(matcher, name, nameLen);
+  case MATCH_FNMATCH:
+    return fnmatch(matcher->pattern, name, FNM_PATHNAME) == 0;
+  }
+
+  if (memchr(name, '/', nameLen) != NULL) {
+    return fnmatch(matcher->pattern, name, FNM_PATHNAME) == 0;
+  }
+  return TRUE;
+}
+
+void newMatcherSet(MatcherSet *set) {
+  set->matchers = NULL;
+  set->count = 0;
+  set->capacity = 0;
+}
+
+void destroyMatcherSet(MatcherSet *set) {
+  for (uint32_t i = 0; i < set->count; i++) {
+    destroyMatcher(&set->matchers[i]);
+  }
+  safefree(set->matchers);
+  newMatcherSet(set);
+}
+
+int addPattern(MatcherSet *set, const char *pattern) {
+  if (set->count == set->capacity) {
+    uint32_t capacity = set->capacity == 0 ? 4 : set->capacity * 2;
+    Matcher *matchers =
+        (Matcher *)realloc(set->matchers, capacity * sizeof(Matcher));
+    if (matchers == NULL) {
+      return -1;
+    }
+    set->matchers = matchers;
+    set->capacity = capacity;
+  }
+
+  Matcher matcher;
+  if (compileMatcher(&matcher, pattern) != 0) {
+    destroyMatcher(&matcher);
+    return -1;
+  }
+
+  // Keeping the set sorted from cheapest to most expensive strategy (stable
+  // with respect to the order in which patterns were added).
+  uint32_t pos = set->count;
+  while (pos > 0 && set->matchers[pos - 1].kind > matcher.kind) {
+    set->matchers[pos] = set->matchers[pos - 1];
+    pos--;
+  }
+  set->matchers[pos] = matcher;
+  set->count++;
+  return 0;
+}
+
+int matchAnyPattern(const MatcherSet *set, const char *name, size_t nameLen) {
+  for (uint32_t i = 0; i < set->count; i++) {
+    if (matchName(&set->matchers[i], name, nameLen)) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
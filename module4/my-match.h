@@ -0,0 +1,104 @@
+#ifndef MY_MATCH_H
+#define MY_MATCH_H
+
+#include "my-util.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of tokens in a glob compiled to an NFA (one bit per state
+// must fit in a uint64_t, the last one being the accepting state). Longer
+// globs are delegated to fnmatch.
+#define MAX_NFA_TOKENS 63
+
+/**
+ * Holds constants corresponding to the strategies that a Matcher can use,
+ * from cheapest to most expensive.
+ */
+typedef enum _MatchKind {
+  // "*": matches any name
+  MATCH_ANY = 0,
+  // "name": compares the whole name
+  MATCH_LITERAL = 1,
+  // "prefix*": compares the beginning of the name
+  MATCH_PREFIX = 2,
+  // "*suffix": compares the end of the name
+  MATCH_SUFFIX = 3,
+  // "*infix*": searches the name
+  MATCH_INFIX = 4,
+  // any other glob, simulated as a bit-parallel NFA
+  MATCH_NFA = 5,
+  // globs the NFA does not support ([[:alpha:]] and the like)
+  MATCH_FNMATCH = 6
+} MatchKind;
+
+/**
+ * A glob pattern, compiled once into the cheapest strategy able to evaluate
+ * it. Matching semantics are those of fnmatch(pattern, name, FNM_PATHNAME),
+ * names being expected not to contain slashes.
+ */
+typedef struct _Matcher {
+  MatchKind kind;
+  // The pattern, as provided.
+  char *pattern;
+  // The pattern's literal part (for MATCH_LITERAL to MATCH_INFIX), with
+  // escapes resolved.
+  char *literal;
+  size_t literalLen;
+  // For MATCH_NFA: bit i of advanceMasks[c] is set if token i consumes
+  // character c (and moves to state i + 1), bit i of starMask is set if
+  // token i is a star (which consumes any character and stays in state i).
+  uint64_t advanceMasks[256];
+  uint64_t starMask;
+  uint64_t acceptMask;
+} Matcher;
+
+/**
+ * Compiles the given glob pattern. Returns 0 on success, -1 on allocation
+ * failure.
+ */
+int compileMatcher(Matcher *matcher, const char *pattern);
+
+/**
+ * Releases the resources kept as part of the given matcher.
+ */
+void destroyMatcher(Matcher *matcher);
+
+/**
+ * Returns TRUE if the given name (of the given length, null-terminated)
+ * matches the given compiled pattern.
+ */
+bool matchName(const Matcher *matcher, const char *name, size_t nameLen);
+
+/**
+ * Holds a set of compiled patterns, which are all evaluated in a single pass.
+ */
+typedef struct _MatcherSet {
+  Matcher *matchers;
+  uint32_t count;
+  uint32_t capacity;
+} MatcherSet;
+
+/**
+ * Initializes an empty MatcherSet.
+ */
+void newMatcherSet(MatcherSet *set);
+
+/**
+ * Releases the resources kept as part of the given MatcherSet.
+ */
+void destroyMatcherSet(MatcherSet *set);
+
+/**
+ * Compiles the given pattern and adds it to the set. Returns 0 on success, -1
+ * on allocation failure.
+ */
+int addPattern(MatcherSet *set, const char *pattern);
+
+/**
+ * Returns the index of the first pattern in the set that the given name
+ * matches, or -1 if it matches none of them. The patterns are evaluated from
+ * cheapest to most expensive.
+ */
+int matchAnyPattern(const MatcherSet *set, const char *name, size_t nameLen);
+
+#endif
@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+#include "my-search.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// ----------------------------------------------------------------------------
+// Search implementations
+
+static const char *findScalar(const char *data, size_t length,
+                              const char *literal, size_t literalLen) {
+  return (const char *)memmem(data, length, literal, literalLen);
+}
+
+#if defined(__x86_64__)
+
+/**
+ * Implements the FindFunction typedef with SSE2 (available on any x86-64
+ * CPU): bit i of the mask is set if the literal's first byte is found at
+ * position i of the block, and its last byte where it would then end.
+ */
+static const char *findSse2(const char *data, size_t length,
+                            const char *literal, size_t literalLen) {
+  if (literalLen == 1) {
+    return (const char *)memchr(data, literal[0], length);
+  }
+  const __m128i first = _mm_set1_epi8(literal[0]);
+  const __m128i last = _mm_set1_epi8(literal[literalLen - 1]);
+  size_t i = 0;
+  for (; i + literalLen - 1 + sizeof(__m128i) <= length;
+       i += sizeof(__m128i)) {
+    __m128i blockFirst = _mm_loadu_si128((const __m128i *)(data + i));
+    __m128i blockLast =
+        _mm_loadu_si128((const __m128i *)(data + i + literalLen - 1));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast)));
+    while (mask != 0) {
+      unsigned bit = (unsigned)__builtin_ctz(mask);
+      if (memcmp(data + i + bit + 1, literal + 1, literalLen - 2) == 0) {
+        return data + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  // Positions too close to the end for a whole block
+  return findScalar(data + i, length - i, literal, literalLen);
+}
+
+/**
+ * Implements the FindFunction typedef with AVX2 (32 positions at once), as
+ * findSse2 does. Compiled for AVX2 whatever the build flags: it is only
+ * called if the running CPU supports it.
+ */
+__attribute__((target("avx2"))) static const char *
+findAvx2(const char *data, size_t length, const char *literal,
+         size_t literalLen) {
+  if (literalLen == 1) {
+    return (const char *)memchr(data, literal[0], length);
+  }
+  const __m256i first = _mm256_set1_epi8(literal[0]);
+  const __m256i last = _mm256_set1_epi8(literal[literalLen - 1]);
+  size_t i = 0;
+  for (; i + literalLen - 1 + sizeof(__m256i) <= length;
+       i += sizeof(__m256i)) {
+    __m256i blockFirst = _mm256_loadu_si256((const __m256i *)(data + i));
+    __m256i blockLast =
+        _mm256_loadu_si256((const __m256i *)(data + i + literalLen - 1));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst),
+                         _mm256_cmpeq_epi8(last, blockLast)));
+    while (mask != 0) {
+      unsigned bit = (unsigned)__builtin_ctz(mask);
+      if (memcmp(data + i + bit + 1, literal + 1, literalLen - 2) == 0) {
+        return data + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return findSse2(data + i, length - i, literal, literalLen);
+}
+
+#endif
+
+// ----------------------------------------------------------------------------
+// LiteralSet
+
+void newLiteralSet(LiteralSet *set) {
+  set->literals = NULL;
+  set->lengths = NULL;
+  set->count = 0;
+  set->capacity = 0;
+  set->minLength = 0;
+  set->maxLength = 0;
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  set->find = __builtin_cpu_supports("avx2") ? findAvx2 : findSse2;
+#else
+  set->find = findScalar;
+#endif
+}
+
+void destroyLiteralSet(LiteralSet *set) {
+  for (uint32_t i = 0; i < set->count; i++) {
+    safefree(set->literals[i]);
+  }
+  safefree(set->literals);
+  safefree(set->lengths);
+  newLiteralSet(set);
+}
+
+int addLiteral(LiteralSet *set, const char *literal) {
+  size_t length = strlen(literal);
+  if (length == 0) {
+    return -1;
+  }
+  if (set->count == set->capacity) {
+    uint32_t capacity = set->capacity == 0 ? 4 : set->capacity * 2;
+    char **literals =
+        (char **)realloc(set->literals, capacity * sizeof(char *));
+    if (literals == NULL) {
+      return -1;
+    }
+    set->literals = literals;
+    size_t *lengths =
+        (size_t *)realloc(set->lengths, capacity * sizeof(size_t));
+    if (lengths == NULL) {
+      return -1;
+    }
+    set->lengths = lengths;
+    set->capacity = capacity;
+  }
+  char *copy = strdup(literal);
+  if (copy == NULL) {
+    return -1;
+  }
+  set->literals[set->count] = copy;
+  set->lengths[set->count] = length;
+  set->count++;
+  if (set->count == 1 || length < set->minLength) {
+    set->minLength = length;
+  }
+  if (length > set->maxLength) {
+    set->maxLength = length;
+  }
+  return 0;
+}
+
+bool containsAnyLiteral(const LiteralSet *set, const char *data,
+                        size_t length) {
+  if (length < set->minLength) {
+    return FALSE;
+  }
+  for (size_t start = 0; start < length; start += SEARCH_WINDOW_SIZE) {
+    size_t windowLen = length - start < SEARCH_WINDOW_SIZE
+                           ? length - start
+                           : SEARCH_WINDOW_SIZE;
+    for (uint32_t i = 0; i < set->count; i++) {
+      // Occurrences starting within the window (which may end past it)
+      size_t literalLen = set->lengths[i];
+      size_t end = start + windowLen + literalLen - 1;
+      end = end < length ? end : length;
+      if (end - start >= literalLen &&
+          set->find(data + start, end - start, set->literals[i],
+                    literalLen) != NULL) {
+        return TRUE;
+      }
+    }
+  }
+  return FALSE;
+}
+
+// ----------------------------------------------------------------------------
+// ContentSearcher
+
+void newContentSearcher(ContentSearcher *searcher) {
+  searcher->buffer = NULL;
+  searcher->capacity = 0;
+  searcher->searchedBytes = 0;
+}
+
+void destroyContentSearcher(ContentSearcher *searcher) {
+  safefree(searcher->buffer);
+  searcher->buffer = NULL;
+  searcher->capacity = 0;
+}
+
+/**
+ * Reads the given file in chunks of SEARCH_CHUNK_SIZE bytes into the
+ * searcher's buffer, and searches each of them. The last maxLength - 1 bytes
+ * of a chunk are kept in front of the next one, for the occurrences spanning
+ * both. A file truncated (or extended) while being read is searched up to
+ * where the reads stopped.
+ */
+static int searchChunks(ContentSearcher *searcher, const LiteralSet *set,
+                        int fd) {
+  size_t overlap = set->maxLength - 1;
+  if (searcher->capacity < SEARCH_CHUNK_SIZE + overlap) {
+    char *buffer = (char *)malloc(SEARCH_CHUNK_SIZE + overlap);
+    if (buffer == NULL) {
+      return -1;
+    }
+    safefree(searcher->buffer);
+    searcher->buffer = buffer;
+    searcher->capacity = SEARCH_CHUNK_SIZE + overlap;
+  }
+  size_t kept = 0;
+  off_t offset = 0;
+  while (TRUE) {
+    ssize_t bytes =
+        pread(fd, searcher->buffer + kept, SEARCH_CHUNK_SIZE, offset);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes < 0) {
+      return -1;
+    }
+    if (bytes == 0) {
+      return 0;
+    }
+    offset += bytes;
+    searcher->searchedBytes = (uint64_t)offset;
+    size_t length = kept + (size_t)bytes;
+    if (containsAnyLiteral(set, searcher->buffer, length)) {
+      return 1;
+    }
+    kept = length < overlap ? length : overlap;
+    memmove(searcher->buffer, searcher->buffer + length - kept, kept);
+  }
+}
+
+int searchFile(ContentSearcher *searcher, const LiteralSet *set, int dirFd,
+               const char *name) {
+  // Non-blocking, in case the name refers to a FIFO (which is not searched)
+  int fd = openat(dirFd, name, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat info;
+  int result = 0;
+  searcher->searchedBytes = 0;
+  if (fstat(fd, &info) != 0) {
+    result = -1;
+  } else if (S_ISREG(info.st_mode) &&
+             (size_t)info.st_size >= set->minLength) {
+    // Reads ahead more aggressively, for the files read in several chunks
+    if ((size_t)info.st_size > SEARCH_CHUNK_SIZE) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    result = searchChunks(searcher, set, fd);
+  }
+  int error = errno;
+  close(fd);
+  errno = error;
+  return result;
+}
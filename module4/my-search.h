@@ -0,0 +1,99 @@
+#ifndef MY_SEARCH_H
+#define MY_SEARCH_H
+
+#include "my-util.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes of a file read into the searcher's buffer at once (larger files are
+// read in several chunks).
+#define SEARCH_CHUNK_SIZE (256 * 1024)
+
+// Bytes of a file searched for every literal before moving on to the next
+// ones (so that they stay in the L2 cache while the literals are searched).
+#define SEARCH_WINDOW_SIZE (64 * 1024)
+
+/**
+ * Returns a pointer to the first occurrence of the given literal (of at least
+ * 1 byte) in the given data, or NULL if there is none.
+ */
+typedef const char *(*FindFunction)(const char *data, size_t length,
+                                    const char *literal, size_t literalLen);
+
+/**
+ * Holds the literal strings searched for in file contents (a file matches if
+ * it contains any of them), and the search implementation picked for the
+ * running CPU: AVX2 or SSE2 on x86-64, memmem otherwise.
+ *
+ * Each literal is searched for by comparing its first and last bytes against
+ * 16 or 32 consecutive positions at once: only the positions where both match
+ * are compared in full.
+ */
+typedef struct _LiteralSet {
+  char **literals;
+  size_t *lengths;
+  uint32_t count;
+  uint32_t capacity;
+  // Length of the shortest literal (files shorter than that are not read).
+  size_t minLength;
+  // Length of the longest literal.
+  size_t maxLength;
+  FindFunction find;
+} LiteralSet;
+
+/**
+ * Initializes an empty set.
+ */
+void newLiteralSet(LiteralSet *set);
+
+/**
+ * Releases the resources kept as part of the given set.
+ */
+void destroyLiteralSet(LiteralSet *set);
+
+/**
+ * Adds the given literal (which must not be empty) to the set. Returns 0 on
+ * success, -1 on allocation failure or if the literal is empty.
+ */
+int addLiteral(LiteralSet *set, const char *literal);
+
+/**
+ * Returns TRUE if the given data contains any of the set's literals.
+ */
+bool containsAnyLiteral(const LiteralSet *set, const char *data,
+                        size_t length);
+
+/**
+ * Searches files for the literals of a set. An instance must only be used by
+ * a single thread: its buffer is allocated on first use (on that thread), and
+ * reused from one file to the next.
+ */
+typedef struct _ContentSearcher {
+  char *buffer;
+  size_t capacity;
+  // Bytes searched by the last call to searchFile.
+  uint64_t searchedBytes;
+} ContentSearcher;
+
+/**
+ * Initializes a searcher (no memory is allocated until a file is searched).
+ */
+void newContentSearcher(ContentSearcher *searcher);
+
+/**
+ * Releases the resources kept as part of the given searcher.
+ */
+void destroyContentSearcher(ContentSearcher *searcher);
+
+/**
+ * Searches the file with the given name (relative to dirFd, links being
+ * followed) for the given literals: the file is read sequentially into the
+ * searcher's buffer, SEARCH_CHUNK_SIZE bytes at a time, and the search stops
+ * at the first chunk with an occurrence. Returns 1 if the file contains any
+ * of the literals, 0 if it does not or is not a regular file, and -1 on error
+ * (errno is set).
+ */
+int searchFile(ContentSearcher *searcher, const LiteralSet *set, int dirFd,
+               const char *name);
+
+#endif
@@ -0,0 +1,281 @@
+#include "my-usage.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_DIR_CAPACITY 1024
+#define INITIAL_PATHS_CAPACITY (64 * 1024)
+#define INITIAL_SHARD_CAPACITY 256
+
+#define DIR_USAGE_INDEX_MASK (((uint64_t)1 << DIR_USAGE_INDEX_BITS) - 1)
+
+// ----------------------------------------------------------------------------
+// UsageAccumulator
+
+void newUsageAccumulator(UsageAccumulator *accumulator, uint32_t workerIndex) {
+  accumulator->workerIndex = workerIndex;
+  accumulator->dirs = NULL;
+  accumulator->dirCount = 0;
+  accumulator->dirCapacity = 0;
+  accumulator->paths = NULL;
+  accumulator->pathsLength = 0;
+  accumulator->pathsCapacity = 0;
+}
+
+void destroyUsageAccumulator(UsageAccumulator *accumulator) {
+  safefree(accumulator->dirs);
+  safefree(accumulator->paths);
+  accumulator->dirs = NULL;
+  accumulator->paths = NULL;
+}
+
+uint64_t beginDirUsage(UsageAccumulator *accumulator, uint64_t parent,
+                       uint32_t depth, const char *path, size_t pathLen) {
+  if (accumulator->dirCount == accumulator->dirCapacity) {
+    accumulator->dirCapacity = accumulator->dirCapacity == 0
+                                   ? INITIAL_DIR_CAPACITY
+                                   : accumulator->dirCapacity * 2;
+    accumulator->dirs = (DirUsage *)realloc(
+        accumulator->dirs, accumulator->dirCapacity * sizeof(DirUsage));
+    assertIt(accumulator->dirs != NULL, "Could not allocate memory\n");
+  }
+  if (accumulator->pathsLength + pathLen + 1 > accumulator->pathsCapacity) {
+    size_t capacity = accumulator->pathsCapacity == 0
+                          ? INITIAL_PATHS_CAPACITY
+                          : accumulator->pathsCapacity * 2;
+    while (accumulator->pathsLength + pathLen + 1 > capacity) {
+      capacity *= 2;
+    }
+    accumulator->paths = (char *)realloc(accumulator->paths, capacity);
+    assertIt(accumulator->paths != NULL, "Could not allocate memory\n");
+    accumulator->pathsCapacity = capacity;
+  }
+
+  DirUsage *dir = &accumulator->dirs[accumulator->dirCount];
+  dir->parent = parent;
+  dir->blocks = 0;
+  dir->size = 0;
+  dir->depth = depth;
+  dir->pathLen = (uint32_t)pathLen;
+  dir->pathOffset = accumulator->pathsLength;
+  memcpy(accumulator->paths + accumulator->pathsLength, path, pathLen);
+  accumulator->paths[accumulator->pathsLength + pathLen] = '\0';
+  accumulator->pathsLength += pathLen + 1;
+  return (uint64_t)accumulator->workerIndex << DIR_USAGE_INDEX_BITS |
+         accumulator->dirCount++;
+}
+
+void addDirUsage(UsageAccumulator *accumulator, uint64_t blocks,
+                 uint64_t size) {
+  DirUsage *dir = &accumulator->dirs[accumulator->dirCount - 1];
+  dir->blocks += blocks;
+  dir->size += size;
+}
+
+const char *dirUsagePath(const UsageAccumulator *accumulator,
+                         const DirUsage *dir) {
+  return accumulator->paths + dir->pathOffset;
+}
+
+const DirUsage *findDirUsage(const UsageAccumulator *accumulators,
+                             uint64_t id) {
+  return &accumulators[id >> DIR_USAGE_INDEX_BITS]
+              .dirs[id & DIR_USAGE_INDEX_MASK];
+}
+
+void sumDirUsages(UsageAccumulator *accumulators, uint32_t count) {
+  // Bucketing the directories by depth (counting sort), so that each
+  // directory is added to its parent once complete: deepest ones first.
+  uint32_t maxDepth = 0;
+  size_t dirCount = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    for (size_t j = 0; j < accumulators[i].dirCount; j++) {
+      if (accumulators[i].dirs[j].depth > maxDepth) {
+        maxDepth = accumulators[i].dirs[j].depth;
+      }
+    }
+    dirCount += accumulators[i].dirCount;
+  }
+  size_t *starts = (size_t *)calloc(maxDepth + 2, sizeof(size_t));
+  DirUsage **byDepth = (DirUsage **)safemalloc(dirCount * sizeof(DirUsage *));
+  assertIt(starts != NULL, "Could not allocate memory\n");
+  for (uint32_t i = 0; i < count; i++) {
+    for (size_t j = 0; j < accumulators[i].dirCount; j++) {
+      starts[accumulators[i].dirs[j].depth + 1]++;
+    }
+  }
+  for (uint32_t depth = 0; depth <= maxDepth; depth++) {
+    starts[depth + 1] += starts[depth];
+  }
+  size_t *cursors = (size_t *)safemalloc((maxDepth + 1) * sizeof(size_t));
+  memcpy(cursors, starts, (maxDepth + 1) * sizeof(size_t));
+  for (uint32_t i = 0; i < count; i++) {
+    for (size_t j = 0; j < accumulators[i].dirCount; j++) {
+      DirUsage *dir = &accumulators[i].dirs[j];
+      byDepth[cursors[dir->depth]++] = dir;
+    }
+  }
+
+  for (size_t i = dirCount; i > 0; i--) {
+    DirUsage *dir = byDepth[i - 1];
+    if (dir->parent != NO_DIR_USAGE) {
+      DirUsage *parent = (DirUsage *)findDirUsage(accumulators, dir->parent);
+      parent->blocks += dir->blocks;
+      parent->size += dir->size;
+    }
+  }
+  safefree(cursors);
+  safefree(byDepth);
+  safefree(starts);
+}
+
+static bool isLarger(const UsageAccumulator *accumulators, uint64_t id,
+                     uint64_t otherId) {
+  return findDirUsage(accumulators, id)->blocks >
+         findDirUsage(accumulators, otherId)->blocks;
+}
+
+/**
+ * Restores the heap property (the smallest directory at the root) below the
+ * given position.
+ */
+static void siftDown(const UsageAccumulator *accumulators, uint64_t *heap,
+                     size_t count, size_t position) {
+  while (TRUE) {
+    size_t smallest = position;
+    size_t left = 2 * position + 1;
+    size_t right = left + 1;
+    if (left < count && isLarger(accumulators, heap[smallest], heap[left])) {
+      smallest = left;
+    }
+    if (right < count && isLarger(accumulators, heap[smallest], heap[right])) {
+      smallest = right;
+    }
+    if (smallest == position) {
+      return;
+    }
+    uint64_t id = heap[position];
+    heap[position] = heap[smallest];
+    heap[smallest] = id;
+    position = smallest;
+  }
+}
+
+size_t findLargestDirUsages(const UsageAccumulator *accumulators,
+                            uint32_t count, size_t maxCount,
+                            uint64_t *largest) {
+  // Keeping the maxCount largest directories in a min-heap.
+  size_t heapCount = 0;
+  for (uint32_t i = 0; i < count && maxCount > 0; i++) {
+    for (size_t j = 0; j < accumulators[i].dirCount; j++) {
+      uint64_t id = (uint64_t)i << DIR_USAGE_INDEX_BITS | j;
+      if (heapCount < maxCount) {
+        largest[heapCount++] = id;
+        if (heapCount == maxCount) {
+          for (size_t k = heapCount / 2; k > 0; k--) {
+            siftDown(accumulators, largest, heapCount, k - 1);
+          }
+        }
+      } else if (isLarger(accumulators, id, largest[0])) {
+        largest[0] = id;
+        siftDown(accumulators, largest, heapCount, 0);
+      }
+    }
+  }
+  if (heapCount < maxCount) {
+    for (size_t k = heapCount / 2; k > 0; k--) {
+      siftDown(accumulators, largest, heapCount, k - 1);
+    }
+  }
+
+  // Sorting in place (largest first) by repeatedly moving the smallest
+  // directory to the end.
+  for (size_t end = heapCount; end > 1; end--) {
+    uint64_t id = largest[0];
+    largest[0] = largest[end - 1];
+    largest[end - 1] = id;
+    siftDown(accumulators, largest, end - 1, 0);
+  }
+  return heapCount;
+}
+
+// ----------------------------------------------------------------------------
+// InodeSet
+
+void newInodeSet(InodeSet *set) {
+  for (size_t i = 0; i < INODE_SET_SHARDS; i++) {
+    InodeShard *shard = &set->shards[i];
+    assertIt(pthread_mutex_init(&shard->mutex, NULL) == 0,
+             "Could not initialize inode set mutex\n");
+    shard->keys = NULL;
+    shard->count = 0;
+    shard->capacity = 0;
+  }
+}
+
+void destroyInodeSet(InodeSet *set) {
+  for (size_t i = 0; i < INODE_SET_SHARDS; i++) {
+    pthread_mutex_destroy(&set->shards[i].mutex);
+    safefree(set->shards[i].keys);
+  }
+}
+
+static uint64_t hashInode(uint64_t dev, uint64_t ino) {
+  // Mixing both values (splitmix64 finalizer), inode numbers being mostly
+  // sequential.
+  uint64_t hash = ino * 0x9E3779B97F4A7C15ULL ^ dev;
+  hash ^= hash >> 30;
+  hash *= 0xBF58476D1CE4E5B9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94D049BB133111EBULL;
+  return hash ^ (hash >> 31);
+}
+
+/**
+ * Inserts the given key in the given shard, which must have room for it.
+ * Returns TRUE if the key was not in the shard already.
+ */
+static bool insertKey(InodeShard *shard, uint64_t hash, uint64_t dev,
+                      uint64_t key) {
+  size_t mask = shard->capacity - 1;
+  // The low bits selected the shard: using the high ones within it.
+  for (size_t i = (hash >> 32) & mask;; i = (i + 1) & mask) {
+    uint64_t *slot = &shard->keys[2 * i];
+    if (slot[0] == 0 && slot[1] == 0) {
+      slot[0] = dev;
+      slot[1] = key;
+      shard->count++;
+      return TRUE;
+    }
+    if (slot[0] == dev && slot[1] == key) {
+      return FALSE;
+    }
+  }
+}
+
+static void growShard(InodeShard *shard) {
+  uint64_t *keys = shard->keys;
+  size_t capacity = shard->capacity;
+  shard->capacity = capacity == 0 ? INITIAL_SHARD_CAPACITY : capacity * 2;
+  shard->keys = (uint64_t *)calloc(2 * shard->capacity, sizeof(uint64_t));
+  assertIt(shard->keys != NULL, "Could not allocate memory\n");
+  shard->count = 0;
+  for (size_t i = 0; i < capacity; i++) {
+    if (keys[2 * i] != 0 || keys[2 * i + 1] != 0) {
+      insertKey(shard, hashInode(keys[2 * i], keys[2 * i + 1] - 1),
+                keys[2 * i], keys[2 * i + 1]);
+    }
+  }
+  safefree(keys);
+}
+
+bool insertInode(InodeSet *set, uint64_t dev, uint64_t ino) {
+  uint64_t hash = hashInode(dev, ino);
+  InodeShard *shard = &set->shards[hash & (INODE_SET_SHARDS - 1)];
+  pthread_mutex_lock(&shard->mutex);
+  if ((shard->count + 1) * 2 > shard->capacity) {
+    growShard(shard);
+  }
+  bool isNew = insertKey(shard, hash, dev, ino + 1);
+  pthread_mutex_unlock(&shard->mutex);
+  return isNew;
+}
@@ -0,0 +1,126 @@
+#ifndef MY_USAGE_H
+#define MY_USAGE_H
+
+#include "my-pool.h"
+#include "my-util.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of shards of an InodeSet (a power of 2).
+#define INODE_SET_SHARDS 64
+
+// Number of bits of a DirUsage id holding the directory's index in its
+// accumulator (the other bits hold the worker's index).
+#define DIR_USAGE_INDEX_BITS 40
+
+// Parent id of the starting directory.
+#define NO_DIR_USAGE UINT64_MAX
+
+/**
+ * Disk usage of a directory: first that of its own entries, then (once
+ * sumDirUsages was called) that of its whole subtree.
+ */
+typedef struct _DirUsage {
+  // Id of the parent directory (NO_DIR_USAGE for the starting directory).
+  uint64_t parent;
+  // Number of 512-byte blocks allocated, and apparent size (in bytes).
+  uint64_t blocks;
+  uint64_t size;
+  uint32_t depth;
+  uint32_t pathLen;
+  // Offset of the directory's path in the accumulator's path buffer.
+  size_t pathOffset;
+} DirUsage;
+
+/**
+ * Records the usage of the directories visited by a worker (so that workers
+ * never write to shared counters while traversing). An instance must only be
+ * used by a single thread until the traversal is done.
+ */
+typedef struct _UsageAccumulator {
+  uint32_t workerIndex;
+  DirUsage *dirs;
+  size_t dirCount;
+  size_t dirCapacity;
+  // Paths of the directories (null-terminated, back to back).
+  char *paths;
+  size_t pathsLength;
+  size_t pathsCapacity;
+} UsageAccumulator;
+
+/**
+ * Shard of an InodeSet: an open-addressing hash table of (device, inode)
+ * pairs, guarded by its own mutex.
+ */
+typedef struct _InodeShard {
+  _Alignas(CACHE_LINE_SIZE) pthread_mutex_t mutex;
+  // Pairs of (device, inode + 1) values, (0, 0) denoting an empty slot.
+  uint64_t *keys;
+  size_t count;
+  size_t capacity;
+} InodeShard;
+
+/**
+ * Set of the files with several hard links seen so far (shared by all
+ * workers, which only contend when hitting the same shard).
+ */
+typedef struct _InodeSet {
+  InodeShard shards[INODE_SET_SHARDS];
+} InodeSet;
+
+void newUsageAccumulator(UsageAccumulator *accumulator, uint32_t workerIndex);
+
+void destroyUsageAccumulator(UsageAccumulator *accumulator);
+
+/**
+ * Starts recording the usage of a directory (usage is then added to it with
+ * addDirUsage, until the next call). Returns the directory's id.
+ */
+uint64_t beginDirUsage(UsageAccumulator *accumulator, uint64_t parent,
+                       uint32_t depth, const char *path, size_t pathLen);
+
+/**
+ * Adds the given usage to the directory being recorded.
+ */
+void addDirUsage(UsageAccumulator *accumulator, uint64_t blocks,
+                 uint64_t size);
+
+/**
+ * Returns the (null-terminated) path of the given directory.
+ */
+const char *dirUsagePath(const UsageAccumulator *accumulator,
+                         const DirUsage *dir);
+
+/**
+ * Adds the usage of every directory to that of its ancestors (once all
+ * workers are done), so that each directory ends up holding the usage of its
+ * subtree.
+ */
+void sumDirUsages(UsageAccumulator *accumulators, uint32_t count);
+
+/**
+ * Returns the directory with the given id.
+ */
+const DirUsage *findDirUsage(const UsageAccumulator *accumulators,
+                             uint64_t id);
+
+/**
+ * Fills the given array with the ids of (at most) the given number of
+ * directories using the most blocks, largest first. Returns the number of ids
+ * written.
+ */
+size_t findLargestDirUsages(const UsageAccumulator *accumulators,
+                            uint32_t count, size_t maxCount,
+                            uint64_t *largest);
+
+void newInodeSet(InodeSet *set);
+
+void destroyInodeSet(InodeSet *set);
+
+/**
+ * Adds the given file to the set. Returns TRUE if it was not in it already.
+ */
+bool insertInode(InodeSet *set, uint64_t dev, uint64_t ino);
+
+#endif
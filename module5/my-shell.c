@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <spawn.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,6 +11,8 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+extern char **environ;
+
 #ifndef SA_RESTART
 #define SA_RESTART 0x000004
 #endif
@@ -78,6 +81,20 @@ int findEndOfLine(const char *input, uint32_t maxLen) {
 
 typedef enum _InputState { NOT_EMPTY = 0, EMPTY = 1, TIMED_OUT = 2 } InputState;
 
+/**
+ * Holds constants corresponding to the ways the process running a command
+ * can be created.
+ */
+typedef enum _SpawnMethod {
+  // posix_spawnp: the child shares the shell's address space until it execs
+  // (vfork semantics), so nothing is copied however large the shell is.
+  SPAWN_POSIX = 0,
+  // fork, then execvp in the child: the shell's page tables are copied for
+  // each command. Needed only if the child must run code of the shell before
+  // the exec.
+  SPAWN_FORK = 1
+} SpawnMethod;
+
 typedef struct _Command {
   char name[MAX_CMD_NAME_LEN];
   char args[MAX_ARGS][MAX_ARG_LEN];
@@ -139,33 +156,77 @@ Command *parseCommandLine(char *cmdLine, uint32_t lineNumber) {
   return cmd;
 }
 
-void executeCommand(Command *cmd) {
-  if (strcmp(cmd->name, CMD_EXIT) == 0) {
-    _exit(EXIT_SUCCESS);
+/**
+ * Fills the given argument vector (NULL-terminated, as expected by exec) with
+ * the arguments of the given command.
+ */
+static void makeArgv(Command *cmd, char *argv[MAX_ARGS]) {
+  for (uint32_t i = 0; i < cmd->argCount; i++) {
+    argv[i] = cmd->args[i];
   }
+  argv[cmd->argCount] = NULL;
+}
+
+static void reportExecError(Command *cmd, int error) {
+  fprintf(stderr, "Error executing command (errno: %u) at line %u: ", error,
+          cmd->lineNumber);
+  printCmd(cmd);
+  fflush(stdout);
+}
+
+/**
+ * Starts the given command with posix_spawnp, which creates the child with
+ * vfork semantics (clone(CLONE_VM | CLONE_VFORK) on Linux): the shell is only
+ * suspended until the child execs, and its page tables are not copied.
+ *
+ * Exits the shell if the command could not be run.
+ */
+static pid_t spawnCommand(Command *cmd, char *argv[MAX_ARGS]) {
+  pid_t cmdPid;
+  int error = posix_spawnp(&cmdPid, cmd->name, NULL, NULL, argv, environ);
+  if (error != 0) {
+    reportExecError(cmd, error);
+    _exit(error);
+  }
+  return cmdPid;
+}
+
+/**
+ * Starts the given command with fork, then execvp in the child.
+ */
+static pid_t forkCommand(Command *cmd, char *argv[MAX_ARGS]) {
   pid_t cmdPid = fork();
   assertIt(cmdPid >= 0, "Could not fork command process");
 
   // If cmdPid == 0, then we're in the child process' context
   if (cmdPid == 0) {
-    int exitCode = execvp(cmd->name, (char *const *)cmd->args);
-    if (exitCode == 1) {
-      fprintf(stderr, "Error executing command (errno: %u) at line %u", errno,
-              cmd->lineNumber);
-      printCmd(cmd);
-      _exit(errno);
-    }
+    execvp(cmd->name, argv);
+    int error = errno;
+    reportExecError(cmd, error);
+    _exit(error);
   }
-  // else, we are in the parent's context and need to wait
-  // for the child to finish
-  else {
-    int childStatus;
-    wait(&childStatus);
-    if (childStatus != 0) {
-      // Command exection resulted in an error,
-      // aborting
-      _exit(childStatus);
-    }
+  return cmdPid;
+}
+
+void executeCommand(Command *cmd, SpawnMethod method) {
+  if (strcmp(cmd->name, CMD_EXIT) == 0) {
+    _exit(EXIT_SUCCESS);
+  }
+  char *argv[MAX_ARGS];
+  makeArgv(cmd, argv);
+  pid_t cmdPid = method == SPAWN_FORK ? forkCommand(cmd, argv)
+                                      : spawnCommand(cmd, argv);
+
+  // We are in the parent's context and need to wait for the child to finish
+  int childStatus;
+  while (waitpid(cmdPid, &childStatus, 0) < 0) {
+    assertIt(errno == EINTR, "Could not wait for command process");
+  }
+  if (childStatus != 0) {
+    // Command exection resulted in an error,
+    // aborting
+    _exit(WIFEXITED(childStatus) ? WEXITSTATUS(childStatus)
+                                 : 128 + WTERMSIG(childStatus));
   }
 }
 
@@ -211,23 +272,48 @@ InputState input(char *buf, uint32_t bufSz, FILE *inputStream,
   return state;
 }
 
+void help(char *program) {
+  printf("Usage: %s [-h] [-f]\n\n", program);
+  printf("  -h: displays this help\n");
+  printf("  -f: runs commands with fork + execvp (defaults to posix_spawnp, "
+         "which\n");
+  printf("      does not copy the shell's address space)\n");
+}
+
 int main(int argc, char **argv) {
   char cmdLine[MAX_CMD_LINE_LEN];
   uint32_t lineNumber = 0;
   FILE *inputStream = stdin;
   bool tty = isatty(fileno(inputStream));
   char *prompt = tty ? PROMPT : "";
+  SpawnMethod method = SPAWN_POSIX;
+  InputState state;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "hf")) != -1) {
+    switch (opt) {
+    case 'h':
+      help(argv[0]);
+      _exit(EXIT_SUCCESS);
+    case 'f':
+      method = SPAWN_FORK;
+      break;
+    default:
+      help(argv[0]);
+      _exit(EXIT_FAILURE);
+    }
+  }
 
   if (tty) {
     fprintf(stderr, "%s", prompt);
   }
 
-  while (input(cmdLine, MAX_CMD_LINE_LEN, inputStream, INPUT_TIMEOUT_SECS) !=
-         TIMED_OUT) {
+  while ((state = input(cmdLine, MAX_CMD_LINE_LEN, inputStream,
+                        INPUT_TIMEOUT_SECS)) == NOT_EMPTY) {
     lineNumber++;
     Command *cmd = parseCommandLine(cmdLine, lineNumber);
     if (cmd != NULL) {
-      executeCommand(cmd);
+      executeCommand(cmd, method);
       safeFree(cmd);
     } else {
       fprintf(stderr, "No command specified\n");
@@ -236,9 +322,11 @@ int main(int argc, char **argv) {
       fprintf(stderr, "\n%s", prompt);
     }
   }
-  // If we reach this point, it is because of an
+  // If we reach this point, it is because of the end of the input, or of an
   // input timeout
-  fprintf(stderr, "No activity detected for at least %u seconds. Exiting.\n",
-          INPUT_TIMEOUT_SECS);
+  if (state == TIMED_OUT) {
+    fprintf(stderr, "No activity detected for at least %u seconds. Exiting.\n",
+            INPUT_TIMEOUT_SECS);
+  }
   _exit(EXIT_SUCCESS);
 }
\ No newline at end of file
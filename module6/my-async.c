@@ -0,0 +1,340 @@
+#define _GNU_SOURCE
+#include "my-async.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Events handled per epoll_wait call.
+#define MAX_EVENTS 64
+
+// Commands collected at once while destroying a shell.
+#define DESTROY_BATCH_SIZE 64
+
+void newAsyncShell(AsyncShell *shell, SpawnMethod method) {
+  shell->method = method;
+  shell->isProfiling = FALSE;
+  shell->epollFd = epoll_create1(EPOLL_CLOEXEC);
+  assertIt(shell->epollFd >= 0,
+           "Could not create epoll instance (errno: %u)\n", errno);
+  shell->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  assertIt(shell->eventFd >= 0, "Could not create eventfd (errno: %u)\n",
+           errno);
+  // The eventfd's events are those without a stage
+  struct epoll_event event = {0};
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  assertIt(epoll_ctl(shell->epollFd, EPOLL_CTL_ADD, shell->eventFd, &event) ==
+               0,
+           "Could not watch eventfd (errno: %u)\n", errno);
+  shell->nullFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  assertIt(shell->nullFd >= 0, "Could not open /dev/null (errno: %u)\n",
+           errno);
+  shell->commandCount = 0;
+  shell->pendingCount = 0;
+  shell->completedHead = NULL;
+  shell->completedTail = NULL;
+  shell->runningCommands = NULL;
+  shell->freeCommands = NULL;
+  newCommandArena(&shell->parseArena);
+}
+
+int asyncShellFd(const AsyncShell *shell) { return shell->epollFd; }
+
+static void unlinkRunning(AsyncShell *shell, AsyncCommand *command) {
+  if (command->previous != NULL) {
+    command->previous->next = command->next;
+  } else {
+    shell->runningCommands = command->next;
+  }
+  if (command->next != NULL) {
+    command->next->previous = command->previous;
+  }
+}
+
+/**
+ * Maps the content of the given memory file (of which a private copy is
+ * made only of the pages written to, which never are), then closes it.
+ */
+static void mapCapture(int fd, const char **data, size_t *length) {
+  struct stat info;
+  *data = NULL;
+  *length = 0;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    void *mapping =
+        mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping != MAP_FAILED) {
+      *data = (const char *)mapping;
+      *length = (size_t)info.st_size;
+    }
+  }
+  close(fd);
+}
+
+static void completeCommand(AsyncShell *shell, AsyncCommand *command) {
+  unlinkRunning(shell, command);
+  command->wallNs = monotonicNs() - command->startNs;
+  if (command->startError != 0) {
+    command->exitStatus = command->startError == ENOENT ? 127 : 126;
+  } else if (WIFEXITED(command->lastStatus)) {
+    command->exitStatus = WEXITSTATUS(command->lastStatus);
+  } else {
+    command->exitStatus = 128 + WTERMSIG(command->lastStatus);
+  }
+  if (command->outputFd >= 0) {
+    mapCapture(command->outputFd, &command->output, &command->outputLength);
+    command->outputFd = -1;
+  }
+  if (command->errorFd >= 0) {
+    mapCapture(command->errorFd, &command->errorOutput,
+               &command->errorLength);
+    command->errorFd = -1;
+  }
+
+  command->next = NULL;
+  if (shell->completedTail != NULL) {
+    shell->completedTail->next = command;
+  } else {
+    shell->completedHead = command;
+    // Keeps the shell's descriptor readable until the queue is emptied
+    uint64_t one = 1;
+    assertIt(write(shell->eventFd, &one, sizeof(one)) == sizeof(one),
+             "Could not write to eventfd (errno: %u)\n", errno);
+  }
+  shell->completedTail = command;
+}
+
+/**
+ * Reaps the given stage, which exited, completing its command if it was the
+ * last one running.
+ */
+static void reapStage(AsyncShell *shell, AsyncStage *stage) {
+  AsyncCommand *command = stage->command;
+  uint32_t index = (uint32_t)(stage - command->stages);
+  int status;
+  struct rusage stageUsage;
+  pid_t pid;
+  while ((pid = wait4(command->pipeline.pids[index], &status, 0,
+                      &stageUsage)) < 0 &&
+         errno == EINTR) {
+  }
+  if (pid < 0) {
+    // Reaped by someone else: the status is lost
+    status = 0;
+  } else if (command->pipeline.usage != NULL) {
+    addStageUsage(command->pipeline.usage, &stageUsage);
+  }
+  // Closing it would not be enough: a child being spawned may still hold a
+  // copy (until its exec completes), which keeps it in the epoll instance
+  epoll_ctl(shell->epollFd, EPOLL_CTL_DEL, stage->pidFd, NULL);
+  close(stage->pidFd);
+  stage->pidFd = -1;
+  if (index == command->pipeline.pidCount - 1) {
+    command->lastStatus = status;
+  }
+  if (--command->runningCount == 0) {
+    completeCommand(shell, command);
+  }
+}
+
+/**
+ * Watches the pidfd of the given started stage. If it cannot be opened, the
+ * stage is killed (and reaped) instead: it could not be waited for without
+ * blocking.
+ */
+static void watchStage(AsyncShell *shell, AsyncCommand *command,
+                       uint32_t index) {
+  AsyncStage *stage = &command->stages[index];
+  pid_t pid = command->pipeline.pids[index];
+  stage->command = command;
+  stage->pidFd = (int)syscall(SYS_pidfd_open, pid, 0);
+  if (stage->pidFd >= 0) {
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.ptr = stage;
+    if (epoll_ctl(shell->epollFd, EPOLL_CTL_ADD, stage->pidFd, &event) == 0) {
+      command->runningCount++;
+      return;
+    }
+    close(stage->pidFd);
+    stage->pidFd = -1;
+  }
+  command->startError = command->startError != 0 ? command->startError : errno;
+  kill(pid, SIGKILL);
+  while (waitpid(pid, NULL, 0) < 0 && errno == EINTR) {
+  }
+}
+
+/**
+ * Returns a command to start: a released one if any (reusing its memory).
+ */
+static AsyncCommand *takeCommand(AsyncShell *shell) {
+  AsyncCommand *command = shell->freeCommands;
+  if (command != NULL) {
+    shell->freeCommands = command->next;
+    return command;
+  }
+  command = (AsyncCommand *)safeMalloc(sizeof(AsyncCommand),
+                                       "Creating async command");
+  newCommandArena(&command->arena);
+  return command;
+}
+
+AsyncCommand *startAsyncCommand(AsyncShell *shell, CommandArena *arena,
+                                Command *cmd) {
+  AsyncCommand *command = takeCommand(shell);
+  CommandArena releasedArena = command->arena;
+  command->arena = *arena;
+  *arena = releasedArena;
+  command->id = ++shell->commandCount;
+  command->startNs = monotonicNs();
+  command->cmd = cmd;
+  command->exitStatus = 0;
+  command->output = NULL;
+  command->outputLength = 0;
+  command->errorOutput = NULL;
+  command->errorLength = 0;
+  command->data = NULL;
+  command->runningCount = 0;
+  command->lastStatus = 0;
+  command->startError = 0;
+  command->pipeline.isRelaying = FALSE;
+  command->pipeline.usage = shell->isProfiling ? &command->usage : NULL;
+  memset(&command->usage, 0, sizeof(PipelineUsage));
+  command->pipeline.pidCount = 0;
+  command->previous = NULL;
+  command->next = shell->runningCommands;
+  if (command->next != NULL) {
+    command->next->previous = command;
+  }
+  shell->runningCommands = command;
+  shell->pendingCount++;
+
+  command->outputFd = memfd_create("my-shell-stdout", MFD_CLOEXEC);
+  command->errorFd = memfd_create("my-shell-stderr", MFD_CLOEXEC);
+  if (command->outputFd < 0 || command->errorFd < 0) {
+    command->startError = errno;
+  } else {
+    // If a stage can't be started, those before it still have to be reaped
+    command->startError = startPipeline(
+        cmd, shell->method,
+        (PipelineFds){shell->nullFd, command->outputFd, command->errorFd},
+        &command->pipeline);
+  }
+  for (uint32_t i = 0; i < command->pipeline.pidCount; i++) {
+    watchStage(shell, command, i);
+  }
+  if (command->runningCount == 0) {
+    completeCommand(shell, command);
+  }
+  return command;
+}
+
+AsyncCommand *submitAsyncCommand(AsyncShell *shell, const char *cmdLine,
+                                 size_t length) {
+  Command *cmd = parseCommandLine(&shell->parseArena, cmdLine, length,
+                                  shell->commandCount + 1);
+  if (cmd == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  return startAsyncCommand(shell, &shell->parseArena, cmd);
+}
+
+/**
+ * Reaps the stages which exited, waiting for one for at most the given
+ * number of milliseconds if none did.
+ */
+static void reapStages(AsyncShell *shell, int timeoutMs) {
+  struct epoll_event events[MAX_EVENTS];
+  int count = epoll_wait(shell->epollFd, events, MAX_EVENTS, timeoutMs);
+  for (int i = 0; i < count; i++) {
+    if (events[i].data.ptr != NULL) {
+      reapStage(shell, (AsyncStage *)events[i].data.ptr);
+    }
+  }
+}
+
+uint32_t collectAsyncCommands(AsyncShell *shell, AsyncCommand **completed,
+                              uint32_t max, int timeoutMs) {
+  reapStages(shell, 0);
+  while (shell->completedHead == NULL && shell->pendingCount > 0 &&
+         timeoutMs != 0) {
+    reapStages(shell, timeoutMs);
+    if (timeoutMs > 0) {
+      break;
+    }
+  }
+
+  uint32_t count = 0;
+  while (count < max && shell->completedHead != NULL) {
+    AsyncCommand *command = shell->completedHead;
+    shell->completedHead = command->next;
+    command->next = NULL;
+    completed[count++] = command;
+  }
+  if (shell->completedHead == NULL) {
+    shell->completedTail = NULL;
+    uint64_t value;
+    ssize_t bytes;
+    while ((bytes = read(shell->eventFd, &value, sizeof(value))) < 0 &&
+           errno == EINTR) {
+    }
+    // EAGAIN means it was already read (no completion since), which is fine
+    assertIt(bytes == sizeof(value) || errno == EAGAIN,
+             "Could not read from eventfd (errno: %u)\n", errno);
+  }
+  shell->pendingCount -= count;
+  return count;
+}
+
+void freeAsyncCommand(AsyncShell *shell, AsyncCommand *command) {
+  if (command->output != NULL) {
+    munmap((void *)command->output, command->outputLength);
+  }
+  if (command->errorOutput != NULL) {
+    munmap((void *)command->errorOutput, command->errorLength);
+  }
+  command->output = NULL;
+  command->errorOutput = NULL;
+  command->next = shell->freeCommands;
+  shell->freeCommands = command;
+}
+
+void destroyAsyncShell(AsyncShell *shell) {
+  for (AsyncCommand *command = shell->runningCommands; command != NULL;
+       command = command->next) {
+    for (uint32_t i = 0; i < command->pipeline.pidCount; i++) {
+      if (command->stages[i].pidFd >= 0) {
+        kill(command->pipeline.pids[i], SIGKILL);
+      }
+    }
+  }
+  AsyncCommand *completed[DESTROY_BATCH_SIZE];
+  while (shell->pendingCount > 0) {
+    uint32_t count =
+        collectAsyncCommands(shell, completed, DESTROY_BATCH_SIZE, -1);
+    for (uint32_t i = 0; i < count; i++) {
+      freeAsyncCommand(shell, completed[i]);
+    }
+  }
+  while (shell->freeCommands != NULL) {
+    AsyncCommand *command = shell->freeCommands;
+    shell->freeCommands = command->next;
+    destroyCommandArena(&command->arena);
+    safeFree(command);
+  }
+  destroyCommandArena(&shell->parseArena);
+  close(shell->nullFd);
+  close(shell->eventFd);
+  close(shell->epollFd);
+}
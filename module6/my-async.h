@@ -0,0 +1,162 @@
+#ifndef MY_ASYNC_H
+#define MY_ASYNC_H
+
+#include "my-shell.h"
+#include "my-util.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Forward declarations.
+ */
+typedef struct _AsyncCommand AsyncCommand;
+
+/**
+ * A stage of a running command, as referred to by the epoll events of its
+ * pidfd.
+ */
+typedef struct _AsyncStage {
+  AsyncCommand *command;
+  int pidFd;
+} AsyncStage;
+
+/**
+ * A command line submitted to an AsyncShell: the handle returned on
+ * submission, and through which its results are read once it completed.
+ */
+struct _AsyncCommand {
+  // Results (set once the command completed): the exit status (127 if a
+  // stage could not be found, 126 if it could not be started, 128 plus the
+  // signal number if the last stage was killed), and what the command wrote
+  // to its standard output and error (NULL if nothing), mapped in memory.
+  int exitStatus;
+  const char *output;
+  size_t outputLength;
+  const char *errorOutput;
+  size_t errorLength;
+  // Time from submission to completion, and what the command's stages cost
+  // (only if the shell's isProfiling flag was set when it was submitted).
+  uint64_t wallNs;
+  PipelineUsage usage;
+  // Application-specific state (not managed by the shell).
+  void *data;
+
+  // Number of the command in submission order, starting at 1 (its line
+  // number in messages).
+  uint32_t id;
+  uint64_t startNs;
+  CommandArena arena;
+  Command *cmd;
+  Pipeline pipeline;
+  AsyncStage stages[MAX_STAGES];
+  // Stages not reaped yet.
+  uint32_t runningCount;
+  // Wait status of the last stage.
+  int lastStatus;
+  // errno value if a stage could not be started (0 otherwise).
+  int startError;
+  // Memory files capturing the output and the error output.
+  int outputFd;
+  int errorFd;
+  // Neighbours in the list of running commands, or next command of the
+  // completion queue, or of the free list.
+  AsyncCommand *previous;
+  AsyncCommand *next;
+};
+
+/**
+ * Runs command lines as child processes without ever blocking the calling
+ * thread, so that an application (e.g. a service with its own event loop)
+ * can run thousands at once:
+ *
+ * - Submitting a line starts all its stages (with /dev/null as standard
+ *   input, unless redirected), and returns a handle.
+ * - The stages are reaped as they exit: their pidfds are watched by an epoll
+ *   instance (requires Linux 5.3), whose descriptor (see asyncShellFd) the
+ *   application polls or adds to its own epoll instance. It is readable
+ *   whenever collectAsyncCommands would return completed commands.
+ * - The standard output and error of each command are captured in memory
+ *   files, mapped once it completed.
+ *
+ * Once the shell is created, nothing exits the process: errors are reported
+ * through the handles (and the captured error output). Builtins are not
+ * recognized (cd and export would change the application's state): commands
+ * are run from PATH, tee stages as processes.
+ *
+ * Not thread-safe: a shell must be used by a single thread. Each running
+ * command holds 2 descriptors plus one per stage (the application may have
+ * to raise RLIMIT_NOFILE), and its stages must not be reaped by others
+ * (SIGCHLD must not be ignored).
+ */
+typedef struct _AsyncShell {
+  SpawnMethod method;
+  // Whether the usage of the commands is measured (see AsyncCommand). Set by
+  // the caller (FALSE by default).
+  bool isProfiling;
+  int epollFd;
+  // Readable (non-zero) while commands completed without any stage to reap
+  // (e.g. none could be started) are queued: watched by epollFd too.
+  int eventFd;
+  int nullFd;
+  uint32_t commandCount;
+  // Commands submitted and not collected yet.
+  uint32_t pendingCount;
+  // Completed commands, in completion order, not collected yet.
+  AsyncCommand *completedHead;
+  AsyncCommand *completedTail;
+  // Commands with stages to reap.
+  AsyncCommand *runningCommands;
+  // Released commands, whose memory (e.g. arena) is reused.
+  AsyncCommand *freeCommands;
+  // Arena lines submitted are parsed into (then swapped with the handle's).
+  CommandArena parseArena;
+} AsyncShell;
+
+void newAsyncShell(AsyncShell *shell, SpawnMethod method);
+
+/**
+ * Releases the given shell, killing the stages still running (and reaping
+ * them) first. The handles not collected yet are released; those collected
+ * must have been released by the application.
+ */
+void destroyAsyncShell(AsyncShell *shell);
+
+/**
+ * Returns the descriptor of the given shell to poll for completions.
+ */
+int asyncShellFd(const AsyncShell *shell);
+
+/**
+ * Parses the given command line (of the given length) and starts it. Returns
+ * its handle, or NULL if the line is empty or not valid (errno being set to
+ * EINVAL, the syntax error being reported on stderr). A command whose stages
+ * could not all be started still gets a handle, completing with exit status
+ * 126 or 127.
+ */
+AsyncCommand *submitAsyncCommand(AsyncShell *shell, const char *cmdLine,
+                                 size_t length);
+
+/**
+ * Starts the given parsed command line, parsed into the given arena: the
+ * command's handle takes the arena's memory, leaving the arena with that of
+ * a released handle (no copy is made). Returns its handle.
+ */
+AsyncCommand *startAsyncCommand(AsyncShell *shell, CommandArena *arena,
+                                Command *cmd);
+
+/**
+ * Reaps the stages which exited, and fills the given array with the commands
+ * which completed (at most the given number, oldest first). Waits for at
+ * least one for at most the given number of milliseconds (0 not to wait, -1
+ * to wait indefinitely), if none completed yet and some are pending. Returns
+ * the number of commands.
+ */
+uint32_t collectAsyncCommands(AsyncShell *shell, AsyncCommand **completed,
+                              uint32_t max, int timeoutMs);
+
+/**
+ * Releases the given completed command (its results are no longer valid).
+ */
+void freeAsyncCommand(AsyncShell *shell, AsyncCommand *command);
+
+#endif
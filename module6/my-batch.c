@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include "my-batch.h"
+#include "my-builtins.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Lines collected at once.
+#define COLLECT_BATCH_SIZE 64
+
+void newBatch(Batch *batch, uint32_t concurrency, SpawnMethod method,
+              Profile *profile) {
+  batch->concurrency = concurrency;
+  newAsyncShell(&batch->shell, method);
+  batch->shell.isProfiling = profile != NULL;
+  batch->profile = profile;
+  batch->lineCount = 0;
+  batch->failures = NULL;
+  batch->failureCount = 0;
+  batch->failureCapacity = 0;
+}
+
+static void addFailure(Batch *batch, uint32_t lineNumber, int exitStatus) {
+  if (batch->failureCount == batch->failureCapacity) {
+    batch->failureCapacity =
+        batch->failureCapacity == 0 ? 64 : batch->failureCapacity * 2;
+    LineStatus *failures = (LineStatus *)safeMalloc(
+        batch->failureCapacity * sizeof(LineStatus), "Growing batch failures");
+    if (batch->failures != NULL) {
+      memcpy(failures, batch->failures,
+             batch->failureCount * sizeof(LineStatus));
+      safeFree(batch->failures);
+    }
+    batch->failures = failures;
+  }
+  batch->failures[batch->failureCount++] =
+      (LineStatus){lineNumber, exitStatus};
+}
+
+/**
+ * Writes the given captured output to the given descriptor.
+ */
+static void writeCapture(const char *data, size_t length, int fd) {
+  while (length > 0) {
+    ssize_t bytes = write(fd, data, length);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes <= 0) {
+      break;
+    }
+    data += bytes;
+    length -= (size_t)bytes;
+  }
+}
+
+/**
+ * Writes out the lines which are done, waiting for at least one if none is.
+ */
+static void collectLines(Batch *batch) {
+  AsyncCommand *completed[COLLECT_BATCH_SIZE];
+  uint32_t count =
+      collectAsyncCommands(&batch->shell, completed, COLLECT_BATCH_SIZE, -1);
+  for (uint32_t i = 0; i < count; i++) {
+    AsyncCommand *command = completed[i];
+    writeCapture(command->output, command->outputLength, STDOUT_FILENO);
+    writeCapture(command->errorOutput, command->errorLength, STDERR_FILENO);
+    if (command->exitStatus != 0) {
+      addFailure(batch, command->cmd->lineNumber, command->exitStatus);
+    }
+    if (batch->profile != NULL) {
+      recordLine(batch->profile, command->cmd, command->exitStatus,
+                 command->wallNs, &command->usage);
+    }
+    freeAsyncCommand(&batch->shell, command);
+  }
+}
+
+void submitCommand(Batch *batch, CommandArena *arena, Command *cmd) {
+  if (isBuiltin(cmd, CMD_WAIT)) {
+    waitBatch(batch);
+    return;
+  }
+  batch->lineCount++;
+  const Builtin *builtin = findBuiltin(cmd);
+  if (builtin != NULL && !builtin->isBlocking) {
+    uint64_t start = monotonicNs();
+    int exitCode = runBuiltin(builtin, cmd);
+    if (exitCode != 0) {
+      addFailure(batch, cmd->lineNumber, exitCode);
+    }
+    if (batch->profile != NULL) {
+      PipelineUsage usage = {0};
+      recordLine(batch->profile, cmd, exitCode, monotonicNs() - start,
+                 &usage);
+    }
+    return;
+  }
+
+  while (batch->shell.pendingCount >= batch->concurrency) {
+    collectLines(batch);
+  }
+  startAsyncCommand(&batch->shell, arena, cmd);
+}
+
+void waitBatch(Batch *batch) {
+  while (batch->shell.pendingCount > 0) {
+    collectLines(batch);
+  }
+}
+
+static int compareLineStatuses(const void *a, const void *b) {
+  uint32_t x = ((const LineStatus *)a)->lineNumber;
+  uint32_t y = ((const LineStatus *)b)->lineNumber;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+int finishBatch(Batch *batch) {
+  waitBatch(batch);
+  qsort(batch->failures, batch->failureCount, sizeof(LineStatus),
+        compareLineStatuses);
+  for (uint32_t i = 0; i < batch->failureCount; i++) {
+    fprintf(stderr, "Line %u exited with status %d\n",
+            batch->failures[i].lineNumber, batch->failures[i].exitStatus);
+  }
+  if (batch->failureCount > 0) {
+    fprintf(stderr, "%u of %u command lines failed\n", batch->failureCount,
+            batch->lineCount);
+  }
+  int exitCode = batch->failureCount > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+  destroyAsyncShell(&batch->shell);
+  safeFree(batch->failures);
+  batch->failures = NULL;
+  return exitCode;
+}
@@ -0,0 +1,76 @@
+#ifndef MY_BATCH_H
+#define MY_BATCH_H
+
+#include "my-async.h"
+#include "my-profile.h"
+#include "my-shell.h"
+#include "my-util.h"
+#include <stdint.h>
+
+/**
+ * Exit status of a command line of a batch.
+ */
+typedef struct _LineStatus {
+  uint32_t lineNumber;
+  int exitStatus;
+} LineStatus;
+
+/**
+ * Runs independent command lines concurrently, up to a given number at once,
+ * instead of one after another:
+ *
+ * - The lines are run by an AsyncShell (see my-async.h), which reaps their
+ *   stages as they exit.
+ * - The standard output and error of each line are captured, and written to
+ *   the shell's once the line is done: the output of a line is never
+ *   interleaved with others'. Lines read /dev/null (unless redirected), the
+ *   shell's input being the script.
+ * - A wait line is a barrier: the lines after it start once all the lines
+ *   before it are done.
+ * - A failing line does not stop the batch: the exit statuses of the failing
+ *   lines are collected, and reported at the end.
+ *
+ * Tee stages are run as processes (the shell doesn't relay them, as it would
+ * block the batch).
+ */
+typedef struct _Batch {
+  uint32_t concurrency;
+  AsyncShell shell;
+  uint32_t lineCount;
+  LineStatus *failures;
+  uint32_t failureCount;
+  uint32_t failureCapacity;
+  // Records the lines if not NULL.
+  Profile *profile;
+} Batch;
+
+/**
+ * Creates a batch running up to the given number of lines at once, recording
+ * them in the given profile (if not NULL).
+ */
+void newBatch(Batch *batch, uint32_t concurrency, SpawnMethod method,
+              Profile *profile);
+
+/**
+ * Starts the given command line, parsed into the given arena, once fewer
+ * than the concurrency limit are running (reaping lines until then). The
+ * line takes the arena's memory, leaving the arena with that of a line which
+ * is done (no copy is made). wait waits for the lines before it (see
+ * waitBatch), and the other builtins but sleep run at once. exit is left to
+ * the caller.
+ */
+void submitCommand(Batch *batch, CommandArena *arena, Command *cmd);
+
+/**
+ * Waits until all the lines submitted so far are done.
+ */
+void waitBatch(Batch *batch);
+
+/**
+ * Waits for all the lines, reports those which failed (sorted by line
+ * number) on stderr, and releases the batch. Returns the exit status of the
+ * shell: EXIT_FAILURE if a line failed, EXIT_SUCCESS otherwise.
+ */
+int finishBatch(Batch *batch);
+
+#endif
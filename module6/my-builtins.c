@@ -0,0 +1,411 @@
+#define _GNU_SOURCE
+#include "my-builtins.h"
+#include "my-hash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+// Exit status of test on syntax errors (1 meaning false).
+#define TEST_ERROR 2
+
+static int runCd(Command *cmd) {
+  if (cmd->argCount > 2) {
+    fprintf(stderr, "cd: too many arguments (line %u)\n", cmd->lineNumber);
+    return EXIT_FAILURE;
+  }
+  const char *variable = cmd->argCount == 1 ? "HOME"
+                         : strcmp(cmd->args[1], "-") == 0 ? "OLDPWD"
+                                                          : NULL;
+  const char *dir = variable != NULL ? getenv(variable) : cmd->args[1];
+  if (dir == NULL) {
+    fprintf(stderr, "cd: %s not set (line %u)\n", variable, cmd->lineNumber);
+    return EXIT_FAILURE;
+  }
+
+  char *previousDir = getcwd(NULL, 0);
+  if (chdir(dir) != 0) {
+    fprintf(stderr, "cd: %s: %s (line %u)\n", dir, strerror(errno),
+            cmd->lineNumber);
+    safeFree(previousDir);
+    return EXIT_FAILURE;
+  }
+  // The commands run next get the new directories (relative paths given to
+  // them, and the hashed ones, are resolved against the new directory)
+  char *currentDir = getcwd(NULL, 0);
+  if (previousDir != NULL) {
+    setenv("OLDPWD", previousDir, 1);
+  }
+  if (currentDir != NULL) {
+    setenv("PWD", currentDir, 1);
+    if (variable != NULL && strcmp(variable, "OLDPWD") == 0) {
+      printf("%s\n", currentDir);
+    }
+  }
+  safeFree(previousDir);
+  safeFree(currentDir);
+  return EXIT_SUCCESS;
+}
+
+static int runEcho(Command *cmd) {
+  uint32_t first = 1;
+  bool isEndingLine = TRUE;
+  while (first < cmd->argCount && strcmp(cmd->args[first], "-n") == 0) {
+    isEndingLine = FALSE;
+    first++;
+  }
+  for (uint32_t i = first; i < cmd->argCount; i++) {
+    fputs(cmd->args[i], stdout);
+    if (i + 1 < cmd->argCount) {
+      putchar(' ');
+    }
+  }
+  if (isEndingLine) {
+    putchar('\n');
+  }
+  return EXIT_SUCCESS;
+}
+
+static bool isVariableName(const char *name, size_t length) {
+  if (length == 0 || (name[0] >= '0' && name[0] <= '9')) {
+    return FALSE;
+  }
+  for (size_t i = 0; i < length; i++) {
+    char c = name[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9') || c == '_')) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/**
+ * Runs export: export NAME=VALUE... sets the given variables in the shell's
+ * environment (which all its commands get), export (or export -p) lists
+ * them. The shell has no unexported variables: export NAME does nothing.
+ */
+static int runExport(Command *cmd) {
+  if (cmd->argCount == 1 ||
+      (cmd->argCount == 2 && strcmp(cmd->args[1], "-p") == 0)) {
+    for (char **variable = environ; *variable != NULL; variable++) {
+      printf("export %s\n", *variable);
+    }
+    return EXIT_SUCCESS;
+  }
+  int exitCode = EXIT_SUCCESS;
+  for (uint32_t i = 1; i < cmd->argCount; i++) {
+    char *arg = cmd->args[i];
+    char *equals = strchr(arg, '=');
+    size_t nameLength = equals != NULL ? (size_t)(equals - arg) : strlen(arg);
+    if (!isVariableName(arg, nameLength)) {
+      fprintf(stderr, "export: '%s': not a valid identifier (line %u)\n", arg,
+              cmd->lineNumber);
+      exitCode = EXIT_FAILURE;
+    } else if (equals != NULL) {
+      // The argument belongs to the line's arena: it can be split in place
+      *equals = '\0';
+      setenv(arg, equals + 1, 1);
+      *equals = '=';
+    }
+  }
+  return exitCode;
+}
+
+static int runFalse(Command *cmd) { return EXIT_FAILURE; }
+
+static int runTrue(Command *cmd) { return EXIT_SUCCESS; }
+
+/**
+ * Runs the hash builtin: hash lists the hashed commands, hash -r forgets
+ * them, and hash <name>... hashes the given commands. Returns the builtin's
+ * exit status.
+ */
+static int runHash(Command *cmd) {
+  CommandHash *commandHash = shellCommandHash();
+  int exitCode = EXIT_SUCCESS;
+  if (cmd->argCount == 1) {
+    printCommandHash(commandHash);
+  }
+  for (uint32_t i = 1; i < cmd->argCount; i++) {
+    if (strcmp(cmd->args[i], "-r") == 0) {
+      clearCommandHash(commandHash);
+    } else if (strchr(cmd->args[i], '/') == NULL &&
+               resolveCommand(commandHash, cmd->args[i], FALSE) == NULL) {
+      fprintf(stderr, "hash: %s: not found (line %u)\n", cmd->args[i],
+              cmd->lineNumber);
+      exitCode = EXIT_FAILURE;
+    }
+  }
+  return exitCode;
+}
+
+/**
+ * Runs sleep: waits for the sum of the given intervals, in seconds (possibly
+ * fractional), or in minutes, hours or days given the m, h or d suffix.
+ */
+static int runSleep(Command *cmd) {
+  if (cmd->argCount == 1) {
+    fprintf(stderr, "sleep: missing operand (line %u)\n", cmd->lineNumber);
+    return EXIT_FAILURE;
+  }
+  double seconds = 0;
+  for (uint32_t i = 1; i < cmd->argCount; i++) {
+    char *end;
+    double interval = strtod(cmd->args[i], &end);
+    static const char units[] = "smhd";
+    static const double unitSeconds[] = {1, 60, 60 * 60, 24 * 60 * 60};
+    const char *suffix = strchr(units, *end);
+    if (end == cmd->args[i] || !(interval >= 0) ||
+        (*end != '\0' && (suffix == NULL || end[1] != '\0'))) {
+      fprintf(stderr, "sleep: invalid time interval '%s' (line %u)\n",
+              cmd->args[i], cmd->lineNumber);
+      return EXIT_FAILURE;
+    }
+    seconds += *end != '\0' ? interval * unitSeconds[suffix - units] : interval;
+  }
+  struct timespec delay;
+  delay.tv_sec = (time_t)seconds;
+  delay.tv_nsec = (long)((seconds - (double)delay.tv_sec) * 1e9);
+  while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+  }
+  return EXIT_SUCCESS;
+}
+
+static bool parseInteger(const char *arg, long long *value) {
+  char *end;
+  errno = 0;
+  *value = strtoll(arg, &end, 10);
+  return end != arg && *end == '\0' && errno == 0;
+}
+
+/**
+ * Evaluates the given binary expression of test, if the given operator is a
+ * binary one. Returns the exit status of test, or -1 if it is not.
+ */
+static int testBinary(const char *left, const char *op, const char *right,
+                      uint32_t lineNumber) {
+  if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) {
+    return strcmp(left, right) == 0 ? 0 : 1;
+  }
+  if (strcmp(op, "!=") == 0) {
+    return strcmp(left, right) != 0 ? 0 : 1;
+  }
+  static const char *const comparisons[] = {"-eq", "-ne", "-lt",
+                                            "-le", "-gt", "-ge"};
+  for (uint32_t i = 0; i < sizeof(comparisons) / sizeof(comparisons[0]);
+       i++) {
+    if (strcmp(op, comparisons[i]) != 0) {
+      continue;
+    }
+    long long x, y;
+    if (!parseInteger(left, &x) || !parseInteger(right, &y)) {
+      fprintf(stderr, "test: integer expression expected (line %u)\n",
+              lineNumber);
+      return TEST_ERROR;
+    }
+    bool results[] = {x == y, x != y, x < y, x <= y, x > y, x >= y};
+    return results[i] ? 0 : 1;
+  }
+  return -1;
+}
+
+/**
+ * Evaluates the given unary expression of test. Returns its exit status.
+ */
+static int testUnary(const char *op, const char *operand,
+                     uint32_t lineNumber) {
+  struct stat info;
+  if (op[0] != '-' || op[1] == '\0' || op[2] != '\0') {
+    fprintf(stderr, "test: %s: unary operator expected (line %u)\n", op,
+            lineNumber);
+    return TEST_ERROR;
+  }
+  bool result;
+  switch (op[1]) {
+  case 'n':
+    result = operand[0] != '\0';
+    break;
+  case 'z':
+    result = operand[0] == '\0';
+    break;
+  case 'e':
+    result = stat(operand, &info) == 0;
+    break;
+  case 'f':
+    result = stat(operand, &info) == 0 && S_ISREG(info.st_mode);
+    break;
+  case 'd':
+    result = stat(operand, &info) == 0 && S_ISDIR(info.st_mode);
+    break;
+  case 's':
+    result = stat(operand, &info) == 0 && info.st_size > 0;
+    break;
+  case 'h':
+  case 'L':
+    result = lstat(operand, &info) == 0 && S_ISLNK(info.st_mode);
+    break;
+  case 'r':
+    result = access(operand, R_OK) == 0;
+    break;
+  case 'w':
+    result = access(operand, W_OK) == 0;
+    break;
+  case 'x':
+    result = access(operand, X_OK) == 0;
+    break;
+  default:
+    fprintf(stderr, "test: %s: unary operator expected (line %u)\n", op,
+            lineNumber);
+    return TEST_ERROR;
+  }
+  return result ? 0 : 1;
+}
+
+/**
+ * Evaluates the given arguments of test, following POSIX for up to 4 of
+ * them (negation, unary and binary expressions: no -a nor -o).
+ */
+static int evaluateTest(char **args, uint32_t count, uint32_t lineNumber) {
+  int status;
+  bool isNegated = count > 1 && strcmp(args[0], "!") == 0;
+  switch (count) {
+  case 0:
+    return 1;
+  case 1:
+    return args[0][0] != '\0' ? 0 : 1;
+  case 2:
+    break;
+  case 3:
+    // A binary operator takes precedence over the negation
+    status = testBinary(args[0], args[1], args[2], lineNumber);
+    if (status >= 0) {
+      return status;
+    }
+    if (strcmp(args[0], "(") == 0 && strcmp(args[2], ")") == 0) {
+      return evaluateTest(args + 1, 1, lineNumber);
+    }
+    break;
+  case 4:
+    if (isNegated) {
+      break;
+    }
+    if (strcmp(args[0], "(") == 0 && strcmp(args[3], ")") == 0) {
+      return evaluateTest(args + 1, 2, lineNumber);
+    }
+    // Fall through
+  default:
+    fprintf(stderr, "test: too many arguments (line %u)\n", lineNumber);
+    return TEST_ERROR;
+  }
+  if (isNegated) {
+    status = evaluateTest(args + 1, count - 1, lineNumber);
+    return status == TEST_ERROR ? status : !status;
+  }
+  if (count == 2) {
+    return testUnary(args[0], args[1], lineNumber);
+  }
+  fprintf(stderr, "test: %s: binary operator expected (line %u)\n", args[1],
+          lineNumber);
+  return TEST_ERROR;
+}
+
+/**
+ * Runs test, or [ (which expects ] as its last argument).
+ */
+static int runTest(Command *cmd) {
+  uint32_t count = cmd->argCount - 1;
+  if (strcmp(cmd->name, "[") == 0) {
+    if (count == 0 || strcmp(cmd->args[count], "]") != 0) {
+      fprintf(stderr, "[: missing ']' (line %u)\n", cmd->lineNumber);
+      return TEST_ERROR;
+    }
+    count--;
+  }
+  return evaluateTest(cmd->args + 1, count, cmd->lineNumber);
+}
+
+// wait: nothing runs in the background outside of batches (which handle it
+// themselves)
+static int runWait(Command *cmd) { return EXIT_SUCCESS; }
+
+// Sorted by name (in strcmp order), for bsearch.
+static const Builtin builtins[] = {
+    {"[", runTest, FALSE},         {"cd", runCd, FALSE},
+    {"echo", runEcho, FALSE},      {"export", runExport, FALSE},
+    {"false", runFalse, FALSE},    {CMD_HASH, runHash, FALSE},
+    {"sleep", runSleep, TRUE},     {"test", runTest, FALSE},
+    {"true", runTrue, FALSE},      {CMD_WAIT, runWait, FALSE},
+};
+
+static int compareBuiltin(const void *name, const void *builtin) {
+  return strcmp((const char *)name, ((const Builtin *)builtin)->name);
+}
+
+const Builtin *findBuiltin(Command *cmd) {
+  if (cmd->next != NULL) {
+    return NULL;
+  }
+  return (const Builtin *)bsearch(cmd->name, builtins,
+                                  sizeof(builtins) / sizeof(builtins[0]),
+                                  sizeof(Builtin), compareBuiltin);
+}
+
+/**
+ * Redirects the given descriptor of the shell to the given file, saving the
+ * descriptor it replaces. Returns the saved descriptor, or -1 on failure
+ * (which is reported).
+ */
+static int redirectShell(Command *cmd, int fd, const char *path, int flags) {
+  int fileFd = open(path, flags | O_CLOEXEC, 0666);
+  if (fileFd < 0) {
+    fprintf(stderr, "%s: %s: %s (line %u)\n", cmd->name, path,
+            strerror(errno), cmd->lineNumber);
+    return -1;
+  }
+  int savedFd = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+  dup2(fileFd, fd);
+  close(fileFd);
+  return savedFd;
+}
+
+static void restoreShell(int fd, int savedFd) {
+  if (savedFd >= 0) {
+    dup2(savedFd, fd);
+    close(savedFd);
+  }
+}
+
+int runBuiltin(const Builtin *builtin, Command *cmd) {
+  int savedInput = -1;
+  int savedOutput = -1;
+  // What the shell wrote before goes to the previous output
+  fflush(stdout);
+  if (cmd->inputPath != NULL) {
+    savedInput = redirectShell(cmd, STDIN_FILENO, cmd->inputPath, O_RDONLY);
+    if (savedInput < 0) {
+      return EXIT_FAILURE;
+    }
+  }
+  if (cmd->outputPath != NULL) {
+    int flags = O_WRONLY | O_CREAT | (cmd->isAppending ? O_APPEND : O_TRUNC);
+    savedOutput = redirectShell(cmd, STDOUT_FILENO, cmd->outputPath, flags);
+    if (savedOutput < 0) {
+      restoreShell(STDIN_FILENO, savedInput);
+      return EXIT_FAILURE;
+    }
+  }
+
+  int exitCode = builtin->run(cmd);
+  // Commands run next write to the same descriptor
+  fflush(stdout);
+  restoreShell(STDIN_FILENO, savedInput);
+  restoreShell(STDOUT_FILENO, savedOutput);
+  return exitCode;
+}
@@ -0,0 +1,37 @@
+#ifndef MY_BUILTINS_H
+#define MY_BUILTINS_H
+
+#include "my-shell.h"
+#include "my-util.h"
+
+typedef int (*BuiltinFunction)(Command *cmd);
+
+/**
+ * A command run by the shell itself instead of a child process: either
+ * because it changes the shell's state (cd, export, hash), or because it is
+ * too simple to be worth a process (echo, true, false, test, sleep).
+ */
+typedef struct _Builtin {
+  const char *name;
+  // Returns the builtin's exit status.
+  BuiltinFunction run;
+  // Whether it waits (sleep): batches run it as a process instead, as it
+  // would hold up the lines running concurrently.
+  bool isBlocking;
+} Builtin;
+
+/**
+ * Returns the builtin the given command runs (builtins are only recognized
+ * outside of pipelines, exit aside), or NULL if it is not a builtin. The
+ * builtins are a table sorted by name, searched by bisection.
+ */
+const Builtin *findBuiltin(Command *cmd);
+
+/**
+ * Runs the given builtin for the given command, its redirections applied to
+ * the shell's own descriptors meanwhile (and restored after). Returns its
+ * exit status.
+ */
+int runBuiltin(const Builtin *builtin, Command *cmd);
+
+#endif
@@ -0,0 +1,195 @@
+#include "my-hash.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define INITIAL_CAPACITY 64
+
+/**
+ * FNV-1a hash of the given name.
+ */
+static uint64_t hashName(const char *name) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (const char *c = name; *c != '\0'; c++) {
+    hash ^= (unsigned char)*c;
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+static char *copyString(const char *text) {
+  size_t length = strlen(text) + 1;
+  char *copy = (char *)safeMalloc(length, "Copying string");
+  memcpy(copy, text, length);
+  return copy;
+}
+
+void newCommandHash(CommandHash *hash) {
+  hash->entries = NULL;
+  hash->capacity = 0;
+  hash->count = 0;
+  hash->searchPath = NULL;
+}
+
+void clearCommandHash(CommandHash *hash) {
+  for (uint32_t i = 0; i < hash->capacity; i++) {
+    HashEntry *entry = &hash->entries[i];
+    if (entry->name != NULL) {
+      safeFree(entry->name);
+      safeFree(entry->path);
+      entry->name = NULL;
+    }
+  }
+  hash->count = 0;
+}
+
+void destroyCommandHash(CommandHash *hash) {
+  clearCommandHash(hash);
+  safeFree(hash->entries);
+  safeFree(hash->searchPath);
+  newCommandHash(hash);
+}
+
+/**
+ * Returns the slot holding the given name, or the empty slot where it would
+ * be inserted.
+ */
+static HashEntry *findSlot(const CommandHash *hash, const char *name) {
+  uint32_t mask = hash->capacity - 1;
+  for (uint32_t i = (uint32_t)hashName(name) & mask;; i = (i + 1) & mask) {
+    HashEntry *entry = &hash->entries[i];
+    if (entry->name == NULL || strcmp(entry->name, name) == 0) {
+      return entry;
+    }
+  }
+}
+
+/**
+ * Doubles the number of slots (the table is kept at most half full).
+ */
+static void growCommandHash(CommandHash *hash) {
+  HashEntry *entries = hash->entries;
+  uint32_t capacity = hash->capacity;
+  hash->capacity = capacity == 0 ? INITIAL_CAPACITY : capacity * 2;
+  hash->entries = (HashEntry *)safeMalloc(
+      hash->capacity * sizeof(HashEntry), "Growing command hash table");
+  memset(hash->entries, 0, hash->capacity * sizeof(HashEntry));
+  for (uint32_t i = 0; i < capacity; i++) {
+    if (entries[i].name != NULL) {
+      *findSlot(hash, entries[i].name) = entries[i];
+    }
+  }
+  safeFree(entries);
+}
+
+/**
+ * Looks for an executable regular file with the given name in the
+ * directories of the given search path (an empty directory denoting the
+ * current one), with a single stat call per directory. Returns its path (to
+ * be freed), or NULL if none was found.
+ */
+static char *searchCommand(const char *searchPath, const char *name) {
+  char path[PATH_MAX];
+  size_t nameLen = strlen(name);
+  const char *dir = searchPath;
+  while (TRUE) {
+    const char *end = strchr(dir, ':');
+    size_t dirLen = end != NULL ? (size_t)(end - dir) : strlen(dir);
+    if (dirLen + nameLen + 2 <= sizeof(path)) {
+      if (dirLen == 0) {
+        path[0] = '.';
+        dirLen = 1;
+      } else {
+        memcpy(path, dir, dirLen);
+      }
+      path[dirLen] = '/';
+      memcpy(path + dirLen + 1, name, nameLen + 1);
+
+      struct stat info;
+      if (stat(path, &info) == 0 && S_ISREG(info.st_mode) &&
+          (info.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) != 0) {
+        return copyString(path);
+      }
+    }
+    if (end == NULL) {
+      return NULL;
+    }
+    dir = end + 1;
+  }
+}
+
+const char *resolveCommand(CommandHash *hash, const char *name, bool isHit) {
+  const char *searchPath = getenv("PATH");
+  searchPath = searchPath != NULL ? searchPath : DEFAULT_SEARCH_PATH;
+  // PATH changed: commands may resolve to other executables
+  if (hash->searchPath == NULL || strcmp(hash->searchPath, searchPath) != 0) {
+    clearCommandHash(hash);
+    safeFree(hash->searchPath);
+    hash->searchPath = copyString(searchPath);
+  }
+
+  HashEntry *entry = hash->capacity > 0 ? findSlot(hash, name) : NULL;
+  if (entry == NULL || entry->name == NULL) {
+    char *path = searchCommand(searchPath, name);
+    if (path == NULL) {
+      return NULL;
+    }
+    if ((hash->count + 1) * 2 > hash->capacity) {
+      growCommandHash(hash);
+    }
+    entry = findSlot(hash, name);
+    entry->name = copyString(name);
+    entry->path = path;
+    entry->hits = 0;
+    hash->count++;
+  }
+  if (isHit) {
+    entry->hits++;
+  }
+  return entry->path;
+}
+
+void forgetCommand(CommandHash *hash, const char *name) {
+  if (hash->capacity == 0) {
+    return;
+  }
+  HashEntry *entry = findSlot(hash, name);
+  if (entry->name == NULL) {
+    return;
+  }
+  safeFree(entry->name);
+  safeFree(entry->path);
+  entry->name = NULL;
+  hash->count--;
+
+  // Moving back the entries following the removed one which would no longer
+  // be found (linear probing stops at the first empty slot).
+  uint32_t mask = hash->capacity - 1;
+  uint32_t hole = (uint32_t)(entry - hash->entries);
+  for (uint32_t i = (hole + 1) & mask; hash->entries[i].name != NULL;
+       i = (i + 1) & mask) {
+    uint32_t home = (uint32_t)hashName(hash->entries[i].name) & mask;
+    // Whether the entry's home slot is cyclically outside (hole, i]
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      hash->entries[hole] = hash->entries[i];
+      hash->entries[i].name = NULL;
+      hole = i;
+    }
+  }
+}
+
+void printCommandHash(const CommandHash *hash) {
+  if (hash->count == 0) {
+    printf("hash: hash table empty\n");
+    return;
+  }
+  printf("hits\tcommand\n");
+  for (uint32_t i = 0; i < hash->capacity; i++) {
+    const HashEntry *entry = &hash->entries[i];
+    if (entry->name != NULL) {
+      printf("%4u\t%s\n", entry->hits, entry->path);
+    }
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef MY_HASH_H
+#define MY_HASH_H
+
+#include "my-util.h"
+#include <stdint.h>
+
+// Search path used if PATH is not set (that of execvp).
+#define DEFAULT_SEARCH_PATH "/bin:/usr/bin"
+
+/**
+ * A command name, and the absolute path it was resolved to.
+ */
+typedef struct _HashEntry {
+  // NULL denoting an empty slot.
+  char *name;
+  char *path;
+  // Number of times the path was used to run the command.
+  uint32_t hits;
+} HashEntry;
+
+/**
+ * Maps command names to their location in the PATH directories (as the hash
+ * builtin of other shells does), so that each command is searched for once:
+ * an open-addressing hash table, emptied whenever PATH changes.
+ */
+typedef struct _CommandHash {
+  HashEntry *entries;
+  // Number of slots (a power of 2).
+  uint32_t capacity;
+  uint32_t count;
+  // Value of PATH the commands were resolved against (NULL if none yet).
+  char *searchPath;
+} CommandHash;
+
+void newCommandHash(CommandHash *hash);
+
+void destroyCommandHash(CommandHash *hash);
+
+/**
+ * Forgets all the commands.
+ */
+void clearCommandHash(CommandHash *hash);
+
+/**
+ * Returns the path of the executable the given command name (which must not
+ * contain a '/') resolves to, searching the PATH directories only if the name
+ * isn't hashed yet (or PATH has changed since). The hits of the resulting
+ * entry are incremented if isHit is TRUE.
+ *
+ * Returns NULL if no executable was found.
+ */
+const char *resolveCommand(CommandHash *hash, const char *name, bool isHit);
+
+/**
+ * Forgets the given command name (e.g. because its hashed path could not be
+ * executed).
+ */
+void forgetCommand(CommandHash *hash, const char *name);
+
+/**
+ * Writes the hashed commands (hits, then path) to stdout.
+ */
+void printCommandHash(const CommandHash *hash);
+
+#endif
@@ -0,0 +1,208 @@
+#include "my-profile.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Buckets of the histogram: bucket b counts the wall times of 2^(b-1) µs to
+// 2^b µs (bucket 0 those under 1 µs).
+#define HISTOGRAM_BUCKETS 40
+
+// Width of the histogram's largest bar.
+#define HISTOGRAM_WIDTH 50
+
+/**
+ * A measure summarized over the lines of a profile.
+ */
+typedef struct _ProfileMeasure {
+  const char *name;
+  uint64_t (*measure)(const LineProfile *line);
+} ProfileMeasure;
+
+static uint64_t wallUs(const LineProfile *line) { return line->wallNs / 1000; }
+
+static uint64_t userUs(const LineProfile *line) { return line->usage.userUs; }
+
+static uint64_t systemUs(const LineProfile *line) {
+  return line->usage.systemUs;
+}
+
+static uint64_t forkUs(const LineProfile *line) {
+  return line->usage.forkNs / 1000;
+}
+
+static uint64_t execUs(const LineProfile *line) {
+  return line->usage.execNs / 1000;
+}
+
+static uint64_t maxRssKb(const LineProfile *line) {
+  return line->usage.maxRssKb;
+}
+
+static uint64_t switches(const LineProfile *line) {
+  return line->usage.voluntarySwitches + line->usage.involuntarySwitches;
+}
+
+static const ProfileMeasure measures[] = {
+    {"wall (us)", wallUs},   {"user (us)", userUs},
+    {"sys (us)", systemUs},  {"fork (us)", forkUs},
+    {"exec (us)", execUs},   {"max RSS (KiB)", maxRssKb},
+    {"switches", switches},
+};
+
+bool newProfile(Profile *profile, const char *path) {
+  profile->output = fopen(path, "w");
+  if (profile->output == NULL) {
+    return FALSE;
+  }
+  profile->lines = NULL;
+  profile->lineCount = 0;
+  profile->lineCapacity = 0;
+  fprintf(profile->output,
+          "# line\tstatus\twall_us\tuser_us\tsys_us\tmax_rss_kb\tvoluntary_cs"
+          "\tinvoluntary_cs\tfork_us\texec_us\tcommand\n");
+  return TRUE;
+}
+
+/**
+ * Writes the given command line, its stages separated by |, on a single
+ * field (tabs and newlines in arguments becoming spaces).
+ */
+static void writeCommandText(FILE *output, Command *cmd) {
+  for (Command *stage = cmd; stage != NULL; stage = stage->next) {
+    if (stage != cmd) {
+      fputs(" | ", output);
+    }
+    for (uint32_t i = 0; i < stage->argCount; i++) {
+      if (i > 0) {
+        fputc(' ', output);
+      }
+      for (const char *c = stage->args[i]; *c != '\0'; c++) {
+        fputc(*c == '\t' || *c == '\n' ? ' ' : *c, output);
+      }
+    }
+  }
+}
+
+void recordLine(Profile *profile, Command *cmd, int exitStatus,
+                uint64_t wallNs, const PipelineUsage *usage) {
+  if (profile->lineCount == profile->lineCapacity) {
+    profile->lineCapacity =
+        profile->lineCapacity == 0 ? 1024 : profile->lineCapacity * 2;
+    LineProfile *lines = (LineProfile *)safeMalloc(
+        profile->lineCapacity * sizeof(LineProfile), "Growing profile lines");
+    if (profile->lines != NULL) {
+      memcpy(lines, profile->lines, profile->lineCount * sizeof(LineProfile));
+      safeFree(profile->lines);
+    }
+    profile->lines = lines;
+  }
+  LineProfile *line = &profile->lines[profile->lineCount++];
+  line->lineNumber = cmd->lineNumber;
+  line->exitStatus = exitStatus;
+  line->wallNs = wallNs;
+  line->usage = *usage;
+
+  fprintf(profile->output, "%u\t%d\t%.1f\t%llu\t%llu\t%llu\t%llu\t%llu\t%.1f\t"
+          "%.1f\t",
+          line->lineNumber, exitStatus, (double)wallNs / 1000,
+          (unsigned long long)usage->userUs,
+          (unsigned long long)usage->systemUs,
+          (unsigned long long)usage->maxRssKb,
+          (unsigned long long)usage->voluntarySwitches,
+          (unsigned long long)usage->involuntarySwitches,
+          (double)usage->forkNs / 1000, (double)usage->execNs / 1000);
+  writeCommandText(profile->output, cmd);
+  fputc('\n', profile->output);
+}
+
+static int compareValues(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static int compareWallTimes(const void *a, const void *b) {
+  // Slowest first
+  uint64_t x = ((const LineProfile *)a)->wallNs;
+  uint64_t y = ((const LineProfile *)b)->wallNs;
+  return x > y ? -1 : x < y ? 1 : 0;
+}
+
+/**
+ * Returns the given percentile of the given sorted values (nearest rank).
+ */
+static uint64_t percentile(const uint64_t *values, uint32_t count,
+                           uint32_t rank) {
+  uint64_t index = ((uint64_t)count * rank + 99) / 100;
+  return values[index > 0 ? index - 1 : 0];
+}
+
+static void writePercentiles(Profile *profile, uint64_t *values) {
+  fprintf(profile->output, "# %-14s %12s %12s %12s %12s\n", "", "p50", "p95",
+          "p99", "max");
+  for (size_t m = 0; m < sizeof(measures) / sizeof(measures[0]); m++) {
+    for (uint32_t i = 0; i < profile->lineCount; i++) {
+      values[i] = measures[m].measure(&profile->lines[i]);
+    }
+    qsort(values, profile->lineCount, sizeof(uint64_t), compareValues);
+    fprintf(profile->output, "# %-14s %12llu %12llu %12llu %12llu\n",
+            measures[m].name,
+            (unsigned long long)percentile(values, profile->lineCount, 50),
+            (unsigned long long)percentile(values, profile->lineCount, 95),
+            (unsigned long long)percentile(values, profile->lineCount, 99),
+            (unsigned long long)values[profile->lineCount - 1]);
+  }
+}
+
+static void writeHistogram(Profile *profile) {
+  uint32_t buckets[HISTOGRAM_BUCKETS] = {0};
+  uint32_t first = HISTOGRAM_BUCKETS;
+  uint32_t last = 0;
+  uint32_t largest = 0;
+  for (uint32_t i = 0; i < profile->lineCount; i++) {
+    uint64_t us = wallUs(&profile->lines[i]);
+    uint32_t bucket = us == 0 ? 0 : 64 - (uint32_t)__builtin_clzll(us);
+    bucket = bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+    buckets[bucket]++;
+    first = bucket < first ? bucket : first;
+    last = bucket > last ? bucket : last;
+    largest = buckets[bucket] > largest ? buckets[bucket] : largest;
+  }
+  fprintf(profile->output, "#\n# wall time (us)      lines\n");
+  for (uint32_t b = first; b <= last; b++) {
+    char bar[HISTOGRAM_WIDTH + 1];
+    uint32_t width = (uint32_t)((uint64_t)buckets[b] * HISTOGRAM_WIDTH /
+                                largest);
+    memset(bar, '*', width);
+    bar[width] = '\0';
+    fprintf(profile->output, "# < %-12llu %10u %s\n", 1ULL << b, buckets[b],
+            bar);
+  }
+}
+
+void finishProfile(Profile *profile) {
+  fprintf(profile->output, "#\n# %u lines\n", profile->lineCount);
+  if (profile->lineCount > 0) {
+    uint64_t *values = (uint64_t *)safeMalloc(
+        profile->lineCount * sizeof(uint64_t), "Sorting profile measures");
+    writePercentiles(profile, values);
+    safeFree(values);
+    writeHistogram(profile);
+
+    qsort(profile->lines, profile->lineCount, sizeof(LineProfile),
+          compareWallTimes);
+    fprintf(profile->output, "#\n# slowest lines\n");
+    for (uint32_t i = 0;
+         i < profile->lineCount && i < PROFILE_SLOWEST_COUNT; i++) {
+      fprintf(profile->output, "# line %u: %.1f us (status %d)\n",
+              profile->lines[i].lineNumber,
+              (double)profile->lines[i].wallNs / 1000,
+              profile->lines[i].exitStatus);
+    }
+  }
+  if (fclose(profile->output) != 0) {
+    fprintf(stderr, "Could not write profile (errno: %u)\n", errno);
+  }
+  safeFree(profile->lines);
+  profile->lines = NULL;
+}
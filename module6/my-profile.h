@@ -0,0 +1,58 @@
+#ifndef MY_PROFILE_H
+#define MY_PROFILE_H
+
+#include "my-shell.h"
+#include "my-util.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// Number of the slowest lines listed in the summary.
+#define PROFILE_SLOWEST_COUNT 10
+
+/**
+ * What running a command line cost.
+ */
+typedef struct _LineProfile {
+  uint32_t lineNumber;
+  int exitStatus;
+  // Time from the start of the line to its end (its last stage reaped).
+  uint64_t wallNs;
+  PipelineUsage usage;
+} LineProfile;
+
+/**
+ * Accounting of the command lines a shell runs, to tell the lines which are
+ * slow by themselves from the cost of starting them (fork and exec):
+ *
+ * - A row per line is written as the line completes (in completion order in
+ *   batch mode): tab-separated values, sortable (e.g. sort -t$'\t' -k3 -n)
+ *   to find the slow lines.
+ * - At the end, a summary (lines starting with #): the median, 95th and
+ *   99th percentiles and maximum of each measure, a histogram of the wall
+ *   times (on a log scale), and the slowest lines.
+ */
+typedef struct _Profile {
+  FILE *output;
+  LineProfile *lines;
+  uint32_t lineCount;
+  uint32_t lineCapacity;
+} Profile;
+
+/**
+ * Creates a profile written to the given file (truncated). Returns FALSE if
+ * it could not be opened (errno being set).
+ */
+bool newProfile(Profile *profile, const char *path);
+
+/**
+ * Records the given command line (parsed into cmd), writing its row.
+ */
+void recordLine(Profile *profile, Command *cmd, int exitStatus,
+                uint64_t wallNs, const PipelineUsage *usage);
+
+/**
+ * Writes the summary of the lines recorded, then releases the profile.
+ */
+void finishProfile(Profile *profile);
+
+#endif
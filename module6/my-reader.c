@@ -0,0 +1,110 @@
+#include "my-reader.h"
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void newLineReader(LineReader *reader, int fd, uint32_t timeoutSecs) {
+  struct stat info;
+  reader->fd = fd;
+  reader->capacity = READER_BLOCK_SIZE;
+  reader->buffer = (char *)safeMalloc(reader->capacity, "Creating line reader");
+  reader->start = 0;
+  reader->end = 0;
+  reader->isAtEnd = FALSE;
+  reader->isPolling = fstat(fd, &info) != 0 || !S_ISREG(info.st_mode);
+  reader->timeoutSecs = timeoutSecs;
+}
+
+void destroyLineReader(LineReader *reader) {
+  safeFree(reader->buffer);
+  reader->buffer = NULL;
+}
+
+/**
+ * Makes room for a block after the incomplete line the buffer ends with:
+ * moves it to the beginning of the buffer, and doubles the buffer if the
+ * line still leaves less than a block.
+ */
+static void makeRoom(LineReader *reader) {
+  size_t length = reader->end - reader->start;
+  if (reader->start > 0) {
+    memmove(reader->buffer, reader->buffer + reader->start, length);
+    reader->start = 0;
+    reader->end = length;
+  }
+  if (reader->capacity - length < READER_BLOCK_SIZE) {
+    reader->capacity *= 2;
+    char *buffer = (char *)safeMalloc(reader->capacity, "Growing line reader");
+    memcpy(buffer, reader->buffer, length);
+    safeFree(reader->buffer);
+    reader->buffer = buffer;
+  }
+}
+
+/**
+ * Reads the next block of the input after the buffered bytes. Returns
+ * TIMED_OUT if none came within the timeout, EMPTY at the end of the input,
+ * NOT_EMPTY otherwise.
+ */
+static InputState readBlock(LineReader *reader) {
+  makeRoom(reader);
+  if (reader->isPolling && reader->timeoutSecs > 0) {
+    struct pollfd fd = {reader->fd, POLLIN, 0};
+    int count;
+    // Being interrupted (which the shell does not expect, having no handler)
+    // restarts the timeout
+    while ((count = poll(&fd, 1, (int)reader->timeoutSecs * 1000)) < 0 &&
+           errno == EINTR) {
+    }
+    if (count == 0) {
+      return TIMED_OUT;
+    }
+  }
+  ssize_t bytes;
+  while ((bytes = read(reader->fd, reader->buffer + reader->end,
+                       reader->capacity - reader->end)) < 0 &&
+         errno == EINTR) {
+  }
+  if (bytes <= 0) {
+    reader->isAtEnd = TRUE;
+    return EMPTY;
+  }
+  reader->end += (size_t)bytes;
+  return NOT_EMPTY;
+}
+
+InputState readLine(LineReader *reader, char **line, size_t *length) {
+  // Bytes of the incomplete line already searched for a newline
+  size_t searched = 0;
+  while (TRUE) {
+    char *start = reader->buffer + reader->start;
+    size_t available = reader->end - reader->start;
+    char *newline =
+        (char *)memchr(start + searched, '\n', available - searched);
+    if (newline != NULL) {
+      *newline = '\0';
+      *line = start;
+      *length = (size_t)(newline - start);
+      reader->start += *length + 1;
+      return NOT_EMPTY;
+    }
+    if (reader->isAtEnd) {
+      if (available == 0) {
+        return EMPTY;
+      }
+      // Last line, without a newline (makeRoom left room for the NUL)
+      start[available] = '\0';
+      *line = start;
+      *length = available;
+      reader->start = reader->end;
+      return NOT_EMPTY;
+    }
+    searched = available;
+    InputState state = readBlock(reader);
+    if (state == TIMED_OUT) {
+      return state;
+    }
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef MY_READER_H
+#define MY_READER_H
+
+#include "my-util.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes requested by each read (the buffer grows beyond for longer lines).
+#define READER_BLOCK_SIZE (64 * 1024)
+
+typedef enum _InputState { NOT_EMPTY = 0, EMPTY = 1, TIMED_OUT = 2 } InputState;
+
+/**
+ * Reads the lines of the shell's input by blocks: a read returns as many
+ * lines as are available (all those of a block of a script), which are then
+ * split with memchr. Lines are not limited in length.
+ *
+ * A timeout only applies when the reader actually has to wait for input:
+ * poll is called before reading a pipe or a terminal, never for a regular
+ * file (whose reads do not block). No signal (nor handler) is involved.
+ */
+typedef struct _LineReader {
+  int fd;
+  char *buffer;
+  size_t capacity;
+  // Bytes of the buffer not returned yet: between start and end.
+  size_t start;
+  size_t end;
+  bool isAtEnd;
+  // Whether reads may block (see above).
+  bool isPolling;
+  // Seconds to wait for input (0 to wait indefinitely).
+  uint32_t timeoutSecs;
+} LineReader;
+
+void newLineReader(LineReader *reader, int fd, uint32_t timeoutSecs);
+
+void destroyLineReader(LineReader *reader);
+
+/**
+ * Reads the next line (ending with a newline, or at the end of the input),
+ * and points the given line to it, NUL-terminated instead of the newline,
+ * and the given length to its length. The line remains valid until the next
+ * call.
+ *
+ * Returns NOT_EMPTY if a line was read, EMPTY at the end of the input (or if
+ * reading failed), or TIMED_OUT if nothing could be read within the timeout.
+ */
+InputState readLine(LineReader *reader, char **line, size_t *length);
+
+#endif
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include "my-relay.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Buffer of the relays which cannot splice (the shell runs them one at a
+// time).
+static char copyBuffer[64 * 1024];
+
+void newRelay(Relay *relay, int input, int output, int file) {
+  struct stat info;
+  relay->input = input;
+  relay->output = output;
+  relay->file = file;
+  relay->isSplicing = fstat(output, &info) == 0 && S_ISFIFO(info.st_mode);
+  relay->isWaitingForOutput = FALSE;
+  relay->isDone = FALSE;
+  relay->error = 0;
+}
+
+static int writeAll(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    data += written;
+    length -= (size_t)written;
+  }
+  return 0;
+}
+
+static void closeOutput(Relay *relay) {
+  if (relay->output != STDOUT_FILENO) {
+    close(relay->output);
+  }
+  relay->output = -1;
+}
+
+static void finishRelay(Relay *relay, int error) {
+  if (relay->error == 0) {
+    relay->error = error;
+  }
+  close(relay->input);
+  close(relay->file);
+  if (relay->output >= 0) {
+    closeOutput(relay);
+  }
+  relay->isDone = TRUE;
+}
+
+/**
+ * Copies at most the given number of bytes of the input through the buffer,
+ * to the file (and to the output, if isToOutput). Returns the number of bytes
+ * copied (0 at end of file), -1 on error.
+ */
+static ssize_t copyInput(Relay *relay, size_t length, bool isToOutput) {
+  length = length < sizeof(copyBuffer) ? length : sizeof(copyBuffer);
+  ssize_t bytes = read(relay->input, copyBuffer, length);
+  if (bytes <= 0) {
+    return bytes;
+  }
+  if (writeAll(relay->file, copyBuffer, (size_t)bytes) != 0) {
+    return -1;
+  }
+  if (isToOutput && writeAll(relay->output, copyBuffer, (size_t)bytes) != 0) {
+    if (errno != EPIPE) {
+      return -1;
+    }
+    closeOutput(relay);
+  }
+  return bytes;
+}
+
+/**
+ * Moves the given number of bytes (already duplicated to the output) from
+ * the input to the file.
+ */
+static int moveToFile(Relay *relay, size_t length) {
+  while (length > 0) {
+    ssize_t bytes = splice(relay->input, NULL, relay->file, NULL, length,
+                           SPLICE_F_MOVE);
+    if (bytes < 0 && errno == EINVAL) {
+      // The file does not support splicing (e.g. a terminal)
+      bytes = copyInput(relay, length, FALSE);
+    }
+    if (bytes <= 0) {
+      return -1;
+    }
+    length -= (size_t)bytes;
+  }
+  return 0;
+}
+
+/**
+ * Moves what can be moved without blocking on the output (which poll has
+ * found ready, as well as the input or the output).
+ */
+static void stepRelay(Relay *relay) {
+  ssize_t bytes;
+  if (relay->output < 0) {
+    bytes = splice(relay->input, NULL, relay->file, NULL, RELAY_CHUNK_SIZE,
+                   SPLICE_F_MOVE);
+    if (bytes < 0 && errno == EINVAL) {
+      bytes = copyInput(relay, RELAY_CHUNK_SIZE, FALSE);
+    }
+  } else if (!relay->isSplicing) {
+    bytes = copyInput(relay, RELAY_CHUNK_SIZE, TRUE);
+  } else {
+    bytes = tee(relay->input, relay->output, RELAY_CHUNK_SIZE,
+                SPLICE_F_NONBLOCK);
+    if (bytes < 0 && errno == EAGAIN) {
+      // Having polled the input, the output is full; having polled the
+      // output, the input is empty.
+      relay->isWaitingForOutput = !relay->isWaitingForOutput;
+      return;
+    }
+    if (bytes < 0 && errno == EPIPE) {
+      closeOutput(relay);
+      relay->isWaitingForOutput = FALSE;
+      return;
+    }
+    relay->isWaitingForOutput = FALSE;
+    if (bytes > 0 && moveToFile(relay, (size_t)bytes) != 0) {
+      bytes = -1;
+    }
+  }
+
+  if (bytes < 0 && errno != EINTR && errno != EAGAIN) {
+    finishRelay(relay, errno);
+  } else if (bytes == 0) {
+    finishRelay(relay, 0);
+  }
+}
+
+int runRelays(Relay *relays, uint32_t count) {
+  struct pollfd *fds = (struct pollfd *)safeMalloc(
+      count * sizeof(struct pollfd), "Creating relay poll set");
+  uint32_t *indexes =
+      (uint32_t *)safeMalloc(count * sizeof(uint32_t), "Creating relay set");
+
+  // Writing to a stage which exited must fail with EPIPE, not kill the shell
+  // (the stages were spawned with the default disposition already).
+  struct sigaction ignoreAction = {0};
+  struct sigaction previousAction;
+  ignoreAction.sa_handler = SIG_IGN;
+  sigemptyset(&ignoreAction.sa_mask);
+  sigaction(SIGPIPE, &ignoreAction, &previousAction);
+
+  while (TRUE) {
+    uint32_t fdCount = 0;
+    for (uint32_t i = 0; i < count; i++) {
+      Relay *relay = &relays[i];
+      if (!relay->isDone) {
+        fds[fdCount].fd =
+            relay->isWaitingForOutput ? relay->output : relay->input;
+        fds[fdCount].events = relay->isWaitingForOutput ? POLLOUT : POLLIN;
+        indexes[fdCount++] = i;
+      }
+    }
+    if (fdCount == 0) {
+      break;
+    }
+    if (poll(fds, fdCount, -1) < 0) {
+      assertIt(errno == EINTR, "Could not poll pipeline relays");
+      continue;
+    }
+    for (uint32_t i = 0; i < fdCount; i++) {
+      if (fds[i].revents != 0) {
+        stepRelay(&relays[indexes[i]]);
+      }
+    }
+  }
+
+  sigaction(SIGPIPE, &previousAction, NULL);
+  safeFree(indexes);
+  safeFree(fds);
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (relays[i].error != 0) {
+      return relays[i].error;
+    }
+  }
+  return 0;
+}
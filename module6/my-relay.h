@@ -0,0 +1,46 @@
+#ifndef MY_RELAY_H
+#define MY_RELAY_H
+
+#include "my-util.h"
+#include <stdint.h>
+
+// Bytes moved by a relay at once (at most the size of the pipes).
+#define RELAY_CHUNK_SIZE (1024 * 1024)
+
+/**
+ * A tee stage of a pipeline, run by the shell itself instead of a tee
+ * process: what the previous stage writes to the input pipe is copied to the
+ * file and to the output (the next stage's pipe, or the shell's standard
+ * output).
+ *
+ * If the output is a pipe, the data is duplicated into it with tee(2), then
+ * moved to the file with splice(2): it never reaches user space. Otherwise,
+ * it has to be read into a buffer and written to both.
+ */
+typedef struct _Relay {
+  int input;
+  // -1 once closed (the next stage exited; the file still gets everything).
+  int output;
+  int file;
+  bool isSplicing;
+  // Whether the last attempt could not proceed because the output was full.
+  bool isWaitingForOutput;
+  bool isDone;
+  // errno value of the first error (0 if none).
+  int error;
+} Relay;
+
+/**
+ * Initializes a relay between the given descriptors, of which it takes
+ * ownership (the output is not closed if it is the standard output).
+ */
+void newRelay(Relay *relay, int input, int output, int file);
+
+/**
+ * Runs the given relays until their inputs reach end of file, multiplexing
+ * them with poll (each may have to wait for the others' stages). Returns 0 on
+ * success, or the errno value of the first relay that failed.
+ */
+int runRelays(Relay *relays, uint32_t count);
+
+#endif
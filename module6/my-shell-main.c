@@ -1,28 +1,111 @@
+#include "my-batch.h"
+#include "my-profile.h"
 #include "my-shell.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #define INPUT_TIMEOUT_SECS 60
-#define MAX_CMD_LINE_LEN 512
+
+void help(char *program) {
+  printf("Usage: %s [-h] [-f] [-j <jobs>] [-p <file>]\n\n", program);
+  printf("  -h: displays this help\n");
+  printf("  -f: runs commands with fork + execvp (defaults to posix_spawnp, "
+         "which\n");
+  printf("      does not copy the shell's address space)\n");
+  printf("  -j: batch mode: runs up to the given number of lines at once, and "
+         "keeps\n");
+  printf("      going if some fail (their exit statuses are reported at the "
+         "end).\n");
+  printf("      A wait line waits for all the lines before it\n");
+  printf("  -p: accounting mode: writes the wall time, CPU time, max RSS, "
+         "context\n");
+  printf("      switches and fork/exec latency of each line to the given "
+         "file,\n");
+  printf("      followed by their percentiles and a histogram\n");
+}
 
 int main(int argc, char **argv) {
-  char cmdLine[MAX_CMD_LINE_LEN];
+  char *cmdLine;
+  size_t length;
   uint32_t lineNumber = 0;
-  FILE *inputStream = stdin;
-  bool tty = isatty(fileno(inputStream));
+  LineReader reader;
+  bool tty = isatty(STDIN_FILENO);
   char *prompt = tty ? PROMPT : "";
+  SpawnMethod method = SPAWN_POSIX;
+  InputState state;
+  int exitCode = EXIT_SUCCESS;
+  // 0 if not in batch mode
+  uint32_t concurrency = 0;
+  Batch batch;
+  // Reused by all the lines (see submitCommand for batches)
+  CommandArena arena;
+  // NULL if not in accounting mode
+  char *profilePath = NULL;
+  Profile profile;
+  PipelineUsage usage;
 
+  int opt;
+  while ((opt = getopt(argc, argv, "hfj:p:")) != -1) {
+    switch (opt) {
+    case 'h':
+      help(argv[0]);
+      _exit(EXIT_SUCCESS);
+    case 'f':
+      method = SPAWN_FORK;
+      break;
+    case 'j':
+      concurrency = (uint32_t)atoi(optarg);
+      if (concurrency == 0) {
+        fprintf(stderr, "Value of -j option (jobs) must be > 0\n");
+        _exit(EXIT_FAILURE);
+      }
+      break;
+    case 'p':
+      profilePath = optarg;
+      break;
+    default:
+      help(argv[0]);
+      _exit(EXIT_FAILURE);
+    }
+  }
+
+  if (profilePath != NULL && !newProfile(&profile, profilePath)) {
+    fprintf(stderr, "Could not open profile %s (errno: %u)\n", profilePath,
+            errno);
+    _exit(EXIT_FAILURE);
+  }
+  newLineReader(&reader, STDIN_FILENO, INPUT_TIMEOUT_SECS);
+  newCommandArena(&arena);
+  if (concurrency > 0) {
+    newBatch(&batch, concurrency, method,
+             profilePath != NULL ? &profile : NULL);
+  }
   if (tty) {
     fprintf(stderr, "%s", prompt);
   }
 
-  while (input(cmdLine, MAX_CMD_LINE_LEN, inputStream, INPUT_TIMEOUT_SECS) !=
-         TIMED_OUT) {
+  while ((state = readLine(&reader, &cmdLine, &length)) == NOT_EMPTY) {
     lineNumber++;
-    Command *cmd = parseCommandLine(cmdLine, lineNumber);
-    if (cmd != NULL) {
-      executeCommand(cmd);
-      safeFree(cmd);
+    Command *cmd = parseCommandLine(&arena, cmdLine, length, lineNumber);
+    if (cmd != NULL && isBuiltin(cmd, CMD_EXIT)) {
+      break;
+    } else if (cmd != NULL && concurrency > 0) {
+      submitCommand(&batch, &arena, cmd);
+    } else if (cmd != NULL) {
+      uint64_t start = monotonicNs();
+      exitCode =
+          executeCommand(cmd, method, profilePath != NULL ? &usage : NULL);
+      if (profilePath != NULL) {
+        recordLine(&profile, cmd, exitCode, monotonicNs() - start, &usage);
+      }
+      // A failing command line ends the shell, with its exit status
+      if (exitCode != 0) {
+        break;
+      }
+    } else if (!arena.isValid) {
+      exitCode = 2;
+      break;
     } else {
       fprintf(stderr, "No command specified\n");
     }
@@ -30,9 +113,20 @@ int main(int argc, char **argv) {
       fprintf(stderr, "\n%s", prompt);
     }
   }
-  // If we reach this point, it is because of an
-  // input timeout
-  fprintf(stderr, "No activity detected for at least %u seconds. Exiting.\n",
-          INPUT_TIMEOUT_SECS);
-  _exit(EXIT_SUCCESS);
+  // If we reach this point, it is because of the end of the input, of an
+  // input timeout, of an exit line or of a failing command line
+  if (state == TIMED_OUT) {
+    fprintf(stderr, "No activity detected for at least %u seconds. Exiting.\n",
+            INPUT_TIMEOUT_SECS);
+  }
+  if (concurrency > 0) {
+    int batchCode = finishBatch(&batch);
+    exitCode = exitCode != 0 ? exitCode : batchCode;
+  }
+  if (profilePath != NULL) {
+    finishProfile(&profile);
+  }
+  destroyCommandArena(&arena);
+  destroyLineReader(&reader);
+  _exit(exitCode);
 }
\ No newline at end of file
@@ -1,11 +1,24 @@
+#define _GNU_SOURCE
 #include "my-shell.h"
+#include "my-builtins.h"
+#include "my-hash.h"
+#include "my-relay.h"
 #include "my-util.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <wait.h>
 
+extern char **environ;
+
+// Locations of the commands run so far (see the hash builtin).
+static CommandHash commandHash = {NULL, 0, 0, NULL};
+
+CommandHash *shellCommandHash(void) { return &commandHash; }
+
 void printCmd(Command *cmd) {
   printf("%s", cmd->name);
 
@@ -18,114 +31,553 @@ void printCmd(Command *cmd) {
   printf("\n");
 }
 
+void newCommandArena(CommandArena *arena) {
+  arena->text = NULL;
+  arena->textCapacity = 0;
+  arena->args = NULL;
+  arena->argCapacity = 0;
+  arena->stages = NULL;
+  arena->stageCapacity = 0;
+  arena->isValid = TRUE;
+}
+
+void destroyCommandArena(CommandArena *arena) {
+  safeFree(arena->text);
+  safeFree(arena->args);
+  safeFree(arena->stages);
+  newCommandArena(arena);
+}
+
 /**
- * Parses the given command line into a Command instance.
- *
- * Returns NULL if the command line is an empty command line, or
- * a Command pointer otherwise.
+ * Makes the given array (of elements of the given size, count of which are
+ * used) hold at least one more element, doubling its capacity if it is full.
  */
-Command *parseCommandLine(char *cmdLine, uint32_t lineNumber) {
-  char *token = NULL;
-  uint32_t tokenCount = 0;
+static void *growArray(void *array, uint32_t count, uint32_t *capacity,
+                       size_t size, const char *hint) {
+  if (count < *capacity) {
+    return array;
+  }
+  *capacity = *capacity == 0 ? 16 : *capacity * 2;
+  void *grown = safeMalloc(*capacity * size, hint);
+  if (array != NULL) {
+    memcpy(grown, array, count * size);
+    safeFree(array);
+  }
+  return grown;
+}
 
-  Command *cmd =
-      (Command *)safeMalloc(sizeof(Command), "Creating Command instance");
-  cmd->lineNumber = lineNumber;
+/**
+ * Reports a syntax error of the line parsed into the given arena, flagging
+ * it invalid. Returns NULL (for the parsing functions to return).
+ */
+static void *reportSyntaxError(CommandArena *arena, uint32_t lineNumber,
+                               const char *token) {
+  fprintf(stderr, "Syntax error near '%s' at line %u\n", token, lineNumber);
+  arena->isValid = FALSE;
+  return NULL;
+}
+
+static bool isDelimiter(char c) { return c == ' ' || c == '\t'; }
+
+static bool isOperator(char c) { return c == '|' || c == '<' || c == '>'; }
 
-  do {
-    token =
-        tokenCount == 0 ? strtok(cmdLine, ARG_DELIM) : strtok(NULL, ARG_DELIM);
-    if (token != NULL) {
-      assertIt(tokenCount < MAX_ARG_LEN - 1,
-               "Too many arguments. Expected max of: %u", MAX_ARG_LEN - 1);
-      // Treating the first token as the command name
-      if (tokenCount == 0) {
-        strncpy(cmd->name, token, sizeof(cmd->name));
+/**
+ * Copies the word starting at the given position of the line to the given
+ * output (unquoting it), NUL-terminated. Returns the position after the word,
+ * or NULL if a quote is not closed.
+ */
+static const char *readWord(CommandArena *arena, const char *c,
+                            const char *end, char **output,
+                            uint32_t lineNumber) {
+  char *out = *output;
+  while (c < end && !isDelimiter(*c) && !isOperator(*c)) {
+    if (*c == '\'' || *c == '"') {
+      char quote = *c++;
+      while (c < end && *c != quote) {
+        if (quote == '"' && *c == '\\' && c + 1 < end &&
+            (c[1] == '"' || c[1] == '\\')) {
+          c++;
+        }
+        *out++ = *c++;
+      }
+      if (c == end) {
+        return reportSyntaxError(arena, lineNumber, quote == '"' ? "\"" : "'");
+      }
+      c++;
+    } else if (*c == '\\') {
+      // A trailing backslash stands for nothing (there is no next line)
+      if (++c < end) {
+        *out++ = *c++;
       }
+    } else {
+      *out++ = *c++;
+    }
+  }
+  *out++ = '\0';
+  *output = out;
+  return c;
+}
+
+static void addArg(CommandArena *arena, uint32_t *argCount, char *arg) {
+  arena->args = (char **)growArray(arena->args, *argCount,
+                                   &arena->argCapacity, sizeof(char *),
+                                   "Growing command arguments");
+  arena->args[(*argCount)++] = arg;
+}
+
+static Command *addStage(CommandArena *arena, uint32_t *stageCount,
+                         uint32_t lineNumber) {
+  if (*stageCount == MAX_STAGES) {
+    fprintf(stderr, "Too many pipeline stages (max: %u) at line %u\n",
+            MAX_STAGES, lineNumber);
+    arena->isValid = FALSE;
+    return NULL;
+  }
+  arena->stages = (Command *)growArray(arena->stages, *stageCount,
+                                       &arena->stageCapacity, sizeof(Command),
+                                       "Growing command stages");
+  Command *cmd = &arena->stages[(*stageCount)++];
+  cmd->argCount = 0;
+  cmd->lineNumber = lineNumber;
+  cmd->inputPath = NULL;
+  cmd->outputPath = NULL;
+  cmd->isAppending = FALSE;
+  return cmd;
+}
 
-      strncpy(cmd->args[tokenCount], token, sizeof(cmd->args[tokenCount]));
-      tokenCount++;
+Command *parseCommandLine(CommandArena *arena, const char *cmdLine,
+                          size_t length, uint32_t lineNumber) {
+  // Each character of the line is copied at most once, and each word is
+  // separated from the next by at least a character, or followed by a NUL
+  if (arena->textCapacity < 2 * length + 1) {
+    safeFree(arena->text);
+    arena->textCapacity = 2 * length + 1;
+    arena->text =
+        (char *)safeMalloc(arena->textCapacity, "Growing command line");
+  }
+  char *out = arena->text;
+  arena->isValid = TRUE;
+  const char *c = cmdLine;
+  const char *end = cmdLine + length;
+  uint32_t stageCount = 0;
+  uint32_t argCount = 0;
+  // Stage being parsed (NULL after a pipe), and the redirection its next
+  // word is the path of (if not NULL)
+  Command *cmd = NULL;
+  char **redirection = NULL;
+
+  while (TRUE) {
+    while (c < end && isDelimiter(*c)) {
+      c++;
+    }
+    if (c == end) {
+      break;
+    }
+    if (*c == '|') {
+      if (cmd == NULL || cmd->argCount == 0 || redirection != NULL) {
+        return reportSyntaxError(arena, lineNumber, "|");
+      }
+      addArg(arena, &argCount, NULL);
+      cmd = NULL;
+      c++;
+      continue;
+    }
+    if (cmd == NULL) {
+      cmd = addStage(arena, &stageCount, lineNumber);
+      if (cmd == NULL) {
+        return NULL;
+      }
+    }
+    if (*c == '<' || *c == '>') {
+      if (redirection != NULL) {
+        return reportSyntaxError(arena, lineNumber, *c == '<' ? "<" : ">");
+      }
+      bool isInput = *c++ == '<';
+      redirection = isInput ? &cmd->inputPath : &cmd->outputPath;
+      if (!isInput) {
+        cmd->isAppending = c < end && *c == '>';
+        c += cmd->isAppending ? 1 : 0;
+      }
+      continue;
     }
-  } while (token != NULL);
 
-  cmd->argCount = tokenCount;
+    char *word = out;
+    if ((c = readWord(arena, c, end, &out, lineNumber)) == NULL) {
+      return NULL;
+    }
+    if (redirection != NULL) {
+      *redirection = word;
+      redirection = NULL;
+    } else {
+      addArg(arena, &argCount, word);
+      cmd->argCount++;
+    }
+  }
 
   // Command line was empty
   // - returning NULL in that case
-  if (tokenCount == 0) {
-    safeFree(cmd);
+  if (stageCount == 0) {
     return NULL;
   }
+  // Line ending with a pipe or a redirection, or a stage made of redirections
+  // only
+  if (cmd == NULL || cmd->argCount == 0 || redirection != NULL) {
+    return reportSyntaxError(arena, lineNumber, cmd == NULL ? "|" : "newline");
+  }
+  addArg(arena, &argCount, NULL);
 
-  return cmd;
+  // The arrays may have moved while growing: the stages are linked, and
+  // pointed to their arguments, once complete
+  char **args = arena->args;
+  for (uint32_t i = 0; i < stageCount; i++) {
+    Command *stage = &arena->stages[i];
+    stage->args = args;
+    stage->name = args[0];
+    stage->next = i + 1 < stageCount ? stage + 1 : NULL;
+    args += stage->argCount + 1;
+  }
+  return arena->stages;
 }
 
-void executeCommand(Command *cmd) {
-  if (strcmp(cmd->name, CMD_EXIT) == 0) {
-    _exit(EXIT_SUCCESS);
+/**
+ * Reports the failure to run the given command on the given descriptor (the
+ * error output its stages get, if not -1: the shell's otherwise).
+ */
+static void reportExecError(Command *cmd, int error, int fd) {
+  fd = fd >= 0 ? fd : STDERR_FILENO;
+  dprintf(fd, "Error executing command (errno: %u) at line %u:", error,
+          cmd->lineNumber);
+  for (uint32_t i = 0; i < cmd->argCount; i++) {
+    dprintf(fd, " %s", cmd->args[i]);
   }
-  pid_t cmdPid = fork();
-  assertIt(cmdPid >= 0, "Could not fork command process");
+  dprintf(fd, "\n");
+}
 
-  // If cmdPid == 0, then we're in the child process' context
-  if (cmdPid == 0) {
-    int exitCode = execvp(cmd->name, (char *const *)cmd->args);
-    if (exitCode == 1) {
-      fprintf(stderr, "Error executing command (errno: %u) at line %u", errno,
-              cmd->lineNumber);
-      printCmd(cmd);
-      _exit(errno);
-    }
-  }
-  // else, we are in the parent's context and need to wait
-  // for the child to finish
-  else {
-    int childStatus;
-    wait(&childStatus);
-    if (childStatus != 0) {
-      // Command exection resulted in an error,
-      // aborting
-      _exit(childStatus);
-    }
+static int outputFlags(Command *cmd) {
+  return O_WRONLY | O_CREAT | (cmd->isAppending ? O_APPEND : O_TRUNC);
+}
+
+/**
+ * Starts the given command, whose executable is at the given path, with
+ * posix_spawn, which creates the child with vfork semantics
+ * (clone(CLONE_VM | CLONE_VFORK) on Linux): the shell is only suspended until
+ * the child execs, and its page tables are not copied. The redirections are
+ * made in the child by file actions.
+ *
+ * If the path comes from the command hash and cannot be executed (the
+ * executable was removed or replaced since), the command is searched for
+ * again. Returns 0 on success, or the errno value of the failure (which is
+ * reported). The time the calls take is added to the given usage (if not
+ * NULL).
+ */
+static int spawnCommand(Command *cmd, const char *path, bool isHashed,
+                        PipelineFds fds, PipelineUsage *usage,
+                        pid_t *cmdPid) {
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if (fds.input >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, fds.input, STDIN_FILENO);
+  }
+  if (fds.output >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, fds.output, STDOUT_FILENO);
   }
+  if (fds.error >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, fds.error, STDERR_FILENO);
+  }
+  if (cmd->inputPath != NULL) {
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, cmd->inputPath,
+                                     O_RDONLY, 0);
+  }
+  if (cmd->outputPath != NULL) {
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, cmd->outputPath,
+                                     outputFlags(cmd), 0666);
+  }
+
+  uint64_t start = usage != NULL ? monotonicNs() : 0;
+  int error = posix_spawn(cmdPid, path, &actions, NULL, cmd->args, environ);
+  if (error != 0 && isHashed) {
+    forgetCommand(&commandHash, cmd->name);
+    path = resolveCommand(&commandHash, cmd->name, TRUE);
+    error = path != NULL
+                ? posix_spawn(cmdPid, path, &actions, NULL, cmd->args, environ)
+                : ENOENT;
+  }
+  if (usage != NULL) {
+    usage->forkNs += monotonicNs() - start;
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  if (error != 0) {
+    reportExecError(cmd, error, fds.error);
+  }
+  return error;
 }
 
-static void inactivity_handler(int signo) { siglongjmp(jmpBuf, 1); }
+/**
+ * Redirects the given descriptor (in the child) to the given file.
+ */
+static void redirectTo(Command *cmd, int fd, const char *path, int flags) {
+  int fileFd = open(path, flags, 0666);
+  if (fileFd < 0 || dup2(fileFd, fd) < 0) {
+    int error = errno;
+    reportExecError(cmd, error, -1);
+    _exit(error);
+  }
+  close(fileFd);
+}
 
-InputState input(char *buf, uint32_t bufSz, FILE *inputStream,
-                 uint32_t timeoutSecs) {
+/**
+ * Starts the given command with fork, then execv of the given path in the
+ * child (falling back to searching PATH with execvp: the parent cannot tell
+ * that a hashed path is stale). Failures in the child are reported by its
+ * exit status (the errno value). Returns 0 on success, or the errno value of
+ * the fork failure (which is reported).
+ *
+ * If the given usage is not NULL, the time fork takes is added to it, and the
+ * time the child takes to exec: the parent waits for the end of file on a
+ * close-on-exec pipe, whose write end only the child then holds.
+ */
+static int forkCommand(Command *cmd, const char *path, PipelineFds fds,
+                       PipelineUsage *usage, pid_t *cmdPid) {
+  int execFds[2] = {-1, -1};
+  if (usage != NULL && pipe2(execFds, O_CLOEXEC) != 0) {
+    execFds[0] = execFds[1] = -1;
+  }
+  uint64_t start = usage != NULL ? monotonicNs() : 0;
+  *cmdPid = fork();
+  if (*cmdPid < 0) {
+    int error = errno;
+    reportExecError(cmd, error, fds.error);
+    if (execFds[0] >= 0) {
+      close(execFds[0]);
+      close(execFds[1]);
+    }
+    return error;
+  }
+  if (*cmdPid > 0 && usage != NULL) {
+    uint64_t forked = monotonicNs();
+    usage->forkNs += forked - start;
+    if (execFds[0] >= 0) {
+      close(execFds[1]);
+      char byte;
+      while (read(execFds[0], &byte, sizeof(byte)) < 0 && errno == EINTR) {
+      }
+      close(execFds[0]);
+      usage->execNs += monotonicNs() - forked;
+    }
+  }
 
-  int previousAlarm;
-  InputState state = NOT_EMPTY;
+  // If cmdPid == 0, then we're in the child process' context
+  if (*cmdPid == 0) {
+    // The pipes are close-on-exec, their copies on stdin/stdout are not
+    if (fds.input >= 0) {
+      dup2(fds.input, STDIN_FILENO);
+    }
+    if (fds.output >= 0) {
+      dup2(fds.output, STDOUT_FILENO);
+    }
+    if (fds.error >= 0) {
+      dup2(fds.error, STDERR_FILENO);
+    }
+    if (cmd->inputPath != NULL) {
+      redirectTo(cmd, STDIN_FILENO, cmd->inputPath, O_RDONLY);
+    }
+    if (cmd->outputPath != NULL) {
+      redirectTo(cmd, STDOUT_FILENO, cmd->outputPath, outputFlags(cmd));
+    }
+    execv(path, cmd->args);
+    execvp(cmd->name, cmd->args);
+    int error = errno;
+    reportExecError(cmd, error, -1);
+    _exit(error);
+  }
+  return 0;
+}
 
-  struct sigaction currentAction = {0};
-  struct sigaction previousAction = {0};
+/**
+ * Starts the given stage of a pipeline, resolving its executable through the
+ * command hash. Returns 0 on success, or the errno value of the failure.
+ */
+static int startStage(Command *cmd, SpawnMethod method, PipelineFds fds,
+                      PipelineUsage *usage, pid_t *cmdPid) {
+  // Names containing a '/' are paths, which are not searched for
+  bool isHashed = strchr(cmd->name, '/') == NULL;
+  const char *path =
+      isHashed ? resolveCommand(&commandHash, cmd->name, TRUE) : cmd->name;
+  if (path == NULL) {
+    reportExecError(cmd, ENOENT, fds.error);
+    return ENOENT;
+  }
+  if (method == SPAWN_FORK) {
+    return forkCommand(cmd, path, fds, usage, cmdPid);
+  }
+  return spawnCommand(cmd, path, isHashed, fds, usage, cmdPid);
+}
 
-  if (sigsetjmp(jmpBuf, 1) == 0) {
-    currentAction.sa_handler = inactivity_handler;
-    sigemptyset(&(currentAction.sa_mask));
-    currentAction.sa_flags = SA_RESTART;
+/**
+ * Returns whether the given stage is a tee the shell can relay itself:
+ * neither first (it would read the shell's input), nor redirected, and
+ * writing to a single file.
+ */
+static bool isRelayedTee(Command *cmd, bool isFirst) {
+  if (isFirst || strcmp(cmd->name, CMD_TEE) != 0 ||
+      cmd->inputPath != NULL || cmd->outputPath != NULL) {
+    return FALSE;
+  }
+  bool isAppending = cmd->argCount == 3 && strcmp(cmd->args[1], "-a") == 0;
+  return (cmd->argCount == 2 && cmd->args[1][0] != '-') ||
+         (isAppending && cmd->args[2][0] != '-');
+}
 
-    previousAlarm = alarm(0);
-    sigaction(SIGALRM, &currentAction, &previousAction);
+/**
+ * Creates a pipe whose descriptors are not inherited by the stages (they get
+ * copies on their stdin and stdout), as large as allowed up to PIPE_SIZE.
+ * Returns 0 on success, or the errno value of the failure (which is reported
+ * as that of the given stage).
+ */
+static int createPipe(Command *cmd, int errorFd, int fds[2]) {
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    int error = errno;
+    reportExecError(cmd, error, errorFd);
+    fds[0] = fds[1] = -1;
+    return error;
+  }
+  // Beyond /proc/sys/fs/pipe-max-size, this fails for unprivileged users
+  // (the pipe is then left with its default size)
+  fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE);
+  return 0;
+}
+
+/**
+ * Sets up the relay of the given tee stage, between the given pipes.
+ */
+static int startRelay(Command *cmd, Relay *relay, int input, int output) {
+  const char *path = cmd->args[cmd->argCount - 1];
+  int flags = O_WRONLY | O_CREAT | O_CLOEXEC |
+              (cmd->argCount == 3 ? O_APPEND : O_TRUNC);
+  int file = open(path, flags, 0666);
+  if (file < 0) {
+    int error = errno;
+    reportExecError(cmd, error, -1);
+    return error;
+  }
+  newRelay(relay, input, output, file);
+  return 0;
+}
 
-    alarm(timeoutSecs);
+int startPipeline(Command *cmd, SpawnMethod method, PipelineFds fds,
+                  Pipeline *pipeline) {
+  pipeline->pidCount = 0;
+  pipeline->relayCount = 0;
+  pipeline->isLastRelayed = FALSE;
+  if (pipeline->usage != NULL) {
+    memset(pipeline->usage, 0, sizeof(PipelineUsage));
+  }
+  // Read end of the pipe from the previous stage
+  int input = fds.input;
+  int error = 0;
 
-    if (fgets(buf, bufSz, inputStream) != NULL) {
-      int eol = findEndOfLine(buf, bufSz);
-      buf[eol] = '\0';
-      state = NOT_EMPTY;
+  for (Command *stage = cmd; stage != NULL && error == 0;
+       stage = stage->next) {
+    int pipeFds[2] = {-1, fds.output};
+    if (stage->next != NULL &&
+        (error = createPipe(stage, fds.error, pipeFds)) != 0) {
+      break;
+    }
+    PipelineFds stageFds = {input, pipeFds[1], fds.error};
+    bool isRelayed = pipeline->isRelaying && isRelayedTee(stage, stage == cmd);
+    if (isRelayed) {
+      Relay *relay = &pipeline->relays[pipeline->relayCount];
+      error = startRelay(stage, relay, input,
+                         pipeFds[1] >= 0 ? pipeFds[1] : STDOUT_FILENO);
+      pipeline->relayCount += error == 0 ? 1 : 0;
+      pipeline->isLastRelayed = stage->next == NULL;
     } else {
-      state = EMPTY;
+      pid_t pid;
+      error = startStage(stage, method, stageFds, pipeline->usage, &pid);
+      if (error == 0) {
+        pipeline->pids[pipeline->pidCount++] = pid;
+      }
+    }
+    // A relay keeps its pipes, stages got copies of theirs (the caller's
+    // descriptors are left open)
+    if (!isRelayed || error != 0) {
+      if (input >= 0 && input != fds.input) {
+        close(input);
+      }
+      if (pipeFds[1] >= 0 && pipeFds[1] != fds.output) {
+        close(pipeFds[1]);
+      }
+    }
+    input = pipeFds[0];
+  }
+  if (input >= 0 && input != fds.input && error != 0) {
+    close(input);
+  }
+  return error;
+}
+
+int waitPipeline(Pipeline *pipeline, uint32_t lineNumber) {
+  int relayError = pipeline->relayCount > 0
+                       ? runRelays(pipeline->relays, pipeline->relayCount)
+                       : 0;
+  if (relayError != 0) {
+    fprintf(stderr, "Error relaying tee (errno: %u) at line %u\n", relayError,
+            lineNumber);
+  }
+  int lastStatus = 0;
+  for (uint32_t i = 0; i < pipeline->pidCount; i++) {
+    int childStatus;
+    struct rusage stageUsage;
+    while (wait4(pipeline->pids[i], &childStatus, 0, &stageUsage) < 0) {
+      assertIt(errno == EINTR, "Could not wait for command process");
     }
-  } else {
-    state = TIMED_OUT;
+    if (pipeline->usage != NULL) {
+      addStageUsage(pipeline->usage, &stageUsage);
+    }
+    lastStatus = childStatus;
+  }
+  // A tee run by the shell exits with 1 on errors
+  return pipeline->isLastRelayed ? (relayError != 0 ? 1 << 8 : 0)
+                                 : lastStatus;
+}
+
+void addStageUsage(PipelineUsage *usage, const struct rusage *stageUsage) {
+  usage->userUs += (uint64_t)stageUsage->ru_utime.tv_sec * 1000000 +
+                   (uint64_t)stageUsage->ru_utime.tv_usec;
+  usage->systemUs += (uint64_t)stageUsage->ru_stime.tv_sec * 1000000 +
+                     (uint64_t)stageUsage->ru_stime.tv_usec;
+  // In kilobytes on Linux
+  if ((uint64_t)stageUsage->ru_maxrss > usage->maxRssKb) {
+    usage->maxRssKb = (uint64_t)stageUsage->ru_maxrss;
   }
+  usage->voluntarySwitches += (uint64_t)stageUsage->ru_nvcsw;
+  usage->involuntarySwitches += (uint64_t)stageUsage->ru_nivcsw;
+}
+
+bool isBuiltin(Command *cmd, const char *name) {
+  return cmd->next == NULL && strcmp(cmd->name, name) == 0;
+}
 
-  // Resetting alarm state
-  alarm(0);
-  sigaction(SIGALRM, &previousAction, 0);
-  alarm(previousAlarm);
+int executeCommand(Command *cmd, SpawnMethod method, PipelineUsage *usage) {
+  const Builtin *builtin = findBuiltin(cmd);
+  if (builtin != NULL) {
+    if (usage != NULL) {
+      memset(usage, 0, sizeof(PipelineUsage));
+    }
+    return runBuiltin(builtin, cmd);
+  }
 
-  return state;
+  Pipeline pipeline;
+  pipeline.isRelaying = TRUE;
+  pipeline.usage = usage;
+  int error =
+      startPipeline(cmd, method, (PipelineFds){-1, -1, -1}, &pipeline);
+  // We are in the parent's context and need to wait for the children to
+  // finish (those started before a failure too)
+  int childStatus = waitPipeline(&pipeline, cmd->lineNumber);
+  if (error != 0) {
+    return error;
+  }
+  return WIFEXITED(childStatus) ? WEXITSTATUS(childStatus)
+                                : 128 + WTERMSIG(childStatus);
 }
@@ -1,47 +1,197 @@
+#ifndef MY_SHELL_H
+#define MY_SHELL_H
+
+#include "my-hash.h"
+#include "my-reader.h"
+#include "my-relay.h"
 #include "my-util.h"
 #include "stdarg.h"
-#include <setjmp.h>
-#include <signal.h>
 #include <stdio.h>
-
-#ifndef SA_RESTART
-#define SA_RESTART 0x000004
-#endif
+#include <sys/resource.h>
 
 #define PROMPT "my-sh > "
-#define MAX_CMD_NAME_LEN 64
-// The last argument in argv that we passed to execvp must be NULL.
-// We are reserving 128 slots for the arguments, leaving the last one
-// to the NULL value. We must therefore accept MAX_ARGS - 1 arguments.
-#define MAX_ARGS 129
-#define MAX_ARG_LEN 64
-#define ARG_DELIM " "
 #define CMD_EXIT "exit"
+#define CMD_HASH "hash"
+#define CMD_TEE "tee"
+#define CMD_WAIT "wait"
+// Size requested for the pipes connecting the stages of a pipeline (instead
+// of the default 64 KiB, the stages then switch less often).
+#define PIPE_SIZE (1024 * 1024)
+#define MAX_STAGES 64
 
-typedef enum _InputState { NOT_EMPTY = 0, EMPTY = 1, TIMED_OUT = 2 } InputState;
+/**
+ * Holds constants corresponding to the ways the process running a command
+ * can be created.
+ */
+typedef enum _SpawnMethod {
+  // posix_spawnp: the child shares the shell's address space until it execs
+  // (vfork semantics), so nothing is copied however large the shell is.
+  SPAWN_POSIX = 0,
+  // fork, then execvp in the child: the shell's page tables are copied for
+  // each command. Needed only if the child must run code of the shell before
+  // the exec.
+  SPAWN_FORK = 1
+} SpawnMethod;
 
 typedef struct _Command {
-  char name[MAX_CMD_NAME_LEN];
-  char args[MAX_ARGS][MAX_ARG_LEN];
+  // The command name (args[0]), and the NULL-terminated arguments, as passed
+  // to exec. All the strings of a command line point into its arena.
+  char *name;
+  char **args;
   uint32_t argCount;
   uint32_t lineNumber;
+  // Files the standard input and output are redirected from and to (NULL if
+  // none), the latter being appended to if isAppending is TRUE.
+  char *inputPath;
+  char *outputPath;
+  bool isAppending;
+  // Next stage of the pipeline, reading what this one writes (NULL for the
+  // last stage).
+  struct _Command *next;
 } Command;
 
+/**
+ * Memory holding a parsed command line: the stages, the argument vectors
+ * they point into (one after the other, each NULL-terminated), and the text
+ * of the arguments. Parsing a line reuses the memory of the previous line,
+ * which only grows when a line is longer (or has more arguments or stages)
+ * than those before it: no allocation is made while running a script.
+ */
+typedef struct _CommandArena {
+  char *text;
+  size_t textCapacity;
+  char **args;
+  uint32_t argCapacity;
+  Command *stages;
+  uint32_t stageCapacity;
+  // Whether the last line parsed was valid.
+  bool isValid;
+} CommandArena;
+
+/**
+ * Descriptors the stages of a pipeline are started with (-1 to inherit the
+ * shell's): the first stage's input, the last stage's output, and the error
+ * output of all stages.
+ */
+typedef struct _PipelineFds {
+  int input;
+  int output;
+  int error;
+} PipelineFds;
+
+/**
+ * What running the stages of a pipeline cost: the time the shell spent
+ * starting them, and the resources they used (as reported by wait4).
+ */
+typedef struct _PipelineUsage {
+  // Time spent creating the stages' processes: by fork, or by the whole
+  // posix_spawn call (which returns once the child execed).
+  uint64_t forkNs;
+  // Time spent waiting for the forked stages to exec (fork only: included in
+  // forkNs with posix_spawn).
+  uint64_t execNs;
+  // CPU time of the stages, summed.
+  uint64_t userUs;
+  uint64_t systemUs;
+  // Largest maximum resident set size of the stages.
+  uint64_t maxRssKb;
+  // Context switches of the stages, summed: waiting for a resource (e.g.
+  // I/O), or preempted.
+  uint64_t voluntarySwitches;
+  uint64_t involuntarySwitches;
+} PipelineUsage;
+
+/**
+ * The processes (and relays) running the stages of a started pipeline.
+ */
+typedef struct _Pipeline {
+  // Whether tee stages may be relayed by the shell (see executeCommand),
+  // which then happens in waitPipeline. Set by the caller.
+  bool isRelaying;
+  // Filled by startPipeline and waitPipeline if not NULL (measuring a forked
+  // stage's exec makes the shell wait for it). Set by the caller.
+  PipelineUsage *usage;
+  pid_t pids[MAX_STAGES];
+  uint32_t pidCount;
+  Relay relays[MAX_STAGES];
+  uint32_t relayCount;
+  bool isLastRelayed;
+} Pipeline;
+
 void printCmd(Command *cmd);
 
+void newCommandArena(CommandArena *arena);
+
+void destroyCommandArena(CommandArena *arena);
+
 /**
- * Parses the given command line into a Command instance.
+ * Parses the given command line (of the given length) into the given arena,
+ * in a single pass: one Command per stage if the line is a pipeline. The
+ * previous command line parsed into the arena is discarded.
  *
- * Returns NULL if the command line is an empty command line, or
+ * Arguments are separated by spaces or tabs. The operators (|, <, > and >>)
+ * need not be: "a|b>c" is a pipeline. Quoting makes characters literal:
+ * between single quotes, between double quotes (in which \" and \\ stand
+ * for " and \), or after a backslash.
+ *
+ * Returns NULL if the command line is an empty command line, or not valid
+ * (the syntax error is reported, and the arena's isValid flag cleared), or
  * a Command pointer otherwise.
  */
-Command *parseCommandLine(char *cmdLine, uint32_t lineNumber);
+Command *parseCommandLine(CommandArena *arena, const char *cmdLine,
+                          size_t length, uint32_t lineNumber);
 
-void executeCommand(Command *cmd);
+/**
+ * Runs the given command in a child process created with the given method,
+ * and waits for it. Returns its exit status (128 plus the signal number if it
+ * was killed), or the errno value of the failure if it could not be run. The
+ * exit builtin is left to the caller. Fills the given usage if not NULL (see
+ * PipelineUsage).
+ *
+ * Builtins (see my-builtins.h) are run by the shell itself, without a child
+ * process; they are only recognized outside of pipelines. The stages of a
+ * pipeline are all started before waiting for any of them, connected by
+ * pipes, and the pipeline's status is that of its last stage. A tee stage
+ * with a single file (tee [-a] <file>, not first) is run by the shell itself,
+ * which relays the data without copying it (see my-relay.h).
+ *
+ * The executable is looked up in the PATH directories once per command name
+ * and PATH value (see my-hash.h), then executed directly: the hash builtin
+ * lists the commands hashed so far, hash -r forgets them.
+ */
+int executeCommand(Command *cmd, SpawnMethod method, PipelineUsage *usage);
 
-static sigjmp_buf jmpBuf;
+/**
+ * Returns whether the given command is the given builtin (outside of a
+ * pipeline).
+ */
+bool isBuiltin(Command *cmd, const char *name);
 
-static void inactivity_handler(int signo);
+/**
+ * Returns the command hash the executables are resolved with (see the hash
+ * builtin).
+ */
+CommandHash *shellCommandHash(void);
 
-InputState input(char *buf, uint32_t bufSz, FILE *inputStream,
-                 uint32_t timeoutSecs);
\ No newline at end of file
+/**
+ * Starts all the stages of the given pipeline, connected by pipes, with the
+ * given descriptors. Returns 0 on success, or the errno value of the stage
+ * which could not be started (which is reported): the stages started before
+ * it still have to be waited for.
+ */
+int startPipeline(Command *cmd, SpawnMethod method, PipelineFds fds,
+                  Pipeline *pipeline);
+
+/**
+ * Runs the relays of the given started pipeline, then waits for its stages.
+ * Returns the wait status of the last stage.
+ */
+int waitPipeline(Pipeline *pipeline, uint32_t lineNumber);
+
+/**
+ * Adds the resources used by a stage (as reported by wait4) to the given
+ * usage.
+ */
+void addStageUsage(PipelineUsage *usage, const struct rusage *stageUsage);
+
+#endif
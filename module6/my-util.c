@@ -2,6 +2,7 @@
 #include "stdarg.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 void *safeMalloc(size_t size, const char *hint) {
   void *ptr = malloc(size);
@@ -34,4 +35,10 @@ int findEndOfLine(const char *input, uint32_t maxLen) {
     }
   }
   return maxLen;
-}
\ No newline at end of file
+}
+
+uint64_t monotonicNs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
@@ -1,3 +1,6 @@
+#ifndef MY_UTIL_H
+#define MY_UTIL_H
+
 #include <stdint.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -30,4 +33,12 @@ void assertIt(bool condition, char *format, ...);
  * The goal of this function is to allow for replacing
  * with a '\0' the EOF character at the located position.
  */
-int findEndOfLine(const char *input, uint32_t maxLen);
\ No newline at end of file
+int findEndOfLine(const char *input, uint32_t maxLen);
+
+/**
+ * Returns the time elapsed since an arbitrary point (CLOCK_MONOTONIC), in
+ * nanoseconds: differences between calls measure durations.
+ */
+uint64_t monotonicNs(void);
+
+#endif